@@ -42,6 +42,22 @@ const char* tego_error_get_message(const tego_error_t* error);
 
 typedef struct tego_context tego_context_t;
 
+/*
+ * Functions taking a context may be called from any thread. Calls made on the
+ * thread the context was initialized on (which runs the Qt event loop) run
+ * straight away, calls from any other thread are queued over to it and block
+ * until they have run. The _async variants return as soon as their call has
+ * been queued and report its result through a completion callback.
+ */
+
+/*
+ * Create a new context, with its own identity once its service is started.
+ * Several contexts may be created, all on the same thread, and they share
+ * that thread's Qt event loop and a single tor daemon
+ *
+ * @param out_context : returned context
+ * @param error : filled on error
+ */
 void tego_initialize(
     tego_context_t** out_context,
     tego_error_t** error);
@@ -325,7 +341,7 @@ typedef enum
 } tego_host_user_state_t;
 
 /*
- * Get the current state of the host user
+ * Get the current state of the host user, may be called from any thread
  *
  * @param context : the current tego context
  * @param out_state : destination to save state
@@ -370,7 +386,7 @@ typedef enum
 } tego_user_type_t;
 
 /*
- * Get the type of a given user
+ * Get the type of a given user, may be called from any thread
  *
  * @param context : the current tego context
  * @param user : the given user
@@ -444,9 +460,31 @@ void tego_tor_launch_config_set_data_directory(
     size_t dataDirectoryLength,
     tego_error_t** error);
 
+/*
+ * Set the directory of the profile the tor daemon's data directory belongs to
+ *
+ * libtego keeps its own state there, such as the hashes of files which have
+ * been sent so that sending them again needn't re-read them. If no profile
+ * directory is set that state only lasts as long as the process.
+ *
+ * @param launchConfig : config struct to save to
+ * @param profileDirectory : the profile's directory
+ * @param profileDirectoryLength : length of profileDirectory string not counting
+ *  the null terminator
+ * @param error : filled on error
+ */
+void tego_tor_launch_config_set_profile_directory(
+    tego_tor_launch_config_t* launchConfig,
+    const char* profileDirectory,
+    size_t profileDirectoryLength,
+    tego_error_t** error);
+
 /*
  * Start an instance of the tor daemon and associate it with the given context
  *
+ * Every context in the process shares the one tor daemon, so once it has been
+ * started by one context the launch config passed in by the others is ignored
+ *
  * @param context : the current tego context
  * @param torConfig : tor configuration params
  * @param error : filled on error
@@ -666,7 +704,7 @@ void tego_context_stop_service(
 
 /*
  * Returns the number of charactres required (including null) to
- * write out the tor logs
+ * write out the tor logs, may be called from any thread
  *
  * @param context : the current tego context
  * @param error : filled on error
@@ -678,7 +716,7 @@ size_t tego_context_get_tor_logs_size(
 
 /*
  * Fill the passed in buffer with the tor daemon's logs, each entry delimitted
- * by newline character '\n'
+ * by newline character '\n', may be called from any thread
  *
  * @param context : the current tego context
  * @param out_logBuffer : user allocated buffer where tor log is to be written
@@ -890,6 +928,44 @@ void tego_context_send_message(
     tego_message_id_t* out_id,
     tego_error_t** error);
 
+/*
+ * Called once an asynchronous tego_context_send_message_async has run,
+ * alongside the other callbacks
+ *
+ * @param context : the current tego context
+ * @param id : the assigned message id, only valid if error is NULL
+ * @param error : NULL on success, otherwise why the message couldn't be sent
+ * @param userData : as passed to tego_context_send_message_async
+ */
+typedef void (*tego_send_message_completed_callback_t)(
+    tego_context_t* context,
+    tego_message_id_t id,
+    const tego_error_t* error,
+    void* userData);
+
+/*
+ * Send a text message from the host to the given user without waiting for it
+ * to be queued up for sending
+ *
+ * @param context : the current tego context
+ * @param user : the user to send a message to
+ * @param message : utf8 text message to send
+ * @param messageLength : length of message not including null-terminator
+ * @param completed : optional, called with the message's id once it has
+ *  been queued up for sending
+ * @param userData : passed on to completed
+ * @param error : filled on error, failures while sending are reported to
+ *  completed instead
+ */
+void tego_context_send_message_async(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    const char* message,
+    size_t messageLength,
+    tego_send_message_completed_callback_t completed,
+    void* userData,
+    tego_error_t** error);
+
 /*
  * Request to send a file to the given user
  *
@@ -898,7 +974,9 @@ void tego_context_send_message(
  * @param filePath : utf8 path to file to send
  * @param filePathLength : length of filePath not including null-terminator
  * @param out_id : optional, filled with assigned file transfer id for callbacks
- * @param out_fileHash : optional, filled with hash of the file to send
+ * @param out_fileHash : optional, filled with hash of the file to send; the
+ *  whole file must be hashed before this function returns, so pass NULL to
+ *  offer the file immediately and hash it while it is being sent
  * @param out_fileSize : optional, filled with the size of the file in bytes
  * @param error : filled on error
  */
@@ -912,6 +990,51 @@ void tego_context_send_file_transfer_request(
     tego_file_size_t* out_fileSize,
     tego_error_t** error);
 
+/*
+ * Called once an asynchronous tego_context_send_file_transfer_request_async
+ * has run, alongside the other callbacks
+ *
+ * @param context : the current tego context
+ * @param id : the assigned file transfer id, only valid if error is NULL
+ * @param fileHash : the hash of the file if it was requested, otherwise NULL;
+ *  only valid for the duration of the callback
+ * @param fileSize : the size of the file in bytes, only valid if error is NULL
+ * @param error : NULL on success, otherwise why the request couldn't be sent
+ * @param userData : as passed to tego_context_send_file_transfer_request_async
+ */
+typedef void (*tego_send_file_transfer_request_completed_callback_t)(
+    tego_context_t* context,
+    tego_file_transfer_id_t id,
+    const tego_file_hash_t* fileHash,
+    tego_file_size_t fileSize,
+    const tego_error_t* error,
+    void* userData);
+
+/*
+ * Request to send a file to the given user without waiting for the request
+ * to be made
+ *
+ * @param context : the current tego context
+ * @param user : the user to send a file to
+ * @param filePath : utf8 path to file to send
+ * @param filePathLength : length of filePath not including null-terminator
+ * @param hashFile : TEGO_TRUE to hash the whole file before offering it and
+ *  pass the hash on to completed
+ * @param completed : optional, called once the request has been made
+ * @param userData : passed on to completed
+ * @param error : filled on error, failures while making the request are
+ *  reported to completed instead
+ */
+void tego_context_send_file_transfer_request_async(
+    tego_context_t* context,
+    tego_user_id_t const* user,
+    char const* filePath,
+    size_t filePathLength,
+    tego_bool_t hashFile,
+    tego_send_file_transfer_request_completed_callback_t completed,
+    void* userData,
+    tego_error_t** error);
+
 typedef enum
 {
     tego_file_transfer_response_accept, // proceed with a file transfer
@@ -1192,7 +1315,8 @@ typedef void (*tego_message_acknowledged_callback_t)(
  * @param fileName : name of the file user wants to send
  * @param fileNameLength : length of fileName not including the null-terminator
  * @param fileSize : size of the file in bytes
- * @param fileHash : hash of the file
+ * @param fileHash : hash of the file, NULL if the sender has not hashed the
+ *  file yet; in this case the file is verified once the sender has sent it
  */
 typedef void (*tego_file_transfer_request_received_callback_t)(
     tego_context* context,
@@ -1243,6 +1367,9 @@ typedef enum
 /*
  * Callback fired when file transfer send or receive progress has changed
  * This callback is fired for both the sender and the receiver
+ * Only the newest progress of a transfer is delivered, older updates still
+ * waiting to be delivered are dropped. See also
+ * tego_context_set_file_transfer_progress_minimum_interval
  *
  * @param context : the current tego context
  * @param userId : the user sending/receiving the file
@@ -1287,6 +1414,27 @@ typedef void (*tego_file_transfer_complete_callback_t)(
     tego_file_transfer_direction_t direction,
     tego_file_transfer_result_t result);
 
+/*
+ * Callback fired once the hash of a file being transferred is known
+ * This callback is fired for both the sender and the receiver
+ * The sender gets it as soon as the file has been hashed, which may only be
+ * once the whole file has been sent. The receiver gets it once the received
+ * file has been verified against it, just before the transfer completes
+ * successfully, so also when fileHash was NULL in the request
+ *
+ * @param context : the current tego context
+ * @param userId : the user sending/receiving the file
+ * @param id : the file transfer associated with this callback
+ * @param direction : the direction this file is going
+ * @param fileHash : hash of the file
+ */
+typedef void (*tego_file_transfer_hash_known_callback_t)(
+    tego_context_t* context,
+    const tego_user_id_t* userId,
+    tego_file_transfer_id_t id,
+    tego_file_transfer_direction_t direction,
+    tego_file_hash_t const* fileHash);
+
 /*
  * Callback fired when a user's status changes
  *
@@ -1399,6 +1547,11 @@ void tego_context_set_file_transfer_complete_callback(
     tego_file_transfer_complete_callback_t,
     tego_error_t** error);
 
+void tego_context_set_file_transfer_hash_known_callback(
+    tego_context_t* context,
+    tego_file_transfer_hash_known_callback_t,
+    tego_error_t** error);
+
 void tego_context_set_user_status_changed_callback(
     tego_context_t* context,
     tego_user_status_changed_callback_t,
@@ -1409,6 +1562,21 @@ void tego_context_set_new_identity_created_callback(
     tego_new_identity_created_callback_t,
     tego_error_t** error);
 
+/*
+ * Limit how often the file transfer progress callback is fired for each
+ * transfer, progress in between is dropped. The latest progress is always
+ * delivered eventually, and before the transfer's complete callback.
+ *
+ * @param context : the current tego context
+ * @param milliseconds : minimum time between two progress callbacks for the
+ *  same transfer, 0 (the default) for no limit
+ * @param error : filled on error
+ */
+void tego_context_set_file_transfer_progress_minimum_interval(
+    tego_context_t* context,
+    uint32_t milliseconds,
+    tego_error_t** error);
+
 
 /*
  Destructors for various tego types
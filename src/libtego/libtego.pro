@@ -53,7 +53,9 @@ HEADERS +=\
     source/signals.hpp\
     source/tor.hpp\
     source/user.hpp\
-    source/file_hash.hpp
+    source/file_hash.hpp\
+    source/snapshot.hpp\
+    source/command_queue.hpp
 
 SOURCES +=\
     source/libtego.cpp\
@@ -65,6 +67,7 @@ SOURCES +=\
     source/globals.cpp\
     source/context.cpp\
     source/signals.cpp\
+    source/command_queue.cpp\
     source/tor.cpp\
     source/user.cpp\
     source/file_hash.cpp
@@ -82,12 +85,15 @@ INCLUDEPATH +=\
 
 SOURCES += \
     source/core/ContactIDValidator.cpp \
+    source/core/ContactIndex.cpp \
     source/core/ContactsManager.cpp \
     source/core/ContactUser.cpp \
     source/core/ConversationModel.cpp \
     source/core/IdentityManager.cpp \
     source/core/IncomingRequestManager.cpp \
+    source/core/MessageIndex.cpp \
     source/core/OutgoingContactRequest.cpp \
+    source/core/UnreadCounts.cpp \
     source/core/UserIdentity.cpp \
     source/tor/AddOnionCommand.cpp \
     source/tor/AuthenticateCommand.cpp \
@@ -102,6 +108,7 @@ SOURCES += \
     source/tor/TorProcess.cpp \
     source/tor/TorSocket.cpp \
     source/utils/CryptoKey.cpp \
+    source/utils/FileIOWorker.cpp \
     source/utils/PendingOperation.cpp \
     source/utils/SecureRNG.cpp \
     source/utils/StringUtil.cpp
@@ -109,12 +116,15 @@ SOURCES += \
 
 HEADERS += \
     source/core/ContactIDValidator.h \
+    source/core/ContactIndex.h \
     source/core/ContactsManager.h \
     source/core/ContactUser.h \
     source/core/ConversationModel.h \
     source/core/IdentityManager.h \
     source/core/IncomingRequestManager.h \
+    source/core/MessageIndex.h \
     source/core/OutgoingContactRequest.h \
+    source/core/UnreadCounts.h \
     source/core/UserIdentity.h \
     source/tor/AddOnionCommand.h \
     source/tor/AuthenticateCommand.h \
@@ -130,6 +140,7 @@ HEADERS += \
     source/tor/TorProcess_p.h \
     source/tor/TorSocket.h \
     source/utils/CryptoKey.h \
+    source/utils/FileIOWorker.h \
     source/utils/PendingOperation.h \
     source/utils/SecureRNG.h \
     source/utils/StringUtil.h
@@ -142,6 +153,7 @@ SOURCES += \
     source/protocol/ContactRequestChannel.cpp \
     source/protocol/ControlChannel.cpp \
     source/protocol/OutboundConnector.cpp \
+    source/protocol/PacketScheduler.cpp \
     source/protocol/FileChannel.cpp
 
 HEADERS += \
@@ -154,6 +166,7 @@ HEADERS += \
     source/protocol/ContactRequestChannel.h \
     source/protocol/ControlChannel.h \
     source/protocol/OutboundConnector.h \
+    source/protocol/PacketScheduler.h \
     source/protocol/FileChannel.h
 
 include($${QMAKE_INCLUDES}/protobuf.pri)
@@ -0,0 +1,131 @@
+#include "command_queue.hpp"
+#include "error.hpp"
+
+namespace tego
+{
+    //
+    // Command Queue
+    //
+
+    command_queue::command_queue()
+    : head_(&stub_)
+    , tail_(&stub_)
+    , stub_()
+    , scheduled_(false)
+    , closed_(false)
+    , pushing_(0)
+    , receiver_()
+    { }
+
+    command_queue::~command_queue()
+    {
+        // whatever is left is dropped without running, anyone waiting on a
+        // command's result finds its promise broken
+        while (auto n = pop())
+        {
+            delete n;
+        }
+    }
+
+    void command_queue::push_back(type_erased_callback&& command)
+    {
+        // a producer either sees closed_ set here, or close() sees it in pushing_
+        // and waits for it to finish linking its node in
+        pushing_.fetch_add(1);
+        auto pushed = tego::make_scope_exit([this]() -> void { pushing_.fetch_sub(1); });
+        TEGO_THROW_IF_TRUE_MSG(closed_.load(), "command queue closed, its context is being destroyed");
+
+        auto n = new node;
+        n->command = std::move(command);
+        link(n);
+
+        // only the first command since the last drain needs to post one, the
+        // rest are picked up by the same batch
+        if (!scheduled_.exchange(true, std::memory_order_acq_rel))
+        {
+            QMetaObject::invokeMethod(&receiver_, [this]() { this->drain(); }, Qt::QueuedConnection);
+        }
+    }
+
+    void command_queue::drain()
+    {
+        // acquiring scheduled_ makes every command whose producer saw it set
+        // visible to pop(); anything pushed after this posts a new drain
+        scheduled_.exchange(false, std::memory_order_acq_rel);
+
+        while (auto n = pop())
+        {
+            try
+            {
+                n->command.invoke();
+            }
+            catch(const std::exception& ex)
+            {
+                qWarning() << "Command threw an exception:" << ex.what();
+            }
+            catch(...)
+            {
+                qWarning() << "Command threw an unknown exception";
+            }
+            delete n;
+        }
+    }
+
+    void command_queue::close()
+    {
+        closed_.store(true);
+        while (pushing_.load() != 0)
+        {
+            std::this_thread::yield();
+        }
+
+        while (auto n = pop())
+        {
+            delete n;
+        }
+    }
+
+    void command_queue::link(node* n)
+    {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        auto prev = head_.exchange(n, std::memory_order_acq_rel);
+        // between the exchange and this store the list is briefly broken at prev,
+        // pop() treats that the same as the list being empty
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // Dmitry Vyukov's intrusive MPSC node-based queue
+    auto command_queue::pop() -> node*
+    {
+        auto tail = tail_;
+        auto next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_)
+        {
+            if (next == nullptr)
+            {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr)
+        {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        // tail is the last node, put the stub back behind it so it can be taken
+        link(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr)
+        {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+}
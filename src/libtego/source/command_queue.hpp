@@ -0,0 +1,54 @@
+#pragma once
+
+#include "signals.hpp"
+
+namespace tego
+{
+    /*
+     * command_queue hands work from any thread over to the thread running the
+     * context's Qt event loop. Producers push onto a lock-free intrusive list and
+     * never block; the first push after the queue has been drained posts a single
+     * event to the Qt thread, which then runs every command queued by then as
+     * one batch, in the order they were pushed.
+     */
+    class command_queue
+    {
+    public:
+        // must be constructed on the Qt thread
+        command_queue();
+        ~command_queue();
+
+        // may be called from any thread, throws once the queue has been closed
+        void push_back(type_erased_callback&& command);
+        // drops every queued command without running it, so anyone waiting on one
+        // finds its promise broken, and refuses any pushed from then on; only
+        // called on the Qt thread
+        void close();
+    private:
+        struct node
+        {
+            std::atomic<node*> next = nullptr;
+            type_erased_callback command;
+        };
+
+        // runs everything queued so far, only called on the Qt thread
+        void drain();
+        // the oldest queued node or nullptr if there is none (or the newest is still
+        // being linked in by its producer), only called on the Qt thread
+        node* pop();
+        void link(node* n);
+
+        // producers swap themselves in as head_, the consumer pops from tail_;
+        // stub_ keeps the list from ever being empty
+        std::atomic<node*> head_;
+        node* tail_;
+        node stub_;
+        // set while a drain has been posted but not yet started
+        std::atomic_bool scheduled_;
+        std::atomic_bool closed_;
+        // producers currently inside push_back, which close() has to wait out
+        std::atomic<size_t> pushing_;
+        // lives on the Qt thread, drains are posted to it
+        QObject receiver_;
+    };
+}
@@ -4,6 +4,7 @@
 #include "tor.hpp"
 #include "user.hpp"
 #include "ed25519.hpp"
+#include "file_hash.hpp"
 
 using tego::g_globals;
 
@@ -25,6 +26,22 @@ tego_context::tego_context()
 {
     this->torManager = Tor::TorManager::instance();
     this->torControl = torManager->control();
+
+    // tor may already be running for the contexts created before us
+    if (!g_globals.contexts.empty())
+    {
+        this->torLogs.store(g_globals.contexts.front()->get_tor_logs());
+    }
+}
+
+tego_context::~tego_context()
+{
+    // from here on anything calling into us from another thread, our own callbacks
+    // included, gets an error rather than waiting on a command that would never run
+    this->command_queue_.close();
+
+    // takes our identity's onion service and connections down with it
+    delete this->identityManager;
 }
 
 void tego_context::start_tor(const tego_tor_launch_config_t* config)
@@ -32,8 +49,24 @@ void tego_context::start_tor(const tego_tor_launch_config_t* config)
     TEGO_THROW_IF_NULL(this->torManager);
     TEGO_THROW_IF_NULL(config);
 
+    // the tor daemon is shared by every context, so only the first
+    // context to start it gets to pick where its data lives
+    if (g_globals.torStarted)
+    {
+        return;
+    }
+
     this->torManager->setDataDirectory(config->dataDirectory.data());
+
+    if (!config->profileDirectory.empty())
+    {
+        const QDir profileDirectory(QString::fromStdString(config->profileDirectory));
+        g_globals.fileHashCache = std::make_shared<tego_file_hash_cache>(
+            profileDirectory.filePath(QStringLiteral("file_hashes.json")).toStdString());
+    }
+
     this->torManager->start();
+    g_globals.torStarted = true;
 }
 
 bool tego_context::get_tor_daemon_configured() const
@@ -45,31 +78,17 @@ bool tego_context::get_tor_daemon_configured() const
 
 size_t tego_context::get_tor_logs_size() const
 {
-    size_t retval = 0;
-    for(const auto& msg : this->get_tor_logs())
-    {
-        retval += msg.size() + 1;
-    }
-    return retval;
+    return this->torLogs.load()->size();
 }
 
-const std::vector<std::string>& tego_context::get_tor_logs() const
+std::shared_ptr<const std::string> tego_context::get_tor_logs() const
 {
-    TEGO_THROW_IF_NULL(this->torManager);
-
-    auto logMessages = this->torManager->logMessages();
-    TEGO_THROW_IF_FALSE(logMessages.size() >= 0);
-
-    // see if we need to update our local copy
-    if(static_cast<size_t>(logMessages.size()) != this->torLogs.size())
-    {
-        for(size_t i = this->torLogs.size(); i < static_cast<size_t>(logMessages.size()); i++)
-        {
-            this->torLogs.push_back(std::move(logMessages[i].toStdString()));
-        }
-    }
+    return this->torLogs.load();
+}
 
-    return this->torLogs;
+void tego_context::update_tor_logs(std::shared_ptr<const std::string> logs)
+{
+    this->torLogs.store(std::move(logs));
 }
 
 const char* tego_context::get_tor_version_string() const
@@ -248,7 +267,7 @@ void tego_context::start_service(
     }
 
     // save off the singleton on our context
-    this->identityManager = new IdentityManager(keyBlob);
+    this->identityManager = new IdentityManager(this, keyBlob);
     auto userIdentity = this->identityManager->identities().first();
     auto contactsManager = userIdentity->getContacts();
 
@@ -257,11 +276,17 @@ void tego_context::start_service(
     contactsManager->addRejectedIncomingRequests(blockedUsers);
     contactsManager->addOutgoingRequests(pendingUsers);
     contactsManager->addRejectedOutgoingRequests(rejectedUsers);
+
+    this->connect_user_type_signals();
+    this->update_user_types();
 }
 
 void tego_context::start_service()
 {
-    this->identityManager = new IdentityManager({}, {});
+    this->identityManager = new IdentityManager(this, {});
+
+    this->connect_user_type_signals();
+    this->update_user_types();
 }
 
 int32_t tego_context::get_tor_bootstrap_progress() const
@@ -399,7 +424,7 @@ std::unique_ptr<tego_user_id_t> tego_context::get_host_user_id() const
 
 tego_host_user_state_t tego_context::get_host_user_state() const
 {
-    return this->hostUserState;
+    return this->hostUserState.load();
 }
 
 void tego_context::send_chat_request(
@@ -466,49 +491,13 @@ tego_message_id_t tego_context::send_message(
 
 tego_user_type_t tego_context::get_user_type(tego_user_id_t const* user) const
 {
-    auto contactUser = this->getContactUser(user);
-    if (contactUser != nullptr)
-    {
-        auto const status = contactUser->status();
-        switch(status)
-        {
-            case ContactUser::Online:
-            case ContactUser::Offline:
-                return tego_user_type_allowed;
-            case ContactUser::RequestPending:
-                return tego_user_type_pending;
-            case ContactUser::RequestRejected:
-                return tego_user_type_rejected;
-            default:
-                TEGO_THROW_MSG("Unknown ContactUser::Status : {}", (int)status);
-                break;
-        }
-    }
-
-    // next check for requesting users
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
-    auto incomingRequestManager = contactsManager->incomingRequestManager();
-
-    auto hostname = QByteArray::fromStdString(fmt::format("{}.onion", user->serviceId.data));
-
-    // search for the user's serviceId on the incoming request manager
-    auto contactRequest = incomingRequestManager->requestFromHostname(hostname);
-    if (contactRequest != nullptr)
-    {
-        return tego_user_type_requesting;
-    }
-
-    // see if the user is blocked
-    if(incomingRequestManager->isHostnameRejected(hostname))
-    {
-        return tego_user_type_blocked;
-    }
+    TEGO_THROW_IF_NULL(user);
 
-    // finally see if the user matches the host
-    if (hostname == userIdentity->hostname().toUtf8())
+    const auto userTypes = this->userTypes.load();
+    const auto it = userTypes->find(std::string_view(user->serviceId.data, TEGO_V3_ONION_SERVICE_ID_LENGTH));
+    if (it != userTypes->end())
     {
-        return tego_user_type_host;
+        return it->second;
     }
 
     TEGO_THROW_MSG("Unknown user with service id : '{}'", user->serviceId.data);
@@ -592,7 +581,8 @@ void tego_context::forget_user(const tego_user_id_t* user)
 
 std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> tego_context::send_file_transfer_request(
     tego_user_id_t const* user,
-    std::string const& filePath)
+    std::string const& filePath,
+    bool hashFile)
 {
     TEGO_THROW_IF_NULL(user);
 
@@ -600,7 +590,7 @@ std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file
     TEGO_THROW_IF_NULL(contactUser);
     auto conversationModel = contactUser->conversation();
 
-    return conversationModel->sendFile(QString::fromStdString(filePath));
+    return conversationModel->sendFile(QString::fromStdString(filePath), hashFile);
 }
 
 void tego_context::respond_file_transfer_request(
@@ -650,10 +640,75 @@ void tego_context::cancel_file_transfer_transfer(
     conversationModel->cancelTransfer(fileTransfer);
 }
 
+void tego_context::update_user_types()
+{
+    TEGO_THROW_IF_NULL(this->identityManager);
+    auto userIdentity = this->identityManager->identities().first();
+    auto contactsManager = userIdentity->getContacts();
+    auto incomingRequestManager = contactsManager->incomingRequestManager();
+
+    // hostnames are the service id followed by '.onion'
+    const auto serviceId = [](const QByteArray& hostname) -> std::string
+    {
+        return hostname.left(TEGO_V3_ONION_SERVICE_ID_LENGTH).toStdString();
+    };
+
+    // a user may appear in more than one place, so entries are added in the
+    // order of precedence and never overwritten: contacts, then requesting
+    // users, then blocked users and finally the host
+    std::map<std::string, tego_user_type_t, std::less<>> userTypes;
+    for(auto contactUser : contactsManager->contacts())
+    {
+        auto const status = contactUser->status();
+        switch(status)
+        {
+            case ContactUser::Online:
+            case ContactUser::Offline:
+                userTypes.emplace(serviceId(contactUser->hostname().toUtf8()), tego_user_type_allowed);
+                break;
+            case ContactUser::RequestPending:
+                userTypes.emplace(serviceId(contactUser->hostname().toUtf8()), tego_user_type_pending);
+                break;
+            case ContactUser::RequestRejected:
+                userTypes.emplace(serviceId(contactUser->hostname().toUtf8()), tego_user_type_rejected);
+                break;
+            default:
+                qWarning() << "Unknown ContactUser::Status :" << status;
+                break;
+        }
+    }
+    for(auto contactRequest : incomingRequestManager->requests())
+    {
+        userTypes.emplace(serviceId(contactRequest->hostname()), tego_user_type_requesting);
+    }
+    for(const auto& hostname : incomingRequestManager->getRejectedHostnames())
+    {
+        userTypes.emplace(serviceId(hostname), tego_user_type_blocked);
+    }
+    userTypes.emplace(serviceId(userIdentity->hostname().toUtf8()), tego_user_type_host);
+
+    this->userTypes.store(std::move(userTypes));
+}
+
 //
 // tego_context private methods
 //
 
+void tego_context::connect_user_type_signals()
+{
+    TEGO_THROW_IF_NULL(this->identityManager);
+    auto userIdentity = this->identityManager->identities().first();
+    auto contactsManager = userIdentity->getContacts();
+    auto incomingRequestManager = contactsManager->incomingRequestManager();
+
+    const auto update = [this]() -> void { this->update_user_types(); };
+    QObject::connect(contactsManager, &ContactsManager::contactAdded, update);
+    QObject::connect(contactsManager, &ContactsManager::contactStatusChanged, update);
+    QObject::connect(contactsManager, &ContactsManager::contactRemoved, update);
+    QObject::connect(incomingRequestManager, &IncomingRequestManager::requestsChanged, update);
+    QObject::connect(incomingRequestManager, &IncomingRequestManager::rejectedHostsChanged, update);
+}
+
 ContactUser* tego_context::getContactUser(tego_user_id_t const* user) const
 {
     TEGO_THROW_IF_NULL(user);
@@ -731,9 +786,10 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-
-            context->start_tor(launchConfig);
+            return context->invoke([=]() -> void
+            {
+                context->start_tor(launchConfig);
+            });
         }, error);
     }
 
@@ -745,18 +801,24 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_configured);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_configured);
 
-            *out_configured = TEGO_FALSE;
+                *out_configured = TEGO_FALSE;
 
-            if(context->get_tor_daemon_configured())
-            {
-                *out_configured = TEGO_TRUE;
-            }
+                if(context->get_tor_daemon_configured())
+                {
+                    *out_configured = TEGO_TRUE;
+                }
+            });
         }, error);
     };
 
+    // the tor log, user type and host user state queries are served from snapshots
+    // published by the Qt thread, so unlike the rest of the API they may be called
+    // from any thread
+
     size_t tego_context_get_tor_logs_size(
         const tego_context_t* context,
         tego_error_t** error)
@@ -764,7 +826,6 @@ extern "C"
         return tego::translateExceptions([=]() -> size_t
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
 
             return context->get_tor_logs_size();
         }, error, 0);
@@ -780,7 +841,6 @@ extern "C"
         return tego::translateExceptions([=]() -> size_t
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
             TEGO_THROW_IF_NULL(out_logBuffer);
 
             // nothing to do if no space to write
@@ -789,28 +849,14 @@ extern "C"
                 return 0;
             }
 
-            // get our tor logs
-            const auto& logs = context->get_tor_logs();
-            size_t logsSize = context->get_tor_logs_size();
-
-            // create temporary buffer to copy each line into
-            std::vector<char> logBuffer;
-            logBuffer.reserve(logsSize);
+            // get our tor logs, each line is already followed by a new line '\n'
+            const auto logs = context->get_tor_logs();
 
-            // copy each log and separate by new lines '\n'
-            for(const auto& line : logs)
-            {
-                std::copy(line.begin(), line.end(), std::back_inserter(logBuffer));
-                logBuffer.push_back('\n');
-            }
-            // append null terminator
-            logBuffer.push_back(0);
-
-            // finally copy at most logBufferSize bytes from logBuffer
-            size_t copyCount = std::min(logBufferSize, logBuffer.size());
+            // copy at most logBufferSize bytes, including the null terminator
+            size_t copyCount = std::min(logBufferSize, logs->size() + 1);
             TEGO_THROW_IF_FALSE(copyCount > 0);
 
-            std::copy(logBuffer.begin(), logBuffer.begin() + copyCount, out_logBuffer);
+            std::copy(logs->c_str(), logs->c_str() + copyCount, out_logBuffer);
             // always write null terminator at the end
             out_logBuffer[copyCount - 1] = 0;
 
@@ -825,9 +871,10 @@ extern "C"
         return tego::translateExceptions([=]() -> const char*
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-
-            return context->get_tor_version_string();
+            return context->invoke([=]() -> const char*
+            {
+                return context->get_tor_version_string();
+            });
         }, error, nullptr);
     }
 
@@ -839,11 +886,13 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_status);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_status);
 
-            auto status = context->get_tor_control_status();
-            *out_status = status;
+                auto status = context->get_tor_control_status();
+                *out_status = status;
+            });
         }, error);
     }
 
@@ -855,11 +904,13 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_status);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_status);
 
-            const auto status = context->get_tor_process_status();
-            *out_status = status;
+                const auto status = context->get_tor_process_status();
+                *out_status = status;
+            });
         }, error);
     }
 
@@ -871,11 +922,13 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_status);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_status);
 
-            auto status = context->get_tor_network_status();
-            *out_status = status;
+                auto status = context->get_tor_network_status();
+                *out_status = status;
+            });
         }, error);
     }
 
@@ -888,15 +941,17 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_progress);
-            TEGO_THROW_IF_NULL(out_tag);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_progress);
+                TEGO_THROW_IF_NULL(out_tag);
 
-            auto progress = context->get_tor_bootstrap_progress();
-            auto tag = context->get_tor_bootstrap_tag();
+                auto progress = context->get_tor_bootstrap_progress();
+                auto tag = context->get_tor_bootstrap_tag();
 
-            *out_progress = progress;
-            *out_tag = tag;
+                *out_progress = progress;
+                *out_tag = tag;
+            });
         }, error);
     }
 
@@ -911,24 +966,25 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-
-            if (hostPrivateKey == nullptr)
+            return context->invoke([=]() -> void
             {
-                TEGO_THROW_IF_FALSE(userBuffer == nullptr && userTypeBuffer == nullptr && userCount == 0);
-                context->start_service();
-            }
-            else
-            {
-                TEGO_THROW_IF_FALSE((userBuffer == nullptr && userTypeBuffer == nullptr && userCount == 0) ||
-                                    (userBuffer != nullptr && userTypeBuffer != nullptr && userCount > 0));
-
-                context->start_service(
-                    hostPrivateKey,
-                    userBuffer,
-                    userTypeBuffer,
-                    userCount);
-            }
+                if (hostPrivateKey == nullptr)
+                {
+                    TEGO_THROW_IF_FALSE(userBuffer == nullptr && userTypeBuffer == nullptr && userCount == 0);
+                    context->start_service();
+                }
+                else
+                {
+                    TEGO_THROW_IF_FALSE((userBuffer == nullptr && userTypeBuffer == nullptr && userCount == 0) ||
+                                        (userBuffer != nullptr && userTypeBuffer != nullptr && userCount > 0));
+
+                    context->start_service(
+                        hostPrivateKey,
+                        userBuffer,
+                        userTypeBuffer,
+                        userCount);
+                }
+            });
         }, error);
     }
 
@@ -940,11 +996,13 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_hostUser);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_hostUser);
 
-            auto hostUser = context->get_host_user_id();
-            *out_hostUser = hostUser.release();
+                auto hostUser = context->get_host_user_id();
+                *out_hostUser = hostUser.release();
+            });
         }, error);
     }
 
@@ -956,7 +1014,6 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
             TEGO_THROW_IF_NULL(out_state);
 
             auto state = context->get_host_user_state();
@@ -972,9 +1029,10 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-
-            context->update_tor_daemon_config(torConfig);
+            return context->invoke([=]() -> void
+            {
+                context->update_tor_daemon_config(torConfig);
+            });
         }, error);
     }
 
@@ -985,9 +1043,10 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-
-            context->save_tor_daemon_config();
+            return context->invoke([=]() -> void
+            {
+                context->save_tor_daemon_config();
+            });
         }, error);
     }
 
@@ -1000,7 +1059,6 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
             TEGO_THROW_IF_NULL(user);
             TEGO_THROW_IF_NULL(out_type);
 
@@ -1017,11 +1075,13 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_userCount);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(out_userCount);
 
-            auto count = context->get_user_count();
-            *out_userCount = count;
+                auto count = context->get_user_count();
+                *out_userCount = count;
+            });
         }, error);
     }
 
@@ -1035,18 +1095,19 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(out_usersBuffer);
-            TEGO_THROW_IF_NULL(out_userCount);
-
-            auto users = context->get_users();
-            const auto userCount = std::min(users.size(), usersBufferLength);
-            for(size_t i = 0; i < userCount; ++i)
+            return context->invoke([=]() -> void
             {
-                out_usersBuffer[i] = users[i];
-            }
-            *out_userCount = userCount;
-
+                TEGO_THROW_IF_NULL(out_usersBuffer);
+                TEGO_THROW_IF_NULL(out_userCount);
+
+                auto users = context->get_users();
+                const auto userCount = std::min(users.size(), usersBufferLength);
+                for(size_t i = 0; i < userCount; ++i)
+                {
+                    out_usersBuffer[i] = users[i];
+                }
+                *out_userCount = userCount;
+            });
         }, error);
     }
 
@@ -1060,11 +1121,13 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(user);
-            TEGO_THROW_IF_FALSE(message != nullptr || messageLength == 0);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(user);
+                TEGO_THROW_IF_FALSE(message != nullptr || messageLength == 0);
 
-            context->send_chat_request(user, message, messageLength);
+                context->send_chat_request(user, message, messageLength);
+            });
         }, error);
     }
 
@@ -1077,9 +1140,10 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-
-            context->acknowledge_chat_request(user, response);
+            return context->invoke([=]() -> void
+            {
+                context->acknowledge_chat_request(user, response);
+            });
         }, error);
     }
 
@@ -1096,29 +1160,82 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(user);
+                TEGO_THROW_IF_NULL(filePath);
+                TEGO_THROW_IF_FALSE(filePathLength > 0);
+
+                // only hash the file up front if the caller wants the hash, otherwise
+                // it is hashed while it is being sent
+                auto [id, fileHash, fileSize] =
+                    context->send_file_transfer_request(
+                        user,
+                        std::string(filePath, filePathLength),
+                        out_fileHash != nullptr);
+
+                if (out_id != nullptr)
+                {
+                    *out_id = id;
+                }
+                if (out_fileHash != nullptr)
+                {
+                    *out_fileHash = fileHash.release();
+                }
+                if (out_fileSize != nullptr)
+                {
+                    *out_fileSize = fileSize;
+                }
+            });
+        }, error);
+    }
+
+    void tego_context_send_file_transfer_request_async(
+        tego_context* context,
+        tego_user_id_t const* user,
+        char const* filePath,
+        size_t filePathLength,
+        tego_bool_t hashFile,
+        tego_send_file_transfer_request_completed_callback_t completed,
+        void* userData,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
             TEGO_THROW_IF_NULL(user);
             TEGO_THROW_IF_NULL(filePath);
             TEGO_THROW_IF_FALSE(filePathLength > 0);
 
-            auto [id, fileHash, fileSize] =
-                context->send_file_transfer_request(
-                    user,
-                    std::string(filePath, filePathLength));
-
-            if (out_id != nullptr)
-            {
-                *out_id = id;
-            }
-            if (out_fileHash != nullptr)
-            {
-                *out_fileHash = fileHash.release();
-            }
-            if (out_fileSize != nullptr)
+            context->post([=, user=*user, filePath=std::string(filePath, filePathLength)]() -> void
             {
-                *out_fileSize = fileSize;
-            }
-
+                tego_file_transfer_id_t id = 0;
+                std::unique_ptr<tego_file_hash_t> fileHash;
+                tego_file_size_t fileSize = 0;
+                std::optional<std::string> failure;
+                try
+                {
+                    std::tie(id, fileHash, fileSize) = context->send_file_transfer_request(&user, filePath, hashFile == TEGO_TRUE);
+                }
+                catch(const std::exception& ex)
+                {
+                    failure = ex.what();
+                }
+                catch(...)
+                {
+                    failure = "unknown exception";
+                }
+
+                if (completed != nullptr)
+                {
+                    context->callback_registry_.emit_completion(
+                        [=, fileHash=std::shared_ptr<tego_file_hash_t>(std::move(fileHash))]() -> void
+                        {
+                            const tego_error_t err{failure.value_or(std::string())};
+                            completed(context, id, fileHash.get(), fileSize, failure ? &err : nullptr, userData);
+                        });
+                }
+            });
         }, error);
     }
 
@@ -1134,20 +1251,22 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(user);
-            // dest string must be valid is accept
-            TEGO_THROW_IF_TRUE(response == tego_file_transfer_response_accept &&
-                (destPath == nullptr || destPathLength == 0))
-            // dest string must be null and empty if reject
-            TEGO_THROW_IF_TRUE(response == tego_file_transfer_response_reject &&
-                (destPath != nullptr || destPathLength > 0))
-
-            context->respond_file_transfer_request(
-                user,
-                fileTransfer,
-                response,
-                destPath ? std::string(destPath, destPathLength) : std::string());
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(user);
+                // dest string must be valid is accept
+                TEGO_THROW_IF_TRUE(response == tego_file_transfer_response_accept &&
+                    (destPath == nullptr || destPathLength == 0))
+                // dest string must be null and empty if reject
+                TEGO_THROW_IF_TRUE(response == tego_file_transfer_response_reject &&
+                    (destPath != nullptr || destPathLength > 0))
+
+                context->respond_file_transfer_request(
+                    user,
+                    fileTransfer,
+                    response,
+                    destPath ? std::string(destPath, destPathLength) : std::string());
+            });
         }, error);
     }
 
@@ -1160,9 +1279,11 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            TEGO_THROW_IF_NULL(user);
-            context->cancel_file_transfer_transfer(user, id);
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(user);
+                context->cancel_file_transfer_transfer(user, id);
+            });
         }, error);
     }
 
@@ -1177,17 +1298,64 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            return context->invoke([=]() -> void
+            {
+                TEGO_THROW_IF_NULL(user);
+                TEGO_THROW_IF_NULL(message);
+                TEGO_THROW_IF_FALSE(messageLength > 0);
+
+                auto id = context->send_message(user, std::string(message, messageLength));
+                if (out_id != nullptr)
+                {
+                    logger::println("Sent message with id: {}", id);
+                    *out_id = id;
+                }
+            });
+        }, error);
+    }
+
+    void tego_context_send_message_async(
+        tego_context_t* context,
+        const tego_user_id_t* user,
+        const char* message,
+        size_t messageLength,
+        tego_send_message_completed_callback_t completed,
+        void* userData,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
             TEGO_THROW_IF_NULL(user);
             TEGO_THROW_IF_NULL(message);
             TEGO_THROW_IF_FALSE(messageLength > 0);
 
-            auto id = context->send_message(user, std::string(message, messageLength));
-            if (out_id != nullptr)
+            context->post([=, user=*user, message=std::string(message, messageLength)]() -> void
             {
-                logger::println("Sent message with id: {}", id);
-                *out_id = id;
-            }
+                tego_message_id_t id = 0;
+                std::optional<std::string> failure;
+                try
+                {
+                    id = context->send_message(&user, message);
+                }
+                catch(const std::exception& ex)
+                {
+                    failure = ex.what();
+                }
+                catch(...)
+                {
+                    failure = "unknown exception";
+                }
+
+                if (completed != nullptr)
+                {
+                    context->callback_registry_.emit_completion([=]() -> void
+                    {
+                        const tego_error_t err{failure.value_or(std::string())};
+                        completed(context, id, failure ? &err : nullptr, userData);
+                    });
+                }
+            });
         }, error);
     }
 
@@ -1199,8 +1367,10 @@ extern "C"
         return tego::translateExceptions([=]() -> void
         {
             TEGO_THROW_IF_NULL(context);
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
-            context->forget_user(user);
+            return context->invoke([=]() -> void
+            {
+                context->forget_user(user);
+            });
         }, error);
     }
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "signals.hpp"
+#include "command_queue.hpp"
+#include "snapshot.hpp"
 #include "tor.hpp"
 #include "user.hpp"
 
@@ -8,6 +10,8 @@
 #include "tor/TorManager.h"
 #include "core/IdentityManager.h"
 
+class tego_file_hash_cache;
+
 //
 // Tego Context
 //
@@ -16,11 +20,13 @@ struct tego_context
 {
 public:
     tego_context();
+    ~tego_context();
 
     void start_tor(const tego_tor_launch_config_t* config);
     bool get_tor_daemon_configured() const;
     size_t get_tor_logs_size() const;
-    const std::vector<std::string>& get_tor_logs() const;
+    // newline separated and null terminated
+    std::shared_ptr<const std::string> get_tor_logs() const;
     const char* get_tor_version_string() const;
     tego_tor_control_status_t get_tor_control_status() const;
     tego_tor_process_status_t get_tor_process_status() const;
@@ -54,7 +60,8 @@ public:
     void forget_user(const tego_user_id_t* user);
     std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> send_file_transfer_request(
         tego_user_id_t const* user,
-        std::string const& filePath);
+        std::string const& filePath,
+        bool hashFile);
     void respond_file_transfer_request(
         tego_user_id_t const* user,
         tego_file_transfer_id_t fileTransfer,
@@ -65,26 +72,61 @@ public:
         tego_file_transfer_id_t);
 
     tego::callback_registry callback_registry_;
+    // outlives callback_queue_, whose worker may still be calling into us
+    // through invoke() while it is being joined
+    mutable tego::command_queue command_queue_;
     tego::callback_queue callback_queue_;
-    // anything that touches internal state should do so through
-    // this 'global' (actually per tego_context) mutex
-    std::mutex mutex_;
 
     // TODO: figure out ownership of these Qt types
     Tor::TorManager* torManager = nullptr;
     Tor::TorControl* torControl = nullptr;
+    // this context's own identity, contacts and onion service; the tor
+    // daemon and its control connection are shared with every other context
     IdentityManager* identityManager = nullptr;
 
     // we store the thread id that this context is associated with
-    // calls which go into our qt internals must be called from the same
-    // thread as the context was created on
+    // calls which go into our qt internals must be made on the same
+    // thread as the context was created on, calls from other threads are
+    // marshalled over to it through command_queue_
     // (this is not entirely true, they must be called from the thread with the Qt
     // event loop, which in our case is the thread the context is created on)
     std::thread::id threadId;
+
+    // runs func on the Qt thread and returns its result (or rethrows what it threw),
+    // blocking until it has run; called on the Qt thread it runs func straight away
+    template<typename FUNC>
+    auto invoke(FUNC&& func) const -> decltype(func())
+    {
+        if (std::this_thread::get_id() == this->threadId)
+        {
+            return func();
+        }
+
+        std::packaged_task<decltype(func())()> task(std::forward<FUNC>(func));
+        auto result = task.get_future();
+        this->command_queue_.push_back(std::move(task));
+        return result.get();
+    }
+
+    // queues func to run on the Qt thread and returns immediately
+    template<typename FUNC>
+    void post(FUNC&& func) const
+    {
+        this->command_queue_.push_back(std::forward<FUNC>(func));
+    }
+
+    // called on the Qt thread whenever tor's log or the set of users changes, to
+    // publish new snapshots for the read-only queries which may come from any thread;
+    // logs are newline separated, and shared by every context
+    void update_tor_logs(std::shared_ptr<const std::string> logs);
+    void update_user_types();
 private:
     class ContactUser* getContactUser(const tego_user_id_t*) const;
+    void connect_user_type_signals();
 
     mutable std::string torVersion;
-    mutable std::vector<std::string> torLogs;
-    tego_host_user_state_t hostUserState = tego_host_user_state_unknown;
+    tego::snapshot<std::string> torLogs;
+    // keyed by service id
+    tego::snapshot<std::map<std::string, tego_user_type_t, std::less<>>> userTypes;
+    std::atomic<tego_host_user_state_t> hostUserState = tego_host_user_state_unknown;
 };
\ No newline at end of file
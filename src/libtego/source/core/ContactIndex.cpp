@@ -0,0 +1,73 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ContactIndex.h"
+#include "ContactIDValidator.h"
+#include "ed25519.hpp"
+
+QByteArray ContactIndex::keyFromHostname(const QString &hostname)
+{
+    QString serviceId = ContactIDValidator::hostnameFromID(hostname);
+    if (serviceId.isNull())
+        serviceId = hostname;
+
+    if (serviceId.endsWith(QLatin1String(".onion"), Qt::CaseInsensitive))
+        serviceId.chop(tego::static_strlen(".onion"));
+
+    const QByteArray encoded = serviceId.toLatin1();
+    if (encoded.size() == TEGO_V3_ONION_SERVICE_ID_LENGTH) {
+        char raw[TEGO_V3_ONION_SERVICE_ID_RAW_SIZE] = {0};
+        // base32_decode accepts either case
+        const auto bytesDecoded = ::base32_decode(raw, sizeof(raw), encoded.constData(), encoded.size());
+        if (bytesDecoded == sizeof(raw) && raw[TEGO_V3_ONION_SERVICE_ID_VERSION_OFFSET] == 0x03)
+            return QByteArray(raw, ED25519_PUBKEY_LEN);
+    }
+
+    return serviceId.toLower().toUtf8();
+}
+
+void ContactIndex::insert(ContactUser *user, const QString &hostname)
+{
+    contacts.insert(keyFromHostname(hostname), user);
+}
+
+void ContactIndex::remove(ContactUser *user, const QString &hostname)
+{
+    auto it = contacts.find(keyFromHostname(hostname));
+    if (it != contacts.end() && it.value() == user)
+        contacts.erase(it);
+}
+
+ContactUser *ContactIndex::lookup(const QString &hostname) const
+{
+    return contacts.value(keyFromHostname(hostname), nullptr);
+}
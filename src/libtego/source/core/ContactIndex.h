@@ -0,0 +1,62 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CONTACTINDEX_H
+#define CONTACTINDEX_H
+
+class ContactUser;
+
+/* Finds contacts by hostname without scanning the contact list
+ *
+ * Contacts are keyed by the 32 byte public key their v3 onion hostname
+ * decodes to, so the lookup is a single hash probe no matter how the hostname
+ * was spelled: ricochet: IDs, bare service ids and .onion hostnames in any
+ * case all find the same contact. A hostname that is not a v3 service id is
+ * keyed by its lower cased text instead.
+ */
+class ContactIndex
+{
+public:
+    static QByteArray keyFromHostname(const QString &hostname);
+
+    void insert(ContactUser *user, const QString &hostname);
+    // only removes the entry if it still belongs to user
+    void remove(ContactUser *user, const QString &hostname);
+    ContactUser *lookup(const QString &hostname) const;
+
+    int size() const { return contacts.size(); }
+
+private:
+    QHash<QByteArray, ContactUser*> contacts;
+};
+
+#endif // CONTACTINDEX_H
@@ -44,7 +44,6 @@
 #include "ed25519.hpp"
 #include "context.hpp"
 #include "user.hpp"
-#include "globals.hpp"
 
 ContactUser::ContactUser(UserIdentity *ident, const QString& hostname, Status status, QObject *parent)
     : QObject(parent)
@@ -109,14 +108,14 @@ void ContactUser::updateStatus()
     }
 
     {
-        auto userId = this->toTegoUserId();
+        const auto& userId = this->tegoUserId();
         switch(newStatus)
         {
             case ContactUser::Online:
-                tego::g_globals.context->callback_registry_.emit_user_status_changed(userId.release(), tego_user_status_online);
+                this->identity->context->callback_registry_.emit_user_status_changed(&userId, tego_user_status_online);
                 break;
             case ContactUser::Offline:
-                tego::g_globals.context->callback_registry_.emit_user_status_changed(userId.release(), tego_user_status_offline);
+                this->identity->context->callback_registry_.emit_user_status_changed(&userId, tego_user_status_offline);
                 break;
             default:
 
@@ -236,6 +235,7 @@ void ContactUser::setHostname(const QString &hostname)
         fh.append(QLatin1String(".onion"));
 
     m_hostname = hostname;
+    m_tegoUserId.reset();
 
     updateOutgoingSocket();
 }
@@ -441,12 +441,18 @@ void ContactUser::clearConnection()
 
 std::unique_ptr<tego_user_id_t> ContactUser::toTegoUserId() const
 {
-    // convert our hostname to just the service id raw string
-    auto serviceIdString = this->hostname().chopped(tego::static_strlen(".onion")).toUtf8();
-    // ensure valid service id
-    auto serviceId = std::make_unique<tego_v3_onion_service_id>(serviceIdString.data(), serviceIdString.size());
-    // create user id object from service id
-    auto userId = std::make_unique<tego_user_id>(*serviceId.get());
-
-    return userId;
+    return std::make_unique<tego_user_id>(this->tegoUserId());
+}
+
+const tego_user_id_t& ContactUser::tegoUserId() const
+{
+    if (!m_tegoUserId.has_value()) {
+        // convert our hostname to just the service id raw string
+        auto serviceIdString = this->hostname().chopped(tego::static_strlen(".onion")).toUtf8();
+        // ensure valid service id
+        tego_v3_onion_service_id serviceId(serviceIdString.data(), serviceIdString.size());
+        // create user id object from service id
+        m_tegoUserId.emplace(serviceId);
+    }
+    return *m_tegoUserId;
 }
\ No newline at end of file
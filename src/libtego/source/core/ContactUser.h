@@ -34,6 +34,7 @@
 #define CONTACTUSER_H
 
 #include "protocol/Connection.h"
+#include "user.hpp"
 
 class UserIdentity;
 class OutgoingContactRequest;
@@ -90,6 +91,8 @@ public:
     void deleteContact();
 
     std::unique_ptr<tego_user_id_t> toTegoUserId() const;
+    // computed once, for the many callbacks which only borrow it
+    const tego_user_id_t& tegoUserId() const;
 
 public slots:
     /* Assign a connection to this user
@@ -136,6 +139,7 @@ private:
     OutgoingContactRequest *m_contactRequest;
     ConversationModel *m_conversation;
     mutable QString m_hostname;
+    mutable std::optional<tego_user_id_t> m_tegoUserId;
 
     /* See ContactsManager::addContact */
     static ContactUser *addNewContact(UserIdentity *identity, const QString& contactHostname);
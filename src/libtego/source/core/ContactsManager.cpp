@@ -53,7 +53,7 @@ void ContactsManager::addAllowedContacts(const QList<QString>& userHostnames)
     {
         ContactUser *user = new ContactUser(identity, hostname, ContactUser::Offline, this);
         connectSignals(user);
-        pContacts.append(user);
+        appendContact(user);
         emit contactAdded(user);
     }
 }
@@ -90,7 +90,7 @@ void ContactsManager::addRejectedOutgoingRequests(const QList<QString>& userHost
         ContactUser *user = new ContactUser(identity, hostname, ContactUser::RequestRejected, this);
 
         connect(user, SIGNAL(contactDeleted(ContactUser*)), SLOT(contactDeleted(ContactUser*)));
-        pContacts.append(user);
+        appendContact(user);
 
         // emit contactAdded(user);
     }
@@ -104,12 +104,18 @@ ContactUser *ContactsManager::addContact(const QString& hostname)
 
     qDebug() << "Added new contact" << hostname;
 
-    pContacts.append(user);
+    appendContact(user);
     emit contactAdded(user);
 
     return user;
 }
 
+void ContactsManager::appendContact(ContactUser *user)
+{
+    pContacts.append(user);
+    pContactIndex.insert(user, user->hostname());
+}
+
 void ContactsManager::connectSignals(ContactUser *user)
 {
     connect(user, SIGNAL(contactDeleted(ContactUser*)), SLOT(contactDeleted(ContactUser*)));
@@ -146,25 +152,16 @@ ContactUser *ContactsManager::createContactRequest(const QString &contactid, con
 
 void ContactsManager::contactDeleted(ContactUser *user)
 {
-    pContacts.removeOne(user);
+    if (pContacts.removeOne(user)) {
+        pContactIndex.remove(user, user->hostname());
+        pUnreadCounts.remove(user);
+        emit contactRemoved(user);
+    }
 }
 
 ContactUser *ContactsManager::lookupHostname(const QString &hostname) const
 {
-    QString ohost = ContactIDValidator::hostnameFromID(hostname);
-    if (ohost.isNull())
-        ohost = hostname;
-
-    if (!ohost.endsWith(QLatin1String(".onion")))
-        ohost.append(QLatin1String(".onion"));
-
-    for (QList<ContactUser*>::ConstIterator it = pContacts.begin(); it != pContacts.end(); ++it)
-    {
-        if (ohost.compare((*it)->hostname(), Qt::CaseInsensitive) == 0)
-            return *it;
-    }
-
-    return 0;
+    return pContactIndex.lookup(hostname);
 }
 
 void ContactsManager::onUnreadCountChanged()
@@ -174,17 +171,7 @@ void ContactsManager::onUnreadCountChanged()
     if (!model)
         return;
     ContactUser *user = model->contact();
+    pUnreadCounts.set(user, model->unreadCount());
 
     emit unreadCountChanged(user, model->unreadCount());
 }
-
-int ContactsManager::globalUnreadCount() const
-{
-    int re = 0;
-    foreach (ContactUser *u, pContacts) {
-        if (u->conversation())
-            re += u->conversation()->unreadCount();
-    }
-    return re;
-}
-
@@ -34,6 +34,8 @@
 #define CONTACTSMANAGER_H
 
 #include "core/IncomingRequestManager.h"
+#include "core/ContactIndex.h"
+#include "core/UnreadCounts.h"
 
 class OutgoingContactRequest;
 class UserIdentity;
@@ -78,7 +80,7 @@ public:
     // tego_user_type_rejected
     void addRejectedOutgoingRequests(const QList<QString>& userHostnames);
 
-    int globalUnreadCount() const;
+    int globalUnreadCount() const { return pUnreadCounts.total(); }
 
 signals:
     void contactAdded(ContactUser *user);
@@ -87,6 +89,7 @@ signals:
     void unreadCountChanged(ContactUser *user, int unreadCount);
 
     void contactStatusChanged(ContactUser* user, int status);
+    void contactRemoved(ContactUser *user);
 
 private slots:
     void contactDeleted(ContactUser *user);
@@ -94,7 +97,12 @@ private slots:
 
 private:
     QList<ContactUser*> pContacts;
+    /* ContactUser::setHostname is only ever given the hostname the contact
+     * was created with, so entries are keyed once when the contact is added */
+    ContactIndex pContactIndex;
+    UnreadCounts pUnreadCounts;
 
+    void appendContact(ContactUser *user);
     void connectSignals(ContactUser *user);
 };
 
@@ -36,6 +36,7 @@
 using tego::g_globals;
 
 #include "ConversationModel.h"
+#include "UserIdentity.h"
 #include "protocol/Connection.h"
 #include "protocol/ChatChannel.h"
 #include "protocol/FileChannel.h"
@@ -59,6 +60,7 @@ void ConversationModel::setContact(ContactUser *contact)
 
     beginResetModel();
     messages.clear();
+    messageIndex.clear();
 
     if (m_contact)
         disconnect(m_contact, 0, this, 0);
@@ -83,6 +85,7 @@ void ConversationModel::setContact(ContactUser *contact)
                 connect(fc, &Protocol::FileChannel::fileTransferRequestResponded, this, &ConversationModel::onFileTransferRequestResponded);
                 connect(fc, &Protocol::FileChannel::fileTransferProgress, this, &ConversationModel::onFileTransferProgress);
                 connect(fc, &Protocol::FileChannel::fileTransferFinished, this, &ConversationModel::onFileTransferFinished);
+                connect(fc, &Protocol::FileChannel::fileTransferHashKnown, this, &ConversationModel::onFileTransferHashKnown);
             }
         };
 
@@ -122,7 +125,7 @@ template<typename T> T *findOrCreateChannelForContact(ContactUser *contact, Prot
 }
 
 
-std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> ConversationModel::sendFile(const QString &file_uri)
+std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> ConversationModel::sendFile(const QString &file_uri, bool hashFile)
 {
     logger::println("Sending file: {}", file_uri);
 
@@ -131,12 +134,20 @@ std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file
 
     std::unique_ptr<tego_file_hash_t> fileHash;
 
-    // calculate our file hash
-    if(std::ifstream file(file_uri.toStdString(), std::ios::in | std::ios::binary); file.is_open())
+    if(QFile file(file_uri); file.open(QIODevice::ReadOnly))
     {
-        fileHash = std::make_unique<tego_file_hash_t>(file);
-        // copy for our message
-        message.fileHash = *fileHash;
+        // calculate our file hash now only if the caller needs it, otherwise
+        // the FileChannel will hash the file as it is read and sent
+        if (hashFile)
+        {
+            // re-sending a file we have already hashed needn't read it again
+            auto cache = g_globals.fileHashCache;
+            fileHash = std::make_unique<tego_file_hash_t>(cache
+                ? cache->hash_file(file_uri.toStdString())
+                : tego_file_hash::from_file(file_uri.toStdString()));
+            // copy for our message
+            message.fileHash = *fileHash;
+        }
     }
     else
     {
@@ -172,7 +183,7 @@ std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file
     }
 
     beginInsertRows(QModelIndex(), 0, 0);
-    messages.prepend(message);
+    insertMessage(0, message);
     endInsertRows();
     prune();
 
@@ -204,7 +215,7 @@ tego_message_id_t ConversationModel::sendMessage(const QString &text)
     }
 
     beginInsertRows(QModelIndex(), 0, 0);
-    messages.prepend(message);
+    insertMessage(0, message);
     endInsertRows();
     prune();
 
@@ -258,7 +269,7 @@ void ConversationModel::cancelTransfer(tego_file_transfer_id_t id)
     else if(auto it = std::find_if(messages.begin(), messages.end(), [=](auto& msg) {return msg.identifier == id;});
             it != messages.end())
     {
-        messages.erase(it);
+        removeMessage(static_cast<int>(it - messages.begin()));
     }
     else
     {
@@ -344,7 +355,7 @@ void ConversationModel::messageReceived(const QString &text, const QDateTime &ti
 
     beginInsertRows(QModelIndex(), row, row);
     MessageData message(Message, text, time, id, Received);
-    messages.insert(row, message);
+    insertMessage(row, message);
     endInsertRows();
     prune();
 
@@ -354,14 +365,10 @@ void ConversationModel::messageReceived(const QString &text, const QDateTime &ti
     {
         // convert QString to raw utf8
         auto utf8Text = text.toUtf8();
-        auto rawText = std::make_unique<char[]>(utf8Text.size() + 1);
-        std::copy(utf8Text.begin(), utf8Text.end(), rawText.get());
 
-        auto userId = this->m_contact->toTegoUserId();
+        logger::println("Received Message : {}", utf8Text.constData());
 
-        logger::println("Received Message : {}", rawText.get());
-
-        g_globals.context->callback_registry_.emit_message_received(userId.release(), time.toMSecsSinceEpoch(), static_cast<tego_message_id_t>(id), rawText.release(), utf8Text.size());
+        this->context()->callback_registry_.emit_message_received(&this->m_contact->tegoUserId(), time.toMSecsSinceEpoch(), static_cast<tego_message_id_t>(id), utf8Text.constData(), static_cast<size_t>(utf8Text.size()));
     }
 }
 
@@ -375,8 +382,7 @@ void ConversationModel::messageAcknowledged(MessageId id, bool accepted)
     data.status = accepted ? Delivered : Error;
     emit dataChanged(index(row, 0), index(row, 0));
 
-    auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_message_acknowledged(userId.release(), static_cast<tego_message_id_t>(id), (accepted ? TEGO_TRUE : TEGO_FALSE));
+    this->context()->callback_registry_.emit_message_acknowledged(&this->contact()->tegoUserId(), static_cast<tego_message_id_t>(id), (accepted ? TEGO_TRUE : TEGO_FALSE));
 }
 
 void ConversationModel::outboundChannelClosed()
@@ -409,6 +415,7 @@ void ConversationModel::clear()
 
     beginRemoveRows(QModelIndex(), 0, messages.size()-1);
     messages.clear();
+    messageIndex.clear();
     endRemoveRows();
 
     resetUnreadCount();
@@ -428,29 +435,19 @@ void ConversationModel::onContactStatusChanged()
     emit dataChanged(index(0, 0), index(rowCount()-1, 0), QVector<int>() << SectionRole);
 }
 
-void ConversationModel::onFileTransferRequestReceived(tego_file_transfer_id_t id, const QString& filename, tego_file_size_t fileSize, tego_file_hash_t hash)
+void ConversationModel::onFileTransferRequestReceived(tego_file_transfer_id_t id, const QString& filename, tego_file_size_t fileSize, std::optional<tego_file_hash_t> hash)
 {
-    // user id
-    auto userId = this->contact()->toTegoUserId();
-
     // filename
     auto utf8Filename = filename.toUtf8();
-    const auto rawFilenameLength = utf8Filename.size();
-    const auto rawFilenameSize = rawFilenameLength + 1; // for null terminator
-    auto rawFilename = std::make_unique<char[]>(rawFilenameSize);
-    std::copy(utf8Filename.begin(), utf8Filename.end(), rawFilename.get());
-    rawFilename[rawFilenameLength] = 0;
-
-    // filehash
-    auto heapHash = std::make_unique<tego_file_hash_t>(hash);
 
-    g_globals.context->callback_registry_.emit_file_transfer_request_received(
-        userId.release(),
+    // filehash, null if the sender only sends it after the file contents
+    this->context()->callback_registry_.emit_file_transfer_request_received(
+        &this->contact()->tegoUserId(),
         id,
-        rawFilename.release(),
-        rawFilenameLength,
+        utf8Filename.constData(),
+        static_cast<size_t>(utf8Filename.size()),
         fileSize,
-        heapHash.release());
+        hash.has_value() ? &hash.value() : nullptr);
 }
 
 void ConversationModel::onFileTransferAcknowledged(tego_file_transfer_id_t id, bool accepted)
@@ -463,27 +460,24 @@ void ConversationModel::onFileTransferAcknowledged(tego_file_transfer_id_t id, b
     data.status = accepted ? Delivered : Error;
     emit dataChanged(index(row, 0), index(row, 0));
 
-    auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_request_acknowledged(
-        userId.release(),
+    this->context()->callback_registry_.emit_file_transfer_request_acknowledged(
+        &this->contact()->tegoUserId(),
         id,
         accepted ? TEGO_TRUE : TEGO_FALSE);
 }
 
 void ConversationModel::onFileTransferRequestResponded(tego_file_transfer_id_t id, tego_file_transfer_response_t response)
 {
-    auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_request_response_received(
-        userId.release(),
+    this->context()->callback_registry_.emit_file_transfer_request_response_received(
+        &this->contact()->tegoUserId(),
         id,
         response);
 }
 
 void ConversationModel::onFileTransferProgress(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, uint64_t bytesTransmitted, uint64_t bytesTotal)
 {
-    auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_progress(
-        userId.release(),
+    this->context()->callback_registry_.emit_file_transfer_progress(
+        &this->contact()->tegoUserId(),
         id,
         direction,
         bytesTransmitted,
@@ -492,14 +486,22 @@ void ConversationModel::onFileTransferProgress(tego_file_transfer_id_t id, tego_
 
 void ConversationModel::onFileTransferFinished(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, tego_file_transfer_result_t result)
 {
-    auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_complete(
-        userId.release(),
+    this->context()->callback_registry_.emit_file_transfer_complete(
+        &this->contact()->tegoUserId(),
         id,
         direction,
         result);
 }
 
+void ConversationModel::onFileTransferHashKnown(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, const tego_file_hash_t& hash)
+{
+    this->context()->callback_registry_.emit_file_transfer_hash_known(
+        &this->contact()->tegoUserId(),
+        id,
+        direction,
+        &hash);
+}
+
 QHash<int,QByteArray> ConversationModel::roleNames() const
 {
     QHash<int, QByteArray> roles;
@@ -559,11 +561,24 @@ QVariant ConversationModel::data(const QModelIndex &index, int role) const
 
 int ConversationModel::indexOfIdentifier(MessageId identifier, bool isOutgoing) const
 {
-    for (int i = 0; i < messages.size(); i++) {
-        if (messages[i].identifier == identifier && (messages[i].status != Received) == isOutgoing)
-            return i;
-    }
-    return -1;
+    return messageIndex.indexOf(identifier, isOutgoing);
+}
+
+void ConversationModel::insertMessage(int row, const MessageData &message)
+{
+    messages.insert(row, message);
+    messageIndex.insert(row, message.identifier, message.status != Received);
+}
+
+void ConversationModel::removeMessage(int row)
+{
+    messages.removeAt(row);
+    messageIndex.remove(row);
+}
+
+tego_context* ConversationModel::context() const
+{
+    return m_contact->identity->context;
 }
 
 void ConversationModel::prune()
@@ -572,7 +587,7 @@ void ConversationModel::prune()
     if (messages.size() > history_limit) {
         beginRemoveRows(QModelIndex(), history_limit, messages.size()-1);
         while (messages.size() > history_limit) {
-            messages.removeLast();
+            removeMessage(messages.size() - 1);
         }
         endRemoveRows();
     }
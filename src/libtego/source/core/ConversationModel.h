@@ -34,6 +34,7 @@
 #define CONVERSATIONMODEL_H
 
 #include "core/ContactUser.h"
+#include "core/MessageIndex.h"
 #include "protocol/ChatChannel.h"
 #include "protocol/FileChannel.h"
 
@@ -77,7 +78,8 @@ public:
     virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
 
-    std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> sendFile(const QString &file_url);
+    // if hashFile is false, the file is hashed as it is sent rather than up front and no hash is returned
+    std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> sendFile(const QString &file_url, bool hashFile);
     tego_message_id_t sendMessage(const QString &text);
 
     void acceptFile(tego_file_transfer_id_t id, const std::string& dest);
@@ -97,17 +99,19 @@ private slots:
     void sendQueuedMessages();
     void onContactStatusChanged();
 
-    void onFileTransferRequestReceived(tego_file_transfer_id_t id, const QString& filename, tego_file_size_t fileSize, tego_file_hash_t hash);
+    void onFileTransferRequestReceived(tego_file_transfer_id_t id, const QString& filename, tego_file_size_t fileSize, std::optional<tego_file_hash_t> hash);
     void onFileTransferAcknowledged(tego_file_transfer_id_t id, bool ack);
     void onFileTransferRequestResponded(tego_file_transfer_id_t id, tego_file_transfer_response_t response);
     void onFileTransferProgress(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, tego_file_size_t bytesTransmitted, tego_file_size_t bytesTotal);
     void onFileTransferFinished(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, tego_file_transfer_result_t result);
+    void onFileTransferHashKnown(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, const tego_file_hash_t& hash);
 
 private:
     struct MessageData {
         MessageType type;
         QString text;
-        tego_file_hash_t fileHash;
+        // empty for files hashed as they are sent
+        std::optional<tego_file_hash_t> fileHash;
         QDateTime time;
         MessageId identifier;
         MessageStatus status;
@@ -121,6 +125,8 @@ private:
 
     ContactUser *m_contact;
     QList<MessageData> messages;
+    // rows of messages by identifier and direction
+    MessageIndex messageIndex;
     int m_unreadCount;
 
     // The peer might use recent message IDs between connections to handle
@@ -128,7 +134,12 @@ private:
     MessageId lastMessageId;
 
     int indexOfIdentifier(MessageId identifier, bool isOutgoing) const;
+    // every change to messages goes through these to keep messageIndex in step
+    void insertMessage(int row, const MessageData &message);
+    void removeMessage(int row);
     void prune();
+    // the context of the identity our contact belongs to
+    struct tego_context *context() const;
 };
 
 #endif
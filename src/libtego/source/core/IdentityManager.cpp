@@ -37,8 +37,8 @@
 
 IdentityManager *identityManager = 0;
 
-IdentityManager::IdentityManager(const QString& serviceID, QObject *parent)
-    : QObject(parent), highestID(-1)
+IdentityManager::IdentityManager(tego_context* context, const QString& serviceID, QObject *parent)
+    : QObject(parent), m_context(context), highestID(-1)
 {
     identityManager = this;
 
@@ -48,13 +48,14 @@ IdentityManager::IdentityManager(const QString& serviceID, QObject *parent)
     }
     else
     {
-        addIdentity(new UserIdentity(0, serviceID, this));
+        addIdentity(new UserIdentity(0, m_context, serviceID, this));
     }
 }
 
 IdentityManager::~IdentityManager()
 {
-    identityManager = 0;
+    if (identityManager == this)
+        identityManager = 0;
 }
 
 void IdentityManager::addIdentity(UserIdentity *identity)
@@ -74,7 +75,7 @@ void IdentityManager::addIdentity(UserIdentity *identity)
 
 UserIdentity *IdentityManager::createIdentity()
 {
-    UserIdentity *identity = UserIdentity::createIdentity(++highestID);
+    UserIdentity *identity = UserIdentity::createIdentity(++highestID, m_context);
     if (!identity)
         return identity;
 
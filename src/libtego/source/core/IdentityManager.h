@@ -40,8 +40,9 @@ class IdentityManager : public QObject
     Q_DISABLE_COPY(IdentityManager)
 
 public:
+    // context : the tego_context this identity belongs to
     // serviceID : string ED25519-V3 keyblob pulled from config.json, or empty string to create one
-    explicit IdentityManager(const QString& serviceID, QObject *parent = 0);
+    IdentityManager(struct tego_context* context, const QString& serviceID, QObject *parent = 0);
     ~IdentityManager();
 
     const QList<class UserIdentity*> &identities() const { return m_identities; }
@@ -63,12 +64,14 @@ private slots:
     void onIncomingRequestRemoved(class IncomingContactRequest *request);
 
 private:
+    struct tego_context * const m_context;
     QList<class UserIdentity*> m_identities;
     int highestID;
 
     void addIdentity(class UserIdentity *identity);
 };
 
+// the most recently created IdentityManager
 extern class IdentityManager* identityManager;
 
 #endif // IDENTITYMANAGER_H
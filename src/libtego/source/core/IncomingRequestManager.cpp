@@ -66,11 +66,7 @@ IncomingRequestManager::IncomingRequestManager(ContactsManager *c)
 
         auto message = request->message().toUtf8();
 
-        const auto messageLength = static_cast<size_t>(message.size());
-        auto rawMessage = std::make_unique<char[]>(messageLength + 1);
-        std::copy(message.begin(), message.end(), rawMessage.get());
-
-        tego::g_globals.context->callback_registry_.emit_chat_request_received(userId.release(), rawMessage.release(), messageLength);
+        self->contacts->identity->context->callback_registry_.emit_chat_request_received(userId.get(), message.constData(), static_cast<size_t>(message.size()));
 
         logger::trace();
     });
@@ -143,7 +139,7 @@ void IncomingRequestManager::requestReceived()
         return;
     }
 
-    if (identityManager->lookupHostname(hostname)) {
+    if (tego::g_globals.is_local_hostname(hostname)) {
         qDebug() << "Rejecting contact request from a local identity (which shouldn't have been allowed)";
         channel->setResponseStatus(Response::Error);
         return;
@@ -191,6 +187,7 @@ void IncomingRequestManager::removeRequest(IncomingContactRequest *request)
 void IncomingRequestManager::addRejectedHost(const QByteArray &hostname)
 {
     this->rejectedHosts.insert(hostname);
+    emit rejectedHostsChanged();
 }
 
 bool IncomingRequestManager::isHostnameRejected(const QByteArray &hostname) const
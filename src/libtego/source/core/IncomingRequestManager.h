@@ -136,6 +136,7 @@ signals:
     void requestAdded(IncomingContactRequest *request);
     void requestRemoved(IncomingContactRequest *request);
     void requestsChanged();
+    void rejectedHostsChanged();
 
 private slots:
     void requestReceived();
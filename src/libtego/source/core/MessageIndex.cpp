@@ -0,0 +1,113 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "MessageIndex.h"
+
+quint64 MessageIndex::keyOf(quint32 identifier, bool isOutgoing)
+{
+    return (quint64(identifier) << 1) | (isOutgoing ? 1 : 0);
+}
+
+void MessageIndex::rehandle(int first, int last, qint64 delta)
+{
+    // a row's new handle is its neighbour's old one, so walk the rows in the
+    // order that moves each handle into a slot which was already vacated
+    const int count = last - first;
+    for (int i = 0; i < count; ++i) {
+        const int row = delta > 0 ? first + i : last - 1 - i;
+        const quint64 key = keys[row];
+        const qint64 handle = handleOf(row);
+        for (auto it = handles.find(key); it != handles.end() && it.key() == key; ++it) {
+            if (it.value() == handle) {
+                it.value() += delta;
+                break;
+            }
+        }
+    }
+}
+
+void MessageIndex::insert(int row, quint32 identifier, bool isOutgoing)
+{
+    Q_ASSERT(row >= 0 && row <= keys.size());
+
+    // move row 0's handle up, or the handles of everything below row down,
+    // whichever touches fewer rows
+    if (row <= keys.size() / 2) {
+        rehandle(0, row, 1);
+        ++topHandle;
+    } else {
+        rehandle(row, keys.size(), -1);
+    }
+
+    const quint64 key = keyOf(identifier, isOutgoing);
+    keys.insert(row, key);
+    handles.insert(key, handleOf(row));
+}
+
+void MessageIndex::remove(int row)
+{
+    Q_ASSERT(row >= 0 && row < keys.size());
+
+    const quint64 key = keys[row];
+    handles.remove(key, handleOf(row));
+
+    if (row < keys.size() / 2) {
+        rehandle(0, row, -1);
+        --topHandle;
+    } else {
+        rehandle(row + 1, keys.size(), 1);
+    }
+    keys.removeAt(row);
+}
+
+void MessageIndex::clear()
+{
+    keys.clear();
+    handles.clear();
+    topHandle = 0;
+}
+
+int MessageIndex::indexOf(quint32 identifier, bool isOutgoing) const
+{
+    const quint64 key = keyOf(identifier, isOutgoing);
+
+    // the newest message has the highest handle
+    auto it = handles.constFind(key);
+    if (it == handles.constEnd())
+        return -1;
+
+    qint64 handle = it.value();
+    for (++it; it != handles.constEnd() && it.key() == key; ++it)
+        handle = std::max(handle, it.value());
+
+    return int(topHandle - handle);
+}
@@ -0,0 +1,72 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MESSAGEINDEX_H
+#define MESSAGEINDEX_H
+
+/* Finds the row of a message by its identifier and direction
+ *
+ * Mirrors the rows of a conversation, newest first. Each message gets a
+ * handle when it is inserted, and a message's row is the handle of row 0
+ * minus its own, so inserting or removing a row only rehandles the rows on
+ * the shorter side of it. Conversations grow at the top and are pruned at the
+ * bottom, so that is rarely more than a few rows, and lookups are a single
+ * hash probe.
+ *
+ * Identifiers are only unique per direction, and a peer may reuse one across
+ * sessions; lookups find the newest message with a given identifier.
+ */
+class MessageIndex
+{
+public:
+    void insert(int row, quint32 identifier, bool isOutgoing);
+    void remove(int row);
+    void clear();
+
+    // -1 if there is no such message
+    int indexOf(quint32 identifier, bool isOutgoing) const;
+    int size() const { return keys.size(); }
+
+private:
+    static quint64 keyOf(quint32 identifier, bool isOutgoing);
+    qint64 handleOf(int row) const { return topHandle - row; }
+    // adds delta to the handles of rows [first, last)
+    void rehandle(int first, int last, qint64 delta);
+
+    // the key of each row
+    QList<quint64> keys;
+    // every row's handle by key; a key only has several while a peer reuses identifiers
+    QMultiHash<quint64, qint64> handles;
+    qint64 topHandle = 0;
+};
+
+#endif // MESSAGEINDEX_H
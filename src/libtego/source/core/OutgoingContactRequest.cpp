@@ -41,7 +41,6 @@
 #include "ed25519.hpp"
 #include "context.hpp"
 #include "user.hpp"
-#include "globals.hpp"
 
 OutgoingContactRequest *OutgoingContactRequest::createNewRequest(ContactUser *user, const QString &message)
 {
@@ -83,16 +82,9 @@ void OutgoingContactRequest::setStatus(Status newStatus)
 
     if (m_status == Accepted || m_status == Error || m_status == Rejected)
     {
-        // convert our hostname to just the service id raw string
-        auto serviceIdString = user->hostname().chopped(tego::static_strlen(".onion")).toUtf8();
-        // ensure valid service id
-        auto serviceId = std::make_unique<tego_v3_onion_service_id>(serviceIdString.data(), serviceIdString.size());
-        // create user id object from service id
-        auto userId = std::make_unique<tego_user_id>(*serviceId.get());
-
         tego_bool_t requestAccepted = ((m_status == Accepted) ? TEGO_TRUE : TEGO_FALSE);
 
-        tego::g_globals.context->callback_registry_.emit_chat_request_response_received(userId.release(), requestAccepted);
+        user->identity->context->callback_registry_.emit_chat_request_response_received(&user->tegoUserId(), requestAccepted);
     }
 
     emit statusChanged(newStatus, oldStatus);
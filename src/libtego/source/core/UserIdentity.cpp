@@ -33,9 +33,6 @@
 #include "signals.hpp"
 #include "context.hpp"
 #include "ed25519.hpp"
-#include "globals.hpp"
-
-using tego::g_globals;
 
 #include "UserIdentity.h"
 #include "tor/TorControl.h"
@@ -47,9 +44,10 @@ using tego::g_globals;
 
 using namespace Protocol;
 
-UserIdentity::UserIdentity(int id, const QString& serviceID, QObject *parent)
+UserIdentity::UserIdentity(int id, tego_context *ctx, const QString& serviceID, QObject *parent)
     : QObject(parent)
     , uniqueID(id)
+    , context(ctx)
     , contacts(this)
     , m_hiddenService(0)
     , m_incomingServer(0)
@@ -57,20 +55,20 @@ UserIdentity::UserIdentity(int id, const QString& serviceID, QObject *parent)
     setupService(serviceID);
 }
 
-UserIdentity *UserIdentity::createIdentity(int uniqueID)
+UserIdentity *UserIdentity::createIdentity(int uniqueID, tego_context *context)
 {
     // There is actually no support for multiple identities currently.
     Q_ASSERT(uniqueID == 0);
     if (uniqueID != 0)
         return 0;
 
-    return new UserIdentity(uniqueID, "", {});
+    return new UserIdentity(uniqueID, context, "", {});
 }
 
 // TODO: Handle the error cases of this function in a useful way
 void UserIdentity::setupService(const QString& serviceID)
 {
-    g_globals.context->set_host_user_state(tego_host_user_state_offline);
+    this->context->set_host_user_state(tego_host_user_state_offline);
 
     QString keyData = serviceID;
 
@@ -96,15 +94,16 @@ void UserIdentity::setupService(const QString& serviceID)
                     rawKey.size(),
                     tego::throw_on_error());
 
-                g_globals.context->callback_registry_.emit_new_identity_created(privateKey.release());
+                this->context->callback_registry_.emit_new_identity_created(privateKey.get());
             }
         );
     }
 
-    g_globals.context->set_host_user_state(tego_host_user_state_connecting);
+    this->context->set_host_user_state(tego_host_user_state_connecting);
 
     Q_ASSERT(m_hiddenService);
     connect(m_hiddenService, SIGNAL(statusChanged(int,int)), SLOT(onStatusChanged(int,int)));
+    connect(this->context->torControl, &Tor::TorControl::connectivityChanged, this, &UserIdentity::updateHostUserState);
 
     // Generally, these are not used, and we bind to localhost and port 0
     // for an automatic (and portable) selection.
@@ -121,7 +120,7 @@ void UserIdentity::setupService(const QString& serviceID)
     connect(m_incomingServer, &QTcpServer::newConnection, this, &UserIdentity::onIncomingConnection);
 
     m_hiddenService->addTarget(9878, m_incomingServer->serverAddress(), m_incomingServer->serverPort());
-    g_globals.context->torControl->addHiddenService(m_hiddenService);
+    this->context->torControl->addHiddenService(m_hiddenService);
 }
 
 QString UserIdentity::hostname() const
@@ -141,6 +140,16 @@ void UserIdentity::onStatusChanged(int newStatus, int oldStatus)
         emit contactIDChanged();
     }
     emit statusChanged();
+    updateHostUserState();
+}
+
+void UserIdentity::updateHostUserState()
+{
+    // tor is shared with other contexts, but only our own service decides whether we are online
+    if (isServiceOnline() && this->context->torControl->hasConnectivity())
+        this->context->set_host_user_state(tego_host_user_state_online);
+    else if (this->context->get_host_user_state() == tego_host_user_state_online)
+        this->context->set_host_user_state(tego_host_user_state_connecting);
 }
 
 bool UserIdentity::isServiceOnline() const
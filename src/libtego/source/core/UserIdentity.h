@@ -64,9 +64,11 @@ class UserIdentity : public QObject
     friend class IdentityManager;
 public:
     const int uniqueID;
+    // the context this identity belongs to, and reports its events through
+    struct tego_context * const context;
     ContactsManager contacts;
 
-    explicit UserIdentity(int uniqueID, const QString& serviceID, QObject *parent = 0);
+    UserIdentity(int uniqueID, struct tego_context *context, const QString& serviceID, QObject *parent = 0);
 
     /* Properties */
     int getUniqueID() const { return uniqueID; }
@@ -92,13 +94,14 @@ signals:
 private slots:
     void onStatusChanged(int newStatus, int oldStatus);
     void onIncomingConnection();
+    void updateHostUserState();
 
 private:
     Tor::HiddenService *m_hiddenService;
     QTcpServer *m_incomingServer;
     QVector<QSharedPointer<Protocol::Connection>> m_incomingConnections;
 
-    static UserIdentity *createIdentity(int uniqueID);
+    static UserIdentity *createIdentity(int uniqueID, struct tego_context *context);
 
     void handleIncomingAuthedConnection(Protocol::Connection *connection);
     void setupService(const QString& serviceID);
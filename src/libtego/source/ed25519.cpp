@@ -9,18 +9,6 @@ constexpr size_t TEGO_ED25519_KEYBLOB_HEADER_LENGTH = tego::static_strlen(TEGO_E
 constexpr size_t TEGO_ED25519_KEYBLOB_BASE64_LENGTH = 88;
 // number of bytes needed to encode KeyBlob including the null terminator
 constexpr size_t TEGO_ED25519_KEYBLOB_BASE64_SIZE = TEGO_ED25519_KEYBLOB_BASE64_LENGTH + 1;
-// number of bytes the base32 encoded service id string decodes to
-constexpr size_t TEGO_V3_ONION_SERVICE_ID_RAW_SIZE = 35;
-// offset to public key in raw service id
-constexpr size_t TEGO_V3_ONION_SERVICE_ID_PUBLIC_KEY_OFFSET = 0;
-// length of public key in raw service id
-constexpr size_t TEGO_V3_ONION_SERVICE_ID_PUBLIC_KEY_SIZE = 32;
-// offset to checksum in raw service id
-constexpr size_t TEGO_V3_ONION_SERVICE_ID_CHECKSUM_OFFSET = 32;
-// length of checksum in raw service id
-constexpr size_t TEGO_V3_ONION_SERVICE_ID_CHECKSUM_SIZE = 2;
-// offset to version (which should be 0x03) in raw service id
-constexpr size_t TEGO_V3_ONION_SERVICE_ID_VERSION_OFFSET = 34;
 // prefix used when calculating service id checksum
 #define TEGO_V3_ONION_SERVICE_ID_CHECKSUM_SRC_PREFIX ".onion checksum"
 // length of service id prefix not including null terminator
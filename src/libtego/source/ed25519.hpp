@@ -2,6 +2,19 @@
 
 static_assert(ED25519_SIG_LEN == TEGO_ED25519_SIGNATURE_SIZE);
 
+// number of bytes the base32 encoded service id string decodes to
+constexpr size_t TEGO_V3_ONION_SERVICE_ID_RAW_SIZE = 35;
+// offset to public key in raw service id
+constexpr size_t TEGO_V3_ONION_SERVICE_ID_PUBLIC_KEY_OFFSET = 0;
+// length of public key in raw service id
+constexpr size_t TEGO_V3_ONION_SERVICE_ID_PUBLIC_KEY_SIZE = 32;
+// offset to checksum in raw service id
+constexpr size_t TEGO_V3_ONION_SERVICE_ID_CHECKSUM_OFFSET = 32;
+// length of checksum in raw service id
+constexpr size_t TEGO_V3_ONION_SERVICE_ID_CHECKSUM_SIZE = 2;
+// offset to version (which should be 0x03) in raw service id
+constexpr size_t TEGO_V3_ONION_SERVICE_ID_VERSION_OFFSET = 34;
+
 struct tego_ed25519_private_key
 {
     uint8_t data[ED25519_SECKEY_LEN] = {0};
@@ -1,19 +1,6 @@
 #include "file_hash.hpp"
 #include "error.hpp"
 
-// implements deleter for openssl's EVP_MD_CTX
-namespace std
-{
-    template<> class default_delete<::EVP_MD_CTX>
-    {
-    public:
-        void operator()(EVP_MD_CTX* val)
-        {
-            ::EVP_MD_CTX_free(val);
-        }
-    };
-}
-
 tego_file_hash::tego_file_hash()
 {
     TEGO_THROW_IF_FALSE(static_cast<size_t>(EVP_MD_size(EVP_sha3_512())) == data.size());
@@ -24,25 +11,15 @@ tego_file_hash::tego_file_hash()
 tego_file_hash::tego_file_hash(uint8_t const* begin, uint8_t const* end)
 : tego_file_hash()
 {
-    // init sha3 512 algo
-    std::unique_ptr<::EVP_MD_CTX> ctx(EVP_MD_CTX_new());
-    EVP_DigestInit_ex(ctx.get(), EVP_sha3_512(), nullptr);
-
-    // calc hash
-    EVP_DigestUpdate(ctx.get(), begin, end - begin);
-
-    // copy hash to our local buffer
-    uint32_t hashSize = 0;
-    EVP_DigestFinal_ex(ctx.get(), data.begin(), &hashSize);
-    TEGO_THROW_IF_FALSE(hashSize == this->DIGEST_SIZE);
+    tego_file_hasher hasher;
+    hasher.update(begin, end);
+    *this = hasher.finalize();
 }
 
 tego_file_hash::tego_file_hash(std::istream& stream)
 : tego_file_hash()
 {
-    // init sha3 512 algo
-    std::unique_ptr<::EVP_MD_CTX> ctx(EVP_MD_CTX_new());
-    EVP_DigestInit_ex(ctx.get(), EVP_sha3_512(), nullptr);
+    tego_file_hasher hasher;
 
     // alloc a temp 64k buffer to read bytes into
     constexpr size_t BLOCK_SIZE = 65536;
@@ -57,13 +34,109 @@ tego_file_hash::tego_file_hash(std::istream& stream)
         TEGO_THROW_IF_FALSE_MSG(bytesRead <= BLOCK_SIZE, "Invalid amount of bytes read");
 
         // hash the block
-        EVP_DigestUpdate(ctx.get(), buffer.get(), bytesRead);
+        hasher.update(buffer.get(), buffer.get() + bytesRead);
     }
 
-    // copy hash to our local buffer
-    uint32_t hashSize = 0;
-    EVP_DigestFinal_ex(ctx.get(), data.begin(), &hashSize);
-    TEGO_THROW_IF_FALSE(hashSize == this->DIGEST_SIZE);
+    *this = hasher.finalize();
+}
+
+namespace
+{
+    // calls process() over bytes [offset, offset + size) of the file at path, in order; every
+    // block but the last is a multiple of alignment. The file is mapped a large window at a
+    // time where possible, and otherwise read in smaller blocks.
+    bool for_each_file_block(
+        const std::string& path,
+        tego_file_size_t offset,
+        tego_file_size_t size,
+        tego_file_size_t alignment,
+        const std::function<void(uint8_t const*, uint8_t const*)>& process)
+    {
+        QFile file(QString::fromStdString(path));
+        if (!file.open(QIODevice::ReadOnly) ||
+            offset + size > static_cast<tego_file_size_t>(file.size()))
+        {
+            return false;
+        }
+
+        // ~64 MiB windows keep address space use modest on 32-bit builds, ~4 MiB reads
+        // keep the fallback's buffer small
+        const auto windowSize = alignment * 1024;
+        const auto readSize = alignment * 64;
+        std::vector<uint8_t> buffer;
+
+        const auto end = offset + size;
+        for (auto position = offset; position < end;)
+        {
+            const auto windowLength = std::min(windowSize, end - position);
+            if (auto view = file.map(static_cast<qint64>(position), static_cast<qint64>(windowLength)); view != nullptr)
+            {
+                process(view, view + windowLength);
+                file.unmap(view);
+                position += windowLength;
+                continue;
+            }
+
+            // not every file can be mapped (eg on some network filesystems), so read it instead
+            const auto readLength = std::min(readSize, end - position);
+            buffer.resize(static_cast<size_t>(readLength));
+            if (!file.seek(static_cast<qint64>(position)) ||
+                file.read(reinterpret_cast<char*>(buffer.data()), static_cast<qint64>(readLength)) != static_cast<qint64>(readLength))
+            {
+                return false;
+            }
+            process(buffer.data(), buffer.data() + readLength);
+            position += readLength;
+        }
+        return true;
+    }
+}
+
+tego_file_hash tego_file_hash::from_file(const std::string& path)
+{
+    const auto size = QFileInfo(QString::fromStdString(path)).size();
+    TEGO_THROW_IF_FALSE_MSG(size >= 0, "Failed to read file for hashing");
+
+    tego_file_hasher hasher;
+    const auto succeeded = for_each_file_block(path, 0, static_cast<tego_file_size_t>(size), 64 * 1024, [&](uint8_t const* begin, uint8_t const* end)
+    {
+        hasher.update(begin, end);
+    });
+    TEGO_THROW_IF_FALSE_MSG(succeeded, "Failed to read file for hashing");
+
+    return hasher.finalize();
+}
+
+std::vector<std::optional<tego_file_hash>> tego_file_hash::from_files(const std::vector<std::string>& paths, size_t threadCount)
+{
+    std::vector<std::optional<tego_file_hash>> hashes(paths.size());
+
+    // each thread takes the next unhashed file until there are none left
+    std::atomic<size_t> next = 0;
+    auto hashFiles = [&]()
+    {
+        for (auto i = next++; i < paths.size(); i = next++)
+        {
+            try
+            {
+                hashes[i] = from_file(paths[i]);
+            }
+            catch(...) {}
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min(std::max<size_t>(threadCount, 1), paths.size()); ++t)
+    {
+        threads.emplace_back(hashFiles);
+    }
+    hashFiles();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    return hashes;
 }
 
 constexpr size_t tego_file_hash::string_size() const
@@ -85,6 +158,436 @@ const std::string& tego_file_hash::to_string() const
     return hex;
 }
 
+//
+// Tego File Hasher
+//
+
+tego_file_hasher::tego_file_hasher()
+: ctx_(EVP_MD_CTX_new())
+{
+    TEGO_THROW_IF_NULL(ctx_);
+
+    // init sha3 512 algo
+    TEGO_THROW_IF_FALSE(EVP_DigestInit_ex(ctx_.get(), EVP_sha3_512(), nullptr) == 1);
+}
+
+tego_file_hasher::tego_file_hasher(const tego_file_hasher& that)
+: ctx_(EVP_MD_CTX_new())
+{
+    TEGO_THROW_IF_NULL(ctx_);
+    TEGO_THROW_IF_NULL(that.ctx_);
+
+    TEGO_THROW_IF_FALSE(EVP_MD_CTX_copy_ex(ctx_.get(), that.ctx_.get()) == 1);
+}
+
+void tego_file_hasher::update(uint8_t const* begin, uint8_t const* end)
+{
+    TEGO_THROW_IF_NULL(ctx_);
+    TEGO_THROW_IF_FALSE(begin <= end);
+
+    EVP_DigestUpdate(ctx_.get(), begin, end - begin);
+}
+
+void tego_file_hasher::update(char const* begin, char const* end)
+{
+    update(reinterpret_cast<uint8_t const*>(begin), reinterpret_cast<uint8_t const*>(end));
+}
+
+tego_file_hash tego_file_hasher::finalize()
+{
+    TEGO_THROW_IF_NULL(ctx_);
+
+    // copy hash to our local buffer
+    tego_file_hash retval;
+    uint32_t hashSize = 0;
+    EVP_DigestFinal_ex(ctx_.get(), retval.data.begin(), &hashSize);
+    TEGO_THROW_IF_FALSE(hashSize == tego_file_hash::DIGEST_SIZE);
+
+    // the context can't be reused after being finalized
+    ctx_.reset();
+
+    return retval;
+}
+
+//
+// Tego File Hash Tree
+//
+
+namespace
+{
+    // prefixed to the hashed data so leaves and interior nodes can never collide
+    constexpr uint8_t LEAF_PREFIX = 0x00;
+    constexpr uint8_t NODE_PREFIX = 0x01;
+}
+
+std::vector<size_t> tego_file_hash_tree::level_sizes(tego_file_size_t size)
+{
+    // an empty file still has a single (empty) leaf
+    std::vector<size_t> sizes = {std::max<size_t>(1, static_cast<size_t>((size + LEAF_SIZE - 1) / LEAF_SIZE))};
+    while (sizes.back() > 1)
+    {
+        sizes.push_back((sizes.back() + FANOUT - 1) / FANOUT);
+    }
+    return sizes;
+}
+
+tego_file_hash_tree tego_file_hash_tree::from_file(const std::string& path, tego_file_size_t size, size_t threadCount)
+{
+    tego_file_hash_tree tree;
+    const auto sizes = level_sizes(size);
+    const auto leafCount = sizes.front();
+
+    std::vector<tego_file_hash> leaves(leafCount);
+
+    // each thread hashes its own contiguous run of leaves, reading that part of the
+    // file itself; small files aren't worth the thread startup
+    constexpr size_t MIN_LEAVES_PER_THREAD = 64;
+    threadCount = std::clamp<size_t>(leafCount / MIN_LEAVES_PER_THREAD, 1, std::max<size_t>(threadCount, 1));
+    const auto leavesPerThread = (leafCount + threadCount - 1) / threadCount;
+
+    auto hashLeaves = [&](size_t first, size_t last) -> bool
+    {
+        if (first == last)
+        {
+            return true;
+        }
+
+        // blocks are whole numbers of leaves, apart from the file's final leaf
+        auto leaf = first;
+        const auto offset = first * LEAF_SIZE;
+        const auto length = std::min<tego_file_size_t>(last * LEAF_SIZE, size) - offset;
+        return for_each_file_block(path, offset, length, LEAF_SIZE, [&](uint8_t const* begin, uint8_t const* end)
+        {
+            while (begin < end)
+            {
+                const auto leafEnd = static_cast<tego_file_size_t>(end - begin) > LEAF_SIZE ? begin + LEAF_SIZE : end;
+                leaves[leaf++] = leaf_hash(begin, leafEnd);
+                begin = leafEnd;
+            }
+        });
+    };
+
+    // an empty file has nothing to read, but still has its one empty leaf
+    if (size == 0)
+    {
+        leaves[0] = leaf_hash(nullptr, nullptr);
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<char> succeeded(threadCount, false);
+    for (size_t t = 1; t < threadCount; ++t)
+    {
+        const auto first = std::min(t * leavesPerThread, leafCount);
+        const auto last = std::min(first + leavesPerThread, leafCount);
+        threads.emplace_back([&, t, first, last]() { succeeded[t] = hashLeaves(first, last); });
+    }
+    // this thread takes the first run
+    succeeded[0] = hashLeaves(0, std::min(leavesPerThread, leafCount));
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    TEGO_THROW_IF_FALSE_MSG(std::all_of(succeeded.begin(), succeeded.end(), [](char s) { return s; }), "Failed to read file for hashing");
+
+    // then build up each level from the one below
+    tree.levels_.resize(sizes.size());
+    tree.levels_[0].assign(leaves.begin(), leaves.end());
+    for (size_t level = 1; level < sizes.size(); ++level)
+    {
+        const auto& below = tree.levels_[level - 1];
+        auto& nodes = tree.levels_[level];
+        nodes.reserve(sizes[level]);
+
+        std::vector<tego_file_hash> children;
+        for (size_t index = 0; index < sizes[level]; ++index)
+        {
+            children.clear();
+            const auto first = tree.first_child(index);
+            for (auto i = first; i < first + tree.child_count(level, index); ++i)
+            {
+                children.push_back(*below[i]);
+            }
+            nodes.push_back(node_hash(children.data(), children.data() + children.size()));
+        }
+    }
+
+    return tree;
+}
+
+tego_file_hash_tree::tego_file_hash_tree(tego_file_size_t size, const tego_file_hash& root)
+{
+    const auto sizes = level_sizes(size);
+    levels_.resize(sizes.size());
+    for (size_t level = 0; level < sizes.size(); ++level)
+    {
+        levels_[level].resize(sizes[level]);
+    }
+    levels_.back().front() = root;
+}
+
+tego_file_hash tego_file_hash_tree::leaf_hash(uint8_t const* begin, uint8_t const* end)
+{
+    tego_file_hasher hasher;
+    hasher.update(&LEAF_PREFIX, &LEAF_PREFIX + 1);
+    hasher.update(begin, end);
+    return hasher.finalize();
+}
+
+tego_file_hash tego_file_hash_tree::node_hash(tego_file_hash const* begin, tego_file_hash const* end)
+{
+    tego_file_hasher hasher;
+    hasher.update(&NODE_PREFIX, &NODE_PREFIX + 1);
+    for (auto it = begin; it != end; ++it)
+    {
+        hasher.update(it->data.data(), it->data.data() + it->data.size());
+    }
+    return hasher.finalize();
+}
+
+const tego_file_hash& tego_file_hash_tree::root() const
+{
+    return *levels_.back().front();
+}
+
+size_t tego_file_hash_tree::height() const
+{
+    return levels_.size();
+}
+
+size_t tego_file_hash_tree::level_size(size_t level) const
+{
+    TEGO_THROW_IF_FALSE(level < levels_.size());
+    return levels_[level].size();
+}
+
+const std::optional<tego_file_hash>& tego_file_hash_tree::node(size_t level, size_t index) const
+{
+    TEGO_THROW_IF_FALSE(level < levels_.size() && index < levels_[level].size());
+    return levels_[level][index];
+}
+
+size_t tego_file_hash_tree::first_child(size_t index) const
+{
+    return index * FANOUT;
+}
+
+size_t tego_file_hash_tree::child_count(size_t level, size_t index) const
+{
+    TEGO_THROW_IF_FALSE(level > 0 && level < levels_.size() && index < levels_[level].size());
+    return std::min(FANOUT, levels_[level - 1].size() - first_child(index));
+}
+
+bool tego_file_hash_tree::add_children(size_t level, size_t index, std::vector<tego_file_hash>&& children)
+{
+    const auto& parent = node(level, index);
+    if (!parent.has_value() ||
+        children.size() != child_count(level, index) ||
+        node_hash(children.data(), children.data() + children.size()).data != parent->data)
+    {
+        return false;
+    }
+
+    auto& below = levels_[level - 1];
+    std::move(children.begin(), children.end(), below.begin() + first_child(index));
+    return true;
+}
+
+bool tego_file_hash_tree::verify_leaf(size_t index, uint8_t const* begin, uint8_t const* end) const
+{
+    const auto& leaf = node(0, index);
+    TEGO_THROW_IF_FALSE(leaf.has_value());
+    return leaf_hash(begin, end).data == leaf->data;
+}
+
+bool tego_file_hash_tree::verify_leaf(size_t index, char const* begin, char const* end) const
+{
+    return verify_leaf(index, reinterpret_cast<uint8_t const*>(begin), reinterpret_cast<uint8_t const*>(end));
+}
+
+//
+// Tego File Hash Cache
+//
+
+tego_file_hash_cache::tego_file_hash_cache(const std::string& cachePath)
+: cachePath_(QString::fromStdString(cachePath))
+{
+    load();
+}
+
+std::optional<tego_file_hash> tego_file_hash_cache::lookup(const std::string& path) const
+{
+    const auto canonicalPath = QFileInfo(QString::fromStdString(path)).canonicalFilePath();
+    if (canonicalPath.isEmpty())
+    {
+        return std::nullopt;
+    }
+    const auto identity = identify(canonicalPath);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(canonicalPath);
+    if (it == entries_.end() || !identity || it->identity != *identity)
+    {
+        return std::nullopt;
+    }
+    it->lastUsed = QDateTime::currentMSecsSinceEpoch();
+    return it->hash;
+}
+
+tego_file_hash tego_file_hash_cache::hash_file(const std::string& path)
+{
+    if (auto hash = lookup(path); hash)
+    {
+        return *hash;
+    }
+
+    const auto canonicalPath = QFileInfo(QString::fromStdString(path)).canonicalFilePath();
+    const auto before = canonicalPath.isEmpty() ? std::nullopt : identify(canonicalPath);
+    auto hash = tego_file_hash::from_file(path);
+
+    // only remember the hash if the file wasn't modified while we were reading it
+    if (before && before == identify(canonicalPath))
+    {
+        insert(canonicalPath, *before, hash);
+    }
+    return hash;
+}
+
+std::optional<tego_file_hash_cache::file_identity> tego_file_hash_cache::identify(const QString& canonicalPath)
+{
+    QFileInfo info(canonicalPath);
+    if (!info.isFile())
+    {
+        return std::nullopt;
+    }
+
+    file_identity identity;
+    identity.size = static_cast<tego_file_size_t>(info.size());
+    identity.modified = info.lastModified().toMSecsSinceEpoch();
+
+    // QFileInfo can't tell us whether the path now refers to a different file, which
+    // eg replacing a file with one of the same size and timestamp would hide
+#ifdef Q_OS_WIN
+    auto handle = ::CreateFileW(
+        reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(canonicalPath).utf16()),
+        0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return std::nullopt;
+    }
+    BY_HANDLE_FILE_INFORMATION fileInfo = {};
+    const auto succeeded = ::GetFileInformationByHandle(handle, &fileInfo);
+    ::CloseHandle(handle);
+    if (!succeeded)
+    {
+        return std::nullopt;
+    }
+    identity.device = fileInfo.dwVolumeSerialNumber;
+    identity.inode = (static_cast<quint64>(fileInfo.nFileIndexHigh) << 32) | fileInfo.nFileIndexLow;
+#else
+    struct stat st = {};
+    if (::stat(QFile::encodeName(canonicalPath).constData(), &st) != 0)
+    {
+        return std::nullopt;
+    }
+    identity.device = static_cast<quint64>(st.st_dev);
+    identity.inode = static_cast<quint64>(st.st_ino);
+#endif
+
+    return identity;
+}
+
+void tego_file_hash_cache::insert(const QString& canonicalPath, const file_identity& identity, const tego_file_hash& hash)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!entries_.contains(canonicalPath) && static_cast<size_t>(entries_.size()) >= MAX_ENTRIES)
+    {
+        // evict whichever file we have gone longest without sending
+        auto oldest = std::min_element(entries_.begin(), entries_.end(), [](const entry& left, const entry& right)
+        {
+            return left.lastUsed < right.lastUsed;
+        });
+        entries_.erase(oldest);
+    }
+    entries_.insert(canonicalPath, {identity, hash, QDateTime::currentMSecsSinceEpoch()});
+
+    save();
+}
+
+void tego_file_hash_cache::load()
+{
+    QFile file(cachePath_);
+    if (!file.exists())
+    {
+        return;
+    }
+    else if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Failed to open file hash cache" << cachePath_ << ":" << file.errorString();
+        return;
+    }
+
+    QJsonParseError error;
+    const auto document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (!document.isObject())
+    {
+        // a stale cache only costs us a re-hash, so start over rather than fail
+        qWarning() << "Ignoring corrupt file hash cache" << cachePath_ << ":" << error.errorString();
+        return;
+    }
+
+    const auto root = document.object();
+    for (auto it = root.begin(); it != root.end(); ++it)
+    {
+        const auto value = it.value().toObject();
+        const auto hashBytes = QByteArray::fromHex(value.value(QStringLiteral("hash")).toString().toLatin1());
+        if (static_cast<size_t>(hashBytes.size()) != tego_file_hash::DIGEST_SIZE)
+        {
+            continue;
+        }
+
+        entry e;
+        std::copy(hashBytes.begin(), hashBytes.end(), e.hash.data.begin());
+        // 64-bit values are stored as strings, json numbers are doubles
+        e.identity.size = value.value(QStringLiteral("size")).toString().toULongLong();
+        e.identity.modified = value.value(QStringLiteral("modified")).toString().toLongLong();
+        e.identity.device = value.value(QStringLiteral("device")).toString().toULongLong();
+        e.identity.inode = value.value(QStringLiteral("inode")).toString().toULongLong();
+        e.lastUsed = value.value(QStringLiteral("lastUsed")).toString().toLongLong();
+        entries_.insert(it.key(), std::move(e));
+    }
+}
+
+void tego_file_hash_cache::save() const
+{
+    QJsonObject root;
+    for (auto it = entries_.cbegin(); it != entries_.cend(); ++it)
+    {
+        const auto& e = it.value();
+        QJsonObject value;
+        value.insert(QStringLiteral("hash"), QString::fromStdString(e.hash.to_string()));
+        value.insert(QStringLiteral("size"), QString::number(e.identity.size));
+        value.insert(QStringLiteral("modified"), QString::number(e.identity.modified));
+        value.insert(QStringLiteral("device"), QString::number(e.identity.device));
+        value.insert(QStringLiteral("inode"), QString::number(e.identity.inode));
+        value.insert(QStringLiteral("lastUsed"), QString::number(e.lastUsed));
+        root.insert(it.key(), value);
+    }
+
+    QSaveFile file(cachePath_);
+    if (!file.open(QIODevice::WriteOnly) ||
+        file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) < 0 ||
+        !file.commit())
+    {
+        qWarning() << "Failed to write file hash cache" << cachePath_ << ":" << file.errorString();
+    }
+}
+
 extern "C"
 {
     size_t tego_file_hash_string_size(
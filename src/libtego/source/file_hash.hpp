@@ -1,5 +1,18 @@
 #pragma once
 
+// implements deleter for openssl's EVP_MD_CTX
+namespace std
+{
+    template<> class default_delete<::EVP_MD_CTX>
+    {
+    public:
+        void operator()(EVP_MD_CTX* val)
+        {
+            ::EVP_MD_CTX_free(val);
+        }
+    };
+}
+
 //
 // Tego File Hash
 //
@@ -12,6 +25,13 @@ struct tego_file_hash
     // hash en entire stream, reads bytes into blocks and incrementally hashes
     tego_file_hash(std::istream& stream);
 
+    // hash a file on disk, reading it through large memory mapped views where possible
+    // rather than copying it through iostream buffers; throws if it can't be read
+    static tego_file_hash from_file(const std::string& path);
+    // hash several files at once, each on its own thread with up to threadCount running
+    // at a time; files which couldn't be read are left empty
+    static std::vector<std::optional<tego_file_hash>> from_files(const std::vector<std::string>& paths, size_t threadCount);
+
     constexpr size_t string_size() const;
     const std::string& to_string() const;
 
@@ -23,4 +43,125 @@ struct tego_file_hash
     constexpr static size_t STRING_SIZE = STRING_LENGTH + 1;
     std::array<uint8_t, DIGEST_SIZE> data;
     mutable std::string hex;
-};
\ No newline at end of file
+};
+
+//
+// Tego File Hasher
+//
+
+// incrementally hashes a file as its bytes become available (eg as
+// chunks arrive over the network) so the file never needs to be re-read
+class tego_file_hasher
+{
+public:
+    tego_file_hasher();
+    // copies carry on from the same state independently, eg to get the digest of what has
+    // been hashed so far without finalizing the original
+    tego_file_hasher(const tego_file_hasher&);
+    tego_file_hasher(tego_file_hasher&&) = default;
+    tego_file_hasher& operator=(tego_file_hasher&&) = default;
+
+    void update(uint8_t const* begin, uint8_t const* end);
+    void update(char const* begin, char const* end);
+    // may only be called once, no further updates are allowed afterwards
+    tego_file_hash finalize();
+private:
+    std::unique_ptr<::EVP_MD_CTX> ctx_;
+};
+
+//
+// Tego File Hash Tree
+//
+
+// Merkle tree over a file's fixed size leaves (one FileChannel chunk each), with every
+// interior node hashing up to FANOUT children. Given a trusted root, each leaf can be
+// checked as soon as the nodes above it are known rather than only once the whole file
+// has been hashed. Leaf and interior node hashes are domain separated so a leaf can
+// never be mistaken for a node.
+class tego_file_hash_tree
+{
+public:
+    constexpr static tego_file_size_t LEAF_SIZE = 63 * 1024;
+    constexpr static size_t FANOUT = 512;
+
+    // build the complete tree of the first size bytes of the file at path, hashing
+    // leaves on up to threadCount threads; throws if the file can't be read
+    static tego_file_hash_tree from_file(const std::string& path, tego_file_size_t size, size_t threadCount);
+
+    // a tree for a file of the given size where only the root is known, the
+    // rest gets filled in as the nodes and leaves are verified
+    tego_file_hash_tree(tego_file_size_t size, const tego_file_hash& root);
+
+    static tego_file_hash leaf_hash(uint8_t const* begin, uint8_t const* end);
+    static tego_file_hash node_hash(tego_file_hash const* begin, tego_file_hash const* end);
+
+    const tego_file_hash& root() const;
+    // level 0 holds the leaves, the last level holds only the root
+    size_t height() const;
+    size_t level_size(size_t level) const;
+    // the node at level and index, if it has been verified
+    const std::optional<tego_file_hash>& node(size_t level, size_t index) const;
+    // index of the first child below the given node, and how many children it has
+    size_t first_child(size_t index) const;
+    size_t child_count(size_t level, size_t index) const;
+
+    // store the children of a verified node, returns false if they do not hash to it
+    bool add_children(size_t level, size_t index, std::vector<tego_file_hash>&& children);
+    // returns true if the given bytes hash to the leaf at index, which must be verified
+    bool verify_leaf(size_t index, uint8_t const* begin, uint8_t const* end) const;
+    bool verify_leaf(size_t index, char const* begin, char const* end) const;
+
+private:
+    tego_file_hash_tree() = default;
+    static std::vector<size_t> level_sizes(tego_file_size_t size);
+
+    std::vector<std::vector<std::optional<tego_file_hash>>> levels_;
+};
+
+//
+// Tego File Hash Cache
+//
+
+// remembers the hashes of files we have already sent so re-sending a large file (eg to
+// several contacts) needn't read it all over again. Entries are keyed by canonical path
+// and only used while the file's size, modification time and inode are unchanged. The
+// cache is persisted as json at the given path, and may be used from any thread.
+class tego_file_hash_cache
+{
+public:
+    constexpr static size_t MAX_ENTRIES = 4096;
+
+    explicit tego_file_hash_cache(const std::string& cachePath);
+
+    // the cached hash of the file at path, if it hasn't changed since it was hashed
+    std::optional<tego_file_hash> lookup(const std::string& path) const;
+    // the cached hash if there is one, otherwise hashes the file and remembers the
+    // result; throws if the file can't be read
+    tego_file_hash hash_file(const std::string& path);
+
+private:
+    struct file_identity
+    {
+        tego_file_size_t size = 0;
+        qint64 modified = 0;
+        quint64 device = 0;
+        quint64 inode = 0;
+
+        bool operator==(const file_identity&) const = default;
+    };
+    struct entry
+    {
+        file_identity identity;
+        tego_file_hash hash;
+        qint64 lastUsed = 0;
+    };
+
+    static std::optional<file_identity> identify(const QString& canonicalPath);
+    void insert(const QString& canonicalPath, const file_identity& identity, const tego_file_hash& hash);
+    void load();
+    void save() const;
+
+    const QString cachePath_;
+    mutable std::mutex mutex_;
+    mutable QHash<QString, entry> entries_;
+};
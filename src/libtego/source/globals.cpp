@@ -1,3 +1,18 @@
 #include "globals.hpp"
 
-tego::globals tego::globals::instance = {};
\ No newline at end of file
+#include "core/IdentityManager.h"
+
+tego::globals tego::globals::instance = {};
+
+bool tego::globals::is_local_hostname(const QString& hostname) const
+{
+    for(const auto& context : contexts)
+    {
+        if (context->identityManager != nullptr &&
+            context->identityManager->lookupHostname(hostname) != nullptr)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -11,10 +11,31 @@ namespace tego
 
         bool opensslAllocatorInited = false;
         bool secureRNGSeeded = false;
-        std::unique_ptr<tego_context> context = nullptr;
+        // set once the first context has started the tor daemon they all share
+        bool torStarted = false;
+        // every live context in the order they were created, each with its own identity;
+        // they all share the one tor daemon and the Qt event loop of the thread they
+        // were created on
+        std::vector<std::unique_ptr<tego_context>> contexts;
+        // hashes of the files sent from the profile around the shared tor daemon;
+        // only kept if that profile's directory was given when tor was started
+        std::shared_ptr<tego_file_hash_cache> fileHashCache;
+
+        // calls func with each context, for events about the tor daemon they share
+        template<typename FUNC>
+        void for_each_context(FUNC&& func)
+        {
+            for(auto& context : contexts)
+            {
+                func(*context);
+            }
+        }
+
+        // true if hostname belongs to any context's identity
+        bool is_local_hostname(const QString& hostname) const;
 
         static globals instance;
     };
 
     inline constexpr globals& g_globals = globals::instance;
-}
\ No newline at end of file
+}
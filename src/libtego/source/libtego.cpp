@@ -18,7 +18,9 @@ extern "C"
             logger::println("init");
 
             TEGO_THROW_IF_NULL(out_context);
-            TEGO_THROW_IF_FALSE(tego::g_globals.context.get() == nullptr);
+            // contexts share the Qt event loop, so must all live on the same thread
+            TEGO_THROW_IF_FALSE(g_globals.contexts.empty() ||
+                                g_globals.contexts.front()->threadId == std::this_thread::get_id());
 
             // initialize OpenSSL's allocator
             if (!g_globals.opensslAllocatorInited) {
@@ -38,9 +40,9 @@ extern "C"
                 g_globals.secureRNGSeeded = true;
             }
 
-            // create and save off singleton context
-            g_globals.context = std::make_unique<tego_context>();
-            *out_context = g_globals.context.get();
+            // create and save off another context
+            g_globals.contexts.push_back(std::make_unique<tego_context>());
+            *out_context = g_globals.contexts.back().get();
 
         }, error);
     }
@@ -51,7 +53,18 @@ extern "C"
         {
             if (context)
             {
-                tego::g_globals.context.reset(nullptr);
+                TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+                auto& contexts = g_globals.contexts;
+                auto it = std::find_if(contexts.begin(), contexts.end(),
+                    [context](const auto& ctx) -> bool { return ctx.get() == context; });
+                TEGO_THROW_IF_FALSE(it != contexts.end());
+
+                // take it out of the list before tearing it down, so whatever it
+                // emits on the way out only goes to the contexts left
+                auto doomed = std::move(*it);
+                contexts.erase(it);
+                doomed.reset();
             }
         }, error);
     }
@@ -9,6 +9,8 @@
 #include <wincrypt.h>
 // workaround because protobuffer defines a GetMessage function
 #undef GetMessage
+#else
+#include <sys/stat.h>
 #endif
 
 // standard library
@@ -48,19 +50,27 @@ extern "C" {
 #ifdef __cplusplus
 
 // standard library
+#include <algorithm>
+#include <atomic>
 #include <string_view>
 #include <cstdio>
 #include <stdexcept>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <set>
 #include <sstream>
 #include <optional>
 #include <tuple>
+#include <vector>
 #include <type_traits>
 #include <chrono>
 
@@ -79,6 +89,7 @@ extern "C" {
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDebug>
+#include <QDir>
 #include <QElapsedTimer>
 #include <QExplicitlySharedDataPointer>
 #include <QFileInfo>
@@ -86,6 +97,7 @@ extern "C" {
 #include <QGuiApplication>
 #include <QHash>
 #include <QJsonDocument>
+#include <QJsonObject>
 #include <QJsonParseError>
 #include <QJsonValue>
 #include <QList>
@@ -253,7 +253,7 @@ QByteArray AuthHiddenServiceChannelPrivate::getProofMessage(const QByteArray& cl
     return proofMessage;
 }
 
-void AuthHiddenServiceChannel::receivePacket(const QByteArray &packet)
+void AuthHiddenServiceChannel::receivePacket(const PacketView &packet)
 {
     Data::AuthHiddenService::Packet message;
     if (!message.ParseFromArray(packet.constData(), packet.size())) {
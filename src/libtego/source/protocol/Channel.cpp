@@ -63,12 +63,14 @@ Channel::Channel(const QString &type, Direction direction, Connection *connectio
     : QObject(connection)
     , d_ptr(new ChannelPrivate(this, type, direction, connection))
 {
+    connect(connection, &Connection::writable, this, &Channel::writable);
 }
 
 Channel::Channel(ChannelPrivate *d_ptr)
     : QObject(d_ptr->connection)
     , d_ptr(d_ptr)
 {
+    connect(d_ptr->connection, &Connection::writable, this, &Channel::writable);
 }
 
 Channel::~Channel()
@@ -113,6 +115,12 @@ bool Channel::isOpened() const
     return d->isOpened;
 }
 
+bool Channel::isWritable() const
+{
+    Q_D(const Channel);
+    return d->connection->isWritable();
+}
+
 bool Channel::openChannel()
 {
     Q_D(Channel);
@@ -140,6 +148,8 @@ void Channel::closeChannel()
 
     if (!d->hasSentClose && d->identifier >= 0 && connection()->isConnected()) {
         d->hasSentClose = true;
+        // bulk data still waiting would only be ignored by the peer once it sees the close
+        connection()->d->discardChannelFlows(d->identifier);
         bool ok = connection()->d->writePacket(this, QByteArray());
         if (!ok)
             qDebug() << "Failed sending channel close message";
@@ -255,27 +265,79 @@ bool Channel::processChannelOpenResult(const Data::Control::ChannelResult *resul
     return true;
 }
 
-bool Channel::sendPacket(const QByteArray &packet)
+bool ChannelPrivate::canSendPacket(const QByteArray &packet)
 {
-    Q_D(Channel);
-    if (d->identifier < 0) {
-        TEGO_BUG() << "Cannot send packet to channel" << type() << "without an assigned identifier";
+    if (identifier < 0) {
+        TEGO_BUG() << "Cannot send packet to channel" << type << "without an assigned identifier";
         return false;
     }
 
     if (packet.size() == 0) {
-        TEGO_BUG() << "Cannot send empty packet to channel" << type();
+        TEGO_BUG() << "Cannot send empty packet to channel" << type;
         return false;
     }
 
     if (packet.size() > ConnectionPrivate::PacketMaxDataSize) {
-        TEGO_BUG() << "Packet is too big on channel" << type();
+        TEGO_BUG() << "Packet is too big on channel" << type;
         return false;
     }
 
+    return true;
+}
+
+bool Channel::sendPacket(const QByteArray &packet)
+{
+    Q_D(Channel);
+    if (!d->canSendPacket(packet))
+        return false;
+
     return connection()->d->writePacket(this, packet);
 }
 
+bool Channel::sendBulkPacket(quint32 flow, const QByteArray &packet)
+{
+    Q_D(Channel);
+    if (!d->canSendPacket(packet))
+        return false;
+
+    return connection()->d->writeBulkPacket(this, flow, packet);
+}
+
+bool Channel::sendBulkFrame(quint32 flow, QByteArray &&frame)
+{
+    Q_D(Channel);
+    Q_STATIC_ASSERT(FrameHeaderSize == ConnectionPrivate::PacketHeaderSize);
+    if (frame.size() <= FrameHeaderSize || !d->canSendPacket(QByteArray::fromRawData(frame.constData() + FrameHeaderSize, frame.size() - FrameHeaderSize)))
+        return false;
+
+    return connection()->d->writeBulkFrame(this, flow, std::move(frame));
+}
+
+PacketScheduler::Priority Channel::sendPriority() const
+{
+    return PacketScheduler::Priority::Interactive;
+}
+
+void Channel::setFlowRateLimit(quint32 flow, qint64 bytesPerSecond)
+{
+    Q_D(Channel);
+    if (d->identifier < 0) {
+        TEGO_BUG() << "Cannot limit flow on channel" << type() << "without an assigned identifier";
+        return;
+    }
+
+    connection()->d->scheduler.setRateLimit(ConnectionPrivate::flowKey(d->identifier, flow), bytesPerSecond);
+}
+
+void Channel::discardFlow(quint32 flow)
+{
+    Q_D(Channel);
+    if (d->identifier < 0)
+        return;
+
+    connection()->d->scheduler.removeFlow(ConnectionPrivate::flowKey(d->identifier, flow));
+}
+
 void Channel::requestInboundApproval()
 {
     if (direction() != Channel::Inbound || isOpened()) {
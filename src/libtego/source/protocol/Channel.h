@@ -34,6 +34,7 @@
 #define PROTOCOL_CHANNEL_H
 
 #include "protocol/ControlChannel.pb.h"
+#include "protocol/PacketScheduler.h"
 
 namespace Protocol
 {
@@ -41,6 +42,35 @@ namespace Protocol
 class Connection;
 class ChannelPrivate;
 
+/* Data of a received packet, pointing into the connection's read buffer
+ *
+ * Connections read everything available from the socket in one go and split
+ * it into packets in place, so handling a packet needs no allocation or copy.
+ * A view is only valid until receivePacket returns. A channel which needs the
+ * data for longer can keep a reference to buffer(), which holds the packet at
+ * offset(); the connection never writes to a buffer once it is shared.
+ */
+class PacketView
+{
+public:
+    PacketView(const QByteArray &buffer, int offset, int size)
+        : m_buffer(buffer), m_offset(offset), m_size(size)
+    {
+    }
+
+    const char *constData() const { return m_buffer.constData() + m_offset; }
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    const QByteArray &buffer() const { return m_buffer; }
+    int offset() const { return m_offset; }
+
+private:
+    const QByteArray &m_buffer;
+    const int m_offset;
+    const int m_size;
+};
+
 /* Base representation of a channel inside of a connection
  *
  * Channel is subclassed by channel type implementations to handle channel
@@ -89,6 +119,8 @@ public:
     Direction direction() const;
     Connection *connection();
     bool isOpened() const;
+    /* Whether the connection wants more bulk data; see Connection::isWritable */
+    bool isWritable() const;
 
     /* Send the OpenChannel request for this channel
      *
@@ -121,6 +153,11 @@ signals:
      */
     void invalidated();
 
+    /* Emitted when the connection's write backlog has drained after isWritable()
+     * returned false, so bulk producers should resume sending
+     */
+    void writable();
+
 public slots:
     void closeChannel();
 
@@ -174,13 +211,14 @@ protected:
     /* Process data from an inbound packet for this channel
      *
      * Subclasses must implement this method to handle inbound packets for this
-     * channel. 'packet' is raw data from the packet, and will not be empty.
+     * channel. 'packet' is raw data from the packet, and will not be empty. It
+     * is only valid for the duration of the call; see PacketView.
      *
      * Generally, a channel will parse packets using the protobuf ParseFromArray
      * method of their packet message type, and call appropriate handlers for
      * the messages it contains.
      */
-    virtual void receivePacket(const QByteArray &packet) = 0;
+    virtual void receivePacket(const PacketView &packet) = 0;
 
     /* Send raw data as a packet on this channel
      *
@@ -206,6 +244,45 @@ protected:
      */
     template<typename T> bool sendMessage(const T &message);
 
+    /* Priority of this channel's packets relative to others on the connection
+     *
+     * Packets sent with sendPacket or sendMessage are scheduled with this
+     * priority, in the order they were sent. The default is Interactive;
+     * the control channel uses Control.
+     */
+    virtual PacketScheduler::Priority sendPriority() const;
+
+    /* Send a packet of bulk data as part of a flow
+     *
+     * Bulk packets are only written when no control or interactive packets
+     * are waiting, so large amounts of data never hold up the rest of the
+     * connection. Packets within a flow keep their order, and flows (eg one
+     * per file transfer) share the connection evenly. Otherwise these behave
+     * like sendPacket and sendMessage.
+     */
+    bool sendBulkPacket(quint32 flow, const QByteArray &packet);
+    template<typename T> bool sendBulkMessage(quint32 flow, const T &message);
+
+    /* Send a bulk packet which is already laid out as a frame
+     *
+     * The first FrameHeaderSize bytes of 'frame' are left for the connection
+     * to fill in, and the packet follows. The frame is queued and written as
+     * it is, without copying it, so large packets can be built directly in
+     * the buffer that ends up being written to the socket. If the frame is
+     * refused it is left as it was, so it can be sent again later.
+     */
+    bool sendBulkFrame(quint32 flow, QByteArray &&frame);
+    static const int FrameHeaderSize = 4;
+
+    /* Cap a flow at bytesPerSecond, or remove its cap with 0
+     *
+     * The cap stays in place until the flow is discarded or the channel closes.
+     */
+    void setFlowRateLimit(quint32 flow, qint64 bytesPerSecond);
+
+    /* Drop any of a flow's packets which haven't been written yet */
+    void discardFlow(quint32 flow);
+
     /* Get approval for an inbound channel from the Connection's handlers
      *
      * Channels that require approval from higher-layer functionality before
@@ -225,6 +302,9 @@ protected:
     void requestInboundApproval();
 
     QScopedPointer<ChannelPrivate> d_ptr;
+
+private:
+    template<typename T> bool serializeMessage(const T &message, QByteArray &packet);
 };
 
 }
@@ -60,6 +60,8 @@ public:
     bool isInvalidated;
 
     void invalidate();
+    // sanity checks shared by every way of sending a packet
+    bool canSendPacket(const QByteArray &packet);
 
     // Called by ControlChannel to act on valid channel request/result messages
     bool openChannelInbound(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result);
@@ -67,7 +69,7 @@ public:
     bool openChannelResult(const Data::Control::ChannelResult *result);
 };
 
-template<typename T> bool Channel::sendMessage(const T &message)
+template<typename T> bool Channel::serializeMessage(const T &message, QByteArray &packet)
 {
     int size = message.ByteSize();
     if (size > ConnectionPrivate::PacketMaxDataSize) {
@@ -82,7 +84,7 @@ template<typename T> bool Channel::sendMessage(const T &message)
         return false;
     }
 
-    QByteArray packet(size, 0);
+    packet = QByteArray(size, 0);
     quint8 *end = message.SerializeWithCachedSizesToArray(reinterpret_cast<quint8*>(packet.data()));
     quint8 *expected_end = reinterpret_cast<quint8*>(packet.data() + size);
     if (end != expected_end) {
@@ -90,9 +92,26 @@ template<typename T> bool Channel::sendMessage(const T &message)
         return false;
     }
 
+    return true;
+}
+
+template<typename T> bool Channel::sendMessage(const T &message)
+{
+    QByteArray packet;
+    if (!serializeMessage(message, packet))
+        return false;
+
     return sendPacket(packet);
 }
 
+template<typename T> bool Channel::sendBulkMessage(quint32 flow, const T &message)
+{
+    QByteArray packet;
+    if (!serializeMessage(message, packet))
+        return false;
+
+    return sendBulkPacket(flow, packet);
+}
 }
 
 #endif
@@ -77,7 +77,7 @@ bool ChatChannel::allowOutboundChannelRequest(Data::Control::OpenChannel *reques
     return true;
 }
 
-void ChatChannel::receivePacket(const QByteArray &packet)
+void ChatChannel::receivePacket(const PacketView &packet)
 {
     Data::Chat::Packet message;
     if (!message.ParseFromArray(packet.constData(), packet.size())) {
@@ -59,7 +59,7 @@ signals:
 protected:
     virtual bool allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result);
     virtual bool allowOutboundChannelRequest(Data::Control::OpenChannel *request);
-    virtual void receivePacket(const QByteArray &packet);
+    virtual void receivePacket(const PacketView &packet);
 
 private:
     QSet<MessageId> pendingMessages;
@@ -51,10 +51,17 @@ ConnectionPrivate::ConnectionPrivate(Connection *qq)
     , purpose(Connection::Purpose::Unknown)
     , wasClosed(false)
     , handshakeDone(false)
+    , writeBlocked(false)
+    , sendTimer(new QTimer(this))
+    , readOffset(0)
     , nextOutboundChannelId(-1)
 {
     ageTimer.start();
 
+    // Wakes us when a rate limited flow may send again
+    sendTimer->setSingleShot(true);
+    connect(sendTimer, &QTimer::timeout, this, &ConnectionPrivate::resumeWriting);
+
     QTimer *timeout = new QTimer(this);
     timeout->setSingleShot(true);
     timeout->setInterval(UnknownPurposeTimeout * 1000);
@@ -139,6 +146,16 @@ int Connection::age() const
     return qRound(d->ageTimer.elapsed() / 1000.0);
 }
 
+bool Connection::isWritable() const
+{
+    return !d->writeBlocked;
+}
+
+qint64 Connection::bytesToWrite() const
+{
+    return d->scheduler.queuedBytes() + (d->socket ? d->socket->bytesToWrite() : 0);
+}
+
 void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
 {
     if (socket) {
@@ -150,6 +167,7 @@ void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
     direction = d;
     connect(socket, &QAbstractSocket::disconnected, this, &ConnectionPrivate::socketDisconnected);
     connect(socket, &QIODevice::readyRead, this, &ConnectionPrivate::socketReadable);
+    connect(socket, &QIODevice::bytesWritten, this, &ConnectionPrivate::resumeWriting);
 
     socket->setParent(q);
 
@@ -321,20 +339,48 @@ void ConnectionPrivate::socketReadable()
         }
     }
 
-    qint64 available;
-    while ((available = socket->bytesAvailable()) >= PacketHeaderSize) {
-        uchar header[PacketHeaderSize];
-        // Peek at the header first, to read the size of the packet and make sure
-        // the entire thing is available within the buffer.
-        qint64 re = socket->peek(reinterpret_cast<char*>(header), PacketHeaderSize);
+    // Everything available is read at once, after whatever partial packet was left
+    // over from last time, and split into packets in place
+    const qint64 available = socket->bytesAvailable();
+    if (available <= 0)
+        return;
+
+    const int pending = readBuffer.size() - readOffset;
+    if (pending + available > INT_MAX / 2) {
+        qWarning() << "Connection read buffer is too large; disconnecting";
+        socket->abort();
+        return;
+    }
+
+    if (!readBuffer.isDetached()) {
+        // A channel is still holding on to packets from the last batch, leave that
+        // buffer to it and start a new one
+        QByteArray buffer;
+        buffer.reserve(pending + static_cast<int>(available));
+        buffer.append(readBuffer.constData() + readOffset, pending);
+        readBuffer = buffer;
+    } else if (readOffset > 0) {
+        memmove(readBuffer.data(), readBuffer.constData() + readOffset, pending);
+    }
+    readOffset = 0;
+    readBuffer.resize(pending + static_cast<int>(available));
+
+    qint64 re = socket->read(readBuffer.data() + pending, available);
+    if (re != available) {
         if (re < 0) {
             qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
-            socket->abort();
-            return;
-        } else if (re < PacketHeaderSize) {
-            TEGO_BUG() << "Socket had" << available << "bytes available but peek only returned" << re;
-            return;
+        } else {
+            // Because of QTcpSocket buffering, we can expect that up to 'available' bytes
+            // will read. Treat anything less as an error condition.
+            TEGO_BUG() << "Socket read was unexpectedly small;" << available << "bytes should've been available but we read" << re;
         }
+        readBuffer.clear();
+        socket->abort();
+        return;
+    }
+
+    while (readBuffer.size() - readOffset >= PacketHeaderSize) {
+        const uchar *header = reinterpret_cast<const uchar*>(readBuffer.constData() + readOffset);
 
         Q_STATIC_ASSERT(PacketHeaderSize == 4);
         quint16 packetSize = qFromBigEndian<quint16>(header);
@@ -346,36 +392,11 @@ void ConnectionPrivate::socketReadable()
             return;
         }
 
-        if (packetSize > available)
+        if (packetSize > readBuffer.size() - readOffset)
             break;
 
-        // Read header out of the buffer and discard
-        re = socket->read(reinterpret_cast<char*>(header), PacketHeaderSize);
-        if (re != PacketHeaderSize) {
-            if (re < 0) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
-            } else {
-                // Because of QTcpSocket buffering, we can expect that up to 'available' bytes
-                // will read. Treat anything less as an error condition.
-                TEGO_BUG() << "Socket read was unexpectedly small;" << available << "bytes should've been available but we read" << re;
-            }
-            socket->abort();
-            return;
-        }
-
-        // Read data
-        QByteArray data(packetSize - PacketHeaderSize, 0);
-        re = (data.size() == 0) ? 0 : socket->read(data.data(), data.size());
-        if (re != data.size()) {
-            if (re < 0) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
-            } else {
-                // As above
-                TEGO_BUG() << "Socket read was unexpectedly small;" << available << "bytes should've been available but we read" << re;
-            }
-            socket->abort();
-            return;
-        }
+        PacketView data(readBuffer, readOffset + PacketHeaderSize, packetSize - PacketHeaderSize);
+        readOffset += packetSize;
 
         Channel *channel = q->channel(channelId);
         if (!channel) {
@@ -404,6 +425,10 @@ void ConnectionPrivate::socketReadable()
         } else {
             channel->receivePacket(data);
         }
+
+        // Handling a packet may have closed the connection, the rest of the batch is dropped
+        if (socket->state() == QAbstractSocket::UnconnectedState)
+            return;
     }
 }
 
@@ -417,18 +442,50 @@ bool ConnectionPrivate::writePacket(Channel *channel, const QByteArray &data)
         return false;
     }
 
-    return writePacket(channel->identifier(), data);
+    return writePacket(channel->identifier(), data, channel->sendPriority());
+}
+
+bool ConnectionPrivate::writeBulkPacket(Channel *channel, quint32 flow, const QByteArray &data)
+{
+    if (channel->connection() != q) {
+        TEGO_BUG() << "Writing bulk packet for channel" << channel->identifier() << "on connection" << this
+              << "but its connection is" << channel->connection();
+        qFatal("Connection mismatch while writing packet");
+        return false;
+    }
+
+    return writePacket(channel->identifier(), data, PacketScheduler::Priority::Bulk, flow);
+}
+
+bool ConnectionPrivate::writeBulkFrame(Channel *channel, quint32 flow, QByteArray &&frame)
+{
+    if (channel->connection() != q) {
+        TEGO_BUG() << "Writing bulk frame for channel" << channel->identifier() << "on connection" << this
+              << "but its connection is" << channel->connection();
+        qFatal("Connection mismatch while writing packet");
+        return false;
+    }
+
+    return writeFrame(channel->identifier(), std::move(frame), PacketScheduler::Priority::Bulk, flow);
+}
+
+bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data, PacketScheduler::Priority priority, quint32 flow)
+{
+    QByteArray frame(PacketHeaderSize + data.size(), Qt::Uninitialized);
+    std::copy(data.constBegin(), data.constEnd(), frame.begin() + PacketHeaderSize);
+    return writeFrame(channelId, std::move(frame), priority, flow);
 }
 
-bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
+bool ConnectionPrivate::writeFrame(int channelId, QByteArray &&frame, PacketScheduler::Priority priority, quint32 flow)
 {
     if (channelId < 0 || channelId > UINT16_MAX) {
         TEGO_BUG() << "Cannot write packet for channel with invalid identifier" << channelId;
         return false;
     }
 
-    if (data.size() > PacketMaxDataSize) {
-        TEGO_BUG() << "Cannot write oversized packet of" << data.size() << "bytes to channel" << channelId;
+    const int dataSize = frame.size() - PacketHeaderSize;
+    if (dataSize < 0 || dataSize > PacketMaxDataSize) {
+        TEGO_BUG() << "Cannot write oversized packet of" << dataSize << "bytes to channel" << channelId;
         return false;
     }
 
@@ -437,27 +494,78 @@ bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
         return false;
     }
 
+    if (priority == PacketScheduler::Priority::Bulk && q->bytesToWrite() + frame.size() > Connection::MaxBytesToWrite) {
+        TEGO_BUG() << "Refusing bulk packet for channel" << channelId << "with" << q->bytesToWrite()
+                   << "bytes already waiting to be written";
+        return false;
+    }
+
+    // The header goes in the space left at the front, so the frame is written exactly as
+    // it was built: header and payload in a single write, with no further copies
     Q_STATIC_ASSERT(PacketHeaderSize + PacketMaxDataSize <= UINT16_MAX);
     Q_STATIC_ASSERT(PacketHeaderSize == 4);
-    uchar header[PacketHeaderSize] = { 0 };
-    qToBigEndian(static_cast<quint16>(PacketHeaderSize + data.size()), header);
+    uchar *header = reinterpret_cast<uchar*>(frame.data());
+    qToBigEndian(static_cast<quint16>(frame.size()), header);
     qToBigEndian(static_cast<quint16>(channelId), &header[2]);
 
-    qint64 re = socket->write(reinterpret_cast<char*>(header), PacketHeaderSize);
-    if (re != PacketHeaderSize) {
-        qDebug() << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
-        socket->abort();
-        return false;
+    scheduler.enqueue(priority, flowKey(channelId, flow), std::move(frame));
+    flushPackets();
+
+    // Producers are expected to hold off until writable() once this is false
+    if (!writeBlocked && q->bytesToWrite() >= Connection::HighWatermark)
+        writeBlocked = true;
+    return true;
+}
+
+void ConnectionPrivate::resumeWriting()
+{
+    flushPackets();
+
+    // Only emitted from here, never from within writePacket, so that producers
+    // resuming on writable() aren't re-entered while they're still sending
+    if (writeBlocked && q->bytesToWrite() <= Connection::LowWatermark) {
+        writeBlocked = false;
+        emit q->writable();
     }
+}
 
-    re = socket->write(data, data.size());
-    if (re != data.size()) {
-        qDebug() << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
-        socket->abort();
-        return false;
+void ConnectionPrivate::flushPackets()
+{
+    if (!socket || !q->isConnected())
+        return;
+
+    // Only top up the socket's buffer; anything beyond that stays in the scheduler,
+    // where a chat message can still overtake queued file data
+    const auto now = QDateTime::currentMSecsSinceEpoch();
+    while (socket->bytesToWrite() < SocketBufferTarget) {
+        auto packet = scheduler.dequeue(now);
+        if (!packet)
+            break;
+
+        qint64 re = socket->write(*packet);
+        if (re != packet->size()) {
+            qDebug() << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
+            socket->abort();
+            return;
+        }
     }
 
-    return true;
+    // If everything left is over its rate limit, come back once some of it may go
+    const auto delay = scheduler.nextSendDelay(now);
+    if (delay > 0 && socket->bytesToWrite() < SocketBufferTarget && !sendTimer->isActive())
+        sendTimer->start(static_cast<int>(std::min<qint64>(delay, INT_MAX)));
+}
+
+quint64 ConnectionPrivate::flowKey(int channelId, quint32 flow)
+{
+    return (static_cast<quint64>(channelId) << 32) | flow;
+}
+
+void ConnectionPrivate::discardChannelFlows(int channelId)
+{
+    scheduler.removeFlows([channelId](quint64 key) {
+        return (key >> 32) == static_cast<quint64>(channelId);
+    });
 }
 
 int ConnectionPrivate::availableOutboundChannelId()
@@ -553,9 +661,11 @@ void ConnectionPrivate::removeChannel(Channel *channel)
     // Out of caution, find the channel by pointer instead of identifier. This will make sure
     // it's always removed from the list, even if the identifier was somehow reset or lost.
     for (auto it = channels.begin(); it != channels.end(); ) {
-        if (*it == channel)
+        if (*it == channel) {
+            // The identifier may be reused, so its flows must not outlive it
+            discardChannelFlows(it.key());
             it = channels.erase(it);
-        else
+        } else
             it++;
     }
 }
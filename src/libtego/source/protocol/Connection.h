@@ -118,6 +118,22 @@ public:
     /* Age of the connection in seconds */
     int age() const;
 
+    /* Whether producers of bulk data should keep sending
+     *
+     * Packets waiting to be written (queued in the connection or in the
+     * socket's buffer) are kept between a low and a high watermark. Once
+     * more than HighWatermark bytes are waiting this returns false, until
+     * the backlog drains below LowWatermark and writable() is emitted.
+     * Control and interactive packets are always accepted.
+     */
+    bool isWritable() const;
+    qint64 bytesToWrite() const;
+
+    static const qint64 HighWatermark = 1024 * 1024;
+    static const qint64 LowWatermark = 256 * 1024;
+    // Bulk packets are refused past this, when a producer ignores isWritable()
+    static const qint64 MaxBytesToWrite = 8 * HighWatermark;
+
     /* Assigned purpose of this connection
      *
      * A purpose is assigned to the connection after the peer has
@@ -214,6 +230,10 @@ signals:
      * opened. At this point, the channel can be used or closed normally.
      */
     void channelOpened(Channel *channel);
+    /* Emitted when the write backlog has drained below LowWatermark after
+     * isWritable() returned false, so producers can resume
+     */
+    void writable();
 
 private:
     ConnectionPrivate *d;
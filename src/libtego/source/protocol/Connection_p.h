@@ -34,6 +34,7 @@
 #define PROTOCOL_CONNECTION_P_H
 
 #include "Connection.h"
+#include "PacketScheduler.h"
 
 namespace Protocol
 {
@@ -50,6 +51,9 @@ public:
     static const int PacketMaxDataSize = UINT16_MAX - PacketHeaderSize;
     // Time in seconds before a connection with a purpose of Unknown is killed
     static const int UnknownPurposeTimeout = 15;
+    // Bytes allowed to wait in the socket's write buffer before further packets are
+    // held back in the scheduler, where they can still be reordered by priority
+    static const int SocketBufferTarget = PacketHeaderSize + PacketMaxDataSize;
 
     explicit ConnectionPrivate(Connection *q);
     virtual ~ConnectionPrivate();
@@ -63,6 +67,14 @@ public:
     Connection::Purpose purpose;
     bool wasClosed;
     bool handshakeDone;
+    // Set while the write backlog is over the high watermark
+    bool writeBlocked;
+    PacketScheduler scheduler;
+    QTimer *sendTimer;
+    // Data read from the socket, which received packets point into; everything
+    // before readOffset has been handled
+    QByteArray readBuffer;
+    int readOffset;
 
     void setSocket(QTcpSocket *socket, Connection::Direction direction);
 
@@ -74,8 +86,19 @@ public:
 
     void closeAllChannels();
 
+    // Packets are queued in the scheduler, and written once the socket has room
     bool writePacket(Channel *channel, const QByteArray &data);
-    bool writePacket(int channelId, const QByteArray &data);
+    bool writeBulkPacket(Channel *channel, quint32 flow, const QByteArray &data);
+    // 'frame' begins with PacketHeaderSize bytes for us to fill in
+    bool writeBulkFrame(Channel *channel, quint32 flow, QByteArray &&frame);
+    bool writeFrame(int channelId, QByteArray &&frame, PacketScheduler::Priority priority, quint32 flow);
+    bool writePacket(int channelId, const QByteArray &data,
+                     PacketScheduler::Priority priority = PacketScheduler::Priority::Interactive,
+                     quint32 flow = 0);
+
+    // Each channel numbers its own bulk flows
+    static quint64 flowKey(int channelId, quint32 flow);
+    void discardChannelFlows(int channelId);
 
 public slots:
     void closeImmediately();
@@ -83,6 +106,8 @@ public slots:
 private slots:
     void socketReadable();
     void socketDisconnected();
+    void flushPackets();
+    void resumeWriting();
 
 private:
     int nextOutboundChannelId;
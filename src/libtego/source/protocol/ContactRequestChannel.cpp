@@ -259,7 +259,7 @@ bool ContactRequestChannel::processChannelOpenResult(const Data::Control::Channe
     return handleResponse(&response);
 }
 
-void ContactRequestChannel::receivePacket(const QByteArray &packet)
+void ContactRequestChannel::receivePacket(const PacketView &packet)
 {
     Data::ContactRequest::Response response;
     if (!response.ParseFromArray(packet.constData(), packet.size())) {
@@ -71,7 +71,7 @@ protected:
     virtual bool allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result);
     virtual bool allowOutboundChannelRequest(Data::Control::OpenChannel *request);
     virtual bool processChannelOpenResult(const Data::Control::ChannelResult *result);
-    virtual void receivePacket(const QByteArray &packet);
+    virtual void receivePacket(const PacketView &packet);
 
 private:
     QString m_nickname;
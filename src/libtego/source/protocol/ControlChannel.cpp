@@ -125,7 +125,12 @@ bool ControlChannel::processChannelOpenResult(const Data::Control::ChannelResult
     return false;
 }
 
-void ControlChannel::receivePacket(const QByteArray &packet)
+PacketScheduler::Priority ControlChannel::sendPriority() const
+{
+    return PacketScheduler::Priority::Control;
+}
+
+void ControlChannel::receivePacket(const PacketView &packet)
 {
     Data::Control::Packet message;
     if (!message.ParseFromArray(packet.constData(), packet.size())) {
@@ -60,7 +60,9 @@ protected:
     virtual bool allowOutboundChannelRequest(Data::Control::OpenChannel *request);
     virtual bool processChannelOpenResult(const Data::Control::ChannelResult *result);
 
-    virtual void receivePacket(const QByteArray &packet);
+    virtual void receivePacket(const PacketView &packet);
+    // Opening channels and keepalives always go ahead of other traffic
+    virtual PacketScheduler::Priority sendPriority() const;
 
 private:
     void handleOpenChannel(const Data::Control::OpenChannel &message);
@@ -33,6 +33,7 @@
 #include "FileChannel.h"
 #include "Channel_p.h"
 #include "Connection.h"
+#include "utils/FileIOWorker.h"
 #include "utils/SecureRNG.h"
 #include "utils/Useful.h"
 
@@ -42,6 +43,9 @@
 #include "file_hash.hpp"
 using tego::g_globals;
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
 using namespace Protocol;
 
 static void logTransferStats(qint64 bytes, std::chrono::time_point<std::chrono::system_clock> beginTime)
@@ -52,6 +56,99 @@ static void logTransferStats(qint64 bytes, std::chrono::time_point<std::chrono::
     logger::println("Transfer Complete: {{ size : {} kilobytes, duration : {} seconds, rate : {} kilobytes / second}}", kilobytes, seconds, kilobytes / seconds);
 };
 
+// feeds exactly the next bytes of stream to hasher, returns false if the stream ends first
+static bool hashStreamPrefix(std::istream& stream, tego_file_size_t bytes, tego_file_hasher& hasher)
+{
+    constexpr tego_file_size_t BLOCK_SIZE = 65536;
+    auto buffer = std::make_unique<char[]>(BLOCK_SIZE);
+
+    while (bytes > 0)
+    {
+        const auto blockSize = std::min(bytes, BLOCK_SIZE);
+        stream.read(buffer.get(), static_cast<std::streamsize>(blockSize));
+        if (static_cast<tego_file_size_t>(stream.gcount()) != blockSize)
+        {
+            return false;
+        }
+        hasher.update(buffer.get(), buffer.get() + blockSize);
+        bytes -= blockSize;
+    }
+    return true;
+}
+
+//
+// Resume Records
+//
+// When a connection drops mid-transfer, the receiver keeps its partial file and
+// writes a small json record beside it; if the same file is later accepted to the
+// same destination, the transfer continues from the end of the partial file
+//
+
+static void writeResumeRecord(
+    const std::string& path,
+    tego_file_size_t size,
+    const std::string& hash,
+    const std::string& partialDest,
+    tego_file_size_t written)
+{
+    // sizes are stored as strings as json numbers are doubles
+    QJsonObject json;
+    json.insert(QStringLiteral("size"), QString::number(size));
+    json.insert(QStringLiteral("hash"), QString::fromStdString(hash));
+    json.insert(QStringLiteral("partial"), QString::fromStdString(partialDest));
+    json.insert(QStringLiteral("written"), QString::number(written));
+
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        file.write(QJsonDocument(json).toJson()) < 0)
+    {
+        qWarning() << "Failed to write resume record" << file.fileName();
+    }
+}
+
+// returns the number of bytes of partialDest which may be resumed from
+static std::optional<tego_file_size_t> readResumeRecord(
+    const std::string& path,
+    tego_file_size_t size,
+    const std::string& hash,
+    const std::string& partialDest)
+{
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return std::nullopt;
+    }
+    const auto json = QJsonDocument::fromJson(file.readAll()).object();
+
+    bool ok = false;
+    if (json.value(QStringLiteral("size")).toString().toULongLong(&ok) != size || !ok)
+    {
+        return std::nullopt;
+    }
+
+    const auto written = json.value(QStringLiteral("written")).toString().toULongLong(&ok);
+    if (!ok || written == 0 || written >= size)
+    {
+        return std::nullopt;
+    }
+
+    // either hash may be missing if it was going to follow in a trailer, in which
+    // case the sender's check of the prefix hash is all we have to go on
+    const auto recordHash = json.value(QStringLiteral("hash")).toString().toStdString();
+    if (!recordHash.empty() && !hash.empty() && recordHash != hash)
+    {
+        return std::nullopt;
+    }
+
+    if (json.value(QStringLiteral("partial")).toString().toStdString() != partialDest ||
+        QFileInfo(QString::fromStdString(partialDest)).size() < static_cast<qint64>(written))
+    {
+        return std::nullopt;
+    }
+
+    return written;
+}
+
 //
 // Outgoing Transfer Record
 //
@@ -63,7 +160,17 @@ FileChannel::outgoing_transfer_record::outgoing_transfer_record(
 : id(id)
 , size(fileSize)
 , offset(0)
-, stream(filePath, std::ios::in | std::ios::binary)
+, acked(0)
+, readOffset(0)
+, started(false)
+, stream(std::make_shared<std::ifstream>(filePath, std::ios::in | std::ios::binary))
+, readAhead()
+, pendingReads(0)
+, readGeneration(0)
+, tree()
+, nodesSent()
+, hasher()
+, trailerHash()
 { }
 
 //
@@ -77,19 +184,57 @@ FileChannel::incoming_transfer_record::incoming_transfer_record(
 : id(id)
 , size(fileSize)
 , hash(fileHash)
+, received(0)
+, written(0)
 , stream()
+, hasher()
+, keepPartial(false)
+, tree()
+, retryOffset()
+, retries(0)
 { }
 
 FileChannel::incoming_transfer_record::~incoming_transfer_record()
 {
-    if (this->stream.is_open())
+    // moved-from records and those never accepted have no stream
+    if (this->stream)
     {
-        // try our best to remove the partial file
-        this->stream.close();
+        // writes for this transfer may still be queued, so clean up after them
+        FileIOWorker::instance()->post(
+            [stream = std::move(this->stream),
+             keepPartial = this->keepPartial,
+             size = this->size,
+             hash = this->hash,
+             partialDest = this->partial_dest(),
+             resumeRecordPath = this->resume_record_path()]()
+        {
+            if (!stream->is_open())
+            {
+                // if incoming request succeeded then the partial no longer exists
+                return;
+            }
+
+            if (keepPartial)
+            {
+                // note how much made it to disk so the transfer can pick up from there
+                stream->flush();
+                const auto written = static_cast<std::streamoff>(stream->tellp());
+                stream->close();
+
+                if (!stream->fail() && written > 0)
+                {
+                    writeResumeRecord(resumeRecordPath, size, hash, partialDest, static_cast<tego_file_size_t>(written));
+                    return;
+                }
+            }
+            else
+            {
+                stream->close();
+            }
 
-        // ignore error here, if incoming request succeeded then the
-        // partial should no longer exist
-        QFile::remove(QString::fromStdString(this->partial_dest()));
+            // try our best to remove the partial file, ignoring errors
+            QFile::remove(QString::fromStdString(partialDest));
+        });
     }
 }
 
@@ -98,16 +243,65 @@ std::string FileChannel::incoming_transfer_record::partial_dest() const
     return  dest + ".part";
 }
 
-void FileChannel::incoming_transfer_record::open_stream(const std::string& dest)
+std::string FileChannel::incoming_transfer_record::resume_record_path() const
+{
+    return dest + ".part.resume";
+}
+
+std::shared_ptr<FileChannel::partial_file> FileChannel::openPartialFile(
+    tego_file_size_t size,
+    const std::string& hash,
+    const std::string& partialDest,
+    const std::string& resumeRecordPath,
+    tego_file_size_t alignment)
 {
-    this->dest = dest;
+    auto partialFile = std::make_shared<partial_file>();
+    partialFile->path = partialDest;
+
+    // transfers verified with a hash tree can only resume from the start of a leaf
+    auto written = readResumeRecord(resumeRecordPath, size, hash, partialDest);
+    if (written)
+    {
+        *written -= *written % alignment;
+    }
+
+    if (written && *written > 0)
+    {
+        // anything past what the record says was written may not have made it to disk intact
+        const auto prefixIntact = [&]() -> bool
+        {
+            if (!QFile::resize(QString::fromStdString(partialDest), static_cast<qint64>(*written)))
+            {
+                return false;
+            }
+            std::ifstream prefix(partialDest, std::ios::in | std::ios::binary);
+            return hashStreamPrefix(prefix, *written, partialFile->hasher);
+        };
+
+        if (prefixIntact())
+        {
+            // open for writing at the end of the existing contents
+            partialFile->stream = std::make_shared<std::ofstream>(partialDest, std::ios::in | std::ios::out | std::ios::binary | std::ios::ate);
+            if (partialFile->stream->is_open())
+            {
+                partialFile->offset = *written;
+            }
+        }
+    }
+
+    if (partialFile->offset == 0)
+    {
+        // attempt to open the destination for writing
+        // discard previous contents
+        // binary mode
+        partialFile->hasher = tego_file_hasher();
+        partialFile->stream = std::make_shared<std::ofstream>(partialDest, std::ios::out | std::ios::trunc | std::ios::binary);
+    }
 
-    // attempt to open the destination for reading and writing
-    // discard previous contents
-    // binary mode
-    // we need to read to validate the hash after the transfer completes
-    this->stream.open(this->partial_dest(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
-    TEGO_THROW_IF_FALSE(this->stream.is_open());
+    // the record gets rewritten if this transfer is interrupted too
+    QFile::remove(QString::fromStdString(resumeRecordPath));
+
+    return partialFile;
 }
 
 //
@@ -118,10 +312,11 @@ FileChannel::FileChannel(Direction direction, Connection *connection)
     : Channel(QStringLiteral("im.ricochet.file-transfer"), direction, connection)
 {
     connect(this->d_ptr->connection, &Connection::closed, this, &FileChannel::onConnectionClosed);
+    connect(this, &Channel::writable, this, &FileChannel::onWritable);
 }
 
 bool FileChannel::allowInboundChannelRequest(
-    const Data::Control::OpenChannel*,
+    const Data::Control::OpenChannel *request,
     Data::Control::ChannelResult *result)
 {
     if (connection()->purpose() != Connection::Purpose::KnownContact) {
@@ -135,11 +330,23 @@ bool FileChannel::allowInboundChannelRequest(
         return false;
     }
 
+    // we can always handle a hash trailer, so accept one if offered
+    if (request->GetExtension(Data::File::hash_trailer_offered)) {
+        hashTrailerEnabled = true;
+        result->SetExtension(Data::File::hash_trailer_accepted, true);
+    }
+
+    // likewise for hash trees
+    if (request->GetExtension(Data::File::hash_tree_offered)) {
+        hashTreeEnabled = true;
+        result->SetExtension(Data::File::hash_tree_accepted, true);
+    }
+
     return true;
 }
 
 bool FileChannel::allowOutboundChannelRequest(
-    Data::Control::OpenChannel*)
+    Data::Control::OpenChannel *request)
 {
     if (connection()->findChannel<FileChannel>(Channel::Outbound)) {
         TEGO_BUG() << "Rejecting outbound request for" << type() << "channel because one is already open on this connection";
@@ -151,6 +358,17 @@ bool FileChannel::allowOutboundChannelRequest(
         return false;
     }
 
+    request->SetExtension(Data::File::hash_trailer_offered, true);
+    request->SetExtension(Data::File::hash_tree_offered, true);
+
+    return true;
+}
+
+bool FileChannel::processChannelOpenResult(const Data::Control::ChannelResult *result)
+{
+    // older peers don't know about hash trailers and need the hash in the FileHeader
+    hashTrailerEnabled = result->opened() && result->GetExtension(Data::File::hash_trailer_accepted);
+    hashTreeEnabled = result->opened() && result->GetExtension(Data::File::hash_tree_accepted);
     return true;
 }
 
@@ -165,6 +383,9 @@ bool FileChannel::verifyPacket(Data::File::Packet const& message)
     messageCount += message.has_file_header_response();
     messageCount += message.has_file_chunk_ack();
     messageCount += message.has_file_transfer_complete_notification();
+    messageCount += message.has_file_hash_trailer();
+    messageCount += message.has_file_hash_tree_nodes();
+    messageCount += message.has_file_chunk_retry();
 
     if (messageCount == 1)
     {
@@ -180,6 +401,12 @@ bool FileChannel::verifyPacket(Data::File::Packet const& message)
             return verifyFileChunkAck(message.file_chunk_ack());
         } else if (message.has_file_transfer_complete_notification()) {
             return verifyFileTransferCompleteNotification(message.file_transfer_complete_notification());
+        } else if (message.has_file_hash_trailer()) {
+            return verifyFileHashTrailer(message.file_hash_trailer());
+        } else if (message.has_file_hash_tree_nodes()) {
+            return verifyFileHashTreeNodes(message.file_hash_tree_nodes());
+        } else if (message.has_file_chunk_retry()) {
+            return verifyFileChunkRetry(message.file_chunk_retry());
         }
     }
 
@@ -188,10 +415,20 @@ bool FileChannel::verifyPacket(Data::File::Packet const& message)
 
 bool FileChannel::verifyFileHeader(Data::File::FileHeader const& message)
 {
+    // the hash may only be left out if we agreed to receive it in a trailer, or if
+    // the file is described by a hash tree instead
+    if (message.has_tree_root())
+    {
+        return message.has_file_id() &&
+               message.has_file_size() &&
+               message.has_name() &&
+               !message.has_file_hash() &&
+               hashTreeEnabled;
+    }
     return message.has_file_id() &&
            message.has_file_size() &&
            message.has_name() &&
-           message.has_file_hash();
+           (message.has_file_hash() || hashTrailerEnabled);
 }
 
 bool FileChannel::verifyFileHeaderAck(Data::File::FileHeaderAck const& message)
@@ -219,8 +456,160 @@ bool FileChannel::verifyFileTransferCompleteNotification(Data::File::FileTransfe
     return message.has_file_id() && message.has_result();
 }
 
-void FileChannel::receivePacket(const QByteArray &packet)
+bool FileChannel::verifyFileHashTrailer(Data::File::FileHashTrailer const& message)
+{
+    return message.has_file_id() && message.has_file_hash() && hashTrailerEnabled;
+}
+
+bool FileChannel::verifyFileHashTreeNodes(Data::File::FileHashTreeNodes const& message)
+{
+    return message.has_file_id() && message.has_level() && message.has_index() && message.child_hashes_size() > 0 && hashTreeEnabled;
+}
+
+bool FileChannel::verifyFileChunkRetry(Data::File::FileChunkRetry const& message)
+{
+    return message.has_file_id() && message.has_offset() && hashTreeEnabled;
+}
+
+//
+// Chunk Framing
+//
+
+// FileChunk packets are the only ones large enough for copies to matter, so rather than
+// going through protobuf's generated code their wire format is written and read by hand;
+// the result is still an ordinary Packet{FileChunk} which any protobuf parser accepts
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+FileChannel::file_chunk FileChannel::readChunkFrame(
+    std::ifstream& stream,
+    tego_file_transfer_id_t id,
+    tego_file_size_t offset,
+    tego_file_size_t size)
+{
+    const auto chunkTag = WireFormatLite::MakeTag(Data::File::Packet::kFileChunkFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    const auto idTag = WireFormatLite::MakeTag(Data::File::FileChunk::kFileIdFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+    const auto offsetTag = WireFormatLite::MakeTag(Data::File::FileChunk::kOffsetFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+    const auto dataTag = WireFormatLite::MakeTag(Data::File::FileChunk::kChunkDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+    // every chunk says where it belongs, and its data goes last so the read can land
+    // directly at the end of the frame
+    const auto chunkSize = static_cast<uint32_t>(size);
+    const auto innerSize =
+        CodedOutputStream::VarintSize32(idTag) + CodedOutputStream::VarintSize32(id) +
+        CodedOutputStream::VarintSize32(offsetTag) + CodedOutputStream::VarintSize64(offset) +
+        CodedOutputStream::VarintSize32(dataTag) + CodedOutputStream::VarintSize32(chunkSize) + chunkSize;
+    const auto headerSize = static_cast<int>(
+        Channel::FrameHeaderSize +
+        CodedOutputStream::VarintSize32(chunkTag) + CodedOutputStream::VarintSize32(static_cast<uint32_t>(innerSize)) +
+        innerSize - chunkSize);
+
+    file_chunk chunk;
+    chunk.fileId = id;
+    chunk.offset = offset;
+    chunk.buffer = QByteArray(headerSize + static_cast<int>(chunkSize), Qt::Uninitialized);
+    chunk.dataOffset = headerSize;
+
+    auto out = reinterpret_cast<uint8_t*>(chunk.buffer.data()) + Channel::FrameHeaderSize;
+    out = CodedOutputStream::WriteVarint32ToArray(chunkTag, out);
+    out = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(innerSize), out);
+    out = CodedOutputStream::WriteVarint32ToArray(idTag, out);
+    out = CodedOutputStream::WriteVarint32ToArray(id, out);
+    out = CodedOutputStream::WriteVarint32ToArray(offsetTag, out);
+    out = CodedOutputStream::WriteVarint64ToArray(offset, out);
+    out = CodedOutputStream::WriteVarint32ToArray(dataTag, out);
+    out = CodedOutputStream::WriteVarint32ToArray(chunkSize, out);
+    Q_ASSERT(out == reinterpret_cast<uint8_t*>(chunk.buffer.data() + headerSize));
+
+    stream.read(chunk.buffer.data() + headerSize, static_cast<std::streamsize>(size));
+    // a short read shows up as a size mismatch in handleChunkRead()
+    chunk.size = static_cast<tego_file_size_t>(stream.gcount());
+    return chunk;
+}
+
+std::optional<FileChannel::file_chunk> FileChannel::parseFileChunk(const PacketView& packet)
+{
+    const auto begin = reinterpret_cast<const uint8_t*>(packet.constData());
+    CodedInputStream outer(begin, packet.size());
+
+    // only a Packet holding a FileChunk and nothing else, anything unusual is left to protobuf
+    uint32_t innerSize = 0;
+    if (outer.ReadTag() != WireFormatLite::MakeTag(Data::File::Packet::kFileChunkFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED) ||
+        !outer.ReadVarint32(&innerSize) ||
+        static_cast<qint64>(outer.CurrentPosition()) + innerSize != packet.size())
+    {
+        return std::nullopt;
+    }
+
+    const auto innerBegin = outer.CurrentPosition();
+    CodedInputStream inner(begin + innerBegin, static_cast<int>(innerSize));
+
+    file_chunk chunk;
+    bool hasId = false;
+    bool hasData = false;
+    while (const auto tag = inner.ReadTag())
+    {
+        if (tag == WireFormatLite::MakeTag(Data::File::FileChunk::kFileIdFieldNumber, WireFormatLite::WIRETYPE_VARINT))
+        {
+            uint32_t id = 0;
+            if (!inner.ReadVarint32(&id))
+            {
+                return std::nullopt;
+            }
+            chunk.fileId = id;
+            hasId = true;
+        }
+        else if (tag == WireFormatLite::MakeTag(Data::File::FileChunk::kOffsetFieldNumber, WireFormatLite::WIRETYPE_VARINT))
+        {
+            uint64_t offset = 0;
+            if (!inner.ReadVarint64(&offset))
+            {
+                return std::nullopt;
+            }
+            chunk.offset = offset;
+        }
+        else if (tag == WireFormatLite::MakeTag(Data::File::FileChunk::kChunkDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED))
+        {
+            // protobuf would keep the last of several, but no sender of ours repeats it
+            uint32_t size = 0;
+            if (hasData || !inner.ReadVarint32(&size))
+            {
+                return std::nullopt;
+            }
+            chunk.dataOffset = packet.offset() + innerBegin + inner.CurrentPosition();
+            chunk.size = size;
+            if (!inner.Skip(static_cast<int>(size)))
+            {
+                return std::nullopt;
+            }
+            hasData = true;
+        }
+        else if (!WireFormatLite::SkipField(&inner, tag))
+        {
+            return std::nullopt;
+        }
+    }
+
+    if (!hasId || !hasData || inner.CurrentPosition() != static_cast<int>(innerSize))
+    {
+        return std::nullopt;
+    }
+
+    // shares the connection's read buffer rather than copying out of it
+    chunk.buffer = packet.buffer();
+    return chunk;
+}
+
+void FileChannel::receivePacket(const PacketView &packet)
 {
+    // chunks make up nearly all of our traffic, so they skip the protobuf parser and its
+    // copy of the chunk data, and are handled straight out of the packet they arrived in
+    if (auto chunk = parseFileChunk(packet); chunk.has_value()) {
+        handleFileChunk(*chunk);
+        return;
+    }
+
     Data::File::Packet message;
     if (!message.ParseFromArray(packet.constData(), packet.size())) {
         emitFatalError("Failed to parse message on file channel", tego_file_transfer_result_failure, true);
@@ -238,13 +627,28 @@ void FileChannel::receivePacket(const QByteArray &packet)
     } else if (message.has_file_header_ack()) {
         handleFileHeaderAck(message.file_header_ack());
     } else if (message.has_file_chunk()) {
-        handleFileChunk(message.file_chunk());
+        // only reached for chunks encoded unlike our own, eg with fields repeated
+        const auto& fileChunk = message.file_chunk();
+        file_chunk chunk;
+        chunk.fileId = fileChunk.file_id();
+        if (fileChunk.has_offset()) {
+            chunk.offset = fileChunk.offset();
+        }
+        chunk.buffer = QByteArray::fromStdString(fileChunk.chunk_data());
+        chunk.size = static_cast<tego_file_size_t>(chunk.buffer.size());
+        handleFileChunk(chunk);
     } else if (message.has_file_header_response()) {
         handleFileHeaderResponse(message.file_header_response());
     } else if (message.has_file_chunk_ack()) {
         handleFileChunkAck(message.file_chunk_ack());
     } else if (message.has_file_transfer_complete_notification()) {
         handleFileTransferCompleteNotification(message.file_transfer_complete_notification());
+    } else if (message.has_file_hash_trailer()) {
+        handleFileHashTrailer(message.file_hash_trailer());
+    } else if (message.has_file_hash_tree_nodes()) {
+        handleFileHashTreeNodes(message.file_hash_tree_nodes());
+    } else if (message.has_file_chunk_retry()) {
+        handleFileChunkRetry(message.file_chunk_retry());
     } else {
         emitFatalError("Unrecognized file packet on FileChannel", tego_file_transfer_result_failure, true);
     }
@@ -257,6 +661,28 @@ void FileChannel::onConnectionClosed()
     this->emitFatalError("Connection Closed", tego_file_transfer_result_network_error, false);
 }
 
+void FileChannel::onWritable()
+{
+    if (direction() != Outbound)
+    {
+        return;
+    }
+
+    // every started transfer stopped filling its window when the connection backed up
+    std::vector<tego_file_transfer_id_t> ids;
+    for (const auto& [id, otr] : outgoingTransfers)
+    {
+        if (otr.started)
+        {
+            ids.push_back(id);
+        }
+    }
+    for (auto id : ids)
+    {
+        fillSendWindow(id);
+    }
+}
+
 //
 // Error Handling
 //
@@ -269,8 +695,10 @@ void FileChannel::emitFatalError(std::string&& message, tego_file_transfer_resul
     switch(direction())
     {
     case Inbound:
-        for(const auto& [id, itr] : incomingTransfers)
+        for(auto& [id, itr] : incomingTransfers)
         {
+            // transfers cut off by a dropped connection can be resumed later
+            itr.keepPartial = (error == tego_file_transfer_result_network_error);
             emit this->fileTransferFinished(id, tego_file_transfer_direction_receiving, error);
         }
         incomingTransfers.clear();
@@ -313,6 +741,8 @@ void FileChannel::emitNonFatalError(std::string&& message, tego_file_transfer_id
         {
             emit this->fileTransferFinished(id, tego_file_transfer_direction_sending, error);
             outgoingTransfers.erase(it);
+            // whatever is still queued of it would only be ignored
+            discardFlow(id);
         }
         break;
     default:
@@ -337,6 +767,9 @@ static_assert(has_compatible_file_id<Data::File::FileHeaderResponse>());
 static_assert(has_compatible_file_id<Data::File::FileChunk>());
 static_assert(has_compatible_file_id<Data::File::FileChunkAck>());
 static_assert(has_compatible_file_id<Data::File::FileTransferCompleteNotification>());
+static_assert(has_compatible_file_id<Data::File::FileHashTrailer>());
+static_assert(has_compatible_file_id<Data::File::FileHashTreeNodes>());
+static_assert(has_compatible_file_id<Data::File::FileChunkRetry>());
 
 
 void FileChannel::handleFileHeader(const Data::File::FileHeader &message)
@@ -355,10 +788,14 @@ void FileChannel::handleFileHeader(const Data::File::FileHeader &message)
         qWarning() << "Rejected file header with name containing '/'";
     }
     // ensure the hash is the correct length
-    else if (message.file_hash().size() != tego_file_hash::DIGEST_SIZE)
+    else if (message.has_file_hash() && message.file_hash().size() != tego_file_hash::DIGEST_SIZE)
     {
         qWarning() << "Rejected file header with hash incorrect length";
     }
+    else if (message.has_tree_root() && message.tree_root().size() != tego_file_hash::DIGEST_SIZE)
+    {
+        qWarning() << "Rejected file header with hash tree root incorrect length";
+    }
     else
     {
         // ensure that we can write a file this large
@@ -370,13 +807,29 @@ void FileChannel::handleFileHeader(const Data::File::FileHeader &message)
             }
         }
 
-        tego_file_hash fileHash;
-        const auto& digest = message.file_hash();
-        // copy our digest in directly
-        std::copy(digest.begin(), digest.end(), fileHash.data.begin());
+        // if the sender has not sent a hash, it will arrive in a trailer after the last chunk
+        std::optional<tego_file_hash> fileHash;
+        if (message.has_file_hash())
+        {
+            const auto& digest = message.file_hash();
+            fileHash.emplace();
+            // copy our digest in directly
+            std::copy(digest.begin(), digest.end(), fileHash->data.begin());
+        }
 
         const auto id = message.file_id();
-        incoming_transfer_record ifr(id, message.file_size(), fileHash.to_string());
+        incoming_transfer_record ifr(id, message.file_size(), fileHash ? fileHash->to_string() : std::string());
+
+        // with a hash tree, the verified root stands in for the file's hash
+        if (message.has_tree_root())
+        {
+            tego_file_hash root;
+            const auto& digest = message.tree_root();
+            std::copy(digest.begin(), digest.end(), root.data.begin());
+
+            ifr.hash = root.to_string();
+            ifr.tree.emplace(ifr.size, root);
+        }
 
         // signal the file transfer request
         emit this->fileTransferRequestReceived(id, QString::fromStdString(message.name()), ifr.size, std::move(fileHash));
@@ -433,8 +886,16 @@ void FileChannel::handleFileHeaderResponse(const Data::File::FileHeaderResponse
 
     if (response == tego_file_transfer_response_accept)
     {
-        sendNextChunk(id);
         it->second.beginTime = std::chrono::system_clock::now();
+        if (message.has_resume_offset())
+        {
+            resumeTransfer(id, message.resume_offset(), message.resume_prefix_hash());
+        }
+        else
+        {
+            it->second.started = true;
+            fillSendWindow(id);
+        }
     }
     else
     {
@@ -446,10 +907,11 @@ void FileChannel::handleFileHeaderResponse(const Data::File::FileHeaderResponse
         }
         // receiver rejected our transfer request, so erase it from our records
         outgoingTransfers.erase(it);
+        discardFlow(id);
     }
 }
 
-void FileChannel::handleFileChunk(const Data::File::FileChunk &message)
+void FileChannel::handleFileChunk(const file_chunk &chunk)
 {
     if (direction() != Inbound)
     {
@@ -457,7 +919,7 @@ void FileChannel::handleFileChunk(const Data::File::FileChunk &message)
         return;
     }
 
-    auto it = incomingTransfers.find(message.file_id());
+    auto it = incomingTransfers.find(chunk.fileId);
     if (it == incomingTransfers.end())
     {
         // we can receive an unknown chunk if we cancel in the middle of transmission
@@ -465,152 +927,305 @@ void FileChannel::handleFileChunk(const Data::File::FileChunk &message)
         qWarning() << "rejecting chunk for unknown file";
         return;
     }
-    else if (message.chunk_data().size() > FileMaxChunkSize)
+    else if (chunk.size > FileMaxChunkSize)
     {
         // something is very wrong in this case
         emitFatalError("Rejected FileChunk because of invalid chunk_data() size", tego_file_transfer_result_failure, true);
         return;
     }
-    else
+    else if (!it->second.stream)
     {
-        auto& itr = it->second;
-        const auto& chunk_data = message.chunk_data();
-        itr.stream.write(chunk_data.data(), chunk_data.size());
-
-        // emit progress callback
-        const auto id = message.file_id();
-        const auto streamOffset = static_cast<std::streamoff>(itr.stream.tellg());
-        if (streamOffset == std::streamoff(-1))
-        {
-            // we should send complete message to sender if we have a disk error so they do not spam us with chunks
-            // we can't do anything with; this transfer is not recoverable, but others can continue
-            emitNonFatalError("Error writing chunk to stream", id, tego_file_transfer_result_filesystem_error);
-
-            // send message to transfer partner to let them know we've given up
-            auto notification = std::make_unique<Data::File::FileTransferCompleteNotification>();
-            notification->set_file_id(id);
-            notification->set_result(Protocol::Data::File::Cancelled);
+        emitFatalError("Rejected FileChunk for transfer which has not been accepted", tego_file_transfer_result_failure, true);
+        return;
+    }
 
-            Data::File::Packet packet;
-            packet.set_allocated_file_transfer_complete_notification(notification.release());
-            Channel::sendMessage(packet);
+    const auto id = chunk.fileId;
+    auto& itr = it->second;
 
+    // after a corrupt chunk, everything the sender had in flight is dropped until the resend arrives
+    if (itr.retryOffset.has_value())
+    {
+        if (chunk.offset != itr.retryOffset)
+        {
             return;
         }
+        itr.retryOffset.reset();
+    }
 
-        const auto bytesWritten = static_cast<tego_file_size_t>(streamOffset);
-        const auto& bytesTotal = itr.size;
-
-        emit this->fileTransferProgress(id, tego_file_transfer_direction_receiving, bytesWritten, bytesTotal);
+    // the first chunk after we asked to resume says whether the sender is continuing from our offset
+    if (itr.pendingResume.has_value())
+    {
+        const auto offset = chunk.offset.value_or(0);
+        if (offset == 0)
+        {
+            // the sender's file did not match our partial copy (or it can't resume), so start over
+            qWarning() << "Sender did not resume transfer, starting over";
+            itr.hasher = tego_file_hasher();
+            itr.received = 0;
+            itr.written = 0;
 
-        auto response = std::make_unique<Data::File::FileChunkAck>();
-        response->set_file_id(message.file_id());
-        response->set_bytes_received(bytesWritten);
+            FileIOWorker::instance()->post([stream = itr.stream, partialDest = itr.partial_dest()]()
+            {
+                stream->close();
+                stream->open(partialDest, std::ios::out | std::ios::trunc | std::ios::binary);
+            });
+        }
+        else if (offset != *itr.pendingResume)
+        {
+            emitFatalError("Rejected FileChunk resuming from an offset we did not ask for", tego_file_transfer_result_failure, true);
+            return;
+        }
+        itr.pendingResume.reset();
+    }
+    else if (chunk.offset.has_value() && *chunk.offset != itr.received)
+    {
+        emitFatalError("Rejected FileChunk with unexpected offset", tego_file_transfer_result_failure, true);
+        return;
+    }
 
-        Data::File::Packet packet;
-        packet.set_allocated_file_chunk_ack(response.release());
-        Channel::sendMessage(packet);
+    if (chunk.size > itr.size - itr.received)
+    {
+        // this also catches chunks arriving while we wait on the hash trailer
+        emitFatalError("Rejected FileChunk which would exceed the advertised file size", tego_file_transfer_result_failure, true);
+        return;
+    }
+    else if (itr.received + chunk.size > itr.written + MaxWindowSize)
+    {
+        // chunks are only acknowledged once written, so the sender has ignored our acks
+        emitFatalError("Rejected FileChunk beyond the receive window", tego_file_transfer_result_failure, true);
+        return;
+    }
+    else
+    {
+        const auto chunkBegin = chunk.data();
+        const auto chunkEnd = chunkBegin + chunk.size;
 
-        if (bytesWritten == bytesTotal)
+        if (itr.tree)
         {
-            // reset the read/write stream and calculate the file hash
-            itr.stream.seekg(0);
-            tego_file_hash fileHash(itr.stream);
-            itr.stream.close();
-
-            if (fileHash.to_string() != itr.hash)
+            // each chunk must be exactly the leaf of the tree at its offset
+            const auto leafIndex = static_cast<size_t>(itr.received / tego_file_hash_tree::LEAF_SIZE);
+            if (itr.received % tego_file_hash_tree::LEAF_SIZE != 0 ||
+                chunk.size != std::min(tego_file_hash_tree::LEAF_SIZE, itr.size - itr.received) ||
+                !itr.tree->node(0, leafIndex).has_value())
             {
-                // delete file if calculated hash doesn't match expected
-                QFile::remove(QString::fromStdString(itr.partial_dest()));
-                emit this->fileTransferFinished(id, tego_file_transfer_direction_receiving, tego_file_transfer_result_bad_hash);
+                emitFatalError("Rejected FileChunk which does not line up with the hash tree", tego_file_transfer_result_failure, true);
+                return;
             }
-            else
+
+            if (!itr.tree->verify_leaf(leafIndex, chunkBegin, chunkEnd))
             {
-                // if a file already exists at our final destination, then remove it
-                const auto qDest = QString::fromStdString(itr.dest);
-                if (QFile::exists(qDest))
+                if (++itr.retries > MaxChunkRetries)
                 {
-                    QFile::remove(qDest);
+                    emitNonFatalError("Too many corrupt chunks, giving up on transfer", id, tego_file_transfer_result_bad_hash);
+                    sendFileTransferCompleteNotification(id, Protocol::Data::File::Cancelled);
+                    return;
                 }
 
-                // move our partial file to final destination
-                const auto qPartialDest = QString::fromStdString(itr.partial_dest());
-                if(QFile::rename(qPartialDest, qDest))
-                {
-                    emit this->fileTransferFinished(id, tego_file_transfer_direction_receiving, tego_file_transfer_result_success);
-                    logTransferStats(itr.size, itr.beginTime);
-                }
-                else
-                {
-                    emit this->fileTransferFinished(id, tego_file_transfer_direction_receiving, tego_file_transfer_result_filesystem_error);
-                }
+                // only this chunk onwards needs to be sent again
+                qWarning() << "Chunk failed verification, asking sender to resend from" << itr.received;
+                itr.retryOffset = itr.received;
+
+                auto retry = std::make_unique<Data::File::FileChunkRetry>();
+                retry->set_file_id(id);
+                retry->set_offset(itr.received);
+
+                Data::File::Packet packet;
+                packet.set_allocated_file_chunk_retry(retry.release());
+                Channel::sendMessage(packet);
+                return;
             }
-            incomingTransfers.erase(it);
+        }
+        else
+        {
+            itr.hasher.update(chunkBegin, chunkEnd);
+        }
 
-            // send complete notification to remote user
-            auto notification = std::make_unique<Data::File::FileTransferCompleteNotification>();
-            notification->set_file_id(id);
-            notification->set_result(Protocol::Data::File::Success);
+        itr.received += chunk.size;
+        if (itr.received == itr.size)
+        {
+            // every byte has been hashed as it arrived, so all that's left is to finish the digest;
+            // with a hash tree every leaf has been verified against the root already
+            itr.digest = itr.tree ? itr.tree->root() : itr.hasher.finalize();
+        }
+
+        // hand the chunk off to be written behind us; it's only acknowledged once it is on disk,
+        // so at most MaxWindowSize of each transfer is queued, and the worker caps the total
+        // the job shares the buffer the chunk arrived in, unless that holds a whole batch of
+        // packets read off the socket: then the chunk is copied out, so that what is queued
+        // is no more than what the worker is charged for it
+        file_chunk queuedChunk = chunk;
+        if (static_cast<tego_file_size_t>(queuedChunk.buffer.size()) > 2 * queuedChunk.size)
+        {
+            queuedChunk.buffer = QByteArray(chunk.data(), static_cast<int>(chunk.size));
+            queuedChunk.dataOffset = 0;
+        }
 
-            Data::File::Packet packet;
-            packet.set_allocated_file_transfer_complete_notification(notification.release());
-            Channel::sendMessage(packet);
+        const bool queued = FileIOWorker::instance()->tryPost(this, static_cast<size_t>(chunk.size),
+            [stream = itr.stream, chunk = std::move(queuedChunk)]() -> std::streamoff
+            {
+                stream->write(chunk.data(), static_cast<std::streamsize>(chunk.size));
+                return stream->tellp();
+            },
+            [this, id](std::streamoff streamOffset)
+            {
+                handleChunkWritten(id, streamOffset);
+            });
+        if (!queued)
+        {
+            emitFatalError("Too much received file data waiting to be written", tego_file_transfer_result_failure, true);
+            return;
         }
     }
 }
 
-void FileChannel::handleFileChunkAck(const Data::File::FileChunkAck &message)
+void FileChannel::handleChunkWritten(tego_file_transfer_id_t id, std::streamoff streamOffset)
 {
-    if (direction() != Outbound)
+    auto it = incomingTransfers.find(id);
+    if (it == incomingTransfers.end())
     {
-        emitFatalError("Rejected FileChunkAck message on incoming file channel", tego_file_transfer_result_failure, true);
+        // the transfer was cancelled or failed while the write was queued
         return;
     }
 
-    const auto id = message.file_id();
-
-    auto it = outgoingTransfers.find(id);
-    if (it == outgoingTransfers.end())
+    if (streamOffset == std::streamoff(-1))
     {
-        // we can get here if the sender cancels a transfer and an ack comes in from previously sent chunk
-        // not an error
-        qWarning() << "recieved ack for a chunk we never sent";
+        // we should send complete message to sender if we have a disk error so they do not spam us with chunks
+        // we can't do anything with; this transfer is not recoverable, but others can continue
+        emitNonFatalError("Error writing chunk to stream", id, tego_file_transfer_result_filesystem_error);
+
+        // send message to transfer partner to let them know we've given up
+        sendFileTransferCompleteNotification(id, Protocol::Data::File::Cancelled);
         return;
     }
 
-    const auto& otr = it->second;
+    auto& itr = it->second;
+    itr.written = static_cast<tego_file_size_t>(streamOffset);
+    const auto& bytesTotal = itr.size;
 
-    // verify the ack corresponds to how many bytes we've sent
-    if (message.bytes_received() != otr.offset)
-    {
-        // acks currently always come between sending chunks, so our bytes sent and their bytes received should
-        // not diverge
-        emitFatalError("mismatch between bytes we have sent and the bytes the receiver claims to have received", tego_file_transfer_result_failure, true);
-        return;
-    }
+    // emit progress callback
+    emit this->fileTransferProgress(id, tego_file_transfer_direction_receiving, itr.written, bytesTotal);
+
+    auto response = std::make_unique<Data::File::FileChunkAck>();
+    response->set_file_id(id);
+    response->set_bytes_received(itr.written);
 
-    emit this->fileTransferProgress(otr.id, tego_file_transfer_direction_receiving, otr.offset, otr.size);
+    Data::File::Packet packet;
+    packet.set_allocated_file_chunk_ack(response.release());
+    Channel::sendMessage(packet);
 
-    // send the next chunk until we are done
-    if(otr.offset < otr.size)
+    // otherwise we're still waiting on more chunks or the sender's FileHashTrailer
+    if (itr.written == bytesTotal && !itr.hash.empty())
     {
-        sendNextChunk(id);
+        finishIncomingTransfer(it);
     }
 }
 
-// statically verify that our tego_file_transfer_result_t enum matches the FileTransferResult enum
-typedef int file_transfer_result_underlying_t;
-constexpr bool operator==(Protocol::Data::File::FileTransferResult left, tego_file_transfer_result_t right)
+void FileChannel::finishIncomingTransfer(std::map<tego_file_transfer_id_t, incoming_transfer_record>::iterator it)
 {
-    return static_cast<file_transfer_result_underlying_t>(left) == static_cast<file_transfer_result_underlying_t>(right);
-}
+    const auto id = it->first;
+    auto& itr = it->second;
+    Q_ASSERT(itr.digest.has_value() && itr.written == itr.size && !itr.hash.empty());
+
+    // closing flushes the final bytes to disk and renaming may have to copy across
+    // filesystems, so leave both to the I/O worker
+    FileIOWorker::instance()->post(this,
+        [stream = itr.stream,
+         hashMatches = (itr.digest->to_string() == itr.hash),
+         qPartialDest = QString::fromStdString(itr.partial_dest()),
+         qDest = QString::fromStdString(itr.dest)]() -> tego_file_transfer_result_t
+        {
+            stream->close();
 
-constexpr bool operator==(tego_file_transfer_result_t left, Protocol::Data::File::FileTransferResult right)
-{
-    return right == left;
-}
+            if (stream->fail())
+            {
+                // flushing the final bytes to disk failed, so the file on disk does not match what we hashed
+                QFile::remove(qPartialDest);
+                return tego_file_transfer_result_filesystem_error;
+            }
+            else if (!hashMatches)
+            {
+                // delete file if calculated hash doesn't match expected
+                QFile::remove(qPartialDest);
+                return tego_file_transfer_result_bad_hash;
+            }
 
-static_assert(Protocol::Data::File::Success == tego_file_transfer_result_success);
+            // if a file already exists at our final destination, then remove it
+            if (QFile::exists(qDest))
+            {
+                QFile::remove(qDest);
+            }
+
+            // move our partial file to final destination
+            return QFile::rename(qPartialDest, qDest) ? tego_file_transfer_result_success : tego_file_transfer_result_filesystem_error;
+        },
+        [this, id, size = itr.size, beginTime = itr.beginTime, digest = *itr.digest](tego_file_transfer_result_t result)
+        {
+            if (result == tego_file_transfer_result_success)
+            {
+                emit this->fileTransferHashKnown(id, tego_file_transfer_direction_receiving, digest);
+            }
+            emit this->fileTransferFinished(id, tego_file_transfer_direction_receiving, result);
+            if (result == tego_file_transfer_result_success)
+            {
+                logTransferStats(size, beginTime);
+            }
+        });
+    incomingTransfers.erase(it);
+
+    // send complete notification to remote user
+    sendFileTransferCompleteNotification(id, Protocol::Data::File::Success);
+}
+
+void FileChannel::handleFileChunkAck(const Data::File::FileChunkAck &message)
+{
+    if (direction() != Outbound)
+    {
+        emitFatalError("Rejected FileChunkAck message on incoming file channel", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    const auto id = message.file_id();
+
+    auto it = outgoingTransfers.find(id);
+    if (it == outgoingTransfers.end())
+    {
+        // we can get here if the sender cancels a transfer and an ack comes in from previously sent chunk
+        // not an error
+        qWarning() << "recieved ack for a chunk we never sent";
+        return;
+    }
+
+    auto& otr = it->second;
+
+    // acks are cumulative, so each one must move forward and can never claim
+    // more than we have actually sent
+    const auto bytesReceived = message.bytes_received();
+    if (bytesReceived <= otr.acked || bytesReceived > otr.offset)
+    {
+        emitFatalError("mismatch between bytes we have sent and the bytes the receiver claims to have received", tego_file_transfer_result_failure, true);
+        return;
+    }
+    otr.acked = bytesReceived;
+
+    emit this->fileTransferProgress(otr.id, tego_file_transfer_direction_sending, otr.acked, otr.size);
+
+    // top up the window now that some of it has drained
+    fillSendWindow(id);
+}
+
+// statically verify that our tego_file_transfer_result_t enum matches the FileTransferResult enum
+typedef int file_transfer_result_underlying_t;
+constexpr bool operator==(Protocol::Data::File::FileTransferResult left, tego_file_transfer_result_t right)
+{
+    return static_cast<file_transfer_result_underlying_t>(left) == static_cast<file_transfer_result_underlying_t>(right);
+}
+
+constexpr bool operator==(tego_file_transfer_result_t left, Protocol::Data::File::FileTransferResult right)
+{
+    return right == left;
+}
+
+static_assert(Protocol::Data::File::Success == tego_file_transfer_result_success);
 static_assert(Protocol::Data::File::Cancelled == tego_file_transfer_result_cancelled);
 static_assert(Protocol::Data::File::Failure == tego_file_transfer_result_failure);
 
@@ -640,6 +1255,7 @@ void FileChannel::handleFileTransferCompleteNotification(const Data::File::FileT
             }
 
             outgoingTransfers.erase(it);
+            discardFlow(id);
             emit fileTransferFinished(id, tego_file_transfer_direction_sending, static_cast<tego_file_transfer_result_t>(message.result()));
             return;
         }
@@ -650,8 +1266,278 @@ void FileChannel::handleFileTransferCompleteNotification(const Data::File::FileT
     qWarning() << "received cancel request for unknown transfer:" << id;
 }
 
+void FileChannel::handleFileHashTrailer(const Data::File::FileHashTrailer &message)
+{
+    if (direction() != Inbound)
+    {
+        emitFatalError("Rejected FileHashTrailer message on outbound file channel", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    const auto id = message.file_id();
+    auto it = incomingTransfers.find(id);
+    if (it == incomingTransfers.end())
+    {
+        // we can receive a trailer for an unknown transfer if we cancel in the middle of transmission
+        qWarning() << "rejecting hash trailer for unknown file";
+        return;
+    }
+
+    auto& itr = it->second;
+    if (!itr.hash.empty())
+    {
+        // the sender either sent the hash in the header or has sent a trailer twice
+        emitFatalError("Rejected FileHashTrailer for transfer which already has a hash", tego_file_transfer_result_failure, true);
+        return;
+    }
+    else if (message.file_hash().size() != tego_file_hash::DIGEST_SIZE)
+    {
+        emitFatalError("Rejected FileHashTrailer with hash incorrect length", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    tego_file_hash fileHash;
+    const auto& digest = message.file_hash();
+    std::copy(digest.begin(), digest.end(), fileHash.data.begin());
+    itr.hash = fileHash.to_string();
+
+    // the trailer follows the last chunk, but we may still be writing it
+    if (itr.written == itr.size)
+    {
+        finishIncomingTransfer(it);
+    }
+}
+
+void FileChannel::handleFileHashTreeNodes(const Data::File::FileHashTreeNodes &message)
+{
+    if (direction() != Inbound)
+    {
+        emitFatalError("Rejected FileHashTreeNodes message on outbound file channel", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    const auto id = message.file_id();
+    auto it = incomingTransfers.find(id);
+    if (it == incomingTransfers.end())
+    {
+        // we can receive nodes for an unknown transfer if we cancel in the middle of transmission
+        qWarning() << "rejecting hash tree nodes for unknown file";
+        return;
+    }
+
+    auto& itr = it->second;
+    if (!itr.tree ||
+        message.level() == 0 ||
+        message.level() >= itr.tree->height() ||
+        message.index() >= itr.tree->level_size(message.level()))
+    {
+        emitFatalError("Rejected FileHashTreeNodes for a node which does not exist", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    std::vector<tego_file_hash> children;
+    children.reserve(message.child_hashes_size());
+    for (const auto& digest : message.child_hashes())
+    {
+        if (digest.size() != tego_file_hash::DIGEST_SIZE)
+        {
+            emitFatalError("Rejected FileHashTreeNodes with hash incorrect length", tego_file_transfer_result_failure, true);
+            return;
+        }
+        auto& child = children.emplace_back();
+        std::copy(digest.begin(), digest.end(), child.data.begin());
+    }
+
+    if (!itr.tree->add_children(message.level(), static_cast<size_t>(message.index()), std::move(children)))
+    {
+        // the sender's tree doesn't add up, so nothing it sends for this file can be trusted
+        emitNonFatalError("Hash tree nodes do not match their parent", id, tego_file_transfer_result_bad_hash);
+        sendFileTransferCompleteNotification(id, Protocol::Data::File::Cancelled);
+    }
+}
+
+void FileChannel::handleFileChunkRetry(const Data::File::FileChunkRetry &message)
+{
+    if (direction() != Outbound)
+    {
+        emitFatalError("Rejected FileChunkRetry message on inbound file channel", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    const auto id = message.file_id();
+    auto it = outgoingTransfers.find(id);
+    if (it == outgoingTransfers.end())
+    {
+        // the transfer may have been cancelled since the receiver sent this
+        qWarning() << "received chunk retry for unknown transfer";
+        return;
+    }
+
+    auto& otr = it->second;
+    const auto offset = message.offset();
+    if (!otr.tree ||
+        offset % tego_file_hash_tree::LEAF_SIZE != 0 ||
+        offset < otr.acked ||
+        offset >= otr.offset)
+    {
+        emitFatalError("Rejected FileChunkRetry with invalid offset", tego_file_transfer_result_failure, true);
+        return;
+    }
+
+    qWarning() << "Receiver asked for chunks to be resent from" << offset;
+
+    // forget everything read or sent beyond the corrupt chunk and go back for it
+    otr.offset = offset;
+    otr.readOffset = offset;
+    otr.readAhead.clear();
+    otr.pendingReads = 0;
+    ++otr.readGeneration;
+
+    // queued behind any reads still in progress, which will now be dropped
+    FileIOWorker::instance()->post([stream = otr.stream, offset]()
+    {
+        stream->clear();
+        stream->seekg(static_cast<std::streamoff>(offset));
+    });
+
+    fillSendWindow(id);
+}
+
+tego_file_size_t FileChannel::sendWindowSize() const
+{
+    return sendWindow;
+}
+
+void FileChannel::setSendWindowSize(tego_file_size_t bytes)
+{
+    // a window smaller than one chunk would stall transfers entirely, and receivers
+    // refuse chunks beyond MaxWindowSize
+    sendWindow = std::clamp(bytes, FileMaxChunkSize, MaxWindowSize);
+
+    // a larger window applies to transfers already in progress
+    if (direction() == Outbound)
+    {
+        std::vector<tego_file_transfer_id_t> ids;
+        for(const auto& [id, otr] : outgoingTransfers)
+        {
+            // only fill transfers which have been accepted and started
+            if (otr.started)
+            {
+                ids.push_back(id);
+            }
+        }
+        for(auto id : ids)
+        {
+            fillSendWindow(id);
+        }
+    }
+}
+
+void FileChannel::resumeTransfer(tego_file_transfer_id_t id, tego_file_size_t offset, const std::string& prefixHash)
+{
+    auto it = outgoingTransfers.find(id);
+    Q_ASSERT(it != outgoingTransfers.end());
+    auto& otr = it->second;
+
+    if (offset == 0 ||
+        offset >= otr.size ||
+        prefixHash.size() != tego_file_hash::DIGEST_SIZE ||
+        (otr.tree && offset % tego_file_hash_tree::LEAF_SIZE != 0))
+    {
+        qWarning() << "Ignoring invalid request to resume file transfer";
+        otr.started = true;
+        fillSendWindow(id);
+        return;
+    }
+
+    tego_file_hash expectedHash;
+    std::copy(prefixHash.begin(), prefixHash.end(), expectedHash.data.begin());
+
+    FileIOWorker::instance()->post(this,
+        [stream = otr.stream, offset, expectedHash]() -> std::optional<tego_file_hasher>
+        {
+            // the prefix is hashed from the start of the file, wherever earlier reads left the stream
+            stream->clear();
+            stream->seekg(0);
+
+            tego_file_hasher hasher;
+            if (hashStreamPrefix(*stream, offset, hasher) &&
+                tego_file_hasher(hasher).finalize().data == expectedHash.data)
+            {
+                // the stream is now positioned right where the receiver left off
+                return hasher;
+            }
+
+            stream->clear();
+            stream->seekg(0);
+            return std::nullopt;
+        },
+        [this, id, offset](std::optional<tego_file_hasher> hasher)
+        {
+            auto it = outgoingTransfers.find(id);
+            if (it == outgoingTransfers.end())
+            {
+                return;
+            }
+            auto& otr = it->second;
+
+            // the hash moved the stream, so anything read before it is from the wrong place
+            otr.readAhead.clear();
+            otr.pendingReads = 0;
+            ++otr.readGeneration;
+
+            if (hasher)
+            {
+                otr.offset = offset;
+                otr.acked = offset;
+                otr.readOffset = offset;
+                // a trailer hash has to cover the bytes the receiver already has too
+                if (otr.hasher)
+                {
+                    otr.hasher = std::move(hasher);
+                }
+                emit this->fileTransferProgress(id, tego_file_transfer_direction_sending, otr.acked, otr.size);
+            }
+            else
+            {
+                qWarning() << "Receiver's partial file does not match ours, sending the whole file";
+                otr.offset = 0;
+                otr.acked = 0;
+                otr.readOffset = 0;
+                if (otr.hasher)
+                {
+                    otr.hasher.emplace();
+                }
+            }
+            otr.started = true;
+            fillSendWindow(id);
+        });
+}
+
+bool FileChannel::hashTreePreferred() const
+{
+    return preferHashTree;
+}
+
+void FileChannel::setHashTreePreferred(bool preferred)
+{
+    preferHashTree = preferred;
+}
+
+bool FileChannel::setTransferRateLimit(tego_file_transfer_id_t id, qint64 bytesPerSecond)
+{
+    if (direction() != Outbound || !outgoingTransfers.contains(id))
+    {
+        return false;
+    }
+
+    // each transfer's chunks are their own flow on the connection
+    setFlowRateLimit(id, bytesPerSecond);
+    return true;
+}
+
 bool FileChannel::sendFileWithId(QString file_uri,
-                                 tego_file_hash_t const& file_hash,
+                                 std::optional<tego_file_hash_t> const& file_hash,
                                  QDateTime,
                                  tego_file_transfer_id_t file_id)
 {
@@ -690,26 +1576,132 @@ bool FileChannel::sendFileWithId(QString file_uri,
     // create our record
     const auto filePath = canonicalFilePath.toStdString();
     outgoing_transfer_record otr(file_id, filePath, fileSize);
-    if (!otr.stream.is_open())
+    if (!otr.stream->is_open())
     {
         qWarning() << "Failed to open file for sending header";
         // this error state is bubbled up to ConversationModel
         return false;
     }
-    outgoingTransfers.insert({file_id, std::move(otr)});
 
-    // send file header to recipient
     auto header = std::make_unique<Data::File::FileHeader>();
     header->set_file_id(file_id);
     header->set_file_size(fileSize);
-    header->set_file_hash(file_hash.data.data(), file_hash.data.size());
     header->set_name(fi.fileName().toStdString());
 
+    if (preferHashTree && hashTreeEnabled)
+    {
+        // the tree's root goes in the header, so the whole tree is built first; its
+        // leaves are hashed in parallel on the I/O worker
+        outgoingTransfers.insert({file_id, std::move(otr)});
+
+        FileIOWorker::instance()->post(this,
+            [filePath, fileSize]() -> std::shared_ptr<const tego_file_hash_tree>
+            {
+                try
+                {
+                    return std::make_shared<const tego_file_hash_tree>(
+                        tego_file_hash_tree::from_file(filePath, fileSize, std::thread::hardware_concurrency()));
+                }
+                catch(...)
+                {
+                    return nullptr;
+                }
+            },
+            [this, file_id, header = std::shared_ptr<Data::File::FileHeader>(std::move(header))](std::shared_ptr<const tego_file_hash_tree> tree)
+            {
+                auto it = outgoingTransfers.find(file_id);
+                if (it == outgoingTransfers.end())
+                {
+                    // cancelled while we were hashing
+                    return;
+                }
+                else if (!tree)
+                {
+                    emitNonFatalError("Failed to build hash tree for file", file_id, tego_file_transfer_result_filesystem_error);
+                    return;
+                }
+
+                auto& otr = it->second;
+                otr.tree = tree;
+                otr.nodesSent.assign(tree->height(), 0);
+
+                const auto& root = tree->root();
+                header->set_tree_root(root.data.data(), root.data.size());
+
+                Data::File::Packet packet;
+                packet.set_allocated_file_header(new Data::File::FileHeader(*header));
+                Channel::sendMessage(packet);
+
+                emit this->fileTransferHashKnown(file_id, tego_file_transfer_direction_sending, root);
+            });
+
+        return true;
+    }
+    else if (file_hash.has_value())
+    {
+        header->set_file_hash(file_hash->data.data(), file_hash->data.size());
+    }
+    else if (hashTrailerEnabled)
+    {
+        // hash the file as we send it, the digest is sent after the last chunk
+        otr.hasher.emplace();
+    }
+    else
+    {
+        // our peer needs the hash up front, so we have no choice but to read the file twice;
+        // the first pass happens on the I/O worker and the header follows once it's done
+        outgoingTransfers.insert({file_id, std::move(otr)});
+
+        auto cache = g_globals.fileHashCache;
+        FileIOWorker::instance()->post(this,
+            [filePath, cache = std::move(cache)]() -> std::optional<tego_file_hash>
+            {
+                try
+                {
+                    return cache ? cache->hash_file(filePath) : tego_file_hash::from_file(filePath);
+                }
+                catch(...)
+                {
+                    return std::nullopt;
+                }
+            },
+            [this, file_id, header = std::shared_ptr<Data::File::FileHeader>(std::move(header))](std::optional<tego_file_hash> fileHash)
+            {
+                if (!outgoingTransfers.contains(file_id))
+                {
+                    // cancelled while we were hashing
+                    return;
+                }
+                else if (!fileHash)
+                {
+                    emitNonFatalError("Failed to hash file", file_id, tego_file_transfer_result_filesystem_error);
+                    return;
+                }
+
+                header->set_file_hash(fileHash->data.data(), fileHash->data.size());
+
+                Data::File::Packet packet;
+                packet.set_allocated_file_header(new Data::File::FileHeader(*header));
+                Channel::sendMessage(packet);
+
+                emit this->fileTransferHashKnown(file_id, tego_file_transfer_direction_sending, *fileHash);
+            });
+
+        return true;
+    }
+    outgoingTransfers.insert({file_id, std::move(otr)});
+
+    // send file header to recipient
     Data::File::Packet packet;
     packet.set_allocated_file_header(header.release());
 
     Channel::sendMessage(packet);
 
+    if (file_hash.has_value())
+    {
+        emit this->fileTransferHashKnown(file_id, tego_file_transfer_direction_sending, *file_hash);
+    }
+
     // the first chunk will get sent after the header reponse
     return true;
 }
@@ -721,18 +1713,78 @@ void FileChannel::acceptFile(tego_file_transfer_id_t id, const std::string& dest
     auto& itr = it->second;
 
     itr.beginTime = std::chrono::system_clock::now();
-    itr.open_stream(dest);
+    itr.dest = dest;
+
+    // opening the destination may mean hashing what an interrupted transfer left behind,
+    // so it's done on the I/O worker and our response follows once it's ready
+    FileIOWorker::instance()->post(this,
+        [size = itr.size,
+         hash = itr.hash,
+         partialDest = itr.partial_dest(),
+         resumeRecordPath = itr.resume_record_path(),
+         alignment = itr.tree ? tego_file_hash_tree::LEAF_SIZE : 1]()
+        {
+            return openPartialFile(size, hash, partialDest, resumeRecordPath, alignment);
+        },
+        [this, id](std::shared_ptr<partial_file> partialFile)
+        {
+            handlePartialFileOpened(id, partialFile);
+        });
+}
+
+void FileChannel::handlePartialFileOpened(tego_file_transfer_id_t id, const std::shared_ptr<partial_file>& partialFile)
+{
+    auto it = incomingTransfers.find(id);
+    if (it == incomingTransfers.end())
+    {
+        // cancelled while we were opening the file, so nobody else is going to clean it up
+        FileIOWorker::instance()->post([stream = partialFile->stream, partialDest = partialFile->path]()
+        {
+            stream->close();
+            QFile::remove(QString::fromStdString(partialDest));
+        });
+        return;
+    }
+    auto& itr = it->second;
+
+    if (!partialFile->stream->is_open())
+    {
+        auto response = std::make_unique<Data::File::FileHeaderResponse>();
+        response->set_response(tego_file_transfer_response_reject);
+        response->set_file_id(id);
+
+        Data::File::Packet packet;
+        packet.set_allocated_file_header_response(response.release());
+        Channel::sendMessage(packet);
+
+        emitNonFatalError("Failed to open file for writing", id, tego_file_transfer_result_filesystem_error);
+        return;
+    }
+
+    itr.stream = partialFile->stream;
+    itr.hasher = std::move(partialFile->hasher);
+    itr.received = partialFile->offset;
+    itr.written = partialFile->offset;
 
     auto response = std::make_unique<Data::File::FileHeaderResponse>();
     response->set_response(tego_file_transfer_response_accept);
     response->set_file_id(id);
 
+    if (partialFile->offset > 0)
+    {
+        // ask the sender to continue from the end of our partial file, if it is a prefix of theirs
+        const auto prefixHash = tego_file_hasher(itr.hasher).finalize();
+        response->set_resume_offset(partialFile->offset);
+        response->set_resume_prefix_hash(prefixHash.data.data(), prefixHash.data.size());
+        itr.pendingResume = partialFile->offset;
+    }
+
     Data::File::Packet packet;
     packet.set_allocated_file_header_response(response.release());
     Channel::sendMessage(packet);
 
     // emit starting transfer progress callback
-    emit this->fileTransferProgress(id, tego_file_transfer_direction_receiving, 0, it->second.size);
+    emit this->fileTransferProgress(id, tego_file_transfer_direction_receiving, itr.written, itr.size);
 }
 
 void FileChannel::rejectFile(tego_file_transfer_id_t id)
@@ -774,6 +1826,7 @@ bool FileChannel::cancelTransfer(tego_file_transfer_id_t id)
         if (auto it = outgoingTransfers.find(id); it != outgoingTransfers.end())
         {
             outgoingTransfers.erase(it);
+            discardFlow(id);
         }
         else
         {
@@ -785,65 +1838,225 @@ bool FileChannel::cancelTransfer(tego_file_transfer_id_t id)
     }
 
     // finally send cancel notification to remote user
-    auto notification = std::make_unique<Data::File::FileTransferCompleteNotification>();
-    notification->set_file_id(id);
-    notification->set_result(Protocol::Data::File::Cancelled);
-
-    Data::File::Packet packet;
-    packet.set_allocated_file_transfer_complete_notification(notification.release());
-    Channel::sendMessage(packet);
+    sendFileTransferCompleteNotification(id, Protocol::Data::File::Cancelled);
 
     emit fileTransferFinished(id, tego_file_transfer_direction_receiving, tego_file_transfer_result_cancelled);
 
     return true;
 }
 
-void FileChannel::sendNextChunk(tego_file_transfer_id_t id)
+bool FileChannel::sendNextChunk(tego_file_transfer_id_t id, outgoing_transfer_record& otr)
 {
     Q_ASSERT(direction() == Outbound);
+    Q_ASSERT(otr.finished() == false);
+    Q_ASSERT(!otr.readAhead.empty());
+
+    if (otr.tree && !sendHashTreeNodes(id, otr))
+    {
+        return false;
+    }
 
-    if (auto it = outgoingTransfers.find(id); it != outgoingTransfers.end())
+    // the next chunk the I/O worker has read for us stays at the front of the read
+    // ahead until the connection takes it, so a refused send leaves the transfer as it was
+    auto& chunk = otr.readAhead.front();
+    Q_ASSERT(chunk.size <= FileMaxChunkSize);
+    Q_ASSERT(chunk.offset == otr.offset);
+    const auto chunkSize = chunk.size;
+
+    // the frame is gone once it has been sent, so hash it beforehand into a copy
+    // of the hasher which we only keep if the send goes through
+    std::optional<tego_file_hasher> hasher;
+    if (otr.hasher)
     {
-        auto& otr = it->second;
+        hasher.emplace(*otr.hasher);
+        hasher->update(chunk.data(), chunk.data() + chunkSize);
+    }
 
-        // make sure our offset and the stream offset agree
-        Q_ASSERT(otr.finished() == false);
-        Q_ASSERT(otr.offset == static_cast<tego_file_size_t>(otr.stream.tellg()));
+    // the I/O worker read the chunk straight into a complete frame, so send that as is,
+    // scheduled fairly against our other transfers and behind any chat or control traffic
+    if (!Channel::sendBulkFrame(id, std::move(chunk.buffer)))
+    {
+        return false;
+    }
 
-        // read the next chunk to our buffer, and update our offset
-        otr.stream.read(this->chunkBuffer, FileMaxChunkSize);
-        const auto chunkSize = otr.stream.gcount();
-        // ensure we read a valid value
-        static_assert(FileMaxChunkSize != std::numeric_limits<std::streamsize>::max());
-        if (chunkSize == std::numeric_limits<std::streamsize>::max())
-        {
-            // not quite a fatal error, but we need to cleanup this transfer
-            emitNonFatalError("Problem reading the next chunk from disk", id, tego_file_transfer_result_filesystem_error);
+    otr.readAhead.pop_front();
+    otr.offset += chunkSize;
+    if (otr.hasher)
+    {
+        otr.hasher = std::move(hasher);
+    }
 
-            // send message to transfer partner to let them know we've given up
-            auto notification = std::make_unique<Data::File::FileTransferCompleteNotification>();
-            notification->set_file_id(id);
-            notification->set_result(Protocol::Data::File::Cancelled);
+    // having now read the whole file we know its hash, which follows in a trailer
+    if (otr.finished() && otr.hasher)
+    {
+        otr.trailerHash = otr.hasher->finalize();
+        otr.hasher.reset();
 
-            Data::File::Packet packet;
-            packet.set_allocated_file_transfer_complete_notification(notification.release());
-            Channel::sendMessage(packet);
+        emit this->fileTransferHashKnown(id, tego_file_transfer_direction_sending, *otr.trailerHash);
+    }
+    return true;
+}
 
-            return;
+bool FileChannel::sendHashTrailer(tego_file_transfer_id_t id, outgoing_transfer_record& otr)
+{
+    Q_ASSERT(otr.trailerHash);
+
+    auto trailer = std::make_unique<Data::File::FileHashTrailer>();
+    trailer->set_file_id(id);
+    trailer->set_file_hash(otr.trailerHash->data.data(), otr.trailerHash->data.size());
+
+    Data::File::Packet trailerPacket;
+    trailerPacket.set_allocated_file_hash_trailer(trailer.release());
+    if (!Channel::sendBulkMessage(id, trailerPacket))
+    {
+        return false;
+    }
+
+    otr.trailerHash.reset();
+    return true;
+}
+
+bool FileChannel::sendHashTreeNodes(tego_file_transfer_id_t id, outgoing_transfer_record& otr)
+{
+    Q_ASSERT(otr.tree);
+    const auto& tree = *otr.tree;
+
+    // walk down from the root towards the next chunk's leaf, sending the children of any
+    // node on the way which the receiver hasn't had yet; after a resume that may mean
+    // skipping ahead, and after a retry they have already been sent
+    auto ancestor = static_cast<size_t>(otr.offset / tego_file_hash_tree::LEAF_SIZE);
+    std::vector<size_t> ancestors(tree.height());
+    for (size_t level = 0; level < tree.height(); ++level)
+    {
+        ancestors[level] = ancestor;
+        ancestor /= tego_file_hash_tree::FANOUT;
+    }
+
+    for (auto level = tree.height() - 1; level > 0; --level)
+    {
+        const auto index = ancestors[level];
+        if (index < otr.nodesSent[level])
+        {
+            continue;
         }
-        Q_ASSERT(static_cast<tego_file_size_t>(chunkSize) <= FileMaxChunkSize);
 
-        otr.offset += chunkSize;
+        auto nodes = std::make_unique<Data::File::FileHashTreeNodes>();
+        nodes->set_file_id(id);
+        nodes->set_level(static_cast<uint32_t>(level));
+        nodes->set_index(index);
 
-        // build our chunk
-        auto chunk = std::make_unique<Data::File::FileChunk>();
-        chunk->set_file_id(id);
-        chunk->set_chunk_data(std::begin(chunkBuffer), chunkSize);
+        const auto first = tree.first_child(index);
+        for (auto i = first; i < first + tree.child_count(level, index); ++i)
+        {
+            const auto& child = *tree.node(level - 1, i);
+            nodes->add_child_hashes(child.data.data(), child.data.size());
+        }
 
         Data::File::Packet packet;
-        packet.set_allocated_file_chunk(chunk.release());
+        packet.set_allocated_file_hash_tree_nodes(nodes.release());
+        // must stay ahead of the chunks they describe, so they share the chunks' flow
+        if (!Channel::sendBulkMessage(id, packet))
+        {
+            return false;
+        }
 
-        // send the chunk
-        Channel::sendMessage(packet);
+        otr.nodesSent[level] = index + 1;
+    }
+    return true;
+}
+
+void FileChannel::fillSendWindow(tego_file_transfer_id_t id)
+{
+    Q_ASSERT(direction() == Outbound);
+
+    auto it = outgoingTransfers.find(id);
+    if (it == outgoingTransfers.end())
+    {
+        return;
+    }
+    auto& otr = it->second;
+
+    // stop short of the window if the connection is backed up, onWritable() picks up from here
+    bool refused = false;
+    while (!refused && !otr.readAhead.empty() && otr.inFlight() < sendWindow && isWritable())
+    {
+        refused = !sendNextChunk(id, otr);
+    }
+    if (!refused && otr.trailerHash)
+    {
+        refused = !sendHashTrailer(id, otr);
+    }
+
+    // the connection refuses bulk packets once it has closed, which onConnectionClosed()
+    // deals with, or when it is too far backed up, and then onWritable() retries; if it is
+    // neither nothing would ever retry, so give up on the transfer
+    if (refused)
+    {
+        if (isWritable() && connection()->isConnected())
+        {
+            emitNonFatalError("Connection refused the next packet of an outgoing file transfer", id, tego_file_transfer_result_network_error);
+            sendFileTransferCompleteNotification(id, Protocol::Data::File::Cancelled);
+        }
+        return;
     }
+
+    // keep a few chunks ahead of the network so an ack never has to wait on the disk
+    while (otr.readOffset < otr.size && otr.pendingReads + otr.readAhead.size() < ReadAheadChunks)
+    {
+        const auto chunkSize = std::min(FileMaxChunkSize, otr.size - otr.readOffset);
+        otr.readOffset += chunkSize;
+        ++otr.pendingReads;
+
+        FileIOWorker::instance()->post(this,
+            [stream = otr.stream, id, offset = otr.readOffset - chunkSize, chunkSize]() -> file_chunk
+            {
+                return readChunkFrame(*stream, id, offset, chunkSize);
+            },
+            [this, id, readGeneration = otr.readGeneration, chunkSize](file_chunk chunk)
+            {
+                handleChunkRead(id, readGeneration, chunkSize, std::move(chunk));
+            });
+    }
+}
+
+void FileChannel::handleChunkRead(tego_file_transfer_id_t id, size_t readGeneration, tego_file_size_t expectedSize, file_chunk&& chunk)
+{
+    auto it = outgoingTransfers.find(id);
+    if (it == outgoingTransfers.end())
+    {
+        // the transfer was cancelled or failed while the read was queued
+        return;
+    }
+
+    auto& otr = it->second;
+    if (readGeneration != otr.readGeneration)
+    {
+        // read from before the transfer was rewound
+        return;
+    }
+    --otr.pendingReads;
+
+    if (chunk.size != expectedSize)
+    {
+        // not quite a fatal error, but we need to cleanup this transfer
+        emitNonFatalError("Problem reading the next chunk from disk", id, tego_file_transfer_result_filesystem_error);
+
+        // send message to transfer partner to let them know we've given up
+        sendFileTransferCompleteNotification(id, Protocol::Data::File::Cancelled);
+        return;
+    }
+
+    otr.readAhead.push_back(std::move(chunk));
+    fillSendWindow(id);
+}
+
+void FileChannel::sendFileTransferCompleteNotification(tego_file_transfer_id_t id, Data::File::FileTransferResult result)
+{
+    auto notification = std::make_unique<Data::File::FileTransferCompleteNotification>();
+    notification->set_file_id(id);
+    notification->set_result(result);
+
+    Data::File::Packet packet;
+    packet.set_allocated_file_transfer_complete_notification(notification.release());
+    Channel::sendMessage(packet);
 }
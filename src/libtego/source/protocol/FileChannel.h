@@ -49,25 +49,50 @@ class FileChannel : public Channel
 public:
     explicit FileChannel(Direction direction, Connection *connection);
 
-    bool sendFileWithId(QString file_url, const tego_file_hash_t& fileHash, QDateTime time, tego_file_transfer_id_t id);
+    // fileHash may be empty, in which case the file is hashed as it is sent and the
+    // digest follows in a trailer (or, for peers that don't support that, up front)
+    bool sendFileWithId(QString file_url, const std::optional<tego_file_hash_t>& fileHash, QDateTime time, tego_file_transfer_id_t id);
     void acceptFile(tego_file_transfer_id_t id, const std::string& dest);
     void rejectFile(tego_file_transfer_id_t id);
     bool cancelTransfer(tego_file_transfer_id_t id);
+
+    // maximum number of bytes an outgoing transfer may have sent but not yet
+    // had acknowledged by the receiver; always at least one chunk, and at most
+    // MaxWindowSize
+    tego_file_size_t sendWindowSize() const;
+    void setSendWindowSize(tego_file_size_t bytes);
+
+    // whether to describe outgoing files with a hash tree when the peer supports it, so
+    // each chunk is verified as it arrives and only corrupt ranges are resent; the
+    // tree has to be built before the file is offered
+    bool hashTreePreferred() const;
+    void setHashTreePreferred(bool preferred);
+
+    // cap an outgoing transfer at bytesPerSecond, or lift its cap with 0; returns
+    // false if we aren't sending a transfer with this id
+    bool setTransferRateLimit(tego_file_transfer_id_t id, qint64 bytesPerSecond);
+
     // signals bubble up to the ConversationModel object that owns this FileChannel
 signals:
-    void fileTransferRequestReceived(tego_file_transfer_id_t id, QString fileName, tego_file_size_t fileSize, tego_file_hash_t);
+    // the hash is empty if the sender will only send it once the whole file has been sent
+    void fileTransferRequestReceived(tego_file_transfer_id_t id, QString fileName, tego_file_size_t fileSize, std::optional<tego_file_hash_t>);
     void fileTransferAcknowledged(tego_file_transfer_id_t id, bool ack);
     void fileTransferRequestResponded(tego_file_transfer_id_t id, tego_file_transfer_response_t response);
     void fileTransferProgress(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, tego_file_size_t bytesTransmitted, tego_file_size_t bytesTotal);
     void fileTransferFinished(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, tego_file_transfer_result_t);
+    // the hash of the whole file, once we have hashed what we are sending or verified what we received
+    void fileTransferHashKnown(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, const tego_file_hash_t& hash);
 
 protected:
     virtual bool allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result);
     virtual bool allowOutboundChannelRequest(Data::Control::OpenChannel *request);
-    virtual void receivePacket(const QByteArray &packet);
+    virtual bool processChannelOpenResult(const Data::Control::ChannelResult *result);
+    virtual void receivePacket(const PacketView &packet);
 private:
     // when our socket goes away
     void onConnectionClosed();
+    // when our connection's write backlog has drained enough to send more chunks
+    void onWritable();
 
     // we need runtime checks to ensure that sizes stored as tego_file_size_t are representable as
     // std::streamoff too where appropriate
@@ -78,6 +103,27 @@ private:
     // verify that std::streamoff is representable as qint64 (type used by Qt File APIs for sizes)
     static_assert(std::numeric_limits<std::streamoff>::max() <= std::numeric_limits<qint64>::max());
 
+    // a chunk of file data along with the buffer it lives in: for chunks we send, a complete
+    // frame the I/O worker read the file straight into; for chunks we receive, the buffer
+    // the connection read them into, which may hold other packets too. Either way the data
+    // is shared rather than copied as it is passed on
+    struct file_chunk
+    {
+        tego_file_transfer_id_t fileId = 0;
+        // always set on chunks we send
+        std::optional<tego_file_size_t> offset;
+        QByteArray buffer;
+        int dataOffset = 0;
+        tego_file_size_t size = 0;
+
+        inline const char* data() const { return buffer.constData() + dataOffset; }
+    };
+    // reads size bytes from stream into a new frame holding Packet{FileChunk}
+    static file_chunk readChunkFrame(std::ifstream& stream, tego_file_transfer_id_t id, tego_file_size_t offset, tego_file_size_t size);
+    // parses a Packet holding only a FileChunk in place; empty if the packet is
+    // anything else, which leaves it to the protobuf parser
+    static std::optional<file_chunk> parseFileChunk(const PacketView& packet);
+
     struct outgoing_transfer_record
     {
         outgoing_transfer_record(
@@ -89,10 +135,35 @@ private:
 
         const tego_file_transfer_id_t id;
         const tego_file_size_t size;
+        // bytes read from disk and sent to the receiver
         tego_file_size_t offset;
-        std::ifstream stream;
+        // bytes the receiver has acknowledged writing
+        tego_file_size_t acked;
+        // bytes we have asked the I/O worker to read, including those already sent
+        tego_file_size_t readOffset;
+        // set once the receiver has accepted and any resume has been settled; until
+        // then nothing may be read ahead, as the stream's position isn't decided yet
+        bool started;
+        // shared with reads still queued on the I/O worker
+        std::shared_ptr<std::ifstream> stream;
+        // chunks read ahead of the send window, and reads still in progress
+        std::deque<file_chunk> readAhead;
+        size_t pendingReads;
+        // bumped whenever the transfer rewinds, so reads queued before then get dropped
+        size_t readGeneration;
+
+        // only set when the file is described by a hash tree, along with how far
+        // through each level of the tree we have sent nodes' children
+        std::shared_ptr<const tego_file_hash_tree> tree;
+        std::vector<size_t> nodesSent;
+        // only set when the file is hashed as it is read and sent, with
+        // the digest following in a FileHashTrailer
+        std::optional<tego_file_hasher> hasher;
+        // the digest from hasher, until the FileHashTrailer carrying it has been sent
+        std::optional<tego_file_hash> trailerHash;
 
         inline bool finished() const { return offset == size; }
+        inline tego_file_size_t inFlight() const { return offset - acked; }
     };
 
     struct incoming_transfer_record
@@ -112,20 +183,79 @@ private:
         const tego_file_transfer_id_t id;
         const tego_file_size_t size;
         std::string dest; // destination to save to
-        const std::string hash;
+        // the hash the sender claims, hex encoded; empty until their FileHashTrailer
+        // arrives if they did not know it when sending the header
+        std::string hash;
+
+        // bytes received and queued for writing, and bytes actually written
+        tego_file_size_t received;
+        tego_file_size_t written;
 
-        // need to write and read
-        std::fstream stream;
+        // chunks are hashed as they arrive, so we only ever need to write; the
+        // stream is shared with writes still queued on the I/O worker
+        std::shared_ptr<std::ofstream> stream;
+        tego_file_hasher hasher;
+        // set once every byte has been received and hashed
+        std::optional<tego_file_hash> digest;
+
+        // the offset we asked the sender to resume from, until their first chunk
+        // confirms it or tells us they are starting over
+        std::optional<tego_file_size_t> pendingResume;
+        // set if the transfer was interrupted by a dropped connection, in which case
+        // the partial file is kept along with a resume record describing it
+        bool keepPartial;
+
+        // only set when the sender describes the file with a hash tree, in which case
+        // each chunk is checked against it rather than hashing the whole file
+        std::optional<tego_file_hash_tree> tree;
+        // after a chunk fails verification, the offset we asked the sender to resend
+        // from; chunks are dropped until it arrives
+        std::optional<tego_file_size_t> retryOffset;
+        size_t retries;
 
         std::string partial_dest() const;
-        void open_stream(const std::string& dest);
+        std::string resume_record_path() const;
+    };
+
+    // an incoming transfer's partial file, opened on the I/O worker
+    struct partial_file
+    {
+        std::string path;
+        std::shared_ptr<std::ofstream> stream;
+        // bytes already present from an interrupted transfer, all fed to hasher
+        tego_file_size_t offset = 0;
+        tego_file_hasher hasher;
     };
+    static std::shared_ptr<partial_file> openPartialFile(
+        tego_file_size_t size,
+        const std::string& hash,
+        const std::string& partialDest,
+        const std::string& resumeRecordPath,
+        tego_file_size_t alignment);
     // 63 kb, max packet size is UINT16_MAX (ak 65535, 64k - 1) so leave space for other data
     constexpr static tego_file_size_t FileMaxChunkSize = 63*1024; // bytes
-    // intermediate buffer we load chunks from disk into
-    // each access to this buffer happens on the same thread, and only within the scope of a function
-    // so no need to worry about synchronization or sharing between file transfers
-    char chunkBuffer[FileMaxChunkSize];
+    // chunks each outgoing transfer keeps buffered or being read by the I/O worker, so
+    // the send window can be topped up without waiting on the disk
+    constexpr static size_t ReadAheadChunks = 4;
+    // each chunk is exactly one leaf of a hash tree
+    static_assert(FileMaxChunkSize == tego_file_hash_tree::LEAF_SIZE);
+    // corrupt chunks we will ask to have resent before giving up on a transfer
+    constexpr static size_t MaxChunkRetries = 16;
+
+    // whether both peers have agreed a FileHeader may omit the hash, and
+    // send it in a FileHashTrailer after the final chunk instead
+    bool hashTrailerEnabled = false;
+    // whether both peers have agreed a FileHeader may carry a hash tree root instead
+    bool hashTreeEnabled = false;
+    bool preferHashTree = false;
+
+    // by default allow 8 chunks (~500 kb) to be outstanding, enough to keep a
+    // typical onion circuit busy rather than waiting a round trip per chunk
+    constexpr static tego_file_size_t DefaultSendWindowSize = 8 * FileMaxChunkSize; // bytes
+    // the most an incoming transfer may have received but not yet written; a sender
+    // that runs further ahead than this is ignoring our acks
+    constexpr static tego_file_size_t MaxWindowSize = 64 * FileMaxChunkSize; // bytes
+    tego_file_size_t sendWindow = DefaultSendWindowSize;
 
     // file transfers we are sending
     std::map<tego_file_transfer_id_t, outgoing_transfer_record> outgoingTransfers;
@@ -145,15 +275,42 @@ private:
     bool verifyFileChunk(Data::File::FileChunk const& message);
     bool verifyFileChunkAck(Data::File::FileChunkAck const& message);
     bool verifyFileTransferCompleteNotification(Data::File::FileTransferCompleteNotification const& message);
+    bool verifyFileHashTrailer(Data::File::FileHashTrailer const& message);
+    bool verifyFileHashTreeNodes(Data::File::FileHashTreeNodes const& message);
+    bool verifyFileChunkRetry(Data::File::FileChunkRetry const& message);
 
     void handleFileHeader(const Data::File::FileHeader &message);
     void handleFileHeaderAck(const Data::File::FileHeaderAck &message);
     void handleFileHeaderResponse(const Data::File::FileHeaderResponse &message);
-    void handleFileChunk(const Data::File::FileChunk &message);
+    void handleFileChunk(const file_chunk &chunk);
     void handleFileChunkAck(const Data::File::FileChunkAck &message);
     void handleFileTransferCompleteNotification(const Data::File::FileTransferCompleteNotification &message);
+    void handleFileHashTrailer(const Data::File::FileHashTrailer &message);
+    void handleFileHashTreeNodes(const Data::File::FileHashTreeNodes &message);
+    void handleFileChunkRetry(const Data::File::FileChunkRetry &message);
+
+    // completions of jobs run on the FileIOWorker
+    void handleChunkRead(tego_file_transfer_id_t id, size_t readGeneration, tego_file_size_t expectedSize, file_chunk&& chunk);
+    void handleChunkWritten(tego_file_transfer_id_t id, std::streamoff streamOffset);
+    void handlePartialFileOpened(tego_file_transfer_id_t id, const std::shared_ptr<partial_file>& partialFile);
+
+    // verify the receiver's partial copy matches our file before continuing from its end
+    void resumeTransfer(tego_file_transfer_id_t id, tego_file_size_t offset, const std::string& prefixHash);
+
+    // verifies a fully written incoming transfer against its expected hash and moves it
+    // into place; requires both the digest and the expected hash
+    void finishIncomingTransfer(std::map<tego_file_transfer_id_t, incoming_transfer_record>::iterator it);
 
-    void sendNextChunk(tego_file_transfer_id_t id);
+    // each of these returns false if the connection refused to queue the packet, in which
+    // case the transfer is left as it was so the send can be retried later
+    bool sendNextChunk(tego_file_transfer_id_t id, outgoing_transfer_record& otr);
+    bool sendHashTrailer(tego_file_transfer_id_t id, outgoing_transfer_record& otr);
+    // send the hash tree nodes the receiver needs to verify the next chunk, if it lacks them
+    bool sendHashTreeNodes(tego_file_transfer_id_t id, outgoing_transfer_record& otr);
+    // send read ahead chunks until the transfer's in-flight bytes reach our send window,
+    // then queue up reads for the next few
+    void fillSendWindow(tego_file_transfer_id_t id);
+    void sendFileTransferCompleteNotification(tego_file_transfer_id_t id, Data::File::FileTransferResult result);
 };
 
 }
@@ -0,0 +1,200 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PacketScheduler.h"
+
+using namespace Protocol;
+
+void PacketScheduler::enqueue(Priority priority, quint64 flow, QByteArray &&packet)
+{
+    bytes += packet.size();
+    switch (priority) {
+        case Priority::Control:
+            control.push_back(std::move(packet));
+            break;
+        case Priority::Interactive:
+            interactive.push_back(std::move(packet));
+            break;
+        case Priority::Bulk: {
+            auto &record = flows[flow];
+            if (record.packets.empty())
+                activeFlows.push_back(flow);
+            record.packets.push_back(std::move(packet));
+            break;
+        }
+    }
+}
+
+std::optional<QByteArray> PacketScheduler::dequeue(qint64 now)
+{
+    auto takeFront = [this](std::deque<QByteArray> &queue) {
+        auto packet = std::move(queue.front());
+        queue.pop_front();
+        bytes -= packet.size();
+        return packet;
+    };
+
+    if (!control.empty())
+        return takeFront(control);
+    if (!interactive.empty())
+        return takeFront(interactive);
+
+    // Every flow is visited at most twice: once to top up its deficit, and once
+    // more to send with it. Anything still unsent after that is rate limited.
+    for (size_t visits = 0, maxVisits = activeFlows.size() * 2; visits < maxVisits; ++visits) {
+        const auto flow = activeFlows.front();
+        auto &record = flows.at(flow);
+        record.refill(now);
+
+        if (record.tokens < 0) {
+            activeFlows.pop_front();
+            activeFlows.push_back(flow);
+            continue;
+        }
+
+        const auto size = static_cast<qint64>(record.packets.front().size());
+        if (record.deficit < size) {
+            record.deficit += Quantum;
+            activeFlows.pop_front();
+            activeFlows.push_back(flow);
+            continue;
+        }
+
+        record.deficit -= size;
+        if (record.rateLimit > 0)
+            record.tokens -= size;
+
+        auto packet = takeFront(record.packets);
+        if (record.packets.empty()) {
+            // an idle flow doesn't get to bank a deficit for later
+            record.deficit = 0;
+            activeFlows.pop_front();
+            if (record.rateLimit == 0)
+                flows.erase(flow);
+        }
+        return packet;
+    }
+
+    return std::nullopt;
+}
+
+bool PacketScheduler::isEmpty() const
+{
+    return control.empty() && interactive.empty() && activeFlows.empty();
+}
+
+qint64 PacketScheduler::queuedBytes() const
+{
+    return bytes;
+}
+
+qint64 PacketScheduler::nextSendDelay(qint64 now) const
+{
+    if (!control.empty() || !interactive.empty())
+        return 0;
+
+    qint64 delay = -1;
+    for (auto flow : activeFlows) {
+        const auto flowDelay = flows.at(flow).sendDelay(now);
+        if (delay < 0 || flowDelay < delay)
+            delay = flowDelay;
+    }
+    return delay;
+}
+
+void PacketScheduler::setRateLimit(quint64 flow, qint64 bytesPerSecond)
+{
+    auto it = flows.find(flow);
+    if (bytesPerSecond <= 0) {
+        if (it == flows.end())
+            return;
+        it->second.rateLimit = 0;
+        it->second.tokens = Quantum;
+        it->second.lastRefill.reset();
+        if (it->second.packets.empty())
+            flows.erase(it);
+        return;
+    }
+
+    if (it == flows.end())
+        it = flows.emplace(flow, flow_record()).first;
+    it->second.rateLimit = bytesPerSecond;
+}
+
+void PacketScheduler::removeFlow(quint64 flow)
+{
+    removeFlows([flow](quint64 f) { return f == flow; });
+}
+
+void PacketScheduler::removeFlows(const std::function<bool(quint64)> &pred)
+{
+    activeFlows.erase(std::remove_if(activeFlows.begin(), activeFlows.end(), pred), activeFlows.end());
+    for (auto it = flows.begin(); it != flows.end(); ) {
+        if (pred(it->first)) {
+            for (const auto &packet : it->second.packets)
+                bytes -= packet.size();
+            it = flows.erase(it);
+        } else
+            it++;
+    }
+}
+
+void PacketScheduler::flow_record::refill(qint64 now)
+{
+    if (rateLimit == 0)
+        return;
+    if (!lastRefill || now < *lastRefill) {
+        lastRefill = now;
+        return;
+    }
+
+    // leave any fraction of a byte to accumulate until the next refill
+    const auto earned = (now - *lastRefill) * rateLimit / 1000;
+    if (earned == 0)
+        return;
+    // never bank more than one round's worth, so an idle flow can't then burst
+    tokens = std::min(Quantum, tokens + earned);
+    lastRefill = now;
+}
+
+qint64 PacketScheduler::flow_record::sendDelay(qint64 now) const
+{
+    if (rateLimit == 0 || tokens >= 0)
+        return 0;
+
+    const auto elapsed = lastRefill ? std::max<qint64>(now - *lastRefill, 0) : 0;
+    const auto needed = -tokens * 1000 - elapsed * rateLimit;
+    if (needed <= 0)
+        return 0;
+    // round up, so that by then the bucket really has refilled
+    return (needed + rateLimit - 1) / rateLimit;
+}
@@ -0,0 +1,111 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PROTOCOL_PACKETSCHEDULER_H
+#define PROTOCOL_PACKETSCHEDULER_H
+
+namespace Protocol
+{
+
+/* Orders the packets waiting to be written to a connection's socket
+ *
+ * Packets fall into three priority classes, and a packet is only sent when
+ * nothing of a higher class is waiting: control packets keep the connection
+ * alive and open channels, interactive packets (chat, acknowledgements) are
+ * small and latency sensitive, and bulk packets (file data) make up the rest.
+ *
+ * Control and interactive packets each go out in the order they were queued.
+ * Bulk packets are queued per flow (eg one per file transfer), which keep
+ * their own order but share the link through deficit round robin, so each
+ * flow gets an even share of bytes regardless of packet size. A flow may also
+ * be capped at a number of bytes per second.
+ *
+ * The scheduler only holds packets; ConnectionPrivate decides when to take
+ * them, so that it never writes more into the socket than it has to.
+ */
+class PacketScheduler
+{
+public:
+    enum class Priority {
+        Control,
+        Interactive,
+        Bulk
+    };
+
+    void enqueue(Priority priority, quint64 flow, QByteArray &&packet);
+    // the next packet to send, if any may be sent at time 'now' (in ms)
+    std::optional<QByteArray> dequeue(qint64 now);
+
+    bool isEmpty() const;
+    // total size of every packet waiting
+    qint64 queuedBytes() const;
+    // with only rate limited flows waiting, the ms from 'now' until one may send
+    // again; -1 if nothing is waiting at all
+    qint64 nextSendDelay(qint64 now) const;
+
+    // bytesPerSecond of 0 removes any limit; the limit is kept after the flow drains
+    void setRateLimit(quint64 flow, qint64 bytesPerSecond);
+    // drop a flow's queued packets and its rate limit
+    void removeFlow(quint64 flow);
+    // drop every flow for which pred(flow) is true
+    void removeFlows(const std::function<bool(quint64)> &pred);
+
+    // each bulk flow may send about this many bytes per round
+    static constexpr qint64 Quantum = UINT16_MAX;
+
+private:
+    struct flow_record
+    {
+        std::deque<QByteArray> packets;
+        qint64 deficit = 0;
+
+        qint64 rateLimit = 0;
+        // bytes the flow may send before going over its limit; may go negative,
+        // in which case it must wait for the bucket to refill
+        qint64 tokens = Quantum;
+        std::optional<qint64> lastRefill;
+
+        void refill(qint64 now);
+        qint64 sendDelay(qint64 now) const;
+    };
+
+    std::deque<QByteArray> control;
+    std::deque<QByteArray> interactive;
+    std::map<quint64,flow_record> flows;
+    // flows with packets waiting, in round robin order
+    std::deque<quint64> activeFlows;
+    qint64 bytes = 0;
+};
+
+}
+
+#endif
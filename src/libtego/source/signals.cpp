@@ -14,17 +14,107 @@ namespace tego
 
     type_erased_callback& type_erased_callback::operator=(type_erased_callback&& that)
     {
-        this->data_ = std::move(that.data_);
-        this->callback_ = that.callback_;
-        that.callback_ = nullptr;
+        if (this != &that)
+        {
+            if (this->ops_ != nullptr)
+            {
+                this->ops_->destroy(this->storage_);
+            }
+            this->ops_ = that.ops_;
+            if (this->ops_ != nullptr)
+            {
+                this->ops_->move(that.storage_, this->storage_);
+            }
+            that.ops_ = nullptr;
+        }
 
         return *this;
     }
 
+    type_erased_callback::~type_erased_callback()
+    {
+        if (this->ops_ != nullptr)
+        {
+            this->ops_->destroy(this->storage_);
+        }
+    }
 
     void type_erased_callback::invoke()
     {
-        this->callback_(this->data_.get());
+        this->ops_->invoke(this->storage_);
+    }
+
+    //
+    // Callback Arena
+    //
+
+    callback_arena::~callback_arena()
+    {
+        this->reset();
+    }
+
+    const char* callback_arena::copy_string(const char* str, size_t length)
+    {
+        auto copied = static_cast<char*>(this->allocate(length + 1, 1));
+        std::copy(str, str + length, copied);
+        copied[length] = 0;
+        return copied;
+    }
+
+    void callback_arena::reset()
+    {
+        for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it)
+        {
+            it->second(it->first);
+        }
+        destructors_.clear();
+
+        // every block before current_ was used up to some point, but we don't keep track
+        // of where so wipe the lot
+        for (size_t i = 0; i < blocks_.size() && i <= current_; i++)
+        {
+            const auto used = (i == current_) ? used_ : blocks_[i].size;
+            OPENSSL_cleanse(blocks_[i].data.get(), used);
+        }
+        current_ = 0;
+        used_ = 0;
+    }
+
+    void* callback_arena::allocate(size_t size, size_t alignment)
+    {
+        while (true)
+        {
+            if (current_ < blocks_.size())
+            {
+                auto& block = blocks_[current_];
+                const auto base = reinterpret_cast<uintptr_t>(block.data.get());
+                const auto offset = ((base + used_ + alignment - 1) & ~(alignment - 1)) - base;
+                if (offset + size <= block.size)
+                {
+                    used_ = offset + size;
+                    return block.data.get() + offset;
+                }
+                // doesn't fit, move on to the next block
+                current_++;
+                used_ = 0;
+                continue;
+            }
+
+            // out of blocks, only happens until the arena has grown to fit a busy batch
+            const auto blockSize = std::max(BLOCK_SIZE, size + alignment);
+            blocks_.push_back({std::make_unique<uint8_t[]>(blockSize), blockSize});
+        }
+    }
+
+    //
+    // Coalescing Key
+    //
+
+    void coalescing_key::set_user(const tego_user_id_t* userId)
+    {
+        TEGO_THROW_IF_NULL(userId);
+        static_assert(sizeof(userId->serviceId.data) == std::tuple_size_v<decltype(user)>);
+        std::copy(std::begin(userId->serviceId.data), std::end(userId->serviceId.data), user.begin());
     }
 
     //
@@ -37,9 +127,19 @@ namespace tego
         TEGO_THROW_IF_NULL(context);
     }
 
-    void callback_registry::push_back(type_erased_callback&& callback)
+    void callback_registry::push_back(const std::optional<coalescing_key>& flushes, void* build, type_erased_callback (*invokeBuild)(void*, callback_arena&))
     {
-        this->context_->callback_queue_.push_back(std::move(callback));
+        this->context_->callback_queue_.push_back(flushes, build, invokeBuild);
+    }
+
+    void callback_registry::push_back_coalesced(const coalescing_key& key, type_erased_callback&& callback)
+    {
+        this->context_->callback_queue_.push_back_coalesced(key, std::move(callback));
+    }
+
+    void callback_registry::set_minimum_interval(std::string_view event, std::chrono::milliseconds interval)
+    {
+        this->context_->callback_queue_.set_minimum_interval(event, interval);
     }
 
     //
@@ -50,7 +150,10 @@ namespace tego
     : context_(context)
     , terminating_(false)
     , mutex_()
+    , wakeup_()
     , pending_callbacks_()
+    , pending_coalesced_()
+    , pending_arena_()
     , worker_([](tego_context* ctx) -> void
     {
         auto& self = ctx->callback_queue_;
@@ -59,22 +162,47 @@ namespace tego
         // without blocking while we are executing previously
         // enqueued tasks
         decltype(self.pending_callbacks_) local_queue;
+        callback_arena local_arena;
+        // what to run from local_queue (and any held back updates now due)
+        std::vector<type_erased_callback> ready;
 
-        // we keep spinning until termination is signaled
-        while(!self.terminating_)
+        // we keep going until termination is signaled
+        while(true)
         {
-            // acquire the queue's lock and swap our queues
+            // acquire the queue's lock, wait for work and swap our queues
             // the backend can now keep emitting callbacks
             // while we work through our queue of old ones
             {
-                std::lock_guard<std::mutex> lock(self.mutex_);
+                std::unique_lock<std::mutex> lock(self.mutex_);
+                const auto hasWork = [&self]() -> bool
+                {
+                    if (self.terminating_ || !self.pending_callbacks_.empty()) {
+                        return true;
+                    }
+                    const auto due = self.next_due();
+                    return due.has_value() && *due <= clock::now();
+                };
+                while (!hasWork()) {
+                    // held back updates need us to wake up once they are due
+                    if (const auto due = self.next_due(); due.has_value()) {
+                        self.wakeup_.wait_until(lock, *due);
+                    } else {
+                        self.wakeup_.wait(lock);
+                    }
+                }
+                if (self.terminating_) {
+                    break;
+                }
                 std::swap(local_queue, self.pending_callbacks_);
+                std::swap(local_arena, self.pending_arena_);
+                self.pending_coalesced_.clear();
+                self.schedule(local_queue, ready);
             }
 
-            for(auto& callback : local_queue) {
-                // acquire our context's lock so that we don't have two
-                // threads potentially modifying internals
-                std::lock_guard<std::mutex> lock(ctx->mutex_);
+            // the callbacks' arguments were copied when they were queued, so they
+            // are invoked without holding any lock; an embedder may call back
+            // into the API (or take as long as it likes) from inside one
+            for(auto& callback : ready) {
                 try
                 {
                     callback.invoke();
@@ -82,11 +210,11 @@ namespace tego
                 // swallow any throw exceptions
                 catch(...) {};
             }
-            // empty our our local queue
+            // empty our our local queue, then release the arguments
+            // of its callbacks all at once
+            ready.clear();
             local_queue.clear();
-
-            // sleep before looking for more work
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            local_arena.reset();
         }
 
     }, context)
@@ -96,19 +224,195 @@ namespace tego
 
     callback_queue::~callback_queue()
     {
-        // signal our worker thread to finish up and terminate
-        terminating_ = true;
+        // signal our worker thread to finish up and terminate, under the
+        // lock so it can't miss the wakeup between checking and waiting
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            terminating_ = true;
+        }
+        wakeup_.notify_one();
         worker_.join();
     }
 
-    void callback_queue::push_back(type_erased_callback&& callback)
+    void callback_queue::push_back(const std::optional<coalescing_key>& flushes, void* build, type_erased_callback (*invokeBuild)(void*, callback_arena&))
     {
         // acquire our lock and push into our vec
         if (!terminating_)
         {
-            std::lock_guard<std::mutex> lock(mutex_);
-            pending_callbacks_.push_back(std::move(callback));
+            bool wasEmpty = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                wasEmpty = pending_callbacks_.empty();
+                pending_callbacks_.push_back({invokeBuild(build, pending_arena_), std::nullopt, flushes});
+            }
+            // the worker only sleeps once it has emptied the queue, so it
+            // only needs waking for the first callback of a batch
+            if (wasEmpty)
+            {
+                wakeup_.notify_one();
+            }
+        }
+    }
+
+    void callback_queue::push_back_coalesced(const coalescing_key& key, type_erased_callback&& callback)
+    {
+        if (!terminating_)
+        {
+            bool wasEmpty = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                wasEmpty = pending_callbacks_.empty();
+
+                // supersede the queued update with our key, if any
+                auto it = std::find_if(pending_coalesced_.begin(), pending_coalesced_.end(), [&](size_t index) -> bool
+                {
+                    return pending_callbacks_[index].key == key;
+                });
+                if (it != pending_coalesced_.end())
+                {
+                    pending_callbacks_[*it].callback = std::move(callback);
+                }
+                else
+                {
+                    pending_coalesced_.push_back(pending_callbacks_.size());
+                    pending_callbacks_.push_back({std::move(callback), key, std::nullopt});
+                }
+            }
+            if (wasEmpty)
+            {
+                wakeup_.notify_one();
+            }
+        }
+    }
+
+    void callback_queue::set_minimum_interval(std::string_view event, std::chrono::milliseconds interval)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(minimum_intervals_.begin(), minimum_intervals_.end(), [&](const auto& entry) -> bool
+        {
+            return entry.first == event;
+        });
+        if (it != minimum_intervals_.end())
+        {
+            it->second = interval;
+        }
+        else
+        {
+            minimum_intervals_.push_back({event, interval});
+        }
+    }
+
+    std::chrono::milliseconds callback_queue::minimum_interval(std::string_view event) const
+    {
+        for (const auto& [intervalEvent, interval] : minimum_intervals_)
+        {
+            if (intervalEvent == event)
+            {
+                return interval;
+            }
+        }
+        return std::chrono::milliseconds(0);
+    }
+
+    void callback_queue::schedule(std::vector<queued_callback>& batch, std::vector<type_erased_callback>& ready)
+    {
+        const auto now = clock::now();
+
+        // forget deliveries which no longer hold anything back
+        last_delivered_.erase(
+            std::remove_if(last_delivered_.begin(), last_delivered_.end(), [&](const auto& entry) -> bool
+            {
+                return now >= entry.second + minimum_interval(entry.first.event);
+            }),
+            last_delivered_.end());
+
+        // held back updates superseded by this batch are dropped, the rest go
+        // ahead of it once due as they are older
+        for (const auto& queued : batch)
+        {
+            if (queued.key.has_value())
+            {
+                held_callbacks_.erase(
+                    std::remove_if(held_callbacks_.begin(), held_callbacks_.end(), [&](const held_callback& held) -> bool
+                    {
+                        return held.key == *queued.key;
+                    }),
+                    held_callbacks_.end());
+            }
+        }
+        for (auto it = held_callbacks_.begin(); it != held_callbacks_.end(); )
+        {
+            if (it->due <= now)
+            {
+                it = release_held(it, now, ready);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        for (auto& queued : batch)
+        {
+            if (queued.flushes.has_value())
+            {
+                auto it = std::find_if(held_callbacks_.begin(), held_callbacks_.end(), [&](const held_callback& held) -> bool
+                {
+                    return held.key == *queued.flushes;
+                });
+                if (it != held_callbacks_.end())
+                {
+                    release_held(it, now, ready);
+                }
+            }
+
+            if (queued.key.has_value())
+            {
+                const auto& key = *queued.key;
+                auto last = std::find_if(last_delivered_.begin(), last_delivered_.end(), [&](const auto& entry) -> bool
+                {
+                    return entry.first == key;
+                });
+                if (last != last_delivered_.end())
+                {
+                    // delivered too recently, hold it until the interval has passed
+                    held_callbacks_.push_back({key, std::move(queued.callback), last->second + minimum_interval(key.event)});
+                    continue;
+                }
+                if (minimum_interval(key.event).count() > 0)
+                {
+                    last_delivered_.push_back({key, now});
+                }
+            }
+
+            ready.push_back(std::move(queued.callback));
+        }
+    }
+
+    std::vector<callback_queue::held_callback>::iterator callback_queue::release_held(
+        std::vector<held_callback>::iterator it,
+        clock::time_point now,
+        std::vector<type_erased_callback>& ready)
+    {
+        ready.push_back(std::move(it->callback));
+        if (minimum_interval(it->key.event).count() > 0)
+        {
+            last_delivered_.push_back({it->key, now});
         }
+        return held_callbacks_.erase(it);
+    }
+
+    std::optional<callback_queue::clock::time_point> callback_queue::next_due() const
+    {
+        std::optional<clock::time_point> due;
+        for (const auto& held : held_callbacks_)
+        {
+            if (!due.has_value() || held.due < *due)
+            {
+                due = held.due;
+            }
+        }
+        return due;
     }
 }
 
@@ -127,8 +431,10 @@ extern "C"
         return tego::translateExceptions([=]() -> void\
         {\
             TEGO_THROW_IF_NULL(context);\
-            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());\
-            context->callback_registry_.register_##EVENT(callback);\
+            context->invoke([=]() -> void\
+            {\
+                context->callback_registry_.register_##EVENT(callback);\
+            });\
         }, error);\
     }
 
@@ -149,6 +455,25 @@ extern "C"
     TEGO_DEFINE_CALLBACK_SETTER(file_transfer_request_response_received);
     TEGO_DEFINE_CALLBACK_SETTER(file_transfer_progress);
     TEGO_DEFINE_CALLBACK_SETTER(file_transfer_complete);
+    TEGO_DEFINE_CALLBACK_SETTER(file_transfer_hash_known);
     TEGO_DEFINE_CALLBACK_SETTER(user_status_changed);
     TEGO_DEFINE_CALLBACK_SETTER(new_identity_created);
-}
\ No newline at end of file
+
+    #define TEGO_DEFINE_CALLBACK_INTERVAL_SETTER(EVENT)\
+    void tego_context_set_##EVENT##_minimum_interval(\
+        tego_context_t* context,\
+        uint32_t milliseconds,\
+        tego_error_t** error)\
+    {\
+        return tego::translateExceptions([=]() -> void\
+        {\
+            TEGO_THROW_IF_NULL(context);\
+            context->invoke([=]() -> void\
+            {\
+                context->callback_registry_.set_minimum_interval_##EVENT(std::chrono::milliseconds(milliseconds));\
+            });\
+        }, error);\
+    }
+
+    TEGO_DEFINE_CALLBACK_INTERVAL_SETTER(file_transfer_progress);
+}
@@ -7,33 +7,123 @@ namespace tego
     class type_erased_callback
     {
     public:
+        // callables up to this size (all of those made by callback_registry) are
+        // stored inline rather than on the heap
+        constexpr static size_t INLINE_SIZE = 128;
+
         type_erased_callback() = default;
         type_erased_callback(type_erased_callback&&);
         type_erased_callback& operator=(type_erased_callback&&);
+        ~type_erased_callback();
 
-        template<typename FUNC>
+        template<typename FUNC, typename = std::enable_if_t<!std::is_same_v<std::decay_t<FUNC>, type_erased_callback>>>
         type_erased_callback(FUNC&& func)
         {
-            // heap allocated a moved copy of the passed in function
-            data_ = {
-                new FUNC(std::move(func)),
-                // deleter function casts raw ptr back to FUNC and deletes
-                [](void* data) {
-                    auto* lambda = static_cast<FUNC*>(data);
-                    delete lambda;
-                }
-            };
-
-            // save of a function for invoking func
-            callback_ = [](void* data) {
-                auto* lambda = static_cast<FUNC*>(data);
-                (*lambda)();
-            };
+            using F = std::decay_t<FUNC>;
+            if constexpr (sizeof(F) <= INLINE_SIZE &&
+                          alignof(F) <= alignof(std::max_align_t) &&
+                          std::is_nothrow_move_constructible_v<F>)
+            {
+                new (storage_) F(std::forward<FUNC>(func));
+                ops_ = &inline_operations<F>;
+            }
+            else
+            {
+                // heap allocated a moved copy of the passed in function
+                *reinterpret_cast<F**>(storage_) = new F(std::forward<FUNC>(func));
+                ops_ = &heap_operations<F>;
+            }
         }
         void invoke();
     private:
-        std::unique_ptr<void, void(*)(void*)> data_ = {nullptr, nullptr};
-        void (*callback_)(void* data) = nullptr;
+        // how to call, move and destroy whatever is in storage_
+        struct operations
+        {
+            void (*invoke)(void* storage);
+            void (*move)(void* from, void* to);
+            void (*destroy)(void* storage);
+        };
+
+        template<typename F>
+        inline static constexpr operations inline_operations = {
+            [](void* storage) { (*static_cast<F*>(storage))(); },
+            [](void* from, void* to) {
+                new (to) F(std::move(*static_cast<F*>(from)));
+                static_cast<F*>(from)->~F();
+            },
+            [](void* storage) { static_cast<F*>(storage)->~F(); },
+        };
+
+        // storage_ only holds a pointer to the callable
+        template<typename F>
+        inline static constexpr operations heap_operations = {
+            [](void* storage) { (**static_cast<F**>(storage))(); },
+            [](void* from, void* to) { *static_cast<F**>(to) = *static_cast<F**>(from); },
+            [](void* storage) { delete *static_cast<F**>(storage); },
+        };
+
+        alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+        const operations* ops_ = nullptr;
+    };
+
+    /*
+     * callback_arena holds the arguments of a batch of callbacks (strings,
+     * user ids, etc) so they can all be released at once after the batch
+     * has run. It keeps its memory for the next batch, so a busy callback
+     * queue soon stops allocating altogether. Not thread safe.
+     */
+    class callback_arena
+    {
+    public:
+        callback_arena() = default;
+        callback_arena(callback_arena&&) = default;
+        callback_arena& operator=(callback_arena&&) = default;
+        ~callback_arena();
+
+        // copy of length bytes of str, followed by a null terminator
+        const char* copy_string(const char* str, size_t length);
+        template<typename T>
+        const T* copy(const T& value)
+        {
+            auto copied = new (allocate(sizeof(T), alignof(T))) T(value);
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                destructors_.push_back({copied, [](void* object) { static_cast<T*>(object)->~T(); }});
+            }
+            return copied;
+        }
+
+        // destroys and wipes everything copied in since the last reset, as
+        // callback arguments may include key material
+        void reset();
+    private:
+        void* allocate(size_t size, size_t alignment);
+
+        constexpr static size_t BLOCK_SIZE = 64 * 1024;
+        struct block
+        {
+            std::unique_ptr<uint8_t[]> data;
+            size_t size;
+        };
+        std::vector<block> blocks_;
+        // the block being allocated from, and how much of it is used
+        size_t current_ = 0;
+        size_t used_ = 0;
+        std::vector<std::pair<void*, void(*)(void*)>> destructors_;
+    };
+
+    /*
+     * Identifies a stream of updates where only the newest matters, eg the progress
+     * of one file transfer. Queued updates with equal keys supersede each other.
+     */
+    struct coalescing_key
+    {
+        std::string_view event;
+        std::array<char, TEGO_V3_ONION_SERVICE_ID_SIZE> user = {};
+        tego_file_transfer_id_t transfer = 0;
+
+        void set_user(const tego_user_id_t* userId);
+        bool operator==(const coalescing_key&) const = default;
     };
 
     /*
@@ -48,96 +138,229 @@ namespace tego
     public:
         callback_registry(tego_context* context);
 
+        // delivers the completion of an asynchronous command in order with the
+        // other callbacks; completion holds onto its own arguments
+        template<typename FUNC>
+        void emit_completion(FUNC&& completion)
+        {
+            push_back(std::nullopt, [&completion](callback_arena&) -> type_erased_callback
+            {
+                return std::forward<FUNC>(completion);
+            });
+        }
+
         /*
-         * Each callback X has a register_X function, an emit_X function, and
-         * a cleanup_X_args function
+         * Each callback X has a register_X function and an emit_X function
          *
          * It is assumed that a callback always sends over the tego_context_t* as
-         * the first argument
+         * the first argument. emit_X only borrows its pointer arguments, what
+         * they point to is copied into the callback queue's arena
          */
-        #define TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(EVENT, ...)\
+        #define TEGO_IMPLEMENT_CALLBACK_REGISTER(EVENT)\
         private:\
             tego_##EVENT##_callback_t EVENT##_ = nullptr;\
         public:\
             void register_##EVENT(tego_##EVENT##_callback_t cb)\
             {\
                 EVENT##_ = cb;\
-            }\
+            }
+
+        // FLUSHES names a coalesced stream whose held back update must be
+        // delivered before this callback, or is std::nullopt
+        #define TEGO_IMPLEMENT_CALLBACK_EMIT(EVENT, FLUSHES, ...)\
             template<typename... ARGS>\
             void emit_##EVENT(ARGS&&... args)\
             {\
                 if (EVENT##_ != nullptr) {\
+                    std::tuple<__VA_ARGS__> borrowed(std::forward<ARGS>(args)...);\
                     push_back(\
-                        [=, context=context_, callback=EVENT##_]() mutable -> void\
+                        FLUSHES,\
+                        [&borrowed, context=context_, callback=EVENT##_](callback_arena& arena) -> type_erased_callback\
+                        {\
+                            return [context, callback, payload=copy_args(arena, borrowed)]() -> void\
+                            {\
+                                std::apply([=](auto... args) { callback(context, args...); }, payload);\
+                            };\
+                        }\
+                    );\
+                }\
+            }\
+        private:
+
+        #define TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(EVENT, ...)\
+        TEGO_IMPLEMENT_CALLBACK_REGISTER(EVENT)\
+        TEGO_IMPLEMENT_CALLBACK_EMIT(EVENT, std::nullopt, __VA_ARGS__)
+
+        // delivered after any held back COALESCED update for the same user and transfer
+        #define TEGO_IMPLEMENT_FLUSHING_CALLBACK_FUNCTIONS(EVENT, COALESCED, ...)\
+        TEGO_IMPLEMENT_CALLBACK_REGISTER(EVENT)\
+        TEGO_IMPLEMENT_CALLBACK_EMIT(EVENT, make_coalescing_key(#COALESCED, borrowed), __VA_ARGS__)
+
+        /*
+         * Coalesced callbacks supersede any queued update with the same key (see
+         * make_coalescing_key), and are held back to be delivered no more often than
+         * the minimum interval set for their event. Their arguments are held by
+         * value rather than in the arena, as they may outlive their batch
+         */
+        #define TEGO_IMPLEMENT_COALESCED_CALLBACK_FUNCTIONS(EVENT, ...)\
+        TEGO_IMPLEMENT_CALLBACK_REGISTER(EVENT)\
+        public:\
+            void set_minimum_interval_##EVENT(std::chrono::milliseconds interval)\
+            {\
+                set_minimum_interval(#EVENT, interval);\
+            }\
+            template<typename... ARGS>\
+            void emit_##EVENT(ARGS&&... args)\
+            {\
+                if (EVENT##_ != nullptr) {\
+                    std::tuple<__VA_ARGS__> borrowed(std::forward<ARGS>(args)...);\
+                    push_back_coalesced(\
+                        make_coalescing_key(#EVENT, borrowed),\
+                        [context=context_, callback=EVENT##_, payload=hold_args(borrowed)]() -> void\
                         {\
-                            callback(context, std::forward<ARGS>(args)...);\
-                            cleanup_args(std::forward<ARGS>(args)...);\
+                            std::apply([&](const auto&... held) { callback(context, pass_arg(held)...); }, payload);\
                         }\
                     );\
                 }\
             }\
         private:
 
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_error_occurred, tego_tor_error_origin_t, tego_error_t*);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_error_occurred, tego_tor_error_origin_t, const tego_error_t*);
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(update_tor_daemon_config_succeeded, tego_bool_t);
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_control_status_changed, tego_tor_control_status_t);
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_process_status_changed, tego_tor_process_status_t);
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_network_status_changed, tego_tor_network_status_t);
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_bootstrap_status_changed, int32_t, tego_tor_bootstrap_tag_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_log_received, char*, size_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(tor_log_received, const char*, size_t);
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(host_user_state_changed, tego_host_user_state_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(chat_request_received, tego_user_id_t*, char*, size_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(chat_request_response_received, tego_user_id_t*, tego_bool_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(message_received, tego_user_id_t*, tego_time_t, tego_message_id_t,
-            char*, size_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(message_acknowledged, tego_user_id_t*, tego_message_id_t, tego_bool_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_request_received, tego_user_id_t*, tego_file_transfer_id_t, char*, size_t, uint64_t, tego_file_hash_t*);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_request_acknowledged, tego_user_id_t*, tego_file_transfer_id_t, tego_bool_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_request_response_received, tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_response_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_progress, tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_direction_t, uint64_t, uint64_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_complete, tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_direction_t, tego_file_transfer_result_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(user_status_changed, tego_user_id_t*, tego_user_status_t);
-        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(new_identity_created, tego_ed25519_private_key_t*);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(chat_request_received, const tego_user_id_t*, const char*, size_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(chat_request_response_received, const tego_user_id_t*, tego_bool_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(message_received, const tego_user_id_t*, tego_time_t, tego_message_id_t,
+            const char*, size_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(message_acknowledged, const tego_user_id_t*, tego_message_id_t, tego_bool_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_request_received, const tego_user_id_t*, tego_file_transfer_id_t, const char*, size_t, uint64_t, const tego_file_hash_t*);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_request_acknowledged, const tego_user_id_t*, tego_file_transfer_id_t, tego_bool_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_request_response_received, const tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_response_t);
+        TEGO_IMPLEMENT_COALESCED_CALLBACK_FUNCTIONS(file_transfer_progress, const tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_direction_t, uint64_t, uint64_t);
+        TEGO_IMPLEMENT_FLUSHING_CALLBACK_FUNCTIONS(file_transfer_complete, file_transfer_progress, const tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_direction_t, tego_file_transfer_result_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_hash_known, const tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_direction_t, const tego_file_hash_t*);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(user_status_changed, const tego_user_id_t*, tego_user_status_t);
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(new_identity_created, const tego_ed25519_private_key_t*);
 
 
     private:
-        void push_back(type_erased_callback&&);
+        // builds the callback under the callback queue's lock, so its arguments are
+        // copied into the arena of the batch it is delivered in
+        template<typename BUILD>
+        void push_back(const std::optional<coalescing_key>& flushes, BUILD&& build)
+        {
+            push_back(flushes, &build, [](void* build, callback_arena& arena) -> type_erased_callback
+            {
+                return (*static_cast<std::remove_reference_t<BUILD>*>(build))(arena);
+            });
+        }
+        void push_back(const std::optional<coalescing_key>& flushes, void* build, type_erased_callback (*invokeBuild)(void*, callback_arena&));
+        void push_back_coalesced(const coalescing_key& key, type_erased_callback&&);
+        void set_minimum_interval(std::string_view event, std::chrono::milliseconds interval);
         tego_context* context_ = nullptr;
 
-        // cleanup message buffer
-        static void cleanup_arg(char* msg)
+        // updates are keyed by the user and file transfer they are about, if any
+        template<typename... ARGS>
+        static coalescing_key make_coalescing_key(std::string_view event, const std::tuple<ARGS...>& args)
+        {
+            coalescing_key key;
+            key.event = event;
+            if constexpr (sizeof...(ARGS) >= 2)
+            {
+                if constexpr (std::is_same_v<std::tuple_element_t<0, std::tuple<ARGS...>>, const tego_user_id_t*> &&
+                              std::is_same_v<std::tuple_element_t<1, std::tuple<ARGS...>>, tego_file_transfer_id_t>)
+                {
+                    key.set_user(std::get<0>(args));
+                    key.transfer = std::get<1>(args);
+                }
+            }
+            return key;
+        }
+
+        // copies of what pointer arguments point to, for coalesced callbacks
+        template<typename... ARGS>
+        static auto hold_args(const std::tuple<ARGS...>& args)
+        {
+            return std::apply([](ARGS... args) { return std::make_tuple(hold_arg(args)...); }, args);
+        }
+
+        template<typename T>
+        static std::optional<T> hold_arg(const T* pVal)
+        {
+            return pVal ? std::optional<T>(*pVal) : std::nullopt;
+        }
+
+        // strings would need their length held alongside
+        static std::optional<char> hold_arg(const char*) = delete;
+
+        template<typename T>
+        static T hold_arg(T val)
         {
-            delete[] msg;
+            return val;
         }
 
-        // cleanup for other pointer types
         template<typename T>
-        static void cleanup_arg(T* pVal)
+        static const T* pass_arg(const std::optional<T>& held)
         {
-            delete pVal;
+            return held ? &held.value() : nullptr;
         }
 
-        // no-op for unspecialized types
         template<typename T>
-        static void cleanup_arg(T&&)
-        { }
+        static const T& pass_arg(const T& held)
+        {
+            return held;
+        }
+
+        // copy what pointer arguments point to into the arena, strings are
+        // followed by their length
+        static std::tuple<> copy_args(callback_arena&)
+        {
+            return {};
+        }
+
+        template<typename... ARGS>
+        static auto copy_args(callback_arena& arena, const char* str, size_t length, ARGS... args)
+        {
+            return std::tuple_cat(
+                std::make_tuple(str ? arena.copy_string(str, length) : nullptr, length),
+                copy_args(arena, args...));
+        }
 
-        // no-op for termation case
-        static void cleanup_args()
-        { }
+        template<typename FIRST, typename... ARGS>
+        static auto copy_args(callback_arena& arena, FIRST first, ARGS... args)
+        {
+            return std::tuple_cat(std::make_tuple(copy_arg(arena, first)), copy_args(arena, args...));
+        }
 
-        template<typename FIRST, typename...ARGS>
-        static void cleanup_args(FIRST&& first, ARGS&&... args)
+        template<typename... ARGS>
+        static auto copy_args(callback_arena& arena, const std::tuple<ARGS...>& args)
         {
-            cleanup_arg(std::forward<FIRST>(first));
-            return cleanup_args(std::forward<ARGS>(args)...);
+            return std::apply([&arena](ARGS... args) { return copy_args(arena, args...); }, args);
+        }
+
+        template<typename T>
+        static const T* copy_arg(callback_arena& arena, const T* pVal)
+        {
+            return pVal ? arena.copy(*pVal) : nullptr;
+        }
+
+        // values are copied as they are
+        template<typename T>
+        static T copy_arg(callback_arena&, T val)
+        {
+            return val;
         }
     };
 
     /*
      * callback_queue holds onto a queue of callbacks. Libtego internals
      * enqueue callbacks and the callback queue executes them on a
-     * background worker thread
+     * background worker thread, which sleeps until there is work to do
      */
     class callback_queue
     {
@@ -145,14 +368,55 @@ namespace tego
         callback_queue(tego_context* context);
         ~callback_queue();
 
-        void push_back(type_erased_callback&&);
+        // build is called with the arena of the batch the callback will be part of
+        void push_back(const std::optional<coalescing_key>& flushes, void* build, type_erased_callback (*invokeBuild)(void*, callback_arena&));
+        // replaces any queued callback with the same key
+        void push_back_coalesced(const coalescing_key& key, type_erased_callback&&);
+        // coalesced callbacks for event are delivered at most once per interval
+        void set_minimum_interval(std::string_view event, std::chrono::milliseconds interval);
     private:
+        using clock = std::chrono::steady_clock;
+
+        struct queued_callback
+        {
+            type_erased_callback callback;
+            // set for coalesced callbacks
+            std::optional<coalescing_key> key;
+            // set for callbacks which must follow any held back update with this key
+            std::optional<coalescing_key> flushes;
+        };
+        // a coalesced callback waiting for its interval to pass
+        struct held_callback
+        {
+            coalescing_key key;
+            type_erased_callback callback;
+            clock::time_point due;
+        };
+
+        std::chrono::milliseconds minimum_interval(std::string_view event) const;
+        // sorts a batch taken from pending_callbacks_ into the callbacks to run
+        // now and those to hold back; only called by the worker with mutex_ held
+        void schedule(std::vector<queued_callback>& batch, std::vector<type_erased_callback>& ready);
+        std::vector<held_callback>::iterator release_held(std::vector<held_callback>::iterator it, clock::time_point now, std::vector<type_erased_callback>& ready);
+        std::optional<clock::time_point> next_due() const;
+
         tego_context* context_;
 
         std::atomic_bool terminating_;
         std::mutex mutex_;
+        // signalled when pending_callbacks_ stops being empty, or on termination
+        std::condition_variable wakeup_;
         // this queue is protected by mutex_ within worker_ thread and callback_queue methods
-        std::vector<type_erased_callback> pending_callbacks_;
+        std::vector<queued_callback> pending_callbacks_;
+        // indices of the coalesced callbacks in pending_callbacks_
+        std::vector<size_t> pending_coalesced_;
+        // arguments of pending_callbacks_, also protected by mutex_
+        callback_arena pending_arena_;
+        // also protected by mutex_
+        std::vector<std::pair<std::string_view, std::chrono::milliseconds>> minimum_intervals_;
+        std::vector<held_callback> held_callbacks_;
+        // when each coalesced stream was last delivered, only while that still holds back the next
+        std::vector<std::pair<coalescing_key, clock::time_point>> last_delivered_;
 
 		// worker thread must be last so that other members are init'd before thread runs
         std::thread worker_;
@@ -0,0 +1,38 @@
+#pragma once
+
+namespace tego
+{
+    //
+    // Snapshot
+    //
+
+    // an immutable value published by one thread (the Qt thread) and read by any other
+    // without taking a lock; each update swaps in a whole new copy, and readers keep the
+    // copy they loaded alive for as long as they hold on to it
+    template<typename T>
+    class snapshot
+    {
+    public:
+        snapshot()
+        : value_(std::make_shared<const T>())
+        { }
+
+        std::shared_ptr<const T> load() const
+        {
+            return std::atomic_load_explicit(&value_, std::memory_order_acquire);
+        }
+
+        void store(T&& value)
+        {
+            store(std::make_shared<const T>(std::move(value)));
+        }
+
+        // the same value may be published through several snapshots
+        void store(std::shared_ptr<const T> value)
+        {
+            std::atomic_store_explicit(&value_, std::move(value), std::memory_order_release);
+        }
+    private:
+        std::shared_ptr<const T> value_;
+    };
+}
@@ -38,6 +38,23 @@ extern "C"
         }, error);
     }
 
+    void tego_tor_launch_config_set_profile_directory(
+        tego_tor_launch_config_t* launchConfig,
+        const char* profileDirectory,
+        size_t profileDirectoryLength,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(launchConfig);
+            TEGO_THROW_IF_NULL(profileDirectory);
+
+            logger::println("profile dir : {}", profileDirectory);
+
+            launchConfig->profileDirectory.assign(profileDirectory, profileDirectoryLength);
+        }, error);
+    }
+
     //
     // Tor Daemon Configuration
     //
@@ -7,6 +7,7 @@
 struct tego_tor_launch_config
 {
     std::string dataDirectory;
+    std::string profileDirectory;
 };
 
 typedef enum
@@ -106,6 +106,9 @@ void SetConfCommand::onFinished(int statusCode)
     else
         emit setConfFailed(statusCode);
 
-    g_globals.context->callback_registry_.emit_update_tor_daemon_config_succeeded(isSuccessful() ? TEGO_TRUE : TEGO_FALSE);
+    g_globals.for_each_context([&](tego_context& context)
+    {
+        context.callback_registry_.emit_update_tor_daemon_config_succeeded(isSuccessful() ? TEGO_TRUE : TEGO_FALSE);
+    });
 }
 
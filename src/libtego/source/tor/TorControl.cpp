@@ -66,6 +66,8 @@ public:
     QByteArray authPassword;
     QHostAddress socksAddress;
     QList<HiddenService*> services;
+    // service ids of the services tor has published for us, by service
+    QHash<HiddenService*, QByteArray> publishedServices;
     quint16 controlPort, socksPort;
     TorControl::Status status;
     TorControl::TorStatus torStatus;
@@ -79,6 +81,8 @@ public:
 
     void getTorInfo();
     void publishServices();
+    void publishService(HiddenService *service);
+    void unpublishService(HiddenService *service);
 
 public slots:
     void socketConnected();
@@ -131,8 +135,11 @@ void TorControlPrivate::setStatus(TorControl::Status n)
 
     emit q->statusChanged(status, old);
 
-    g_globals.context->callback_registry_.emit_tor_control_status_changed(
-        static_cast<tego_tor_control_status_t>(status));
+    g_globals.for_each_context([&](tego_context& context)
+    {
+        context.callback_registry_.emit_tor_control_status_changed(
+            static_cast<tego_tor_control_status_t>(status));
+    });
 
     if (status == TorControl::Connected && old < TorControl::Connected)
         emit q->connected();
@@ -152,31 +159,34 @@ void TorControlPrivate::setTorStatus(TorControl::TorStatus n)
     emit q->torStatusChanged(torStatus, old);
     emit q->connectivityChanged();
 
+    std::optional<tego_tor_network_status_t> networkStatus;
     switch(torStatus)
     {
         case TorControl::TorUnknown:
-            g_globals.context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_unknown);
+            networkStatus = tego_tor_network_status_unknown;
             break;
         case TorControl::TorOffline:
-            g_globals.context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_offline);
+            networkStatus = tego_tor_network_status_offline;
             break;
         case TorControl::TorReady:
-            g_globals.context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_ready);
+            networkStatus = tego_tor_network_status_ready;
             break;
     }
 
-
-    if (torStatus == TorControl::TorReady)
-{
-        if (socksAddress.isNull())
-        {
-            // Request info again to read the SOCKS port
-            getTorInfo();
-        }
-        else
+    // every context shares this control connection
+    if (networkStatus.has_value())
+    {
+        g_globals.for_each_context([&](tego_context& context)
         {
-            g_globals.context->set_host_user_state(tego_host_user_state_online);
-        }
+            context.callback_registry_.emit_tor_network_status_changed(networkStatus.value());
+        });
+    }
+
+
+    if (torStatus == TorControl::TorReady && socksAddress.isNull())
+    {
+        // Request info again to read the SOCKS port
+        getTorInfo();
     }
 }
 
@@ -187,11 +197,14 @@ void TorControlPrivate::setError(const QString &message)
 
     qWarning() << "torctrl: Error:" << errorMessage;
 
-    auto tegoError = std::make_unique<tego_error>();
-    tegoError->message = message.toStdString();
-    g_globals.context->callback_registry_.emit_tor_error_occurred(
-        tego_tor_error_origin_control,
-        tegoError.release());
+    tego_error tegoError;
+    tegoError.message = message.toStdString();
+    g_globals.for_each_context([&](tego_context& context)
+    {
+        context.callback_registry_.emit_tor_error_occurred(
+            tego_tor_error_origin_control,
+            &tegoError);
+    });
 
     socket->abort();
 
@@ -329,6 +342,13 @@ void TorControlPrivate::socketDisconnected()
     socksPort = 0;
     setTorStatus(TorControl::TorUnknown);
 
+    /* Services published on this connection went away with it, they're published again on reconnect */
+    publishedServices.clear();
+    foreach (HiddenService *service, services) {
+        if (service->status() == HiddenService::Online)
+            service->setStatus(HiddenService::Offline);
+    }
+
     /* This emits the disconnected() signal as well */
     setStatus(TorControl::NotConnected);
 }
@@ -466,7 +486,6 @@ void TorControlPrivate::getTorInfoReply()
 
     if (command->get(QByteArray("status/circuit-established")).toInt() == 1) {
         qDebug() << "torctrl: Tor indicates that circuits have been established; state is TorReady";
-        g_globals.context->set_host_user_state(tego_host_user_state_online);
         setTorStatus(TorControl::TorReady);
     } else {
         setTorStatus(TorControl::TorOffline);
@@ -483,6 +502,17 @@ void TorControl::addHiddenService(HiddenService *service)
         return;
 
     d->services.append(service);
+    // services go away along with the context whose identity they belong to
+    QObject::connect(service, &QObject::destroyed, this, [this, service]()
+    {
+        d->services.removeOne(service);
+        d->unpublishService(service);
+    });
+
+    // services added by contexts started after we connected are published straight away,
+    // the rest are published once we connect
+    if (isConnected())
+        d->publishService(service);
 }
 
 void TorControlPrivate::publishServices()
@@ -495,15 +525,40 @@ void TorControlPrivate::publishServices()
     // https://trac.torproject.org/projects/tor/wiki/org/teams/NetworkTeam/CoreTorReleases
     Q_ASSERT(q->torVersionAsNewAs(QStringLiteral("0.3.5")));
 
-    foreach (HiddenService *service, services) {
-        if (service->hostname().isEmpty())
-            qDebug() << "torctrl: Creating a new hidden service";
-        else
-            qDebug() << "torctrl: Publishing hidden service" << service->hostname();
-        AddOnionCommand *onionCommand = new AddOnionCommand(service);
-        QObject::connect(onionCommand, &AddOnionCommand::succeeded, service, &HiddenService::servicePublished);
-        socket->sendCommand(onionCommand, onionCommand->build());
+    foreach (HiddenService *service, services)
+        publishService(service);
+}
+
+void TorControlPrivate::publishService(HiddenService *service)
+{
+    if (service->hostname().isEmpty())
+        qDebug() << "torctrl: Creating a new hidden service";
+    else
+        qDebug() << "torctrl: Publishing hidden service" << service->hostname();
+    AddOnionCommand *onionCommand = new AddOnionCommand(service);
+    QObject::connect(onionCommand, &AddOnionCommand::succeeded, service, [this, service]()
+    {
+        // a service created with a new key has only just been given it
+        publishedServices.insert(service, service->privateKey().torServiceID());
+    });
+    QObject::connect(onionCommand, &AddOnionCommand::succeeded, service, &HiddenService::servicePublished);
+    socket->sendCommand(onionCommand, onionCommand->build());
+}
+
+void TorControlPrivate::unpublishService(HiddenService *service)
+{
+    // a service stays up until the control connection which added it closes, and with
+    // a shared tor daemon that is when the last context goes; so take it down ourselves,
+    // which also lets the same identity publish it again
+    auto it = publishedServices.find(service);
+    if (it == publishedServices.end())
+        return;
+
+    if (q->isConnected()) {
+        qDebug() << "torctrl: Removing hidden service" << it.value();
+        socket->sendCommand("DEL_ONION " + it.value() + "\r\n");
     }
+    publishedServices.erase(it);
 }
 
 void TorControl::shutdown()
@@ -567,12 +622,15 @@ void TorControlPrivate::updateBootstrap(const QList<QByteArray> &data)
 
 	// these functions just access 'bootstrapStatus' and parse out the relevant keys
 	// a bit roundabout but better than duplicating the tag parsing logic
-    auto progress = g_globals.context->get_tor_bootstrap_progress();
-    auto tag = g_globals.context->get_tor_bootstrap_tag();
+    g_globals.for_each_context([](tego_context& context)
+    {
+        auto progress = context.get_tor_bootstrap_progress();
+        auto tag = context.get_tor_bootstrap_tag();
 
-    g_globals.context->callback_registry_.emit_tor_bootstrap_status_changed(
-        progress,
-        tag);
+        context.callback_registry_.emit_tor_bootstrap_status_changed(
+            progress,
+            tag);
+    });
 
     qDebug() << bootstrapStatus;
     emit q->bootstrapStatusChanged();
@@ -160,10 +160,13 @@ void TorManager::start()
         d->errorMessage.clear();
         emit errorChanged();
 
-        auto tegoError = std::make_unique<tego_error>();
-        g_globals.context->callback_registry_.emit_tor_error_occurred(
-            tego_tor_error_origin_manager,
-            tegoError.release());
+        tego_error tegoError;
+        g_globals.for_each_context([&](tego_context& context)
+        {
+            context.callback_registry_.emit_tor_error_occurred(
+                tego_tor_error_origin_manager,
+                &tegoError);
+        });
     }
 
     // Launch a bundled Tor instance
@@ -212,22 +215,32 @@ void TorManagerPrivate::processStateChanged(int state)
         control->connect(process->controlHost(), process->controlPort());
     }
 
+    std::optional<tego_tor_process_status_t> processStatus;
     switch(state)
     {
         case TorProcess::NotStarted:
             logger::trace();
-            g_globals.context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_not_started);
+            processStatus = tego_tor_process_status_not_started;
             break;
         case TorProcess::Starting:
             logger::trace();
-            g_globals.context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_starting);
+            processStatus = tego_tor_process_status_starting;
             break;
         case TorProcess::Ready:
             logger::trace();
-            g_globals.context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_running);
+            processStatus = tego_tor_process_status_running;
             break;
     }
 
+    // every context shares this tor process
+    if (processStatus.has_value())
+    {
+        g_globals.for_each_context([&](tego_context& context)
+        {
+            context.callback_registry_.emit_tor_process_status_changed(processStatus.value());
+        });
+    }
+
     emit q->runningChanged();
 }
 
@@ -249,17 +262,21 @@ void TorManagerPrivate::processLogMessage(const QString &message)
     // marshall message out of the QString into our own char buffer
     auto utf8 = message.toUtf8();
 
-    const auto msgLength = utf8.size();
-    const auto msgSize = msgLength + 1;
-    auto msg = std::make_unique<char[]>(msgSize);
-
-    // copy utf8 string to our own buffer
-    std::copy(utf8.begin(), utf8.end(), msg.get());
-    Q_ASSERT(msg[msgLength] == 0);
+    // the whole log as the contexts serve it, one message per line
+    std::string logs;
+    for (const auto& logMessage : logMessages) {
+        logs += logMessage.toStdString();
+        logs += '\n';
+    }
+    auto sharedLogs = std::make_shared<const std::string>(std::move(logs));
 
-    g_globals.context->callback_registry_.emit_tor_log_received(
-        msg.release(),
-        msgLength);
+    g_globals.for_each_context([&](tego_context& context)
+    {
+        context.update_tor_logs(sharedLogs);
+        context.callback_registry_.emit_tor_log_received(
+            utf8.constData(),
+            static_cast<size_t>(utf8.size()));
+    });
 }
 
 void TorManagerPrivate::controlStatusChanged(int status)
@@ -339,12 +356,15 @@ void TorManagerPrivate::setError(const QString &message)
     errorMessage = message;
     emit q->errorChanged();
 
-    auto tegoError = std::make_unique<tego_error>();
-    tegoError->message = message.toStdString();
+    tego_error tegoError;
+    tegoError.message = message.toStdString();
 
-    g_globals.context->callback_registry_.emit_tor_error_occurred(
-        tego_tor_error_origin_manager,
-        tegoError.release());
+    g_globals.for_each_context([&](tego_context& context)
+    {
+        context.callback_registry_.emit_tor_error_occurred(
+            tego_tor_error_origin_manager,
+            &tegoError);
+    });
 }
 
 #include "TorManager.moc"
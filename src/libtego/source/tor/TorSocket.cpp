@@ -30,11 +30,9 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "globals.hpp"
-using tego::g_globals;
-
 #include "TorSocket.h"
 #include "TorControl.h"
+#include "TorManager.h"
 
 using namespace Tor;
 
@@ -45,7 +43,7 @@ TorSocket::TorSocket(QObject *parent)
     , m_maxInterval(900)
     , m_connectAttempts(0)
 {
-    connect(g_globals.context->torControl, SIGNAL(connectivityChanged()), SLOT(connectivityChanged()));
+    connect(TorManager::instance()->control(), SIGNAL(connectivityChanged()), SLOT(connectivityChanged()));
     connect(&m_connectTimer, SIGNAL(timeout()), SLOT(reconnect()));
     connect(this, SIGNAL(disconnected()), SLOT(onFailed()));
     connect(this, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onFailed()));
@@ -101,7 +99,7 @@ int TorSocket::reconnectInterval()
 
 void TorSocket::reconnect()
 {
-    if (!g_globals.context->torControl->hasConnectivity() || !reconnectEnabled())
+    if (!TorManager::instance()->control()->hasConnectivity() || !reconnectEnabled())
         return;
 
     m_connectTimer.stop();
@@ -113,8 +111,8 @@ void TorSocket::reconnect()
 
 void TorSocket::connectivityChanged()
 {
-    if (g_globals.context->torControl->hasConnectivity()) {
-        setProxy(g_globals.context->torControl->connectionProxy());
+    if (TorManager::instance()->control()->hasConnectivity()) {
+        setProxy(TorManager::instance()->control()->connectionProxy());
         if (state() == QAbstractSocket::UnconnectedState)
             reconnect();
     } else {
@@ -129,11 +127,11 @@ void TorSocket::connectToHost(const QString &hostName, quint16 port, OpenMode op
     m_host = hostName;
     m_port = port;
 
-    if (!g_globals.context->torControl->hasConnectivity())
+    if (!TorManager::instance()->control()->hasConnectivity())
         return;
 
-    if (proxy() != g_globals.context->torControl->connectionProxy())
-        setProxy(g_globals.context->torControl->connectionProxy());
+    if (proxy() != TorManager::instance()->control()->connectionProxy())
+        setProxy(TorManager::instance()->control()->connectionProxy());
 
     QAbstractSocket::connectToHost(hostName, port, openMode, protocol);
 }
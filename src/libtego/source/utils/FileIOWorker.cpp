@@ -0,0 +1,107 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FileIOWorker.h"
+
+FileIOWorker *FileIOWorker::instance()
+{
+    static FileIOWorker worker;
+    return &worker;
+}
+
+FileIOWorker::FileIOWorker()
+    : queuedBytes(0)
+    , terminating(false)
+    , thread(&FileIOWorker::run, this)
+{
+}
+
+FileIOWorker::~FileIOWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        terminating = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+}
+
+void FileIOWorker::post(std::function<void()> &&job)
+{
+    enqueue(std::move(job), 0);
+}
+
+bool FileIOWorker::enqueue(std::function<void()> &&job, size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (bytes > MaxQueuedBytes - queuedBytes) {
+            return false;
+        }
+        queuedBytes += bytes;
+        jobs.push_back({std::move(job), bytes});
+    }
+    wakeup.notify_one();
+    return true;
+}
+
+void FileIOWorker::run()
+{
+    for (;;) {
+        queued_job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this] { return terminating || !jobs.empty(); });
+
+            // drain whatever is left before exiting, so cleanup jobs
+            // (removing partial files and the like) still get to run
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        try {
+            job.job();
+        } catch (const std::exception &ex) {
+            qWarning() << "Exception in file I/O job:" << ex.what();
+        } catch (...) {
+            qWarning() << "Unknown exception in file I/O job";
+        }
+
+        if (job.bytes > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            queuedBytes -= job.bytes;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FILEIOWORKER_H
+#define FILEIOWORKER_H
+
+/* Runs blocking filesystem operations on a dedicated background thread
+ *
+ * Jobs run one at a time in the order they were posted, so a sequence of
+ * jobs operating on the same stream never race each other. The result of
+ * each job is handed to its completion function back on the event loop
+ * thread, unless the context object has been destroyed in the meantime.
+ *
+ * Jobs that hold on to data a peer sent us are posted with tryPost, which
+ * counts that data against MaxQueuedBytes until the job has run and refuses
+ * the job rather than queueing past the cap. FileChannel also limits each
+ * incoming transfer to one window of unwritten data, so a well-behaved peer
+ * never comes near the cap; it only stops a misbehaving one exhausting our
+ * memory. Posting never blocks the caller.
+ */
+class FileIOWorker
+{
+    Q_DISABLE_COPY(FileIOWorker)
+public:
+    static FileIOWorker *instance();
+
+    // job() runs on the worker thread and its result is passed to done()
+    // on the thread of the application object
+    template<typename JOB, typename DONE>
+    void post(QObject *context, JOB &&job, DONE &&done)
+    {
+        enqueue(wrap(context, std::forward<JOB>(job), std::forward<DONE>(done)), 0);
+    }
+
+    // like post(), but counts bytes against MaxQueuedBytes until job() has run;
+    // returns false without queueing anything if that would exceed the cap
+    template<typename JOB, typename DONE>
+    bool tryPost(QObject *context, size_t bytes, JOB &&job, DONE &&done)
+    {
+        return enqueue(wrap(context, std::forward<JOB>(job), std::forward<DONE>(done)), bytes);
+    }
+
+    // job() runs on the worker thread with no completion
+    void post(std::function<void()> &&job);
+
+    // data held by queued tryPost jobs, across every transfer
+    constexpr static size_t MaxQueuedBytes = 64 * 1024 * 1024;
+
+private:
+    FileIOWorker();
+    ~FileIOWorker();
+
+    template<typename JOB, typename DONE>
+    static std::function<void()> wrap(QObject *context, JOB &&job, DONE &&done)
+    {
+        return [guard = QPointer<QObject>(context), job = std::forward<JOB>(job), done = std::forward<DONE>(done)]() mutable
+        {
+            auto app = QCoreApplication::instance();
+            auto result = job();
+            if (app == nullptr) {
+                return;
+            }
+
+            QMetaObject::invokeMethod(app, [guard, done = std::move(done), result = std::move(result)]() mutable
+            {
+                // the guard may only be checked on the thread the context lives on
+                if (!guard.isNull()) {
+                    done(std::move(result));
+                }
+            }, Qt::QueuedConnection);
+        };
+    }
+
+    bool enqueue(std::function<void()> &&job, size_t bytes);
+    void run();
+
+    struct queued_job
+    {
+        std::function<void()> job;
+        size_t bytes;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<queued_job> jobs;
+    size_t queuedBytes;
+    bool terminating;
+    // declared last so everything above exists before the thread starts
+    std::thread thread;
+};
+
+#endif // FILEIOWORKER_H
@@ -553,6 +553,27 @@ namespace
         });
     }
 
+    void on_file_transfer_hash_known(
+        tego_context_t*,
+        const tego_user_id_t* userId,
+        tego_file_transfer_id_t id,
+        tego_file_transfer_direction_t direction,
+        tego_file_hash_t const* fileHash)
+    {
+        auto contactId = tegoUserIdToContactId(userId);
+        auto hashStr = tego::to_string(fileHash);
+
+        push_task([=]() -> void
+        {
+            auto contactUser = contactUserFromContactId(contactId);
+            Q_ASSERT(contactUser != nullptr);
+            auto conversationModel = contactUser->conversation();
+            Q_ASSERT(conversationModel != nullptr);
+
+            conversationModel->fileTransferHashKnown(id, direction, QString::fromStdString(hashStr));
+        });
+    }
+
     void on_new_identity_created(
         tego_context_t*,
         const tego_ed25519_private_key_t* privateKey)
@@ -659,6 +680,11 @@ void init_libtego_callbacks(tego_context_t* context)
         &on_file_transfer_complete,
         tego::throw_on_error());
 
+    tego_context_set_file_transfer_hash_known_callback(
+        context,
+        &on_file_transfer_hash_known,
+        tego::throw_on_error());
+
     tego_context_set_user_status_changed_callback(
         context,
         &on_user_status_changed,
@@ -27,6 +27,7 @@ SOURCES += \
     ui/ContactsModel.cpp \
     ui/LanguagesModel.cpp \
     ui/MainWindow.cpp \
+    utils/HistoryLog.cpp \
     utils/Settings.cpp \
     shims/TorControl.cpp\
     shims/TorCommand.cpp\
@@ -45,6 +46,7 @@ HEADERS += \
     ui/ContactsModel.h \
     ui/LanguagesModel.h \
     ui/MainWindow.h \
+    utils/HistoryLog.h \
     utils/Settings.h \
     utils/Useful.h \
     shims/TorControl.h\
@@ -17,6 +17,8 @@
 #include <functional>
 #include <fstream>
 #include <iterator>
+#include <optional>
+#include <atomic>
 
 // fmt
 #include <fmt/format.h>
@@ -32,6 +34,7 @@
 #include <QQuickItem>
 #include <QRegularExpressionValidator>
 #include <QScreen>
+#include <QThreadPool>
 #include <QtQml>
 #ifdef Q_OS_MAC
 #   include <QtMac>
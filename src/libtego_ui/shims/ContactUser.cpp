@@ -92,6 +92,7 @@ namespace shims
 
         tego_context_forget_user(context, userId.get(), tego::throw_on_error());
 
+        conversationModel->deleteHistory();
         settings.undefine();
         emit this->contactDeleted(this);
     }
@@ -4,6 +4,42 @@
 
 namespace shims
 {
+    namespace
+    {
+        class ExportRunnable : public QRunnable
+        {
+        public:
+            ExportRunnable(std::function<void()> &&fn) : fn(std::move(fn)) {}
+            void run() override { fn(); }
+
+        private:
+            std::function<void()> fn;
+        };
+
+        // ui.saveHistory, followed as it changes rather than looked up on every save
+        bool saveHistoryEnabled()
+        {
+            static QPointer<SettingsObject> settings;
+            static bool enabled = false;
+
+            if (settings.isNull())
+            {
+                auto file = SettingsObject::defaultFile();
+                if (file == nullptr)
+                {
+                    return false;
+                }
+                settings = new SettingsObject(file, QStringLiteral("ui"), file);
+                enabled = settings->read<bool>("saveHistory");
+                QObject::connect(settings, &SettingsObject::dataChanged, []()
+                {
+                    enabled = settings->read<bool>("saveHistory");
+                });
+            }
+            return enabled;
+        }
+    }
+
     ConversationModel::ConversationModel(QObject *parent)
     : QAbstractListModel(parent)
     , contactUser(nullptr)
@@ -24,6 +60,12 @@ namespace shims
         });
     }
 
+    ConversationModel::~ConversationModel()
+    {
+        // an export still running keeps its own snapshot, so it only needs to stop early
+        this->cancelExport();
+    }
+
     QHash<int,QByteArray> ConversationModel::roleNames() const
     {
         QHash<int, QByteArray> roles;
@@ -75,10 +117,9 @@ namespace shims
                     if (next.status != Received && next.status != Delivered)
                         return QString();
                 }
-                for (int i = 0; i <= index.row(); i++) {
-                    if (messages[i].status == Received || messages[i].status == Delivered)
-                        return QString();
-                }
+                // a message at or above this one was received or delivered
+                if (newestDeliveredHandle && index.row() >= rowOfHandle(*newestDeliveredHandle))
+                    return QString();
                 return QStringLiteral("offline");
             }
             case TimespanRole: {
@@ -150,6 +191,255 @@ namespace shims
         emit contactChanged();
     }
 
+    bool ConversationModel::canFetchMore(const QModelIndex &parent) const
+    {
+        // until the log is opened, there may be history to fetch
+        return !parent.isValid() && historyEnd != 0 && contactUser != nullptr && saveHistoryEnabled();
+    }
+
+    void ConversationModel::fetchMore(const QModelIndex &parent)
+    {
+        if (!canFetchMore(parent))
+        {
+            return;
+        }
+
+        auto log = this->historyLog();
+        if (log == nullptr)
+        {
+            // nothing to page in, and no point asking again
+            historyEnd = 0;
+            return;
+        }
+
+        QList<MessageData> page;
+        // a page may hold nothing but updates to older messages
+        while (page.isEmpty() && historyEnd > 0)
+        {
+            for (const auto &record : log->readPage(historyEnd))
+            {
+                auto md = readHistoryRecord(record, historyUpdates);
+                if (md)
+                {
+                    page.append(std::move(*md));
+                }
+            }
+        }
+
+        if (page.isEmpty())
+        {
+            return;
+        }
+
+        this->beginInsertRows(QModelIndex(), messages.size(), messages.size() + page.size() - 1);
+        for (auto &md : page)
+        {
+            this->appendMessage(std::move(md));
+        }
+        this->endInsertRows();
+    }
+
+    HistoryLog* ConversationModel::historyLog()
+    {
+        if (!saveHistoryEnabled() || contactUser == nullptr)
+        {
+            history.reset();
+            return nullptr;
+        }
+        if (history)
+        {
+            return history.get();
+        }
+
+        // the log's key is derived from our identity's key, so it is only as
+        // safe as ricochet.json, but a copy of the history alone can't be read
+        const auto privateKey = SettingsObject("identity").read<QString>("privateKey");
+        if (privateKey.isEmpty())
+        {
+            return nullptr;
+        }
+        const auto key = QMessageAuthenticationCode::hash(
+            contactUser->serviceId.toUtf8(),
+            privateKey.toUtf8(),
+            QCryptographicHash::Sha256);
+
+        auto log = std::make_unique<HistoryLog>(historyFilePath(contactUser->serviceId), key);
+        if (!log->open())
+        {
+            qWarning() << "Cannot open conversation history:" << log->errorString();
+            return nullptr;
+        }
+
+        history = std::move(log);
+        // reopened after saveHistory was toggled, the model already holds everything after historyEnd
+        if (historyEnd < 0)
+        {
+            historyEnd = history->size();
+        }
+        return history.get();
+    }
+
+    void ConversationModel::saveToHistory(int row)
+    {
+        auto log = this->historyLog();
+        if (log == nullptr)
+        {
+            return;
+        }
+
+        auto &md = this->messages[row];
+        if (md.historyOffset < 0)
+        {
+            md.historyOffset = log->append(writeHistoryMessage(md));
+        }
+        else
+        {
+            log->append(writeHistoryUpdate(md));
+        }
+    }
+
+    namespace
+    {
+        enum HistoryRecordType : quint8
+        {
+            HistoryMessageRecord = 1,
+            HistoryUpdateRecord,
+        };
+
+        constexpr auto HistoryStreamVersion = QDataStream::Qt_5_9;
+    }
+
+    QString ConversationModel::historyFilePath(const QString &serviceId)
+    {
+        const auto profile = QFileInfo(SettingsObject::defaultFile()->filePath()).path();
+        return QString("%1/history/%2.log").arg(profile).arg(serviceId);
+    }
+
+    QByteArray ConversationModel::writeHistoryMessage(const MessageData &md)
+    {
+        QByteArray re;
+        QDataStream stream(&re, QIODevice::WriteOnly);
+        stream.setVersion(HistoryStreamVersion);
+        stream << quint8(HistoryMessageRecord)
+               << qint32(md.type)
+               << md.text
+               << md.time
+               << md.identifier
+               << qint32(md.status)
+               << md.fileName
+               << md.fileSize
+               << md.fileHash
+               << md.bytesTransferred
+               << qint32(md.transferDirection)
+               << qint32(md.transferStatus);
+        return re;
+    }
+
+    QByteArray ConversationModel::writeHistoryUpdate(const MessageData &md)
+    {
+        QByteArray re;
+        QDataStream stream(&re, QIODevice::WriteOnly);
+        stream.setVersion(HistoryStreamVersion);
+        stream << quint8(HistoryUpdateRecord)
+               << md.historyOffset
+               << qint32(md.status)
+               << qint32(md.transferStatus)
+               << md.bytesTransferred
+               << md.fileHash;
+        return re;
+    }
+
+    std::optional<ConversationModel::MessageData> ConversationModel::readHistoryRecord(const HistoryLog::Record &record, QHash<qint64, HistoryUpdate> &updates)
+    {
+        QDataStream stream(record.data);
+        stream.setVersion(HistoryStreamVersion);
+
+        quint8 recordType = 0;
+        stream >> recordType;
+        if (recordType == HistoryUpdateRecord)
+        {
+            qint64 target = -1;
+            qint32 status = None;
+            qint32 transferStatus = InvalidTransfer;
+            quint64 bytesTransferred = 0;
+            QString fileHash;
+            stream >> target >> status >> transferStatus >> bytesTransferred >> fileHash;
+            // the log is read newest first, so the first update seen is the latest
+            if (stream.status() == QDataStream::Ok && !updates.contains(target))
+            {
+                updates.insert(target, {MessageStatus(status), TransferStatus(transferStatus), bytesTransferred, std::move(fileHash)});
+            }
+            return std::nullopt;
+        }
+        if (recordType != HistoryMessageRecord)
+        {
+            qWarning() << "Unknown history record type" << recordType;
+            return std::nullopt;
+        }
+
+        MessageData md;
+        qint32 type = InvalidMessage;
+        qint32 status = None;
+        qint32 transferDirection = InvalidDirection;
+        qint32 transferStatus = InvalidTransfer;
+        stream >> type
+               >> md.text
+               >> md.time
+               >> md.identifier
+               >> status
+               >> md.fileName
+               >> md.fileSize
+               >> md.fileHash
+               >> md.bytesTransferred
+               >> transferDirection
+               >> transferStatus;
+        if (stream.status() != QDataStream::Ok)
+        {
+            qWarning() << "Malformed history record at offset" << record.offset;
+            return std::nullopt;
+        }
+        md.type = MessageDataType(type);
+        md.status = MessageStatus(status);
+        md.transferDirection = TransferDirection(transferDirection);
+        md.transferStatus = TransferStatus(transferStatus);
+        md.historyOffset = record.offset;
+
+        if (auto it = updates.find(record.offset); it != updates.end())
+        {
+            md.status = it->status;
+            md.transferStatus = it->transferStatus;
+            md.bytesTransferred = it->bytesTransferred;
+            md.fileHash = it->fileHash;
+            updates.erase(it);
+        }
+
+        // whatever was still in flight belonged to an earlier session, and won't finish now
+        if (md.status == Queued || md.status == Sending)
+        {
+            md.status = Error;
+        }
+        if (md.type == TransferMessage &&
+            (md.transferStatus == Pending || md.transferStatus == Accepted || md.transferStatus == InProgress))
+        {
+            md.transferStatus = Cancelled;
+        }
+
+        return md;
+    }
+
+    void ConversationModel::deleteHistory()
+    {
+        if (contactUser == nullptr)
+        {
+            return;
+        }
+
+        history.reset();
+        historyEnd = 0;
+        historyUpdates.clear();
+        QFile::remove(historyFilePath(contactUser->serviceId));
+    }
+
     int ConversationModel::getUnreadCount() const
     {
         return unreadCount;
@@ -209,7 +499,7 @@ namespace shims
         md.status = Queued;
 
         this->beginInsertRows(QModelIndex(), 0, 0);
-        this->messages.prepend(std::move(md));
+        this->prependMessage(std::move(md));
         this->endInsertRows();
         this->addEventFromMessage(indexOfOutgoingMessage(messageId));
     }
@@ -230,7 +520,6 @@ namespace shims
             const auto path = filePath.toUtf8();
             const auto userId = this->contactUser->toTegoUserId();
             tego_file_transfer_id_t id;
-            std::unique_ptr<tego_file_hash_t> fileHash;
             tego_file_size_t fileSize = 0;
 
             try
@@ -241,11 +530,11 @@ namespace shims
                     path.data(),
                     path.size(),
                     &id,
-                    tego::out(fileHash),
+                    nullptr, // don't wait for the file to be hashed before offering it
                     &fileSize,
                     tego::throw_on_error());
 
-                logger::println("send file request id : {}, hash : {}", id, tego::to_string(fileHash.get()));
+                logger::println("send file request id : {}", id);
 
                 MessageData md;
                 md.type = TransferMessage;
@@ -255,12 +544,11 @@ namespace shims
 
                 md.fileName = QFileInfo(filePath).fileName();
                 md.fileSize = fileSize;
-                md.fileHash = QString::fromStdString(tego::to_string(fileHash.get()));
                 md.transferStatus = Pending;
                 md.transferDirection = Uploading;
 
                 this->beginInsertRows(QModelIndex(), 0, 0);
-                this->messages.prepend(std::move(md));
+                this->prependMessage(std::move(md));
                 this->endInsertRows();
 
                 this->addEventFromMessage(indexOfOutgoingMessage(id));
@@ -272,41 +560,41 @@ namespace shims
         }
     }
 
-    void ConversationModel::deserializeTextMessageEventToFile(const EventData &event, std::ofstream &ofile) const
+    void ConversationModel::formatTextMessageEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer)
     {
-        auto &md = this->messages[this->messages.size() - event.messageData.reverseIndex];
+        auto &md = snapshot.message(event.messageData.handle);
         switch (md.status)
         {
             case Received:
-                fmt::print(ofile, "[{}] <{}>: {}\n",
-                                    md.time.toString().toStdString(),
-                                    this->contact()->getNickname().toStdString(),
-                                    md.text.toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] <{}>: {}\n",
+                                                         md.time.toString().toStdString(),
+                                                         snapshot.nickname,
+                                                         md.text.toStdString()); break;
             case Delivered:
-                fmt::print(ofile, "[{}] <{}>: {}\n",
-                                    md.time.toString().toStdString(),
-                                    tr("me").toStdString(),
-                                    md.text.toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] <{}>: {}\n",
+                                                         md.time.toString().toStdString(),
+                                                         snapshot.me,
+                                                         md.text.toStdString()); break;
             default:
                 // messages we sent that weren't delivered
-                fmt::print(ofile, "[{}] <{}> ({}): {}\n",
-                                    md.time.toString().toStdString(),
-                                    tr("me").toStdString(),
-                                    getMessageStatusString(md.status),
-                                    md.text.toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] <{}> ({}): {}\n",
+                                                         md.time.toString().toStdString(),
+                                                         snapshot.me,
+                                                         getMessageStatusString(md.status),
+                                                         md.text.toStdString()); break;
         }
     }
 
-    void ConversationModel::deserializeTransferMessageEventToFile(const EventData &event, std::ofstream &ofile) const
+    void ConversationModel::formatTransferMessageEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer)
     {
-        auto &md = this->messages[this->messages.size() - event.transferData.reverseIndex];
+        auto &md = snapshot.message(event.transferData.handle);
 
         if (md.transferDirection == InvalidDirection)
             return;
 
         std::string sender = md.transferDirection == Uploading
-                                    ? tr("me").toStdString()
-                                    : this->contact()->getNickname().toStdString();
+                                    ? snapshot.me
+                                    : snapshot.nickname;
 
         switch (event.transferData.status)
         {
@@ -315,73 +603,73 @@ namespace shims
             case Rejected:          //FALLTHROUGH
             case Cancelled:         //FALLTHROUGH
             case Finished:
-                fmt::print(ofile, "[{}] file '{}' from <{}> (hash: {}, size: {:L} bytes): {}\n",
-                                    event.time.toString().toStdString(),
-                                    md.fileName.toStdString(),
-                                    sender,
-                                    md.fileHash.toStdString(),
-                                    md.fileSize,
-                                    getTransferStatusString(event.transferData.status)); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] file '{}' from <{}> (hash: {}, size: {:L} bytes): {}\n",
+                                                         event.time.toString().toStdString(),
+                                                         md.fileName.toStdString(),
+                                                         sender,
+                                                         md.fileHash.toStdString(),
+                                                         md.fileSize,
+                                                         getTransferStatusString(event.transferData.status)); break;
             case UnknownFailure:    //FALLTHROUGH
             case BadFileHash:       //FALLTHROUGH
             case NetworkError:      //FALLTHROUGH
             case FileSystemError:
-                fmt::print(ofile, "[{}] file '{}' from <{}> (hash: {}, size: {:L} bytes): Error: {}, bytes transferred: {:L} bytes\n",
-                                    event.time.toString().toStdString(),
-                                    md.fileName.toStdString(),
-                                    sender,
-                                    md.fileHash.toStdString(),
-                                    md.fileSize,
-                                    getTransferStatusString(event.transferData.status),
-                                    event.transferData.bytesTransferred); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] file '{}' from <{}> (hash: {}, size: {:L} bytes): Error: {}, bytes transferred: {:L} bytes\n",
+                                                         event.time.toString().toStdString(),
+                                                         md.fileName.toStdString(),
+                                                         sender,
+                                                         md.fileHash.toStdString(),
+                                                         md.fileSize,
+                                                         getTransferStatusString(event.transferData.status),
+                                                         event.transferData.bytesTransferred); break;
             default:
                 qWarning() << "Invalid transfer status in events";
                 break;
         }
     }
 
-    void ConversationModel::deserializeUserStatusUpdateEventToFile(const EventData &event, std::ofstream &ofile) const
+    void ConversationModel::formatUserStatusUpdateEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer)
     {
         if (event.userStatusData.target == UserTargetNone)
             return;
 
         std::string sender = event.userStatusData.target == UserTargetClient
-                                    ? tr("me").toStdString()
-                                    : this->contact()->getNickname().toStdString();
+                                    ? snapshot.me
+                                    : snapshot.nickname;
 
         switch (event.userStatusData.status)
         {
             case ContactUser::Status::Online:
-                fmt::print(ofile, "[{}] <{}> is now online\n",
-                                    event.time.toString().toStdString(),
-                                    this->contact()->getNickname().toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] <{}> is now online\n",
+                                                         event.time.toString().toStdString(),
+                                                         snapshot.nickname); break;
             case ContactUser::Status::Offline:
-                fmt::print(ofile, "[{}] <{}> is now offline\n",
-                                    event.time.toString().toStdString(),
-                                    this->contact()->getNickname().toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] <{}> is now offline\n",
+                                                         event.time.toString().toStdString(),
+                                                         snapshot.nickname); break;
             case ContactUser::Status::RequestPending:
-                fmt::print(ofile, "[{}] New contact request to <{}>\n",
-                                    event.time.toString().toStdString(),
-                                    this->contact()->getNickname().toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] New contact request to <{}>\n",
+                                                         event.time.toString().toStdString(),
+                                                         snapshot.nickname); break;
             case ContactUser::Status::RequestRejected:
-                fmt::print(ofile, "[{}] Outgoing request to <{}> was rejected\n",
-                                    event.time.toString().toStdString(),
-                                    this->contact()->getNickname().toStdString()); break;
+                fmt::format_to(std::back_inserter(buffer), "[{}] Outgoing request to <{}> was rejected\n",
+                                                         event.time.toString().toStdString(),
+                                                         snapshot.nickname); break;
             default:
                 break;
         }
     }
 
-    void ConversationModel::deserializeEventToFile(const EventData &event, std::ofstream &ofile) const
+    void ConversationModel::formatEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer)
     {
         switch (event.type)
         {
             case TextMessageEvent:
-                deserializeTextMessageEventToFile(event, ofile); break;
+                formatTextMessageEvent(snapshot, event, buffer); break;
             case TransferMessageEvent:
-                deserializeTransferMessageEventToFile(event, ofile); break;
+                formatTransferMessageEvent(snapshot, event, buffer); break;
             case UserStatusUpdateEvent:
-                deserializeUserStatusUpdateEventToFile(event, ofile); break;
+                formatUserStatusUpdateEvent(snapshot, event, buffer); break;
             default:
                 qWarning() << "Unknown event type in events list";
                 break;
@@ -392,8 +680,48 @@ namespace shims
         return events.size() > 0;
     }
 
+    bool ConversationModel::writeExport(const ExportSnapshot &snapshot, std::ofstream &ofile, const ExportState &state, const std::function<void(qreal)> &progress)
+    {
+        // formatted text is written out a chunk at a time rather than line by line
+        constexpr size_t ChunkSize = 64 * 1024;
+
+        fmt::memory_buffer buffer;
+        fmt::format_to(std::back_inserter(buffer), "Conversation with {} ({})\n",
+                                                 snapshot.nickname,
+                                                 snapshot.contactId);
+
+        const int count = snapshot.events.size();
+        int reportedPercent = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            if (state.cancelled)
+                return false;
+
+            formatEvent(snapshot, snapshot.events[i], buffer);
+            if (buffer.size() >= ChunkSize)
+            {
+                if (!ofile.write(buffer.data(), buffer.size()))
+                    return false;
+                buffer.clear();
+
+                const int percent = int(qint64(i + 1) * 100 / count);
+                if (percent != reportedPercent)
+                {
+                    reportedPercent = percent;
+                    progress(qreal(i + 1) / count);
+                }
+            }
+        }
+
+        return ofile.write(buffer.data(), buffer.size()) && ofile.flush();
+    }
+
     bool ConversationModel::exportConversation()
     {
+        // exports of different conversations run side by side, but only one of each
+        if (this->exportState)
+            return true;
+
         const auto proposedDest = QString("%1/%2-%3.log").arg(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation)).arg(this->contact()->getNickname()).arg(this->events.constFirst().time.toString(Qt::ISODate));
 
         auto filePath = QFileDialog::getSaveFileName(nullptr,
@@ -404,25 +732,79 @@ namespace shims
         if (filePath.isEmpty())
             return true;
 
-        std::ofstream ofile(filePath.toStdString(), std::ios::out);
-        if (!ofile.is_open())
+        auto ofile = std::make_shared<std::ofstream>(filePath.toStdString(), std::ios::out);
+        if (!ofile->is_open())
         {
             qWarning() << "Could not open file " << filePath;
             return false;
         }
 
-        fmt::print(ofile, "Conversation with {} ({})\n",
-                            this->contact()->getNickname().toStdString(),
-                            this->contact()->getContactID().toStdString());
+        ExportSnapshot snapshot;
+        snapshot.messages = this->messages;
+        snapshot.events = this->events;
+        snapshot.topHandle = this->topHandle;
+        snapshot.nickname = this->contact()->getNickname().toStdString();
+        snapshot.contactId = this->contact()->getContactID().toStdString();
+        snapshot.me = tr("me").toStdString();
+
+        auto state = std::make_shared<ExportState>();
+        this->exportState = state;
+        this->exportProgress = 0;
+        emit this->exportProgressChanged();
+
+        // runs fn on the gui thread, unless the model is gone by then
+        auto post = [guard = QPointer<ConversationModel>(this), state](auto fn)
+        {
+            auto app = QCoreApplication::instance();
+            if (app == nullptr)
+                return;
 
-        foreach(auto &event, this->events)
+            QMetaObject::invokeMethod(app, [guard, state, fn = std::move(fn)]()
+            {
+                if (!guard.isNull() && guard->exportState == state)
+                    fn(guard.data());
+            }, Qt::QueuedConnection);
+        };
+
+        QThreadPool::globalInstance()->start(new ExportRunnable([=, snapshot = std::move(snapshot)]()
         {
-            deserializeEventToFile(event, ofile);
-        }
+            const bool succeeded = writeExport(snapshot, *ofile, *state, [&](qreal progress)
+            {
+                post([progress](ConversationModel *self)
+                {
+                    self->exportProgress = progress;
+                    emit self->exportProgressChanged();
+                });
+            });
+            ofile->close();
+
+            // don't leave a partial export behind
+            if (!succeeded)
+            {
+                if (!state->cancelled)
+                    qWarning() << "Could not write file " << filePath;
+                QFile::remove(filePath);
+            }
+
+            post([succeeded, cancelled = bool(state->cancelled)](ConversationModel *self)
+            {
+                self->exportState.reset();
+                self->exportProgress = 0;
+                emit self->exportProgressChanged();
+                if (!succeeded && !cancelled)
+                    emit self->exportFailed();
+            });
+        }));
 
         return true;
     }
 
+    void ConversationModel::cancelExport()
+    {
+        if (this->exportState)
+            this->exportState->cancelled = true;
+    }
+
     void ConversationModel::tryAcceptFileTransfer(quint32 id)
     {
         auto row = this->indexOfIncomingMessage(id);
@@ -555,20 +937,35 @@ namespace shims
         md.transferStatus = Pending;
 
         this->beginInsertRows(QModelIndex(), 0, 0);
-        this->messages.prepend(std::move(md));
+        this->prependMessage(std::move(md));
         this->endInsertRows();
 
         this->setUnreadCount(this->unreadCount + 1);
         this->addEventFromMessage(indexOfIncomingMessage(id));
     }
 
+    void ConversationModel::fileTransferHashKnown(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, QString fileHash)
+    {
+        auto row = direction == tego_file_transfer_direction_sending
+                 ? this->indexOfOutgoingMessage(id)
+                 : this->indexOfIncomingMessage(id);
+        if (row < 0)
+        {
+            return;
+        }
+
+        // saved to history along with the transfer's next status change
+        auto &data = messages[row];
+        data.fileHash = std::move(fileHash);
+        emitDataChanged(row);
+    }
+
     void ConversationModel::fileTransferRequestAcknowledged(tego_file_transfer_id_t id, bool accepted)
     {
         auto row = this->indexOfOutgoingMessage(id);
         Q_ASSERT(row >= 0);
 
-        MessageData &data = messages[row];
-        data.status = accepted ? Delivered : Error;
+        setMessageStatus(row, accepted ? Delivered : Error);
         emitDataChanged(row);
     }
 
@@ -655,8 +1052,28 @@ namespace shims
 
         beginRemoveRows(QModelIndex(), 0, messages.size()-1);
         messages.clear();
+        messageHandles.clear();
+        newestDeliveredHandle.reset();
+        // handles keep counting up from where they were, so nothing still holding an
+        // old one can mistake a later message for the one it meant
+        bottomHandle = topHandle + 1;
         endRemoveRows();
 
+        // events about the messages go with them
+        const auto eventCount = events.size();
+        events.erase(std::remove_if(events.begin(), events.end(), [](const EventData &ed)
+        {
+            return ed.type == TextMessageEvent || ed.type == TransferMessageEvent;
+        }), events.end());
+        if (events.size() != eventCount)
+        {
+            emit this->conversationEventCountChanged();
+        }
+
+        // the whole history can be paged in again
+        historyEnd = history ? history->size() : -1;
+        historyUpdates.clear();
+
         resetUnreadCount();
     }
 
@@ -670,7 +1087,7 @@ namespace shims
         md.status = Received;
 
         this->beginInsertRows(QModelIndex(), 0, 0);
-        this->messages.prepend(std::move(md));
+        this->prependMessage(std::move(md));
         this->endInsertRows();
 
         this->setUnreadCount(this->unreadCount + 1);
@@ -682,8 +1099,7 @@ namespace shims
         auto row = this->indexOfOutgoingMessage(messageId);
         Q_ASSERT(row >= 0);
 
-        MessageData &data = messages[row];
-        data.status = accepted ? Delivered : Error;
+        setMessageStatus(row, accepted ? Delivered : Error);
         emitDataChanged(row);
     }
 
@@ -699,11 +1115,11 @@ namespace shims
         {
             case TextMessage:
                 ed.type = TextMessageEvent;
-                ed.messageData.reverseIndex = this->messages.size() - row;
+                ed.messageData.handle = handleOfRow(row);
                 break;
             case TransferMessage:
                 ed.type = TransferMessageEvent;
-                ed.transferData.reverseIndex = this->messages.size() - row;
+                ed.transferData.handle = handleOfRow(row);
                 ed.transferData.status = md.transferStatus;
                 ed.transferData.bytesTransferred = md.bytesTransferred;
                 break;
@@ -712,8 +1128,9 @@ namespace shims
         }
         ed.time = QDateTime::currentDateTime();
 
-        this->events.append(std::move(ed));
-        emit this->conversationEventCountChanged();
+        this->appendEvent(std::move(ed));
+
+        this->saveToHistory(row);
     }
 
     void ConversationModel::setStatus(ContactUser::Status status)
@@ -725,7 +1142,16 @@ namespace shims
         ed.userStatusData.target = UserTargetPeer;
         ed.time = QDateTime::currentDateTime();
 
+        this->appendEvent(std::move(ed));
+    }
+
+    void ConversationModel::appendEvent(EventData &&ed)
+    {
         this->events.append(std::move(ed));
+        if (this->events.size() > MaxEvents)
+        {
+            this->events.removeFirst();
+        }
         emit this->conversationEventCountChanged();
     }
 
@@ -735,37 +1161,90 @@ namespace shims
         emit dataChanged(index(row, 0), index(row, 0));
     }
 
-    int ConversationModel::indexOfMessage(quint32 identifier) const
+    quint64 ConversationModel::messageKey(quint32 identifier, bool isOutgoing)
     {
-        for (int i = 0; i < messages.size(); i++) {
-            const auto& currentMessage = messages[i];
+        return (quint64(identifier) << 1) | (isOutgoing ? 1 : 0);
+    }
 
-            if (currentMessage.identifier == identifier)
-                return i;
+    void ConversationModel::prependMessage(MessageData &&md)
+    {
+        // a reused identifier now refers to the newer message, as a scan from the top would find it
+        const auto handle = ++this->topHandle;
+        this->messageHandles.insert(messageKey(md.identifier, md.status != Received), handle);
+        if (md.status == Received || md.status == Delivered)
+        {
+            this->newestDeliveredHandle = handle;
         }
-        return -1;
+        this->messages.prepend(std::move(md));
     }
 
-    int ConversationModel::indexOfOutgoingMessage(quint32 identifier) const
+    void ConversationModel::appendMessage(MessageData &&md)
     {
-        for (int i = 0; i < messages.size(); i++) {
-            const auto& currentMessage = messages[i];
-
-            if (currentMessage.identifier == identifier && (currentMessage.status != Received))
-                return i;
+        // history is older than anything already in the model
+        const auto handle = --this->bottomHandle;
+        const auto key = messageKey(md.identifier, md.status != Received);
+        if (!this->messageHandles.contains(key))
+        {
+            this->messageHandles.insert(key, handle);
+        }
+        if ((md.status == Received || md.status == Delivered) && !this->newestDeliveredHandle)
+        {
+            this->newestDeliveredHandle = handle;
         }
-        return -1;
+        this->messages.append(std::move(md));
     }
 
-    int ConversationModel::indexOfIncomingMessage(quint32 identifier) const
+    void ConversationModel::setMessageStatus(int row, MessageStatus status)
     {
-        for (int i = 0; i < messages.size(); i++) {
-            const auto& currentMessage = messages[i];
+        messages[row].status = status;
+        saveToHistory(row);
+        if (status != Received && status != Delivered)
+        {
+            return;
+        }
 
-            if (currentMessage.identifier == identifier && (currentMessage.status == Received))
-                return i;
+        // the row above reads our status for its section, and if this is now the
+        // newest delivered message, the rows down from the old one leave the offline section
+        const auto handle = handleOfRow(row);
+        auto lastChanged = row - 1;
+        if (!newestDeliveredHandle || handle > *newestDeliveredHandle)
+        {
+            lastChanged = newestDeliveredHandle ? rowOfHandle(*newestDeliveredHandle) - 1 : messages.size() - 1;
+            newestDeliveredHandle = handle;
+        }
+
+        const auto firstChanged = std::max(row - 1, 0);
+        if (firstChanged <= lastChanged)
+        {
+            emit dataChanged(index(firstChanged, 0), index(lastChanged, 0), {SectionRole});
         }
-        return -1;
+    }
+
+    int ConversationModel::indexOfMessage(quint32 identifier, bool isOutgoing) const
+    {
+        auto it = messageHandles.constFind(messageKey(identifier, isOutgoing));
+        if (it == messageHandles.constEnd())
+            return -1;
+        return rowOfHandle(it.value());
+    }
+
+    int ConversationModel::indexOfMessage(quint32 identifier) const
+    {
+        const auto outgoing = indexOfOutgoingMessage(identifier);
+        const auto incoming = indexOfIncomingMessage(identifier);
+        if (outgoing < 0 || incoming < 0)
+            return std::max(outgoing, incoming);
+        return std::min(outgoing, incoming);
+    }
+
+    int ConversationModel::indexOfOutgoingMessage(quint32 identifier) const
+    {
+        return indexOfMessage(identifier, true);
+    }
+
+    int ConversationModel::indexOfIncomingMessage(quint32 identifier) const
+    {
+        return indexOfMessage(identifier, false);
     }
 
     const char* ConversationModel::getMessageStatusString(const MessageStatus status)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ContactUser.h"
+#include "utils/HistoryLog.h"
 
 namespace shims
 {
@@ -13,8 +14,11 @@ namespace shims
         Q_PROPERTY(shims::ContactUser* contact READ contact WRITE setContact NOTIFY contactChanged)
         Q_PROPERTY(int unreadCount READ getUnreadCount RESET resetUnreadCount NOTIFY unreadCountChanged)
         Q_PROPERTY(int conversationEventCount READ getConversationEventCount NOTIFY conversationEventCountChanged)
+        Q_PROPERTY(bool exporting READ isExporting NOTIFY exportProgressChanged)
+        Q_PROPERTY(qreal exportProgress READ getExportProgress NOTIFY exportProgressChanged)
     public:
         ConversationModel(QObject *parent = 0);
+        ~ConversationModel();
 
         enum {
             TimestampRole = Qt::UserRole,
@@ -83,6 +87,9 @@ namespace shims
         virtual QHash<int,QByteArray> roleNames() const;
         virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
         virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+        // older messages are loaded from history a page at a time as the view scrolls to them
+        virtual bool canFetchMore(const QModelIndex &parent) const;
+        virtual void fetchMore(const QModelIndex &parent);
 
         shims::ContactUser *contact() const;
         void setContact(shims::ContactUser *contact);
@@ -92,7 +99,12 @@ namespace shims
         void sendFile();
         bool hasEventsToExport();
         Q_INVOKABLE int getConversationEventCount() const { return this->events.size(); }
+        // asks for a destination and writes the conversation there in the background;
+        // returns false if the destination can't be opened
         bool exportConversation();
+        bool isExporting() const { return this->exportState != nullptr; }
+        qreal getExportProgress() const { return this->exportProgress; }
+        Q_INVOKABLE void cancelExport();
         // invokable function neeeds to use a Qt type since it is invokable from QML
         static_assert(std::is_same_v<quint32, tego_file_transfer_id_t>);
         Q_INVOKABLE void tryAcceptFileTransfer(quint32 id);
@@ -101,12 +113,14 @@ namespace shims
 
 
         void setStatus(ContactUser::Status status);
+        void deleteHistory();
 
         void fileTransferRequestReceived(tego_file_transfer_id_t id, QString fileName, QString fileHash, quint64 fileSize);
         void fileTransferRequestAcknowledged(tego_file_transfer_id_t id, bool accepted);
         void fileTransferRequestResponded(tego_file_transfer_id_t id, tego_file_transfer_response_t response);
         void fileTransferRequestProgressUpdated(tego_file_transfer_id_t id, quint64 bytesTransferred);
         void fileTransferRequestCompleted(tego_file_transfer_id_t id, tego_file_transfer_result_t result);
+        void fileTransferHashKnown(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, QString fileHash);
 
         void messageReceived(tego_message_id_t messageId, QDateTime timestamp, const QString& text);
         void messageAcknowledged(tego_message_id_t messageId, bool accepted);
@@ -119,6 +133,8 @@ namespace shims
         void contactChanged();
         void unreadCountChanged(int prevCount, int currentCount);
         void conversationEventCountChanged();
+        void exportProgressChanged();
+        void exportFailed();
     private:
         void setUnreadCount(int count);
 
@@ -141,6 +157,8 @@ namespace shims
             quint64 bytesTransferred = 0;
             TransferDirection transferDirection = InvalidDirection;;
             TransferStatus transferStatus = InvalidTransfer;
+            // where the message is saved in history, -1 if it isn't
+            qint64 historyOffset = -1;
         };
 
         struct EventData
@@ -148,10 +166,10 @@ namespace shims
             EventType type = InvalidEvent;
             union {
                 struct {
-                    size_t reverseIndex = 0;
+                    qint64 handle = 0;
                 } messageData;
                 struct {
-                    size_t reverseIndex = 0;
+                    qint64 handle = 0;
                     TransferStatus status = InvalidTransfer;
                     qint64 bytesTransferred = 0; // we care about this for when a transfer is cancelled midway 
                 } transferData;
@@ -167,20 +185,90 @@ namespace shims
         };
 
         QList<MessageData> messages;
+        // only what happened while we were running, and only the newest MaxEvents
+        // of that so a long running session can't grow without bound
         QList<EventData> events;
+        constexpr static int MaxEvents = 10000;
+        void appendEvent(EventData &&ed);
+
+        // new messages are prepended and history is appended, so a message's handle
+        // never changes: row 0 has topHandle, and handles count down from there
+        qint64 topHandle = 0;
+        qint64 bottomHandle = 1;
+        int rowOfHandle(qint64 handle) const { return int(topHandle - handle); }
+        qint64 handleOfRow(int row) const { return topHandle - row; }
+        // handle of the newest message with each identifier and direction
+        QHash<quint64, qint64> messageHandles;
+        static quint64 messageKey(quint32 identifier, bool isOutgoing);
+        void prependMessage(MessageData &&md);
+        void appendMessage(MessageData &&md);
+
+        // handle of the newest message that was received or delivered;
+        // every message above it is in the offline section
+        std::optional<qint64> newestDeliveredHandle;
+        void setMessageStatus(int row, MessageStatus status);
+
+        struct HistoryUpdate
+        {
+            MessageStatus status;
+            TransferStatus transferStatus;
+            quint64 bytesTransferred;
+            QString fileHash;
+        };
+
+        // the conversation saved in the profile, while the ui.saveHistory setting is on
+        std::unique_ptr<HistoryLog> history;
+        // the log before this offset hasn't been loaded yet; -1 until the log is first
+        // opened, which waits for the view to ask for history or a message to be saved
+        qint64 historyEnd = -1;
+        // latest state of messages that haven't been loaded yet, by offset; updates
+        // are read before the messages they apply to since the log is read backwards
+        QHash<qint64, HistoryUpdate> historyUpdates;
+        HistoryLog *historyLog();
+        void saveToHistory(int row);
+        static QString historyFilePath(const QString &serviceId);
+        static QByteArray writeHistoryMessage(const MessageData &md);
+        static QByteArray writeHistoryUpdate(const MessageData &md);
+        // the message in record, with any later update applied; nothing if record is an update
+        static std::optional<MessageData> readHistoryRecord(const HistoryLog::Record &record, QHash<qint64, HistoryUpdate> &updates);
 
         void addEventFromMessage(int row);
 
-        void deserializeTextMessageEventToFile(const EventData &event, std::ofstream &ofile) const;
-        void deserializeTransferMessageEventToFile(const EventData &event, std::ofstream &ofile) const;
-        void deserializeUserStatusUpdateEventToFile(const EventData &event, std::ofstream &ofile) const;
-        void deserializeEventToFile(const EventData &event, std::ofstream &ofile) const;
+        // what an export needs, copied on the gui thread so it can be written from a worker;
+        // the lists are implicitly shared, so taking one is cheap however long the conversation
+        struct ExportSnapshot
+        {
+            QList<MessageData> messages;
+            QList<EventData> events;
+            qint64 topHandle = 0;
+            std::string nickname;
+            std::string contactId;
+            std::string me;
+
+            const MessageData &message(qint64 handle) const { return messages[int(topHandle - handle)]; }
+        };
+
+        struct ExportState
+        {
+            std::atomic<bool> cancelled{false};
+        };
+
+        // the export in progress, if any
+        std::shared_ptr<ExportState> exportState;
+        qreal exportProgress = 0;
+
+        static bool writeExport(const ExportSnapshot &snapshot, std::ofstream &ofile, const ExportState &state, const std::function<void(qreal)> &progress);
+        static void formatTextMessageEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer);
+        static void formatTransferMessageEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer);
+        static void formatUserStatusUpdateEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer);
+        static void formatEvent(const ExportSnapshot &snapshot, const EventData &event, fmt::memory_buffer &buffer);
 
         int unreadCount = 0;
 
         void emitDataChanged(int row);
 
         int indexOfMessage(quint32 identifier) const;
+        int indexOfMessage(quint32 identifier, bool isOutgoing) const;
         int indexOfOutgoingMessage(quint32 identifier) const;
         int indexOfIncomingMessage(quint32 identifier) const;
 
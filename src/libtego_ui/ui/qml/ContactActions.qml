@@ -36,7 +36,7 @@ Item {
     }
 
     function canExportConversation() {
-        return contact.conversation.conversationEventCount > 0;
+        return contact.conversation.conversationEventCount > 0 && !contact.conversation.exporting;
     }
 
     function exportConversation() {
@@ -47,6 +47,12 @@ Item {
 
     signal renameTriggered
 
+    // the export itself is written in the background and may fail after it starts
+    Connections {
+        target: contact.conversation
+        onExportFailed: exportConversationFailedDialog.visible = true
+    }
+
     MessageDialog {
         id: exportConversationFailedDialog
 
@@ -90,6 +96,12 @@ Item {
             text: qsTr("Export Conversation...")
             onTriggered: exportConversation()
         }
+        MenuItem {
+            //: Context menu command to stop a chat log export that is still being written, %1 is how much of it is done
+            visible: contact.conversation.exporting
+            text: qsTr("Cancel Export (%1%)").arg(Math.floor(contact.conversation.exportProgress * 100))
+            onTriggered: contact.conversation.cancelExport()
+        }
         MenuSeparator { }
         MenuItem {
             //: Context menu command to remove a contact from the contact list
@@ -24,6 +24,21 @@ ColumnLayout {
         }
     }
 
+    CheckBox {
+        //: Text description of an option to keep an encrypted copy of conversations in the profile, so they are still there after a restart
+        text: qsTr("Save conversation history")
+        checked: uiSettings.data.saveHistory || false
+        onCheckedChanged: {
+            uiSettings.write("saveHistory", checked)
+        }
+
+        Accessible.role: Accessible.CheckBox
+        Accessible.name: text
+        Accessible.onPressAction: {
+            uiSettings.write("saveHistory", checked)
+        }
+    }
+
     CheckBox {
         //: Text description of an option to play audio notifications when contacts log in, log out, and send messages
         text: qsTr("Play audio notifications")
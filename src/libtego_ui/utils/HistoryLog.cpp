@@ -0,0 +1,278 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HistoryLog.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace
+{
+    constexpr int NonceSize = 12;
+    constexpr int TagSize = 16;
+    constexpr int LengthSize = 4;
+    // no single message comes anywhere near this; anything larger is corruption
+    constexpr quint32 MaxRecordSize = 16 * 1024 * 1024;
+
+    struct cipher_ctx_deleter
+    {
+        void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+    };
+    using cipher_ctx = std::unique_ptr<EVP_CIPHER_CTX, cipher_ctx_deleter>;
+
+    QByteArray offsetBytes(qint64 offset)
+    {
+        QByteArray re(sizeof(qint64), Qt::Uninitialized);
+        qToBigEndian<qint64>(offset, re.data());
+        return re;
+    }
+}
+
+HistoryLog::HistoryLog(const QString &filePath, const QByteArray &k)
+    : file(filePath)
+    , key(k)
+{
+    Q_ASSERT(key.size() == KeySize);
+}
+
+bool HistoryLog::open()
+{
+    QDir dir(QFileInfo(file.fileName()).path());
+    if (!dir.exists() && !dir.mkpath(QStringLiteral("."))) {
+        error = QStringLiteral("Cannot create directory %1").arg(dir.path());
+        return false;
+    }
+
+    if (!file.open(QIODevice::ReadWrite)) {
+        error = file.errorString();
+        return false;
+    }
+    // only the owner may read the log, whatever the umask
+    file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+
+    const bool ok = recover();
+    if (!ok)
+        error = file.errorString();
+    file.close();
+    return ok;
+}
+
+bool HistoryLog::recover()
+{
+    const qint64 size = file.size();
+    if (size == 0)
+        return true;
+
+    // a crash during append leaves a partial record at the end; when the last
+    // length doesn't frame a record, find the last one that is whole
+    bool whole = false;
+    if (size >= 2 * LengthSize && file.seek(size - LengthSize)) {
+        uchar trailer[LengthSize];
+        uchar header[LengthSize];
+        if (file.read(reinterpret_cast<char*>(trailer), LengthSize) == LengthSize) {
+            const quint32 length = qFromBigEndian<quint32>(trailer);
+            const qint64 start = size - 2 * LengthSize - length;
+            whole = length <= MaxRecordSize && start >= 0 &&
+                file.seek(start) &&
+                file.read(reinterpret_cast<char*>(header), LengthSize) == LengthSize &&
+                qFromBigEndian<quint32>(header) == length;
+        }
+    }
+
+    if (!whole) {
+        const qint64 end = recoverEnd();
+        qWarning() << "Dropping" << (size - end) << "bytes of incomplete history from" << file.fileName();
+        if (!file.resize(end))
+            return false;
+    }
+
+    return true;
+}
+
+qint64 HistoryLog::recoverEnd()
+{
+    qint64 end = 0;
+    uchar header[LengthSize];
+    while (file.seek(end) && file.read(reinterpret_cast<char*>(header), LengthSize) == LengthSize) {
+        const quint32 length = qFromBigEndian<quint32>(header);
+        const qint64 next = end + 2 * LengthSize + length;
+        if (length > MaxRecordSize || next > file.size())
+            break;
+        end = next;
+    }
+    return end;
+}
+
+qint64 HistoryLog::append(const QByteArray &data)
+{
+    const qint64 offset = file.size();
+    const QByteArray sealed = seal(offset, data);
+    if (sealed.isEmpty())
+        return -1;
+
+    QByteArray length(LengthSize, Qt::Uninitialized);
+    qToBigEndian<quint32>(sealed.size(), length.data());
+
+    if (!file.open(QIODevice::ReadWrite) ||
+        !file.seek(offset) ||
+        file.write(length + sealed + length) != 2 * LengthSize + sealed.size() ||
+        !file.flush())
+    {
+        qWarning() << "Cannot append to history" << file.fileName() << ":" << file.errorString();
+        if (file.isOpen())
+            file.resize(offset);
+        file.close();
+        return -1;
+    }
+
+    file.close();
+    return offset;
+}
+
+QList<HistoryLog::Record> HistoryLog::readPage(qint64 &end)
+{
+    QList<Record> re;
+    if (end <= 0)
+        return re;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot read history" << file.fileName() << ":" << file.errorString();
+        end = 0;
+        return re;
+    }
+
+    // map a page's worth of log, or all of the newest record if it alone is larger
+    uchar trailer[LengthSize];
+    if (!file.seek(end - LengthSize) || file.read(reinterpret_cast<char*>(trailer), LengthSize) != LengthSize) {
+        qWarning() << "Cannot read history" << file.fileName() << ":" << file.errorString();
+        end = 0;
+        file.close();
+        return re;
+    }
+    const quint32 newestLength = qFromBigEndian<quint32>(trailer);
+    const qint64 newestStart = end - 2 * LengthSize - newestLength;
+    if (newestLength > MaxRecordSize || newestStart < 0) {
+        qWarning() << "History" << file.fileName() << "is corrupt before offset" << end;
+        end = 0;
+        file.close();
+        return re;
+    }
+    const qint64 windowStart = std::min(std::max<qint64>(0, end - PageSize), newestStart);
+
+    uchar *window = file.map(windowStart, end - windowStart);
+    if (!window) {
+        qWarning() << "Cannot map history" << file.fileName() << ":" << file.errorString();
+        end = 0;
+        file.close();
+        return re;
+    }
+
+    qint64 pos = end;
+    while (pos - windowStart >= 2 * LengthSize) {
+        const quint32 length = qFromBigEndian<quint32>(window + (pos - LengthSize - windowStart));
+        const qint64 start = pos - 2 * LengthSize - length;
+        if (length > MaxRecordSize || start < 0) {
+            qWarning() << "History" << file.fileName() << "is corrupt before offset" << pos;
+            pos = 0;
+            break;
+        }
+        // the rest of this record belongs to the next page
+        if (start < windowStart)
+            break;
+
+        if (auto data = unseal(start, window + (start + LengthSize - windowStart), length); data) {
+            re.append({start, std::move(*data)});
+        } else {
+            qWarning() << "History record at offset" << start << "in" << file.fileName() << "failed to decrypt";
+        }
+        pos = start;
+    }
+    file.unmap(window);
+    file.close();
+
+    end = pos;
+    return re;
+}
+
+QByteArray HistoryLog::seal(qint64 offset, const QByteArray &data) const
+{
+    QByteArray re(NonceSize + data.size() + TagSize, Qt::Uninitialized);
+    auto nonce = reinterpret_cast<uchar*>(re.data());
+    auto ciphertext = nonce + NonceSize;
+    const QByteArray aad = offsetBytes(offset);
+
+    if (RAND_bytes(nonce, NonceSize) != 1)
+        return {};
+
+    cipher_ctx ctx(EVP_CIPHER_CTX_new());
+    int length = 0;
+    if (!ctx ||
+        EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const uchar*>(key.constData()), nonce) != 1 ||
+        EVP_EncryptUpdate(ctx.get(), nullptr, &length, reinterpret_cast<const uchar*>(aad.constData()), aad.size()) != 1 ||
+        EVP_EncryptUpdate(ctx.get(), ciphertext, &length, reinterpret_cast<const uchar*>(data.constData()), data.size()) != 1 ||
+        EVP_EncryptFinal_ex(ctx.get(), ciphertext + length, &length) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, TagSize, ciphertext + data.size()) != 1)
+    {
+        return {};
+    }
+
+    return re;
+}
+
+std::optional<QByteArray> HistoryLog::unseal(qint64 offset, const uchar *sealed, int size) const
+{
+    if (size < NonceSize + TagSize)
+        return std::nullopt;
+
+    const int dataSize = size - NonceSize - TagSize;
+    const uchar *nonce = sealed;
+    const uchar *ciphertext = sealed + NonceSize;
+    // EVP wants a mutable tag even though it only reads it
+    uchar tag[TagSize];
+    std::copy(ciphertext + dataSize, ciphertext + dataSize + TagSize, tag);
+    const QByteArray aad = offsetBytes(offset);
+
+    QByteArray re(dataSize, Qt::Uninitialized);
+    cipher_ctx ctx(EVP_CIPHER_CTX_new());
+    int length = 0;
+    if (!ctx ||
+        EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, reinterpret_cast<const uchar*>(key.constData()), nonce) != 1 ||
+        EVP_DecryptUpdate(ctx.get(), nullptr, &length, reinterpret_cast<const uchar*>(aad.constData()), aad.size()) != 1 ||
+        EVP_DecryptUpdate(ctx.get(), reinterpret_cast<uchar*>(re.data()), &length, ciphertext, dataSize) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, TagSize, tag) != 1 ||
+        EVP_DecryptFinal_ex(ctx.get(), reinterpret_cast<uchar*>(re.data()) + length, &length) != 1)
+    {
+        return std::nullopt;
+    }
+
+    return re;
+}
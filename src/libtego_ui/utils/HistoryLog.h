@@ -0,0 +1,98 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UTILS_HISTORYLOG_H
+#define UTILS_HISTORYLOG_H
+
+/* HistoryLog is an append-only, encrypted file of conversation records.
+ *
+ * Each record is sealed with AES-256-GCM under the log's key, and bound to
+ * its offset in the file so records can't be reordered. A record is framed by
+ * its length on both sides:
+ *
+ *   [u32 length][12 byte nonce][ciphertext][16 byte tag][u32 length]
+ *
+ * which lets the log be read backwards a page at a time, newest first. Each
+ * page is memory mapped only while it is decoded, so reading the recent end
+ * of a long log costs the same as reading a short one.
+ *
+ * A record's offset identifies it for as long as the log exists.
+ *
+ * The file is only held open while a page is read or a record appended, so
+ * a log for each of thousands of contacts costs no file descriptors at rest.
+ */
+class HistoryLog
+{
+    Q_DISABLE_COPY(HistoryLog)
+
+public:
+    // bytes of log decoded by each readPage
+    static constexpr qint64 PageSize = 64 * 1024;
+    static constexpr int KeySize = 32;
+
+    struct Record
+    {
+        qint64 offset;
+        QByteArray data;
+    };
+
+    HistoryLog(const QString &filePath, const QByteArray &key);
+
+    // creates the file if needed, and drops a record left half written by a crash
+    bool open();
+    QString errorString() const { return error; }
+
+    // the offset of the new record, or -1 on failure
+    qint64 append(const QByteArray &data);
+
+    // the records ending at or before end, newest first; end is moved back past
+    // them, and reaches 0 once everything has been read
+    QList<Record> readPage(qint64 &end);
+
+    qint64 size() const { return file.size(); }
+
+private:
+    QFile file;
+    QByteArray key;
+    // from the last open() that failed, since closing the file clears its own
+    QString error;
+
+    // drops a record left half written from the end of the open file
+    bool recover();
+
+    QByteArray seal(qint64 offset, const QByteArray &data) const;
+    std::optional<QByteArray> unseal(qint64 offset, const uchar *sealed, int size) const;
+    // the end of the last whole record, found by walking the log from the start
+    qint64 recoverEnd();
+};
+
+#endif // UTILS_HISTORYLOG_H
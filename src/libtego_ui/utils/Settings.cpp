@@ -32,11 +32,26 @@
 
 #include "Settings.h"
 
+namespace {
+    class SettingsJob : public QRunnable
+    {
+    public:
+        SettingsJob(std::function<void()> &&fn) : fn(std::move(fn)) { }
+        void run() override { fn(); }
+
+    private:
+        std::function<void()> fn;
+    };
+}
+
 class SettingsFilePrivate : public QObject
 {
     Q_OBJECT
 
 public:
+    // Once the journal holds this much, the next sync rewrites the file instead
+    static constexpr qint64 JournalLimit = 256 * 1024;
+
     SettingsFile *q;
     QString filePath;
     QString errorMessage;
@@ -44,6 +59,24 @@ public:
     QJsonObject jsonRoot;
     SettingsObject *rootObject;
 
+    int syncDelay;
+    int maxSyncLatency;
+    // Started by the oldest change that hasn't been synced
+    QElapsedTimer pendingSince;
+
+    bool journalEnabled;
+    // Changes that haven't been appended to the journal yet, one JSON object per line
+    QByteArray pendingJournal;
+    qint64 journalSize;
+
+    // Runs file writes one at a time, in the order they were made
+    QThreadPool writer;
+    std::atomic<qint64> bytesWritten;
+    // Hash of the file on disk, and of the file the journal on disk was started
+    // from; only used by the writer, or while it is idle
+    QByteArray fileHash;
+    QByteArray journalBase;
+
     SettingsFilePrivate(SettingsFile *qp);
     virtual ~SettingsFilePrivate();
 
@@ -51,16 +84,23 @@ public:
     void setError(const QString &message);
     bool checkDirPermissions(const QString &path);
     bool readFile();
-    bool writeFile();
+    void readJournal();
+    static QByteArray hashFile(const QByteArray &data);
+    QString journalPath() const;
+    void scheduleSync();
+    void post(std::function<QString()> &&job);
+    void writeFile();
+    void appendJournal(const QByteArray &changes);
 
     static QStringList splitPath(const QString &input, bool &ok);
     QJsonValue read(const QJsonObject &base, const QStringList &path);
+    bool replace(const QStringList &path, const QJsonValue &value, QJsonValue &originalValue);
     bool write(const QStringList &path, const QJsonValue &value);
 
 signals:
     void modified(const QStringList &path, const QJsonValue &value);
 
-private slots:
+public slots:
     void sync();
 };
 
@@ -78,16 +118,25 @@ SettingsFilePrivate::SettingsFilePrivate(SettingsFile *qp)
     : QObject(qp)
     , q(qp)
     , rootObject(0)
+    , syncDelay(500)
+    , maxSyncLatency(5000)
+    , journalEnabled(false)
+    , journalSize(0)
+    , bytesWritten(0)
 {
-    syncTimer.setInterval(0);
     syncTimer.setSingleShot(true);
     connect(&syncTimer, &QTimer::timeout, this, &SettingsFilePrivate::sync);
+
+    writer.setMaxThreadCount(1);
 }
 
 SettingsFilePrivate::~SettingsFilePrivate()
 {
-    if (syncTimer.isActive())
-        sync();
+    // Leave a complete file behind, rather than one that needs its journal
+    syncTimer.stop();
+    if (!filePath.isEmpty() && (pendingSince.isValid() || journalSize > 0))
+        writeFile();
+    writer.waitForDone();
     delete rootObject;
 }
 
@@ -95,6 +144,11 @@ void SettingsFilePrivate::reset()
 {
     filePath.clear();
     errorMessage.clear();
+    pendingSince.invalidate();
+    pendingJournal.clear();
+    journalSize = 0;
+    fileHash.clear();
+    journalBase.clear();
 
     jsonRoot = QJsonObject();
     emit modified(QStringList(), jsonRoot);
@@ -110,6 +164,11 @@ bool SettingsFile::setFilePath(const QString &filePath)
     if (d->filePath == filePath)
         return hasError();
 
+    // Finish with the old file before reading the new one
+    if (d->pendingSince.isValid())
+        d->sync();
+    d->writer.waitForDone();
+
     d->reset();
     d->filePath = filePath;
 
@@ -170,13 +229,91 @@ const SettingsObject *SettingsFile::root() const
     return d->rootObject;
 }
 
+int SettingsFile::syncDelay() const
+{
+    return d->syncDelay;
+}
+
+void SettingsFile::setSyncDelay(int msec)
+{
+    d->syncDelay = msec;
+}
+
+int SettingsFile::maxSyncLatency() const
+{
+    return d->maxSyncLatency;
+}
+
+void SettingsFile::setMaxSyncLatency(int msec)
+{
+    d->maxSyncLatency = msec;
+}
+
+bool SettingsFile::journalEnabled() const
+{
+    return d->journalEnabled;
+}
+
+void SettingsFile::setJournalEnabled(bool enabled)
+{
+    if (d->journalEnabled == enabled)
+        return;
+
+    // Pending changes were recorded for the old mode
+    if (d->pendingSince.isValid())
+        d->sync();
+    d->journalEnabled = enabled;
+}
+
+void SettingsFile::sync()
+{
+    if (d->pendingSince.isValid())
+        d->sync();
+    d->writer.waitForDone();
+}
+
+qint64 SettingsFile::bytesWritten() const
+{
+    return d->bytesWritten;
+}
+
+void SettingsFilePrivate::scheduleSync()
+{
+    if (!pendingSince.isValid())
+        pendingSince.start();
+
+    // Wait for a burst of changes to end, but not past the latency limit
+    qint64 remaining = qMax<qint64>(0, maxSyncLatency - pendingSince.elapsed());
+    syncTimer.start(int(qMin<qint64>(syncDelay, remaining)));
+}
+
 void SettingsFilePrivate::sync()
 {
+    syncTimer.stop();
+    pendingSince.invalidate();
     if (filePath.isEmpty())
         return;
 
-    syncTimer.stop();
-    writeFile();
+    if (journalEnabled && journalSize + pendingJournal.size() <= JournalLimit)
+        appendJournal(pendingJournal);
+    else
+        writeFile();
+    pendingJournal.clear();
+}
+
+QString SettingsFilePrivate::journalPath() const
+{
+    return filePath + QStringLiteral(".journal");
+}
+
+// Run job on the writer thread, and report the error it returns, if any
+void SettingsFilePrivate::post(std::function<QString()> &&job)
+{
+    writer.start(new SettingsJob([this, job = std::move(job)]() {
+        QString message = job();
+        if (!message.isEmpty())
+            QMetaObject::invokeMethod(this, [this, message]() { setError(message); }, Qt::QueuedConnection);
+    }));
 }
 
 bool SettingsFilePrivate::readFile()
@@ -195,48 +332,139 @@ bool SettingsFilePrivate::readFile()
 
     if (data.isEmpty()) {
         jsonRoot = QJsonObject();
-        return true;
-    }
+    } else {
+        QJsonParseError parseError;
+        QJsonDocument document = QJsonDocument::fromJson(data, &parseError);
+        if (document.isNull()) {
+            setError(parseError.errorString());
+            return false;
+        }
 
-    QJsonParseError parseError;
-    QJsonDocument document = QJsonDocument::fromJson(data, &parseError);
-    if (document.isNull()) {
-        setError(parseError.errorString());
-        return false;
-    }
+        if (!document.isObject()) {
+            setError(QStringLiteral("Invalid configuration file (expected object)"));
+            return false;
+        }
 
-    if (!document.isObject()) {
-        setError(QStringLiteral("Invalid configuration file (expected object)"));
-        return false;
+        jsonRoot = document.object();
     }
 
-    jsonRoot = document.object();
+    fileHash = hashFile(data);
+    readJournal();
 
-    emit modified(QStringList(), jsonRoot);
+    if (!jsonRoot.isEmpty())
+        emit modified(QStringList(), jsonRoot);
     return true;
 }
 
-bool SettingsFilePrivate::writeFile()
+QByteArray SettingsFilePrivate::hashFile(const QByteArray &data)
 {
-    QSaveFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-        setError(file.errorString());
-        return false;
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+// Apply the changes journaled since the file was last written
+void SettingsFilePrivate::readJournal()
+{
+    journalSize = 0;
+    journalBase.clear();
+
+    QFile file(journalPath());
+    if (!file.exists())
+        return;
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Cannot read settings journal" << file.fileName() << ":" << file.errorString();
+        return;
     }
 
-    QJsonDocument document(jsonRoot);
-    QByteArray data = document.toJson();
-    if (data.isEmpty() && !document.isEmpty()) {
-        setError(QStringLiteral("Encoding failure"));
-        return false;
+    // The first line names the file the changes apply to. A crash after the file
+    // is rewritten but before the journal is removed leaves a journal for an
+    // older file, and replaying it would undo newer changes.
+    QByteArray header = file.readLine();
+    QByteArray base = QJsonDocument::fromJson(header).object().value(QStringLiteral("base")).toString().toLatin1();
+    if (!header.endsWith('\n') || base != fileHash) {
+        qWarning() << "Discarding stale settings journal" << file.fileName();
+        file.remove();
+        return;
     }
+    journalBase = base;
+    journalSize = header.size();
 
-    if (file.write(data) < data.size() || !file.commit()) {
-        setError(file.errorString());
-        return false;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        QJsonObject change = QJsonDocument::fromJson(line).object();
+
+        bool ok = false;
+        QStringList path = splitPath(change.value(QStringLiteral("path")).toString(), ok);
+
+        // A crash while appending leaves the last change incomplete
+        if (!line.endsWith('\n') || !change.contains(QStringLiteral("path")) || !ok) {
+            qWarning() << "Discarding incomplete change at the end of" << file.fileName();
+            file.resize(journalSize);
+            break;
+        }
+
+        QJsonValue originalValue;
+        replace(path, change.value(QStringLiteral("value")), originalValue);
+        journalSize += line.size();
     }
+}
 
-    return true;
+// Rewrite the whole file, which makes the journal redundant
+void SettingsFilePrivate::writeFile()
+{
+    // QJsonObject is implicitly shared, so this is a cheap snapshot of the current settings
+    post([this, filePath = filePath, root = jsonRoot, journal = journalSize > 0 ? journalPath() : QString()]() -> QString {
+        QJsonDocument document(root);
+        QByteArray data = document.toJson();
+        if (data.isEmpty() && !document.isEmpty())
+            return QStringLiteral("Encoding failure");
+
+        // Nothing to commit if the journal only brought the file back to what it was
+        QByteArray hash = hashFile(data);
+        if (hash != fileHash) {
+            QSaveFile file(filePath);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) < data.size() || !file.commit())
+                return file.errorString();
+            bytesWritten += data.size();
+            fileHash = hash;
+        }
+
+        // If this fails the journal is stale, and is started over by the next append
+        if (!journal.isEmpty() && !QFile::remove(journal))
+            return QStringLiteral("Cannot remove %1").arg(journal);
+        journalBase.clear();
+
+        return QString();
+    });
+    journalSize = 0;
+}
+
+void SettingsFilePrivate::appendJournal(const QByteArray &changes)
+{
+    if (changes.isEmpty())
+        return;
+
+    post([this, journal = journalPath(), changes]() -> QString {
+        // A new journal starts with the hash of the file it applies to
+        bool start = journalBase != fileHash;
+        QFile file(journal);
+        if (!file.open(QIODevice::WriteOnly | (start ? QIODevice::Truncate : QIODevice::Append)))
+            return file.errorString();
+
+        if (start) {
+            QByteArray header = QJsonDocument(QJsonObject{{QStringLiteral("base"), QString::fromLatin1(fileHash)}}).toJson(QJsonDocument::Compact) + '\n';
+            if (file.write(header) < header.size())
+                return file.errorString();
+            bytesWritten += header.size();
+            journalBase = fileHash;
+        }
+
+        if (file.write(changes) < changes.size() || !file.flush())
+            return file.errorString();
+        bytesWritten += changes.size();
+
+        return QString();
+    });
+    journalSize += changes.size();
 }
 
 QStringList SettingsFilePrivate::splitPath(const QString &input, bool &ok)
@@ -308,12 +536,12 @@ static void findModifiedRecursive(ModifiedList &modified, const QStringList &pat
         modified.append(qMakePair(path, newValue));
 }
 
-bool SettingsFilePrivate::write(const QStringList &path, const QJsonValue &value)
+// Set the value at path in jsonRoot, without any notification
+bool SettingsFilePrivate::replace(const QStringList &path, const QJsonValue &value, QJsonValue &originalValue)
 {
     typedef QVarLengthArray<QPair<QString,QJsonObject> > ObjectStack;
     ObjectStack stack;
     QJsonValue current = jsonRoot;
-    QJsonValue originalValue;
     QString currentKey;
 
     foreach (const QString &key, path) {
@@ -341,7 +569,23 @@ bool SettingsFilePrivate::write(const QStringList &path, const QJsonValue &value
 
     // current is now the updated jsonRoot
     jsonRoot = current.toObject();
-    syncTimer.start();
+    return true;
+}
+
+bool SettingsFilePrivate::write(const QStringList &path, const QJsonValue &value)
+{
+    QJsonValue originalValue;
+    if (!replace(path, value, originalValue))
+        return false;
+
+    if (journalEnabled) {
+        QJsonObject change;
+        change.insert(QStringLiteral("path"), path.join(QLatin1Char('.')));
+        // Undefined leaves out the value, which unsets the path when replayed
+        change.insert(QStringLiteral("value"), value);
+        pendingJournal += QJsonDocument(change).toJson(QJsonDocument::Compact) + '\n';
+    }
+    scheduleSync();
 
     ModifiedList modified;
     findModifiedRecursive(modified, path, originalValue, value);
@@ -44,6 +44,14 @@ class SettingsObjectPrivate;
  *
  * Data is accessed via SettingsObject, either using the root property
  * or by creating a SettingsObject, optionally using a base path.
+ *
+ * Changes are written to disk in the background. A burst of changes is
+ * coalesced into one write once no change has been made for syncDelay
+ * milliseconds, but changes are never held back for longer than
+ * maxSyncLatency. With the journal enabled, a write appends just the
+ * changed values to a journal next to the file, and the file itself is
+ * only rewritten once the journal has grown large or the SettingsFile is
+ * destroyed.
  */
 class SettingsFile : public QObject
 {
@@ -68,6 +76,20 @@ public:
     SettingsObject *root();
     const SettingsObject *root() const;
 
+    int syncDelay() const;
+    void setSyncDelay(int msec);
+    int maxSyncLatency() const;
+    void setMaxSyncLatency(int msec);
+
+    bool journalEnabled() const;
+    void setJournalEnabled(bool enabled);
+
+    // Write any pending changes now and wait for them to reach the disk
+    void sync();
+
+    // Bytes written to disk so far, for diagnostics
+    qint64 bytesWritten() const;
+
 signals:
     void filePathChanged();
     void error();
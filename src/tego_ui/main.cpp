@@ -82,6 +82,8 @@ int main(int argc, char *argv[]) try
 #endif
 
     QScopedPointer<SettingsFile> settings(new SettingsFile);
+    // contacts change in bursts; journal the changes rather than rewriting the whole file for each
+    settings->setJournalEnabled(true);
     SettingsObject::setDefaultFile(settings.data());
 
     QString error;
@@ -106,13 +108,21 @@ int main(int argc, char *argv[]) try
         std::unique_ptr<tego_tor_launch_config_t> launchConfig;
         tego_tor_launch_config_initialize(tego::out(launchConfig), tego::throw_on_error());
 
-        auto rawFilePath = (QFileInfo(settings->filePath()).path() + QStringLiteral("/tor/")).toUtf8();
+        const auto profilePath = QFileInfo(settings->filePath()).path();
+        auto rawFilePath = (profilePath + QStringLiteral("/tor/")).toUtf8();
         tego_tor_launch_config_set_data_directory(
             launchConfig.get(),
             rawFilePath.data(),
             rawFilePath.size(),
             tego::throw_on_error());
 
+        auto rawProfilePath = profilePath.toUtf8();
+        tego_tor_launch_config_set_profile_directory(
+            launchConfig.get(),
+            rawProfilePath.data(),
+            rawProfilePath.size(),
+            tego::throw_on_error());
+
         tego_context_start_tor(tegoContext, launchConfig.get(), tego::throw_on_error());
     }
 
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <QtGlobal>
+
+class ContactUser;
+
+// for tests of containers which never dereference their contacts: a distinct,
+// non-null ContactUser pointer for each n
+inline ContactUser *fakeUser(quintptr n)
+{
+    return reinterpret_cast<ContactUser*>(n + 1);
+}
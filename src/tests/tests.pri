@@ -5,6 +5,7 @@ CONFIG += testcase
 
 INCLUDEPATH +=\
     $${PWD}/../libtego/source\
+    $${PWD}\
 
 QMAKE_INCLUDES = $${PWD}/../qmake_includes
 
@@ -6,3 +6,14 @@ CONFIG += ordered
 SUBDIRS = \
     tst_cryptokey \
     tst_contactidvalidator \
+    tst_contactindex \
+    tst_unreadcounts \
+    tst_messageindex \
+    tst_historylog \
+    tst_settings \
+    tst_filechannel \
+    tst_filehash \
+    tst_packetscheduler \
+    tst_connection \
+    tst_callbackqueue \
+    tst_torcontrol \
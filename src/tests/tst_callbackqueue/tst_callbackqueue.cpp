@@ -0,0 +1,600 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <QtTest>
+
+// libtego
+#include <tego/tego.hpp>
+#include "context.hpp"
+#include "globals.hpp"
+
+using std::chrono::steady_clock;
+
+namespace
+{
+    // every allocation in the process is counted while this is set
+    std::atomic<bool> countAllocations = false;
+    std::atomic<qint64> allocationCount = 0;
+}
+
+void* operator new(size_t size)
+{
+    if (countAllocations) {
+        allocationCount++;
+    }
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    // when each test event was pushed and when its callback ran, indexed by the
+    // host user state it carries
+    std::vector<steady_clock::time_point> pushed;
+    std::vector<steady_clock::time_point> invoked;
+    std::atomic<int> invokedCount = 0;
+    std::atomic<bool> inOrder = true;
+
+    void on_host_user_state_changed(tego_context_t*, tego_host_user_state_t state)
+    {
+        const int index = static_cast<int>(state);
+        invoked[index] = steady_clock::now();
+        if (invokedCount.fetch_add(1) != index) {
+            inOrder = false;
+        }
+    }
+
+    std::atomic<int> messagesReceived = 0;
+    std::atomic<int> progressReceived = 0;
+
+    void on_message_received(tego_context_t*, const tego_user_id_t*, tego_time_t, tego_message_id_t, const char* message, size_t messageLength)
+    {
+        if (std::char_traits<char>::length(message) == messageLength) {
+            messagesReceived++;
+        }
+    }
+
+    std::atomic<tego_file_size_t> lastProgress = 0;
+
+    // what the coalescing test sees, in order
+    struct progress_event
+    {
+        char type;
+        tego_file_transfer_id_t id;
+        tego_file_size_t bytes;
+        steady_clock::time_point time;
+    };
+    std::mutex progressMutex;
+    std::vector<progress_event> progressEvents;
+    std::atomic<bool> recordProgress = false;
+
+    void on_file_transfer_progress(tego_context_t*, const tego_user_id_t*, tego_file_transfer_id_t id, tego_file_transfer_direction_t, tego_file_size_t bytesComplete, tego_file_size_t)
+    {
+        lastProgress = bytesComplete;
+        progressReceived++;
+        if (recordProgress) {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            progressEvents.push_back({'p', id, bytesComplete, steady_clock::now()});
+        }
+    }
+
+    void on_file_transfer_complete(tego_context_t*, const tego_user_id_t*, tego_file_transfer_id_t id, tego_file_transfer_direction_t, tego_file_transfer_result_t)
+    {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        progressEvents.push_back({'c', id, 0, steady_clock::now()});
+    }
+
+    // holds up the callback worker while closed
+    std::atomic<bool> gateOpen = true;
+
+    void on_tor_process_status_changed(tego_context_t*, tego_tor_process_status_t)
+    {
+        while (!gateOpen) {
+            std::this_thread::yield();
+        }
+    }
+
+    std::atomic<bool> sendFailed = false;
+
+    // which contexts the multiple contexts test's callbacks were called with
+    std::mutex contextsMutex;
+    std::vector<tego_context_t*> stateChangedContexts;
+    std::vector<tego_context_t*> logReceivedContexts;
+    std::atomic<size_t> stateChangedCount = 0;
+    std::atomic<size_t> logReceivedCount = 0;
+
+    void on_context_host_user_state_changed(tego_context_t* context, tego_host_user_state_t)
+    {
+        std::lock_guard<std::mutex> lock(contextsMutex);
+        stateChangedContexts.push_back(context);
+        stateChangedCount++;
+    }
+
+    void on_tor_log_received(tego_context_t* context, const char*, size_t)
+    {
+        std::lock_guard<std::mutex> lock(contextsMutex);
+        logReceivedContexts.push_back(context);
+        logReceivedCount++;
+    }
+
+    // a callback calling back into its context until the context refuses it
+    std::atomic<int> callsIntoContext = 0;
+    std::atomic<bool> contextRefused = false;
+
+    void on_calling_host_user_state_changed(tego_context_t* context, tego_host_user_state_t)
+    {
+        while (true) {
+            tego_error_t* error = nullptr;
+            tego_context_set_file_transfer_progress_minimum_interval(context, 0, &error);
+            if (error != nullptr) {
+                tego_error_delete(error);
+                contextRefused = true;
+                return;
+            }
+            callsIntoContext++;
+        }
+    }
+
+    void on_send_message_completed(tego_context_t*, tego_message_id_t, const tego_error_t* error, void* userData)
+    {
+        if (error != nullptr && userData == &sendFailed) {
+            sendFailed = true;
+        }
+    }
+}
+
+class TestCallbackQueue : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void latency();
+    void batchOrder();
+    void allocations();
+    void coalescing();
+    void minimumInterval();
+    void contention();
+    void commandMarshalling();
+    void multipleContexts();
+    void uninitializeWhileCalledInto();
+
+private:
+    void reset(int count);
+    // emits the progress of a transfer, then waits until the newest has been delivered
+    std::vector<progress_event> takeProgressEvents(size_t count);
+
+    tego_context_t *context = nullptr;
+};
+
+void TestCallbackQueue::initTestCase()
+{
+    tego_initialize(&context, tego::throw_on_error());
+    tego_context_set_host_user_state_changed_callback(context, &on_host_user_state_changed, tego::throw_on_error());
+    tego_context_set_message_received_callback(context, &on_message_received, tego::throw_on_error());
+    tego_context_set_file_transfer_progress_callback(context, &on_file_transfer_progress, tego::throw_on_error());
+    tego_context_set_file_transfer_complete_callback(context, &on_file_transfer_complete, tego::throw_on_error());
+    tego_context_set_tor_process_status_changed_callback(context, &on_tor_process_status_changed, tego::throw_on_error());
+}
+
+void TestCallbackQueue::cleanupTestCase()
+{
+    tego_uninitialize(context, tego::throw_on_error());
+}
+
+void TestCallbackQueue::reset(int count)
+{
+    pushed.assign(count, {});
+    invoked.assign(count, {});
+    invokedCount = 0;
+    inOrder = true;
+}
+
+void TestCallbackQueue::latency()
+{
+    // one event at a time, each pushed once the worker has gone back to sleep, which
+    // is when the wakeup matters most
+    const int count = 2000;
+    reset(count);
+
+    for (int i = 0; i < count; i++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        pushed[i] = steady_clock::now();
+        context->callback_registry_.emit_host_user_state_changed(static_cast<tego_host_user_state_t>(i));
+        QTRY_COMPARE(invokedCount.load(), i + 1);
+    }
+    QVERIFY(inOrder);
+
+    std::vector<qint64> latencies;
+    for (int i = 0; i < count; i++) {
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(invoked[i] - pushed[i]).count());
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    // histogram of push_back to invocation, in powers of two microseconds
+    std::vector<int> buckets;
+    for (const auto latency : latencies) {
+        size_t bucket = 0;
+        while ((qint64(1) << bucket) <= latency) {
+            bucket++;
+        }
+        buckets.resize(std::max(buckets.size(), bucket + 1));
+        buckets[bucket]++;
+    }
+    for (size_t bucket = 0; bucket < buckets.size(); bucket++) {
+        qInfo("< %7lld us: %d", qint64(1) << bucket, buckets[bucket]);
+    }
+
+    const auto median = latencies[latencies.size() / 2];
+    qInfo("median %lld us, p99 %lld us", median, latencies[latencies.size() * 99 / 100]);
+    QTest::setBenchmarkResult(median * 1000.0, QTest::WalltimeNanoseconds);
+}
+
+void TestCallbackQueue::batchOrder()
+{
+    // events pushed from several threads while the worker is busy must still all
+    // arrive, and those from any one thread in order
+    const int threads = 4;
+    const int perThread = 5000;
+    reset(threads * perThread);
+
+    std::vector<std::thread> producers;
+    std::mutex startMutex;
+    std::condition_variable startCondition;
+    bool start = false;
+    for (int t = 0; t < threads; t++) {
+        producers.emplace_back([&, t]() {
+            {
+                std::unique_lock<std::mutex> lock(startMutex);
+                startCondition.wait(lock, [&]() { return start; });
+            }
+            for (int i = 0; i < perThread; i++) {
+                const int index = t * perThread + i;
+                pushed[index] = steady_clock::now();
+                context->callback_registry_.emit_host_user_state_changed(static_cast<tego_host_user_state_t>(index));
+            }
+        });
+    }
+    {
+        std::lock_guard<std::mutex> lock(startMutex);
+        start = true;
+    }
+    startCondition.notify_all();
+    for (auto &producer : producers) {
+        producer.join();
+    }
+
+    QTRY_COMPARE(invokedCount.load(), threads * perThread);
+    for (int t = 0; t < threads; t++) {
+        for (int i = 1; i < perThread; i++) {
+            const int index = t * perThread + i;
+            QVERIFY(invoked[index - 1] <= invoked[index]);
+        }
+    }
+}
+
+void TestCallbackQueue::allocations()
+{
+    // a busy conversation: messages and per chunk progress, the user id and text of
+    // each borrowed by the callback registry as its callers now do
+    const tego_user_id_t user{tego_v3_onion_service_id_t()};
+    const QByteArray text(200, 'x');
+    const int count = 20000;
+
+    const auto emitEvents = [&]() {
+        messagesReceived = 0;
+        progressReceived = 0;
+        lastProgress = 0;
+        for (int i = 0; i < count; i++) {
+            context->callback_registry_.emit_message_received(&user, tego_time_t(0), tego_message_id_t(i), text.constData(), size_t(text.size()));
+            context->callback_registry_.emit_file_transfer_progress(&user, tego_file_transfer_id_t(1), tego_file_transfer_direction_receiving, uint64_t(i), uint64_t(count));
+        }
+        // spin rather than QTRY_COMPARE, whose event processing allocates; progress
+        // updates still queued get superseded, so only the last is sure to arrive
+        const auto deadline = steady_clock::now() + std::chrono::seconds(30);
+        while ((messagesReceived < count || lastProgress != uint64_t(count - 1)) && steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+    };
+
+    // the first run grows the queues and arena, which are kept for later batches
+    emitEvents();
+    QCOMPARE(messagesReceived.load(), count);
+
+    allocationCount = 0;
+    countAllocations = true;
+    emitEvents();
+    countAllocations = false;
+    QCOMPARE(messagesReceived.load(), count);
+    QCOMPARE(lastProgress.load(), uint64_t(count - 1));
+
+    const auto perEvent = double(allocationCount) / (2 * count);
+    qInfo("%lld allocations for %d callbacks (%.4f per callback)", qint64(allocationCount), 2 * count, perEvent);
+    // previously at least three per message (the callable, the user id and the text)
+    QVERIFY(perEvent < 0.1);
+}
+
+std::vector<progress_event> TestCallbackQueue::takeProgressEvents(size_t count)
+{
+    const auto deadline = steady_clock::now() + std::chrono::seconds(10);
+    std::vector<progress_event> events;
+    while (steady_clock::now() < deadline) {
+        {
+            std::lock_guard<std::mutex> lock(progressMutex);
+            if (progressEvents.size() >= count) {
+                events.swap(progressEvents);
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return events;
+}
+
+void TestCallbackQueue::coalescing()
+{
+    const tego_user_id_t user{tego_v3_onion_service_id_t()};
+    recordProgress = true;
+
+    // hold up the worker so everything below is queued in one batch
+    gateOpen = false;
+    context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_running);
+    for (uint64_t bytes = 1; bytes <= 100; bytes++) {
+        context->callback_registry_.emit_file_transfer_progress(&user, tego_file_transfer_id_t(1), tego_file_transfer_direction_receiving, bytes, uint64_t(100));
+        context->callback_registry_.emit_file_transfer_progress(&user, tego_file_transfer_id_t(2), tego_file_transfer_direction_receiving, bytes, uint64_t(200));
+    }
+    context->callback_registry_.emit_file_transfer_complete(&user, tego_file_transfer_id_t(1), tego_file_transfer_direction_receiving, tego_file_transfer_result_success);
+    gateOpen = true;
+
+    // only the newest update of each transfer, in the order they were first queued
+    const auto events = takeProgressEvents(3);
+    QCOMPARE(events.size(), size_t(3));
+    QCOMPARE(events[0].type, 'p');
+    QCOMPARE(events[0].id, tego_file_transfer_id_t(1));
+    QCOMPARE(events[0].bytes, tego_file_size_t(100));
+    QCOMPARE(events[1].type, 'p');
+    QCOMPARE(events[1].id, tego_file_transfer_id_t(2));
+    QCOMPARE(events[1].bytes, tego_file_size_t(100));
+    QCOMPARE(events[2].type, 'c');
+    QCOMPARE(events[2].id, tego_file_transfer_id_t(1));
+
+    recordProgress = false;
+}
+
+void TestCallbackQueue::minimumInterval()
+{
+    const tego_user_id_t user{tego_v3_onion_service_id_t()};
+    const auto interval = std::chrono::milliseconds(200);
+    tego_context_set_file_transfer_progress_minimum_interval(context, uint32_t(interval.count()), tego::throw_on_error());
+    recordProgress = true;
+
+    const auto progress = [&](uint64_t bytes) {
+        context->callback_registry_.emit_file_transfer_progress(&user, tego_file_transfer_id_t(3), tego_file_transfer_direction_sending, bytes, uint64_t(10));
+    };
+
+    // the first update goes straight through
+    progress(1);
+    auto events = takeProgressEvents(1);
+    QCOMPARE(events.size(), size_t(1));
+    const auto first = events[0].time;
+
+    // those soon after are held back, and only the newest is delivered once the interval has passed
+    progress(2);
+    progress(3);
+    events = takeProgressEvents(1);
+    QCOMPARE(events.size(), size_t(1));
+    QCOMPARE(events[0].bytes, tego_file_size_t(3));
+    // the interval is measured from when the first was scheduled, just before it ran
+    QVERIFY(events[0].time - first >= interval - std::chrono::milliseconds(10));
+
+    // a held back update still arrives ahead of the transfer completing, without waiting
+    progress(4);
+    context->callback_registry_.emit_file_transfer_complete(&user, tego_file_transfer_id_t(3), tego_file_transfer_direction_sending, tego_file_transfer_result_success);
+    events = takeProgressEvents(2);
+    QCOMPARE(events.size(), size_t(2));
+    QCOMPARE(events[0].type, 'p');
+    QCOMPARE(events[0].bytes, tego_file_size_t(4));
+    QCOMPARE(events[1].type, 'c');
+    QVERIFY(events[1].time - events[0].time < interval);
+
+    recordProgress = false;
+    tego_context_set_file_transfer_progress_minimum_interval(context, 0, tego::throw_on_error());
+}
+
+void TestCallbackQueue::contention()
+{
+    // read-only queries from several threads at once, all while the worker is stuck
+    // inside a slow callback; none of them may wait on it, or on each other
+    const int threads = 4;
+    const int perThread = 20000;
+
+    std::string logs;
+    for (int i = 0; i < 50; i++) {
+        logs += "log message " + std::to_string(i) + "\n";
+    }
+    context->update_tor_logs(std::make_shared<const std::string>(std::move(logs)));
+
+    gateOpen = false;
+    context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_running);
+
+    std::atomic<bool> failed = false;
+    std::vector<std::thread> callers;
+    const auto begin = steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        callers.emplace_back([&]() {
+            std::vector<char> buffer;
+            for (int i = 0; i < perThread; i++) {
+                tego_host_user_state_t state;
+                tego_context_get_host_user_state(context, &state, nullptr);
+
+                const auto size = tego_context_get_tor_logs_size(context, nullptr);
+                buffer.resize(size);
+                if (tego_context_get_tor_logs(context, buffer.data(), buffer.size(), nullptr) != size) {
+                    failed = true;
+                }
+            }
+        });
+    }
+    for (auto& caller : callers) {
+        caller.join();
+    }
+    const auto elapsed = steady_clock::now() - begin;
+    gateOpen = true;
+
+    QVERIFY(!failed);
+
+    const auto perCall = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / double(perThread * 3);
+    qInfo("%d threads, %.0f ns per call", threads, perCall);
+    QTest::setBenchmarkResult(perCall, QTest::WalltimeNanoseconds);
+}
+
+void TestCallbackQueue::commandMarshalling()
+{
+    // calls from other threads are run on this one, which keeps its event loop
+    // going inside QTRY_COMPARE until they are all done
+    const int threads = 4;
+    const int perThread = 1000;
+    std::atomic<int> succeeded = 0;
+
+    std::vector<std::thread> callers;
+    for (int t = 0; t < threads; t++) {
+        callers.emplace_back([&]() {
+            for (int i = 0; i < perThread; i++) {
+                tego_error_t* error = nullptr;
+                tego_context_set_file_transfer_progress_minimum_interval(context, 0, &error);
+                if (error == nullptr) {
+                    succeeded++;
+                } else {
+                    tego_error_delete(error);
+                }
+            }
+        });
+    }
+    QTRY_COMPARE(succeeded.load(), threads * perThread);
+    for (auto& caller : callers) {
+        caller.join();
+    }
+
+    // what a marshalled call throws comes back to its caller, here as there is
+    // no host user before the service has started
+    std::atomic<bool> threw = false;
+    std::thread caller([&]() {
+        tego_user_id_t* hostUser = nullptr;
+        tego_error_t* error = nullptr;
+        tego_context_get_host_user_id(context, &hostUser, &error);
+        if (error != nullptr) {
+            threw = true;
+            tego_error_delete(error);
+        }
+    });
+    QTRY_VERIFY(threw);
+    caller.join();
+
+    // async calls return straight away, and their failures arrive through the
+    // completion callback instead
+    const tego_user_id_t user{tego_v3_onion_service_id_t()};
+    tego_context_send_message_async(context, &user, "hello", 5, &on_send_message_completed, &sendFailed, tego::throw_on_error());
+    QTRY_VERIFY(sendFailed);
+}
+
+void TestCallbackQueue::multipleContexts()
+{
+    tego_context_t *second = nullptr;
+    tego_initialize(&second, tego::throw_on_error());
+    QVERIFY(second != nullptr);
+    QVERIFY(second != context);
+
+    // events about one context's identity only go to that context
+    tego_context_set_host_user_state_changed_callback(second, &on_context_host_user_state_changed, tego::throw_on_error());
+    second->callback_registry_.emit_host_user_state_changed(tego_host_user_state_online);
+    QTRY_COMPARE(stateChangedCount.load(), size_t(1));
+    QCOMPARE(stateChangedContexts[0], second);
+
+    // while those about the tor daemon they share go to all of them
+    tego_context_set_tor_log_received_callback(context, &on_tor_log_received, tego::throw_on_error());
+    tego_context_set_tor_log_received_callback(second, &on_tor_log_received, tego::throw_on_error());
+    const char message[] = "shared";
+    tego::g_globals.for_each_context([&](tego_context& ctx) {
+        ctx.callback_registry_.emit_tor_log_received(message, sizeof(message) - 1);
+    });
+    QTRY_COMPARE(logReceivedCount.load(), size_t(2));
+    QVERIFY(std::count(logReceivedContexts.begin(), logReceivedContexts.end(), context) == 1);
+    QVERIFY(std::count(logReceivedContexts.begin(), logReceivedContexts.end(), second) == 1);
+
+    tego_context_set_tor_log_received_callback(context, nullptr, tego::throw_on_error());
+    tego_uninitialize(second, tego::throw_on_error());
+    QCOMPARE(tego::g_globals.contexts.size(), size_t(1));
+}
+
+void TestCallbackQueue::uninitializeWhileCalledInto()
+{
+    tego_context_t *second = nullptr;
+    tego_initialize(&second, tego::throw_on_error());
+
+    // a callback still calling into the context when it is torn down gets an error
+    // back, rather than waiting forever on a command which will never run while the
+    // context waits for the callback to return
+    tego_context_set_host_user_state_changed_callback(second, &on_calling_host_user_state_changed, tego::throw_on_error());
+    second->callback_registry_.emit_host_user_state_changed(tego_host_user_state_online);
+    QTRY_VERIFY(callsIntoContext.load() > 0);
+
+    tego_uninitialize(second, tego::throw_on_error());
+    QVERIFY(contextRefused);
+    QCOMPARE(tego::g_globals.contexts.size(), size_t(1));
+}
+
+QTEST_MAIN(TestCallbackQueue)
+#include "tst_callbackqueue.moc"
@@ -0,0 +1,175 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <memory>
+#include <QtTest>
+#include <QtNetwork>
+
+// libtego_ui
+#include "protocol/Connection.h"
+#include "protocol/ControlChannel.h"
+
+using namespace Protocol;
+
+constexpr char serverHostname[] = "kmhee7bfsixluoummhu7rkjx6vlxksneflromksrdhhi7n5ks3ckygqd.onion";
+
+// a ServerSide Connection fed by a bare socket, so tests can write whatever bytes they like to it
+struct RawPeer
+{
+    QScopedPointer<QTcpSocket> socket;
+    std::unique_ptr<Connection> connection;
+    int keepAlives = 0;
+};
+
+class TestConnection : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void splitPackets();
+    void replay();
+
+private:
+    void connectPeer(RawPeer &peer);
+    // writes data to the peer's socket in pieces of at most maxPiece bytes
+    static void writePieces(RawPeer &peer, const QByteArray &data, int maxPiece);
+
+    // a recorded stream of keep alives, as a busy peer would send them
+    QByteArray stream;
+    int streamPackets = 0;
+};
+
+void TestConnection::initTestCase()
+{
+    Data::Control::KeepAlive *keepAlive = new Data::Control::KeepAlive;
+    keepAlive->set_response_requested(false);
+    Data::Control::Packet message;
+    message.set_allocated_keep_alive(keepAlive);
+    const std::string data = message.SerializeAsString();
+
+    // channel 0 is always the control channel
+    const quint16 packetSize = static_cast<quint16>(4 + data.size());
+    streamPackets = 100000;
+    stream.reserve(streamPackets * packetSize);
+    for (int i = 0; i < streamPackets; i++) {
+        const uchar header[4] = { uchar(packetSize >> 8), uchar(packetSize), 0, 0 };
+        stream.append(reinterpret_cast<const char*>(header), sizeof(header));
+        stream.append(data.data(), static_cast<int>(data.size()));
+    }
+}
+
+void TestConnection::connectPeer(RawPeer &peer)
+{
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    peer.socket.reset(new QTcpSocket);
+    peer.socket->connectToHost(server.serverAddress(), server.serverPort());
+    QVERIFY(peer.socket->waitForConnected(5000));
+    QVERIFY(server.waitForNewConnection(5000));
+
+    QTcpSocket *serverSocket = server.nextPendingConnection();
+    serverSocket->setProperty("localHostname", QString::fromLatin1(serverHostname));
+    peer.connection.reset(new Connection(serverSocket, Connection::ServerSide));
+
+    auto control = peer.connection->findChannel<ControlChannel>();
+    QVERIFY(control);
+    connect(control, &ControlChannel::keepAliveResponse, this, [&peer]() { peer.keepAlives++; });
+
+    // version handshake, offering only ours
+    QSignalSpy ready(peer.connection.get(), &Connection::ready);
+    const char intro[] = { 0x49, 0x4D, 0x01, 0x03 };
+    QCOMPARE(peer.socket->write(intro, sizeof(intro)), qint64(sizeof(intro)));
+    QTRY_COMPARE(ready.count(), 1);
+    QTRY_COMPARE(peer.socket->bytesAvailable(), qint64(1));
+    QCOMPARE(peer.socket->read(1), QByteArray(1, 0x03));
+}
+
+void TestConnection::writePieces(RawPeer &peer, const QByteArray &data, int maxPiece)
+{
+    for (int offset = 0; offset < data.size(); ) {
+        const int size = std::min<int>(1 + QRandomGenerator::global()->bounded(maxPiece), data.size() - offset);
+        peer.socket->write(data.constData() + offset, size);
+        peer.socket->flush();
+        offset += size;
+        // let the connection see each piece on its own
+        QCoreApplication::processEvents();
+    }
+}
+
+void TestConnection::splitPackets()
+{
+    RawPeer peer;
+    connectPeer(peer);
+    if (QTest::currentTestFailed())
+        return;
+
+    // packets arriving a few bytes at a time, split anywhere including inside
+    // their headers, must come out whole and in order
+    const int packets = 2000;
+    const QByteArray part = stream.left(stream.size() / streamPackets * packets);
+    writePieces(peer, part, 7);
+    QTRY_COMPARE(peer.keepAlives, packets);
+
+    // and so must many packets arriving at once
+    writePieces(peer, part, part.size());
+    QTRY_COMPARE(peer.keepAlives, 2 * packets);
+
+    QVERIFY(peer.connection->isConnected());
+}
+
+void TestConnection::replay()
+{
+    RawPeer peer;
+    connectPeer(peer);
+    if (QTest::currentTestFailed())
+        return;
+
+    int expected = 0;
+    QBENCHMARK {
+        expected += streamPackets;
+        QCOMPARE(peer.socket->write(stream), qint64(stream.size()));
+        // rather than QTRY_COMPARE, whose polling interval would swamp the time taken
+        QDeadlineTimer deadline(60 * 1000);
+        while (peer.keepAlives < expected && !deadline.hasExpired())
+            QCoreApplication::processEvents();
+        QCOMPARE(peer.keepAlives, expected);
+    }
+
+    QVERIFY(peer.connection->isConnected());
+}
+
+QTEST_MAIN(TestConnection)
+#include "tst_connection.moc"
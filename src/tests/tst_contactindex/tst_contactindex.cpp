@@ -0,0 +1,155 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <vector>
+#include <QtTest>
+
+// libtego
+#include <tego/tego.hpp>
+#include "core/ContactIndex.h"
+#include "ed25519.hpp"
+
+#include "fake_contacts.hpp"
+
+class TestContactIndex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void spellings();
+    void otherHostnames();
+    void remove();
+    void lookup_data();
+    void lookup();
+
+private:
+    // a v3 service id (without .onion) whose public key starts with n
+    static QString serviceId(quint32 n);
+};
+
+QString TestContactIndex::serviceId(quint32 n)
+{
+    // public key, checksum (not checked by the index), version 3
+    quint8 raw[TEGO_V3_ONION_SERVICE_ID_RAW_SIZE] = {0};
+    qToBigEndian(n, raw);
+    raw[TEGO_V3_ONION_SERVICE_ID_VERSION_OFFSET] = 0x03;
+
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz234567";
+    QString re;
+    for (int bit = 0; bit < int(sizeof(raw)) * 8; bit += 5) {
+        int value = 0;
+        for (int i = 0; i < 5; ++i)
+            value = (value << 1) | ((raw[(bit + i) / 8] >> (7 - (bit + i) % 8)) & 1);
+        re.append(QLatin1Char(alphabet[value]));
+    }
+    Q_ASSERT(re.size() == TEGO_V3_ONION_SERVICE_ID_LENGTH);
+    return re;
+}
+
+void TestContactIndex::spellings()
+{
+    const QString id = serviceId(42);
+    ContactIndex index;
+    index.insert(fakeUser(42), id + QStringLiteral(".onion"));
+
+    QCOMPARE(index.lookup(id), fakeUser(42));
+    QCOMPARE(index.lookup(id + QStringLiteral(".onion")), fakeUser(42));
+    QCOMPARE(index.lookup(id.toUpper() + QStringLiteral(".ONION")), fakeUser(42));
+    QCOMPARE(index.lookup(QStringLiteral("ricochet:") + id), fakeUser(42));
+    // every spelling decodes to the same public key
+    QCOMPARE(ContactIndex::keyFromHostname(id).size(), ED25519_PUBKEY_LEN);
+    QCOMPARE(ContactIndex::keyFromHostname(id.toUpper()), ContactIndex::keyFromHostname(id));
+
+    QCOMPARE(index.lookup(serviceId(43)), nullptr);
+    QCOMPARE(index.lookup(QString()), nullptr);
+}
+
+void TestContactIndex::otherHostnames()
+{
+    ContactIndex index;
+    index.insert(fakeUser(1), QStringLiteral("notav3serviceid.onion"));
+
+    QCOMPARE(index.lookup(QStringLiteral("NotAV3ServiceId.onion")), fakeUser(1));
+    QCOMPARE(index.lookup(QStringLiteral("notav3serviceid")), fakeUser(1));
+    QCOMPARE(index.lookup(QStringLiteral("notav3serviceie")), nullptr);
+}
+
+void TestContactIndex::remove()
+{
+    const QString id = serviceId(7);
+    ContactIndex index;
+    index.insert(fakeUser(7), id);
+    // a stale contact does not take out the entry of its replacement
+    index.remove(fakeUser(8), id);
+    QCOMPARE(index.lookup(id), fakeUser(7));
+
+    index.remove(fakeUser(7), id.toUpper() + QStringLiteral(".onion"));
+    QCOMPARE(index.lookup(id), nullptr);
+    QCOMPARE(index.size(), 0);
+}
+
+void TestContactIndex::lookup_data()
+{
+    QTest::addColumn<int>("contacts");
+
+    QTest::newRow("10") << 10;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("100k") << 100000;
+}
+
+// each iteration resolves 1000 hostnames, as inbound connections and C API
+// calls would, half of them unknown
+void TestContactIndex::lookup()
+{
+    QFETCH(int, contacts);
+
+    ContactIndex index;
+    for (int i = 0; i < contacts; ++i)
+        index.insert(fakeUser(i), serviceId(i) + QStringLiteral(".onion"));
+    QCOMPARE(index.size(), contacts);
+
+    std::vector<QString> queries;
+    for (int i = 0; i < 1000; ++i)
+        queries.push_back(serviceId(i % 2 ? (i * 7919) % contacts : contacts + i));
+
+    int found = 0;
+    QBENCHMARK {
+        found = 0;
+        for (const auto &hostname : queries)
+            found += index.lookup(hostname) != nullptr;
+    }
+    QCOMPARE(found, 500);
+}
+
+QTEST_APPLESS_MAIN(TestContactIndex)
+#include "tst_contactindex.moc"
@@ -0,0 +1,436 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <array>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <QtTest>
+#include <QtNetwork>
+// openssl
+#include <openssl/evp.h>
+
+// libtego
+#include <tego/tego.hpp>
+
+// libtego_ui
+#include "protocol/Connection.h"
+#include "protocol/FileChannel.h"
+
+using namespace Protocol;
+
+constexpr char senderHostname[] = "ockeilzymnguehc4brf4dpcsc634wtei75wa5edslx6yuwfaw3pje6id.onion";
+constexpr char receiverHostname[] = "kmhee7bfsixluoummhu7rkjx6vlxksneflromksrdhhi7n5ks3ckygqd.onion";
+
+// Connection only accepts client sockets whose peer is an onion service
+class OnionSocket : public QTcpSocket
+{
+public:
+    void setOnionPeerName(const QString &name) { setPeerName(name); }
+};
+
+// forwards bytes between two sockets, holding each read back for a fixed delay
+// to stand in for the round trip time of a tor circuit
+class LatencyRelay : public QObject
+{
+public:
+    LatencyRelay(QTcpSocket *a, QTcpSocket *b, int delayMs)
+        : delayMs(delayMs)
+    {
+        connect(a, &QIODevice::readyRead, this, [=]() { forward(a, b, aToB); });
+        connect(b, &QIODevice::readyRead, this, [=]() { forward(b, a, bToA); });
+        connect(a, &QAbstractSocket::disconnected, b, &QAbstractSocket::disconnectFromHost);
+        connect(b, &QAbstractSocket::disconnected, a, &QAbstractSocket::disconnectFromHost);
+    }
+
+private:
+    void forward(QTcpSocket *from, QTcpSocket *to, QQueue<QByteArray> &pending)
+    {
+        pending.enqueue(from->readAll());
+        // timers with equal intervals fire in order, but always write the
+        // oldest pending data in case they don't
+        QTimer::singleShot(delayMs, Qt::PreciseTimer, this, [to, &pending]() {
+            if (!pending.isEmpty())
+                to->write(pending.dequeue());
+        });
+    }
+
+    const int delayMs;
+    QQueue<QByteArray> aToB;
+    QQueue<QByteArray> bToA;
+};
+
+// how the sender hashes the file it offers
+enum class Hashing
+{
+    UpFront,
+    Trailer,
+    Tree,
+};
+Q_DECLARE_METATYPE(Hashing)
+
+// an authenticated pair of KnownContact connections, joined through a LatencyRelay
+struct Loopback
+{
+    QScopedPointer<QTcpSocket> relayIn, relayOut;
+    QScopedPointer<LatencyRelay> relay;
+    std::unique_ptr<Connection> sender, receiver;
+};
+
+class TestFileChannel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void transfer_data();
+    void transfer();
+    void resume_data();
+    void resume();
+    void chunkPathCost();
+
+private:
+    // returns a connected pair of sockets, the first of which will be owned by a ClientSide Connection
+    std::pair<OnionSocket*, QTcpSocket*> socketPair(QTcpServer &server);
+    void connectLoopback(Loopback &loopback, int latencyMs);
+    void closeLoopback(Loopback &loopback);
+    // accept every file offered to the receiver into dest
+    void acceptFiles(Connection *receiver, const std::string &dest, std::optional<tego_file_transfer_result_t> &result);
+    // opens an outbound file channel from the sender
+    FileChannel *openFileChannel(Connection *sender, int windowChunks);
+
+    QTemporaryDir tempDir;
+    QString sourcePath;
+    tego_file_size_t sourceSize = 0;
+    tego_file_hash sourceHash;
+};
+
+void TestFileChannel::initTestCase()
+{
+    QVERIFY(tempDir.isValid());
+
+    // 2 MiB of noise to send, large enough to need a few dozen chunks
+    sourceSize = 2 * 1024 * 1024;
+    sourcePath = tempDir.filePath(QStringLiteral("source.bin"));
+    {
+        QFile source(sourcePath);
+        QVERIFY(source.open(QIODevice::WriteOnly));
+        QByteArray block(64 * 1024, 0);
+        for (tego_file_size_t written = 0; written < sourceSize; written += block.size()) {
+            for (auto &byte : block)
+                byte = static_cast<char>(QRandomGenerator::global()->generate());
+            QCOMPARE(source.write(block), qint64(block.size()));
+        }
+    }
+
+    std::ifstream stream(sourcePath.toStdString(), std::ios::in | std::ios::binary);
+    QVERIFY(stream.is_open());
+    sourceHash = tego_file_hash(stream);
+}
+
+std::pair<OnionSocket*, QTcpSocket*> TestFileChannel::socketPair(QTcpServer &server)
+{
+    auto client = new OnionSocket;
+    client->connectToHost(server.serverAddress(), server.serverPort());
+    if (!client->waitForConnected(5000) || !server.waitForNewConnection(5000)) {
+        delete client;
+        return {nullptr, nullptr};
+    }
+    return {client, server.nextPendingConnection()};
+}
+
+void TestFileChannel::connectLoopback(Loopback &loopback, int latencyMs)
+{
+    // sender <-> relay and relay <-> receiver loopback pairs
+    QTcpServer senderSide, receiverSide;
+    QVERIFY(senderSide.listen(QHostAddress::LocalHost));
+    QVERIFY(receiverSide.listen(QHostAddress::LocalHost));
+
+    auto [senderSocket, relayIn] = socketPair(senderSide);
+    QVERIFY(senderSocket && relayIn);
+    loopback.relayIn.reset(relayIn);
+    auto [relayOut, receiverSocket] = socketPair(receiverSide);
+    QVERIFY(relayOut && receiverSocket);
+    loopback.relayOut.reset(relayOut);
+
+    loopback.relay.reset(new LatencyRelay(relayIn, relayOut, latencyMs));
+
+    senderSocket->setOnionPeerName(QString::fromLatin1(receiverHostname));
+    receiverSocket->setProperty("localHostname", QString::fromLatin1(receiverHostname));
+
+    loopback.sender.reset(new Connection(senderSocket, Connection::ClientSide));
+    loopback.receiver.reset(new Connection(receiverSocket, Connection::ServerSide));
+
+    QSignalSpy senderReady(loopback.sender.get(), &Connection::ready);
+    QTRY_COMPARE(senderReady.count(), 1);
+
+    loopback.receiver->grantAuthentication(Connection::HiddenServiceAuth, QString::fromLatin1(senderHostname));
+    QVERIFY(loopback.receiver->setPurpose(Connection::Purpose::KnownContact));
+    QVERIFY(loopback.sender->setPurpose(Connection::Purpose::KnownContact));
+}
+
+void TestFileChannel::closeLoopback(Loopback &loopback)
+{
+    QSignalSpy senderClosed(loopback.sender.get(), &Connection::closed);
+    QSignalSpy receiverClosed(loopback.receiver.get(), &Connection::closed);
+    loopback.sender->close();
+    loopback.receiver->close();
+    QTRY_COMPARE(senderClosed.count(), 1);
+    QTRY_COMPARE(receiverClosed.count(), 1);
+}
+
+void TestFileChannel::acceptFiles(Connection *receiver, const std::string &dest, std::optional<tego_file_transfer_result_t> &result)
+{
+    connect(receiver, &Connection::channelCreated, this, [&result, dest](Channel *channel) {
+        auto fc = qobject_cast<FileChannel*>(channel);
+        if (!fc)
+            return;
+        // the transfer record only exists once the header handler returns
+        connect(fc, &FileChannel::fileTransferRequestReceived, fc, [fc, dest](tego_file_transfer_id_t id) {
+            QTimer::singleShot(0, fc, [fc, dest, id]() { fc->acceptFile(id, dest); });
+        });
+        connect(fc, &FileChannel::fileTransferFinished, fc, [&result](tego_file_transfer_id_t, tego_file_transfer_direction_t, tego_file_transfer_result_t r) {
+            result = r;
+        });
+    });
+}
+
+FileChannel *TestFileChannel::openFileChannel(Connection *sender, int windowChunks)
+{
+    auto channel = new FileChannel(Channel::Outbound, sender);
+    // FileChannel sends 63 KiB chunks
+    channel->setSendWindowSize(windowChunks * 63 * 1024);
+    if (!channel->openChannel())
+        return nullptr;
+    if (!QTest::qWaitFor([channel]() { return channel->isOpened(); }))
+        return nullptr;
+    return channel;
+}
+
+void TestFileChannel::transfer_data()
+{
+    QTest::addColumn<int>("windowChunks");
+    QTest::addColumn<int>("latencyMs");
+    QTest::addColumn<Hashing>("hashing");
+
+    for (int latency : {0, 25, 100}) {
+        for (int window : {1, 4, 8, 16, 32}) {
+            QTest::newRow(qPrintable(QStringLiteral("window %1, latency %2ms").arg(window).arg(latency)))
+                << window << latency << Hashing::UpFront;
+        }
+    }
+
+    // file hashed while it is sent, with the digest following in a trailer
+    QTest::newRow("window 8, latency 25ms, hash trailer") << 8 << 25 << Hashing::Trailer;
+    // each chunk verified against a hash tree as it arrives
+    QTest::newRow("window 8, latency 25ms, hash tree") << 8 << 25 << Hashing::Tree;
+}
+
+void TestFileChannel::transfer()
+{
+    QFETCH(int, windowChunks);
+    QFETCH(int, latencyMs);
+    QFETCH(Hashing, hashing);
+
+    Loopback loopback;
+    connectLoopback(loopback, latencyMs);
+    if (QTest::currentTestFailed())
+        return;
+
+    const auto dest = tempDir.filePath(QStringLiteral("dest.bin")).toStdString();
+    std::optional<tego_file_transfer_result_t> result;
+    acceptFiles(loopback.receiver.get(), dest, result);
+
+    // both sides learn the file's hash, however it was sent
+    std::optional<tego_file_hash> sentHash, receivedHash;
+    connect(loopback.receiver.get(), &Connection::channelCreated, this, [&receivedHash](Channel *channel) {
+        if (auto fc = qobject_cast<FileChannel*>(channel)) {
+            connect(fc, &FileChannel::fileTransferHashKnown, fc, [&receivedHash](tego_file_transfer_id_t, tego_file_transfer_direction_t, const tego_file_hash_t &hash) {
+                receivedHash = hash;
+            });
+        }
+    });
+
+    auto channel = openFileChannel(loopback.sender.get(), windowChunks);
+    QVERIFY(channel);
+    channel->setHashTreePreferred(hashing == Hashing::Tree);
+    connect(channel, &FileChannel::fileTransferHashKnown, channel, [&sentHash](tego_file_transfer_id_t, tego_file_transfer_direction_t, const tego_file_hash_t &hash) {
+        sentHash = hash;
+    });
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    const auto fileHash = hashing == Hashing::UpFront ? std::optional<tego_file_hash>(sourceHash) : std::nullopt;
+    QVERIFY(channel->sendFileWithId(sourcePath, fileHash, QDateTime(), 1));
+    QTRY_VERIFY_WITH_TIMEOUT(result.has_value(), 120 * 1000);
+    const auto msecs = std::max<qint64>(elapsed.elapsed(), 1);
+
+    QCOMPARE(*result, tego_file_transfer_result_success);
+    QCOMPARE(QFileInfo(QString::fromStdString(dest)).size(), qint64(sourceSize));
+
+    QVERIFY(sentHash.has_value() && receivedHash.has_value());
+    QCOMPARE(receivedHash->to_string(), sentHash->to_string());
+    // a hash tree transfer is identified by the tree's root instead
+    if (hashing != Hashing::Tree)
+        QCOMPARE(sentHash->to_string(), sourceHash.to_string());
+
+    QTest::setBenchmarkResult(sourceSize * 1000.0 / msecs, QTest::BytesPerSecond);
+
+    closeLoopback(loopback);
+}
+
+void TestFileChannel::resume_data()
+{
+    QTest::addColumn<bool>("earlyWritable");
+
+    QTest::newRow("plain") << false;
+    // the connection drains while the header response, and then the prefix hash, are pending
+    QTest::newRow("writable before response") << true;
+}
+
+void TestFileChannel::resume()
+{
+    QFETCH(bool, earlyWritable);
+
+    const auto dest = tempDir.filePath(QStringLiteral("resume-%1.bin").arg(earlyWritable)).toStdString();
+    const auto partialDest = QString::fromStdString(dest + ".part");
+
+    // drop the connection half way through a transfer
+    {
+        Loopback loopback;
+        connectLoopback(loopback, 25);
+        if (QTest::currentTestFailed())
+            return;
+
+        std::optional<tego_file_transfer_result_t> result;
+        acceptFiles(loopback.receiver.get(), dest, result);
+
+        auto channel = openFileChannel(loopback.sender.get(), 1);
+        QVERIFY(channel);
+
+        auto sender = loopback.sender.get();
+        connect(channel, &FileChannel::fileTransferProgress, this, [this, sender](tego_file_transfer_id_t, tego_file_transfer_direction_t, tego_file_size_t bytes, tego_file_size_t) {
+            if (bytes >= sourceSize / 2)
+                QTimer::singleShot(0, sender, &Connection::close);
+        });
+
+        QVERIFY(channel->sendFileWithId(sourcePath, sourceHash, QDateTime(), 1));
+        QTRY_VERIFY_WITH_TIMEOUT(result.has_value(), 120 * 1000);
+        QCOMPARE(*result, tego_file_transfer_result_network_error);
+    }
+
+    // the partial file and its resume record are written by the I/O worker
+    QTRY_VERIFY(QFile::exists(QString::fromStdString(dest + ".part.resume")));
+    QVERIFY(QFileInfo(partialDest).size() >= qint64(sourceSize / 2));
+
+    // offering the same file again picks up where we left off
+    Loopback loopback;
+    connectLoopback(loopback, 25);
+    if (QTest::currentTestFailed())
+        return;
+
+    std::optional<tego_file_transfer_result_t> result;
+    acceptFiles(loopback.receiver.get(), dest, result);
+
+    auto channel = openFileChannel(loopback.sender.get(), 8);
+    QVERIFY(channel);
+
+    std::optional<tego_file_size_t> resumedFrom;
+    connect(channel, &FileChannel::fileTransferProgress, this, [&resumedFrom](tego_file_transfer_id_t, tego_file_transfer_direction_t, tego_file_size_t bytes, tego_file_size_t) {
+        if (!resumedFrom)
+            resumedFrom = bytes;
+    });
+
+    if (earlyWritable) {
+        connect(channel, &FileChannel::fileTransferRequestResponded, channel, [channel]() {
+            QTimer::singleShot(0, channel, [channel]() { emit channel->writable(); });
+        });
+    }
+
+    QVERIFY(channel->sendFileWithId(sourcePath, std::nullopt, QDateTime(), 2));
+    if (earlyWritable)
+        emit channel->writable();
+    QTRY_VERIFY_WITH_TIMEOUT(result.has_value(), 120 * 1000);
+    QCOMPARE(*result, tego_file_transfer_result_success);
+
+    QVERIFY(resumedFrom.has_value());
+    QVERIFY(*resumedFrom >= sourceSize / 2);
+
+    std::ifstream received(dest, std::ios::in | std::ios::binary);
+    QVERIFY(received.is_open());
+    QCOMPARE(tego_file_hash(received).to_string(), sourceHash.to_string());
+    QVERIFY(!QFile::exists(partialDest));
+
+    closeLoopback(loopback);
+}
+
+// CPU time spent moving file data from disk, through both ends of a connection, and back
+// to disk; with no latency and a wide window this is dominated by the chunk path itself
+void TestFileChannel::chunkPathCost()
+{
+    Loopback loopback;
+    connectLoopback(loopback, 0);
+    if (QTest::currentTestFailed())
+        return;
+
+    const auto dest = tempDir.filePath(QStringLiteral("cost.bin")).toStdString();
+    std::optional<tego_file_transfer_result_t> result;
+    acceptFiles(loopback.receiver.get(), dest, result);
+
+    auto channel = openFileChannel(loopback.sender.get(), 32);
+    QVERIFY(channel);
+
+    // std::clock() counts CPU time across every thread in the process, including the I/O worker
+    const auto cpuBegin = std::clock();
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QVERIFY(channel->sendFileWithId(sourcePath, sourceHash, QDateTime(), 1));
+    QTRY_VERIFY_WITH_TIMEOUT(result.has_value(), 120 * 1000);
+    const auto cpuSeconds = double(std::clock() - cpuBegin) / CLOCKS_PER_SEC;
+    const auto msecs = std::max<qint64>(elapsed.elapsed(), 1);
+    QCOMPARE(*result, tego_file_transfer_result_success);
+
+    constexpr double GiB = 1024.0 * 1024.0 * 1024.0;
+    qInfo("CPU per GiB transferred: %.2f s (%.1f MiB/s)",
+          cpuSeconds * GiB / sourceSize, sourceSize * 1000.0 / msecs / (1024.0 * 1024.0));
+    QTest::setBenchmarkResult(sourceSize * 1000.0 / msecs, QTest::BytesPerSecond);
+
+    closeLoopback(loopback);
+}
+
+QTEST_MAIN(TestFileChannel)
+#include "tst_filechannel.moc"
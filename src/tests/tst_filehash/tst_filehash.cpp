@@ -0,0 +1,351 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <array>
+#include <fstream>
+#include <optional>
+#include <vector>
+#include <QtTest>
+// openssl
+#include <openssl/evp.h>
+
+// libtego
+#include <tego/tego.hpp>
+#include "file_hash.hpp"
+
+class TestFileHash : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void treeShape();
+    void treeThreadCount();
+    void singleLeaf();
+    void verifyTopDown();
+    void corruptLeaf();
+    void corruptChildren();
+    void cacheHit();
+    void cacheInvalidation();
+
+    void hashFile_data();
+    void hashFile();
+    void hashFiles_data();
+    void hashFiles();
+
+private:
+    std::vector<char> leafData(size_t index) const;
+    // a file of the given size for benchmarking, created on first use
+    std::string benchmarkFile(qint64 size, int copy = 0);
+
+    QTemporaryDir tempDir;
+    std::string path;
+    QByteArray contents;
+};
+
+constexpr auto LeafSize = tego_file_hash_tree::LEAF_SIZE;
+constexpr auto Fanout = tego_file_hash_tree::FANOUT;
+
+void TestFileHash::initTestCase()
+{
+    QVERIFY(tempDir.isValid());
+
+    // just over one full node of leaves, so the tree has three levels
+    // and the last leaf and node are both partial
+    contents.resize(static_cast<int>((Fanout + 1) * LeafSize + 100));
+    for (auto &byte : contents)
+        byte = static_cast<char>(QRandomGenerator::global()->generate());
+
+    path = tempDir.filePath(QStringLiteral("source.bin")).toStdString();
+    std::ofstream stream(path, std::ios::out | std::ios::binary);
+    stream.write(contents.constData(), contents.size());
+    QVERIFY(stream.good());
+}
+
+std::vector<char> TestFileHash::leafData(size_t index) const
+{
+    const auto begin = contents.constData() + index * LeafSize;
+    const auto size = std::min<size_t>(LeafSize, contents.size() - index * LeafSize);
+    return std::vector<char>(begin, begin + size);
+}
+
+void TestFileHash::treeShape()
+{
+    const auto tree = tego_file_hash_tree::from_file(path, contents.size(), 1);
+
+    QCOMPARE(tree.height(), size_t(3));
+    QCOMPARE(tree.level_size(0), Fanout + 2);
+    QCOMPARE(tree.level_size(1), size_t(2));
+    QCOMPARE(tree.level_size(2), size_t(1));
+    QCOMPARE(tree.child_count(1, 0), Fanout);
+    QCOMPARE(tree.child_count(1, 1), size_t(2));
+
+    // spot check the leaves and the partial node against hashing them directly
+    const auto last = leafData(Fanout + 1);
+    QCOMPARE(tree.node(0, Fanout + 1)->to_string(),
+             tego_file_hash_tree::leaf_hash(reinterpret_cast<const uint8_t*>(last.data()),
+                                            reinterpret_cast<const uint8_t*>(last.data() + last.size())).to_string());
+
+    const std::array<tego_file_hash, 2> children = {*tree.node(0, Fanout), *tree.node(0, Fanout + 1)};
+    QCOMPARE(tree.node(1, 1)->to_string(), tego_file_hash_tree::node_hash(children.data(), children.data() + children.size()).to_string());
+}
+
+void TestFileHash::treeThreadCount()
+{
+    const auto single = tego_file_hash_tree::from_file(path, contents.size(), 1);
+    const auto parallel = tego_file_hash_tree::from_file(path, contents.size(), 8);
+
+    QCOMPARE(parallel.root().to_string(), single.root().to_string());
+}
+
+void TestFileHash::singleLeaf()
+{
+    const auto tree = tego_file_hash_tree::from_file(path, 100, 4);
+    const auto begin = reinterpret_cast<const uint8_t*>(contents.constData());
+
+    QCOMPARE(tree.height(), size_t(1));
+    QCOMPARE(tree.root().to_string(), tego_file_hash_tree::leaf_hash(begin, begin + 100).to_string());
+    // a leaf must never hash the same as the same bytes hashed plainly
+    QVERIFY(tree.root().to_string() != tego_file_hash(begin, begin + 100).to_string());
+}
+
+void TestFileHash::verifyTopDown()
+{
+    const auto source = tego_file_hash_tree::from_file(path, contents.size(), 4);
+    tego_file_hash_tree received(contents.size(), source.root());
+
+    QVERIFY(!received.node(1, 0).has_value());
+    for (auto level = source.height() - 1; level > 0; --level) {
+        for (size_t index = 0; index < source.level_size(level); ++index) {
+            std::vector<tego_file_hash> children;
+            const auto first = source.first_child(index);
+            for (auto i = first; i < first + source.child_count(level, index); ++i)
+                children.push_back(*source.node(level - 1, i));
+            QVERIFY(received.add_children(level, index, std::move(children)));
+        }
+    }
+
+    for (size_t index = 0; index < received.level_size(0); ++index) {
+        const auto leaf = leafData(index);
+        QVERIFY(received.verify_leaf(index, leaf.data(), leaf.data() + leaf.size()));
+    }
+}
+
+void TestFileHash::corruptLeaf()
+{
+    const auto tree = tego_file_hash_tree::from_file(path, contents.size(), 4);
+
+    auto leaf = leafData(7);
+    QVERIFY(tree.verify_leaf(7, leaf.data(), leaf.data() + leaf.size()));
+    leaf[LeafSize / 2] ^= 0x01;
+    QVERIFY(!tree.verify_leaf(7, leaf.data(), leaf.data() + leaf.size()));
+
+    // right data, wrong place
+    const auto other = leafData(8);
+    QVERIFY(!tree.verify_leaf(7, other.data(), other.data() + other.size()));
+}
+
+void TestFileHash::corruptChildren()
+{
+    const auto source = tego_file_hash_tree::from_file(path, contents.size(), 4);
+    tego_file_hash_tree received(contents.size(), source.root());
+
+    // children of a node whose own hash is not yet known can't be checked
+    QVERIFY(!received.add_children(1, 1, {*source.node(0, Fanout), *source.node(0, Fanout + 1)}));
+
+    std::vector<tego_file_hash> children = {*source.node(1, 0), *source.node(1, 1)};
+    children[1].data[0] ^= 0x01;
+    QVERIFY(!received.add_children(2, 0, std::vector<tego_file_hash>(children)));
+
+    // too few children
+    QVERIFY(!received.add_children(2, 0, {*source.node(1, 0)}));
+
+    children[1].data[0] ^= 0x01;
+    QVERIFY(received.add_children(2, 0, std::move(children)));
+    QVERIFY(received.node(1, 1).has_value());
+}
+
+std::string TestFileHash::benchmarkFile(qint64 size, int copy)
+{
+    const auto path = tempDir.filePath(QStringLiteral("bench-%1-%2.bin").arg(size).arg(copy));
+    if (QFileInfo(path).size() != size) {
+        // hashing speed doesn't depend on the data, so repeat one random block
+        QByteArray block(1024 * 1024, 0);
+        for (auto &byte : block)
+            byte = static_cast<char>(QRandomGenerator::global()->generate());
+
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return {};
+        for (qint64 written = 0; written < size; written += block.size()) {
+            if (file.write(block.constData(), std::min<qint64>(block.size(), size - written)) < 0)
+                return {};
+        }
+    }
+    return path.toStdString();
+}
+
+void TestFileHash::cacheHit()
+{
+    const auto cachePath = tempDir.filePath(QStringLiteral("hit.json")).toStdString();
+    const auto expected = tego_file_hash::from_file(path);
+    {
+        tego_file_hash_cache cache(cachePath);
+        QVERIFY(!cache.lookup(path).has_value());
+        QCOMPARE(cache.hash_file(path).to_string(), expected.to_string());
+        QVERIFY(cache.lookup(path).has_value());
+    }
+
+    // the entry survives reloading
+    tego_file_hash_cache cache(cachePath);
+    auto cached = cache.lookup(path);
+    QVERIFY(cached.has_value());
+    QCOMPARE(cached->to_string(), expected.to_string());
+}
+
+void TestFileHash::cacheInvalidation()
+{
+    const auto cachePath = tempDir.filePath(QStringLiteral("invalidation.json")).toStdString();
+    const auto filePath = tempDir.filePath(QStringLiteral("changing.bin"));
+    auto writeFile = [&](const QByteArray& data)
+    {
+        QFile file(filePath);
+        QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        QCOMPARE(file.write(data), data.size());
+    };
+
+    tego_file_hash_cache cache(cachePath);
+    writeFile(contents.left(1000));
+    cache.hash_file(filePath.toStdString());
+    QVERIFY(cache.lookup(filePath.toStdString()).has_value());
+
+    // size changes
+    writeFile(contents.left(2000));
+    QVERIFY(!cache.lookup(filePath.toStdString()).has_value());
+    QCOMPARE(cache.hash_file(filePath.toStdString()).to_string(), tego_file_hash::from_file(filePath.toStdString()).to_string());
+
+    // same size, new contents, new mtime
+    auto modified = contents.left(2000);
+    modified[0] = static_cast<char>(modified[0] ^ 0x01);
+    writeFile(modified);
+    QFile(filePath).setFileTime(QDateTime::currentDateTime().addSecs(60), QFileDevice::FileModificationTime);
+    QVERIFY(!cache.lookup(filePath.toStdString()).has_value());
+    cache.hash_file(filePath.toStdString());
+
+    // a different file at the same path, with the same size and mtime
+    const auto mtime = QFileInfo(filePath).lastModified();
+    const auto replacement = tempDir.filePath(QStringLiteral("replacement.bin"));
+    QVERIFY(QFile::copy(filePath, replacement));
+    {
+        QFile file(replacement);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.setFileTime(mtime, QFileDevice::FileModificationTime));
+    }
+    QVERIFY(QFile::remove(filePath));
+    QVERIFY(QFile::rename(replacement, filePath));
+    QCOMPARE(QFileInfo(filePath).lastModified(), mtime);
+    QVERIFY(!cache.lookup(filePath.toStdString()).has_value());
+}
+
+void TestFileHash::hashFile_data()
+{
+    QTest::addColumn<qint64>("size");
+    QTest::addColumn<bool>("mapped");
+
+    constexpr qint64 MB = 1024 * 1024;
+    for (qint64 size : {MB, 100 * MB, 4096 * MB}) {
+        QTest::newRow(qPrintable(QStringLiteral("%1 MB, iostream").arg(size / MB))) << size << false;
+        QTest::newRow(qPrintable(QStringLiteral("%1 MB, mapped").arg(size / MB))) << size << true;
+    }
+}
+
+void TestFileHash::hashFile()
+{
+    QFETCH(qint64, size);
+    QFETCH(bool, mapped);
+
+    if (size > 1024 * 1024 * 1024 && !qEnvironmentVariableIsSet("TEGO_BENCHMARK_LARGE_FILES"))
+        QSKIP("set TEGO_BENCHMARK_LARGE_FILES to benchmark multi-gigabyte files");
+
+    const auto path = benchmarkFile(size);
+    QVERIFY(!path.empty());
+
+    std::string hash;
+    QBENCHMARK_ONCE {
+        if (mapped) {
+            hash = tego_file_hash::from_file(path).to_string();
+        } else {
+            std::ifstream stream(path, std::ios::in | std::ios::binary);
+            hash = tego_file_hash(stream).to_string();
+        }
+    }
+
+    // both paths must of course agree
+    std::ifstream stream(path, std::ios::in | std::ios::binary);
+    QCOMPARE(hash, tego_file_hash(stream).to_string());
+}
+
+void TestFileHash::hashFiles_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("4 threads") << 4;
+}
+
+void TestFileHash::hashFiles()
+{
+    QFETCH(int, threads);
+
+    // several files offered at once, as when sending a folder's worth
+    std::vector<std::string> paths;
+    for (int i = 0; i < 4; ++i) {
+        paths.push_back(benchmarkFile(25 * 1024 * 1024, i));
+        QVERIFY(!paths.back().empty());
+    }
+
+    std::vector<std::optional<tego_file_hash>> hashes;
+    QBENCHMARK_ONCE {
+        hashes = tego_file_hash::from_files(paths, threads);
+    }
+
+    QCOMPARE(hashes.size(), paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        QVERIFY(hashes[i].has_value());
+        QCOMPARE(hashes[i]->to_string(), tego_file_hash::from_file(paths[i]).to_string());
+    }
+}
+
+QTEST_APPLESS_MAIN(TestFileHash)
+#include "tst_filehash.moc"
@@ -0,0 +1,210 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <memory>
+#include <optional>
+#include <vector>
+#include <QtTest>
+
+// libtego_ui
+#include "utils/HistoryLog.h"
+
+class TestHistoryLog : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+
+    void roundTrip();
+    void paging();
+    void largeRecord();
+    void tornAppend();
+    void wrongKey();
+    void manyLogs();
+
+private:
+    QString logPath() const { return dir.filePath(QStringLiteral("history/contact.log")); }
+    static QByteArray key(char fill = 'k') { return QByteArray(HistoryLog::KeySize, fill); }
+    static QByteArray payload(int n) { return QByteArray::number(n).repeated(10); }
+
+    QTemporaryDir dir;
+};
+
+void TestHistoryLog::init()
+{
+    QVERIFY(dir.isValid());
+    QFile::remove(logPath());
+}
+
+void TestHistoryLog::roundTrip()
+{
+    qint64 offsets[3];
+    {
+        HistoryLog log(logPath(), key());
+        QVERIFY(log.open());
+        for (int i = 0; i < 3; ++i)
+            offsets[i] = log.append(payload(i));
+    }
+    QCOMPARE(offsets[0], qint64(0));
+
+    // the contents are not stored in the clear
+    QFile file(logPath());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(!file.readAll().contains(payload(1)));
+
+    HistoryLog log(logPath(), key());
+    QVERIFY(log.open());
+    qint64 end = log.size();
+    const auto records = log.readPage(end);
+    QCOMPARE(end, qint64(0));
+    QCOMPARE(records.size(), 3);
+    for (int i = 0; i < 3; ++i) {
+        QCOMPARE(records[i].offset, offsets[2 - i]);
+        QCOMPARE(records[i].data, payload(2 - i));
+    }
+}
+
+void TestHistoryLog::paging()
+{
+    constexpr int count = 20000;
+
+    HistoryLog log(logPath(), key());
+    QVERIFY(log.open());
+    for (int i = 0; i < count; ++i)
+        QVERIFY(log.append(payload(i)) >= 0);
+
+    // every record comes back exactly once, newest first, a page at a time
+    qint64 end = log.size();
+    int next = count - 1;
+    int pages = 0;
+    while (end > 0) {
+        const qint64 before = end;
+        const auto records = log.readPage(end);
+        QVERIFY(!records.isEmpty());
+        QVERIFY(before - end <= HistoryLog::PageSize);
+        for (const auto &record : records)
+            QCOMPARE(record.data, payload(next--));
+        ++pages;
+    }
+    QCOMPARE(next, -1);
+    QVERIFY(pages > 1);
+}
+
+void TestHistoryLog::largeRecord()
+{
+    const QByteArray large(3 * HistoryLog::PageSize, 'x');
+
+    HistoryLog log(logPath(), key());
+    QVERIFY(log.open());
+    log.append(payload(0));
+    log.append(large);
+    log.append(payload(1));
+
+    qint64 end = log.size();
+    QList<HistoryLog::Record> records;
+    while (end > 0)
+        records += log.readPage(end);
+
+    QCOMPARE(records.size(), 3);
+    QCOMPARE(records[0].data, payload(1));
+    QCOMPARE(records[1].data, large);
+    QCOMPARE(records[2].data, payload(0));
+}
+
+void TestHistoryLog::tornAppend()
+{
+    {
+        HistoryLog log(logPath(), key());
+        QVERIFY(log.open());
+        log.append(payload(0));
+        log.append(payload(1));
+    }
+
+    // cut the last record short, as a crash in the middle of append would
+    QFile file(logPath());
+    QVERIFY(file.resize(file.size() - 5));
+
+    HistoryLog log(logPath(), key());
+    QVERIFY(log.open());
+    qint64 end = log.size();
+    auto records = log.readPage(end);
+    QCOMPARE(records.size(), 1);
+    QCOMPARE(records[0].data, payload(0));
+
+    // appending carries on after the last whole record
+    log.append(payload(2));
+    end = log.size();
+    records = log.readPage(end);
+    QCOMPARE(records.size(), 2);
+    QCOMPARE(records[0].data, payload(2));
+}
+
+void TestHistoryLog::wrongKey()
+{
+    {
+        HistoryLog log(logPath(), key());
+        QVERIFY(log.open());
+        log.append(payload(0));
+    }
+
+    HistoryLog log(logPath(), key('x'));
+    QVERIFY(log.open());
+    qint64 end = log.size();
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("failed to decrypt"));
+    QVERIFY(log.readPage(end).isEmpty());
+    QCOMPARE(end, qint64(0));
+}
+
+// one log per contact, more than the default limit of 1024 open files
+void TestHistoryLog::manyLogs()
+{
+    constexpr int count = 2048;
+
+    std::vector<std::unique_ptr<HistoryLog>> logs;
+    for (int i = 0; i < count; ++i) {
+        logs.push_back(std::make_unique<HistoryLog>(dir.filePath(QStringLiteral("many/%1.log").arg(i)), key()));
+        QVERIFY(logs.back()->open());
+        QVERIFY(logs.back()->append(payload(i)) >= 0);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        qint64 end = logs[i]->size();
+        const auto records = logs[i]->readPage(end);
+        QCOMPARE(records.size(), 1);
+        QCOMPARE(records[0].data, payload(i));
+    }
+}
+
+QTEST_GUILESS_MAIN(TestHistoryLog)
+#include "tst_historylog.moc"
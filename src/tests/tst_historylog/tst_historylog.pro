@@ -0,0 +1,3 @@
+include(../tests.pri)
+
+SOURCES += tst_historylog.cpp
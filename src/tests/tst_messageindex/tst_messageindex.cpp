@@ -0,0 +1,205 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <random>
+#include <vector>
+#include <QtTest>
+
+// libtego
+#include "core/MessageIndex.h"
+
+class TestMessageIndex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void directions();
+    void reusedIdentifiers();
+    void matchesScan();
+    void replay_data();
+    void replay();
+
+private:
+    struct Message
+    {
+        quint32 identifier;
+        bool isOutgoing;
+    };
+
+    // what ConversationModel did before it had an index
+    static int scan(const std::vector<Message> &messages, quint32 identifier, bool isOutgoing);
+    static void verify(const MessageIndex &index, const std::vector<Message> &messages);
+};
+
+int TestMessageIndex::scan(const std::vector<Message> &messages, quint32 identifier, bool isOutgoing)
+{
+    for (size_t i = 0; i < messages.size(); ++i) {
+        if (messages[i].identifier == identifier && messages[i].isOutgoing == isOutgoing)
+            return int(i);
+    }
+    return -1;
+}
+
+void TestMessageIndex::verify(const MessageIndex &index, const std::vector<Message> &messages)
+{
+    QCOMPARE(index.size(), int(messages.size()));
+    for (const auto &message : messages)
+        QCOMPARE(index.indexOf(message.identifier, message.isOutgoing), scan(messages, message.identifier, message.isOutgoing));
+}
+
+void TestMessageIndex::directions()
+{
+    MessageIndex index;
+    index.insert(0, 5, true);
+    index.insert(0, 5, false);
+    index.insert(0, 6, true);
+
+    QCOMPARE(index.indexOf(6, true), 0);
+    QCOMPARE(index.indexOf(5, false), 1);
+    QCOMPARE(index.indexOf(5, true), 2);
+    QCOMPARE(index.indexOf(6, false), -1);
+
+    index.remove(1);
+    QCOMPARE(index.indexOf(5, false), -1);
+    QCOMPARE(index.indexOf(5, true), 1);
+
+    index.clear();
+    QCOMPARE(index.indexOf(6, true), -1);
+    QCOMPARE(index.size(), 0);
+}
+
+void TestMessageIndex::reusedIdentifiers()
+{
+    // a peer that restarted counts its message ids from the same point again
+    MessageIndex index;
+    index.insert(0, 1, false);
+    index.insert(0, 2, false);
+    index.insert(0, 1, false);
+
+    QCOMPARE(index.indexOf(1, false), 0);
+    index.remove(0);
+    QCOMPARE(index.indexOf(1, false), 1);
+    index.insert(1, 1, false);
+    QCOMPARE(index.indexOf(1, false), 1);
+    index.remove(2);
+    QCOMPARE(index.indexOf(1, false), 1);
+}
+
+// random inserts and removes anywhere, with identifiers drawn from a small
+// range so that plenty of them repeat
+void TestMessageIndex::matchesScan()
+{
+    std::mt19937 rng(1);
+    std::vector<Message> messages;
+    MessageIndex index;
+
+    for (int step = 0; step < 2000; ++step) {
+        const int size = int(messages.size());
+        if (size > 0 && std::uniform_int_distribution<int>(0, 2)(rng) == 0) {
+            const int row = std::uniform_int_distribution<int>(0, size - 1)(rng);
+            messages.erase(messages.begin() + row);
+            index.remove(row);
+        } else {
+            const int row = std::uniform_int_distribution<int>(0, size)(rng);
+            const Message message{quint32(std::uniform_int_distribution<int>(0, 20)(rng)), bool(rng() & 1)};
+            messages.insert(messages.begin() + row, message);
+            index.insert(row, message.identifier, message.isOutgoing);
+        }
+        verify(index, messages);
+    }
+}
+
+void TestMessageIndex::replay_data()
+{
+    QTest::addColumn<bool>("indexed");
+
+    QTest::newRow("scan") << false;
+    QTest::newRow("index") << true;
+}
+
+// a long conversation at ConversationModel's history limit of 1000: messages
+// arrive at the top and the oldest are pruned from the bottom, while every
+// 50th message is a 64 MiB transfer that is looked up again for each of its
+// 63 KiB chunks as the conversation carries on above it
+void TestMessageIndex::replay()
+{
+    QFETCH(bool, indexed);
+
+    constexpr int historyLimit = 1000;
+    constexpr int messageCount = 5000;
+    constexpr int transferInterval = 50;
+    constexpr int chunksPerTransfer = 1040;
+
+    std::vector<Message> messages;
+    MessageIndex index;
+    quint32 nextIdentifier = 0;
+    Message transfer{0, true};
+    int found = 0;
+
+    const auto lookup = [&](const Message &message) {
+        const int row = indexed
+            ? index.indexOf(message.identifier, message.isOutgoing)
+            : scan(messages, message.identifier, message.isOutgoing);
+        found += row >= 0;
+    };
+
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < messageCount; ++i) {
+            // incoming messages go below any unacknowledged ones, here at most a few rows down
+            const bool isOutgoing = i % 3 != 0;
+            const int row = isOutgoing ? 0 : std::min<int>(i % 4, int(messages.size()));
+            const Message message{nextIdentifier++, isOutgoing};
+            messages.insert(messages.begin() + row, message);
+            index.insert(row, message.identifier, message.isOutgoing);
+            while (int(messages.size()) > historyLimit) {
+                messages.pop_back();
+                index.remove(int(messages.size()));
+            }
+
+            if (i % transferInterval == 0)
+                transfer = message;
+            for (int chunk = 0; chunk < chunksPerTransfer / transferInterval; ++chunk)
+                lookup(transfer);
+
+            // acknowledge an outgoing message sent a little earlier
+            if (i >= 10)
+                lookup(Message{nextIdentifier - 10, true});
+        }
+    }
+
+    QVERIFY(found > 0);
+    verify(index, messages);
+}
+
+QTEST_APPLESS_MAIN(TestMessageIndex)
+#include "tst_messageindex.moc"
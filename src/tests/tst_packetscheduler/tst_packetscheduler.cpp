@@ -0,0 +1,204 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <deque>
+#include <functional>
+#include <map>
+#include <optional>
+#include <QtTest>
+
+// libtego
+#include "protocol/PacketScheduler.h"
+
+using Protocol::PacketScheduler;
+using Priority = PacketScheduler::Priority;
+
+class TestPacketScheduler : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void priorityOrder();
+    void flowOrder();
+    void roundRobin();
+    void deficitFairness();
+    void rateLimit();
+    void removeFlow();
+    void queuedBytes();
+
+private:
+    static QByteArray packet(char tag, int size = 1);
+};
+
+QByteArray TestPacketScheduler::packet(char tag, int size)
+{
+    return QByteArray(size, tag);
+}
+
+void TestPacketScheduler::priorityOrder()
+{
+    PacketScheduler scheduler;
+    scheduler.enqueue(Priority::Bulk, 1, packet('b'));
+    scheduler.enqueue(Priority::Interactive, 0, packet('i'));
+    scheduler.enqueue(Priority::Control, 0, packet('c'));
+    scheduler.enqueue(Priority::Interactive, 0, packet('j'));
+
+    QCOMPARE(scheduler.dequeue(0).value(), packet('c'));
+    QCOMPARE(scheduler.dequeue(0).value(), packet('i'));
+    // a late chat message still overtakes file data
+    scheduler.enqueue(Priority::Interactive, 0, packet('k'));
+    QCOMPARE(scheduler.dequeue(0).value(), packet('j'));
+    QCOMPARE(scheduler.dequeue(0).value(), packet('k'));
+    QCOMPARE(scheduler.dequeue(0).value(), packet('b'));
+    QVERIFY(!scheduler.dequeue(0).has_value());
+    QVERIFY(scheduler.isEmpty());
+    QCOMPARE(scheduler.nextSendDelay(0), qint64(-1));
+}
+
+void TestPacketScheduler::flowOrder()
+{
+    PacketScheduler scheduler;
+    for (char c = 'a'; c <= 'e'; ++c)
+        scheduler.enqueue(Priority::Bulk, 7, packet(c));
+
+    for (char c = 'a'; c <= 'e'; ++c)
+        QCOMPARE(scheduler.dequeue(0).value(), packet(c));
+    QVERIFY(scheduler.isEmpty());
+}
+
+void TestPacketScheduler::roundRobin()
+{
+    PacketScheduler scheduler;
+    const int size = PacketScheduler::Quantum;
+    // flow 1 queues everything before flow 2 queues anything
+    for (int i = 0; i < 3; ++i)
+        scheduler.enqueue(Priority::Bulk, 1, packet('a', size));
+    for (int i = 0; i < 3; ++i)
+        scheduler.enqueue(Priority::Bulk, 2, packet('b', size));
+
+    QString order;
+    while (auto next = scheduler.dequeue(0))
+        order += QLatin1Char(next->at(0));
+    QCOMPARE(order, QStringLiteral("ababab"));
+}
+
+void TestPacketScheduler::deficitFairness()
+{
+    PacketScheduler scheduler;
+    // flow 1 sends small packets, flow 2 large ones; each should get
+    // about the same number of bytes through
+    for (int i = 0; i < 400; ++i)
+        scheduler.enqueue(Priority::Bulk, 1, packet('s', 1000));
+    for (int i = 0; i < 20; ++i)
+        scheduler.enqueue(Priority::Bulk, 2, packet('l', 20000));
+
+    qint64 small = 0;
+    qint64 large = 0;
+    for (int i = 0; i < 150; ++i) {
+        auto next = scheduler.dequeue(0);
+        QVERIFY(next.has_value());
+        (next->at(0) == 's' ? small : large) += next->size();
+    }
+    QVERIFY(small > 0 && large > 0);
+    QVERIFY(qAbs(small - large) <= 2 * PacketScheduler::Quantum);
+}
+
+void TestPacketScheduler::rateLimit()
+{
+    PacketScheduler scheduler;
+    scheduler.setRateLimit(1, 10000);
+    for (int i = 0; i < 4; ++i)
+        scheduler.enqueue(Priority::Bulk, 1, packet('a', 30000));
+
+    // the first round's worth goes out straight away
+    QVERIFY(scheduler.dequeue(0).has_value());
+    QVERIFY(scheduler.dequeue(0).has_value());
+    QVERIFY(scheduler.dequeue(0).has_value());
+    QVERIFY(!scheduler.dequeue(0).has_value());
+    QVERIFY(!scheduler.isEmpty());
+
+    // then it's 10 kB/s: the bucket is 90000 - Quantum bytes short
+    const auto expectedDelay = (90000 - PacketScheduler::Quantum) * 1000 / 10000;
+    const auto delay = scheduler.nextSendDelay(0);
+    QVERIFY(qAbs(delay - expectedDelay) <= 1);
+    QVERIFY(!scheduler.dequeue(delay - 10).has_value());
+    QVERIFY(scheduler.dequeue(delay).has_value());
+
+    // an unlimited flow isn't held up behind the limited one
+    scheduler.setRateLimit(1, 10000);
+    scheduler.enqueue(Priority::Bulk, 1, packet('a', 30000));
+    scheduler.enqueue(Priority::Bulk, 2, packet('b', 30000));
+    QCOMPARE(scheduler.dequeue(delay).value(), packet('b', 30000));
+    QVERIFY(!scheduler.dequeue(delay).has_value());
+
+    // lifting the limit lets the rest through
+    scheduler.setRateLimit(1, 0);
+    QVERIFY(scheduler.dequeue(delay).has_value());
+    QVERIFY(scheduler.isEmpty());
+}
+
+void TestPacketScheduler::removeFlow()
+{
+    PacketScheduler scheduler;
+    scheduler.enqueue(Priority::Bulk, 1, packet('a'));
+    scheduler.enqueue(Priority::Bulk, 2, packet('b'));
+    scheduler.enqueue(Priority::Bulk, 1, packet('c'));
+    scheduler.enqueue(Priority::Interactive, 0, packet('i'));
+
+    scheduler.removeFlow(1);
+    QCOMPARE(scheduler.dequeue(0).value(), packet('i'));
+    QCOMPARE(scheduler.dequeue(0).value(), packet('b'));
+    QVERIFY(scheduler.isEmpty());
+}
+
+void TestPacketScheduler::queuedBytes()
+{
+    PacketScheduler scheduler;
+    QCOMPARE(scheduler.queuedBytes(), qint64(0));
+
+    scheduler.enqueue(Priority::Control, 0, packet('c', 10));
+    scheduler.enqueue(Priority::Interactive, 0, packet('i', 100));
+    scheduler.enqueue(Priority::Bulk, 1, packet('a', 1000));
+    scheduler.enqueue(Priority::Bulk, 2, packet('b', 10000));
+    QCOMPARE(scheduler.queuedBytes(), qint64(11110));
+
+    scheduler.dequeue(0);
+    QCOMPARE(scheduler.queuedBytes(), qint64(11100));
+    scheduler.removeFlow(2);
+    QCOMPARE(scheduler.queuedBytes(), qint64(1100));
+    while (scheduler.dequeue(0)) {}
+    QCOMPARE(scheduler.queuedBytes(), qint64(0));
+}
+
+QTEST_APPLESS_MAIN(TestPacketScheduler)
+#include "tst_packetscheduler.moc"
@@ -0,0 +1,267 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <memory>
+#include <QtTest>
+
+// libtego_ui
+#include "utils/Settings.h"
+
+class TestSettings : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+
+    void coalescing();
+    void maxLatency();
+    void journalReplay();
+    void tornJournal();
+    void compactOnDestroy();
+    void staleJournal();
+    void bytesPerContactChange_data();
+    void bytesPerContactChange();
+
+private:
+    QString filePath() const { return dir.filePath(QStringLiteral("ricochet.json")); }
+    QString journalPath() const { return filePath() + QStringLiteral(".journal"); }
+    static QString userPath(int n) { return QStringLiteral("users.%1").arg(n, 56, 10, QLatin1Char('a')); }
+
+    QTemporaryDir dir;
+};
+
+void TestSettings::init()
+{
+    QVERIFY(dir.isValid());
+    QFile::remove(filePath());
+    QFile::remove(journalPath());
+}
+
+void TestSettings::coalescing()
+{
+    SettingsFile settings;
+    settings.setSyncDelay(50);
+    QVERIFY(settings.setFilePath(filePath()));
+
+    for (int i = 0; i < 100; ++i) {
+        settings.root()->write(QStringLiteral("ui.counter"), i);
+        QCoreApplication::processEvents();
+    }
+    QCOMPARE(settings.bytesWritten(), qint64(0));
+
+    // the whole burst is written once
+    QTRY_VERIFY(settings.bytesWritten() > 0);
+    settings.sync();
+    QCOMPARE(settings.bytesWritten(), QFileInfo(filePath()).size());
+
+    QFile file(filePath());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(QJsonDocument::fromJson(file.readAll()).object().value(QStringLiteral("ui")).toObject().value(QStringLiteral("counter")).toInt(), 99);
+}
+
+void TestSettings::maxLatency()
+{
+    SettingsFile settings;
+    settings.setSyncDelay(60 * 1000);
+    settings.setMaxSyncLatency(100);
+    QVERIFY(settings.setFilePath(filePath()));
+
+    // changes that never stop still reach the disk
+    for (int i = 0; i < 25; ++i) {
+        settings.root()->write(QStringLiteral("ui.counter"), i);
+        QTest::qWait(20);
+    }
+    QVERIFY(settings.bytesWritten() > 0);
+}
+
+void TestSettings::journalReplay()
+{
+    SettingsFile settings;
+    settings.setJournalEnabled(true);
+    QVERIFY(settings.setFilePath(filePath()));
+
+    settings.root()->write(QStringLiteral("ui.language"), QStringLiteral("de"));
+    settings.root()->write(QStringLiteral("ui.combinedChatWindow"), true);
+    settings.root()->write(QStringLiteral("users.one.nickname"), QStringLiteral("alice"));
+    settings.root()->write(QStringLiteral("users.two.nickname"), QStringLiteral("bob"));
+    SettingsObject(&settings, QStringLiteral("users.one")).undefine();
+    settings.sync();
+
+    // only the journal has been written
+    QCOMPARE(QFileInfo(filePath()).size(), qint64(0));
+    QVERIFY(QFileInfo(journalPath()).size() > 0);
+
+    SettingsFile reopened;
+    QVERIFY(reopened.setFilePath(filePath()));
+    QCOMPARE(reopened.root()->data(), settings.root()->data());
+    QCOMPARE(reopened.root()->read<QString>("ui.language"), QStringLiteral("de"));
+    QVERIFY(reopened.root()->read("users.one").isUndefined());
+    QCOMPARE(reopened.root()->read<QString>("users.two.nickname"), QStringLiteral("bob"));
+}
+
+void TestSettings::tornJournal()
+{
+    SettingsFile settings;
+    settings.setJournalEnabled(true);
+    QVERIFY(settings.setFilePath(filePath()));
+    settings.root()->write(QStringLiteral("ui.language"), QStringLiteral("de"));
+    settings.sync();
+
+    // as if the process died halfway through an append
+    QFile journal(journalPath());
+    QVERIFY(journal.open(QIODevice::WriteOnly | QIODevice::Append));
+    journal.write(R"({"path":"ui.language","va)");
+    journal.close();
+
+    SettingsFile reopened;
+    reopened.setJournalEnabled(true);
+    QVERIFY(reopened.setFilePath(filePath()));
+    QCOMPARE(reopened.root()->read<QString>("ui.language"), QStringLiteral("de"));
+
+    // later changes still replay after the discarded one
+    reopened.root()->write(QStringLiteral("ui.language"), QStringLiteral("fr"));
+    reopened.sync();
+
+    SettingsFile replayed;
+    QVERIFY(replayed.setFilePath(filePath()));
+    QCOMPARE(replayed.root()->read<QString>("ui.language"), QStringLiteral("fr"));
+}
+
+void TestSettings::compactOnDestroy()
+{
+    auto settings = std::make_unique<SettingsFile>();
+    settings->setJournalEnabled(true);
+    QVERIFY(settings->setFilePath(filePath()));
+    settings->root()->write(QStringLiteral("users.one.nickname"), QStringLiteral("alice"));
+    settings->sync();
+    QVERIFY(QFile::exists(journalPath()));
+
+    settings.reset();
+    QVERIFY(!QFile::exists(journalPath()));
+
+    QFile file(filePath());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const auto root = QJsonDocument::fromJson(file.readAll()).object();
+    QCOMPARE(root.value(QStringLiteral("users")).toObject().value(QStringLiteral("one")).toObject().value(QStringLiteral("nickname")).toString(), QStringLiteral("alice"));
+}
+
+void TestSettings::staleJournal()
+{
+    auto settings = std::make_unique<SettingsFile>();
+    settings->setJournalEnabled(true);
+    QVERIFY(settings->setFilePath(filePath()));
+    settings->root()->write(QStringLiteral("ui.language"), QStringLiteral("de"));
+    settings->sync();
+
+    QFile journal(journalPath());
+    QVERIFY(journal.open(QIODevice::ReadOnly));
+    const QByteArray stale = journal.readAll();
+    journal.close();
+
+    settings->root()->write(QStringLiteral("ui.language"), QStringLiteral("fr"));
+    settings.reset();
+    QVERIFY(!QFile::exists(journalPath()));
+
+    // as if the process died after the file was rewritten, before the journal was removed
+    QVERIFY(journal.open(QIODevice::WriteOnly));
+    journal.write(stale);
+    journal.close();
+
+    SettingsFile reopened;
+    reopened.setJournalEnabled(true);
+    QVERIFY(reopened.setFilePath(filePath()));
+    QCOMPARE(reopened.root()->read<QString>("ui.language"), QStringLiteral("fr"));
+    QVERIFY(!QFile::exists(journalPath()));
+
+    // and journaling starts over against the current file
+    reopened.root()->write(QStringLiteral("ui.language"), QStringLiteral("it"));
+    reopened.sync();
+
+    SettingsFile replayed;
+    QVERIFY(replayed.setFilePath(filePath()));
+    QCOMPARE(replayed.root()->read<QString>("ui.language"), QStringLiteral("it"));
+}
+
+void TestSettings::bytesPerContactChange_data()
+{
+    QTest::addColumn<int>("syncDelay");
+    QTest::addColumn<bool>("journal");
+
+    QTest::newRow("immediate") << 0 << false;
+    QTest::newRow("debounced") << 500 << false;
+    QTest::newRow("journaled") << 0 << true;
+    QTest::newRow("debounced journaled") << 500 << true;
+}
+
+// Bytes written for each change to a profile with many contacts, one change per
+// event loop turn, as when contacts come online or are renamed one after another
+void TestSettings::bytesPerContactChange()
+{
+    QFETCH(int, syncDelay);
+    QFETCH(bool, journal);
+
+    constexpr int contacts = 500;
+    constexpr int changes = 500;
+
+    SettingsFile settings;
+    settings.setSyncDelay(syncDelay);
+    settings.setJournalEnabled(journal);
+    QVERIFY(settings.setFilePath(filePath()));
+
+    QJsonObject users;
+    for (int i = 0; i < contacts; ++i) {
+        QJsonObject user;
+        user.insert(QStringLiteral("nickname"), QStringLiteral("contact %1").arg(i));
+        user.insert(QStringLiteral("type"), QStringLiteral("allowed"));
+        users.insert(userPath(i).mid(6), user);
+    }
+    settings.root()->write(QStringLiteral("users"), users);
+    settings.sync();
+    const qint64 before = settings.bytesWritten();
+
+    for (int i = 0; i < changes; ++i) {
+        SettingsObject user(&settings, userPath(i % contacts));
+        user.write("nickname", QStringLiteral("renamed %1").arg(i));
+        QTest::qWait(1);
+    }
+    settings.sync();
+
+    const qreal perChange = qreal(settings.bytesWritten() - before) / changes;
+    qInfo() << QTest::currentDataTag() << ":" << perChange << "bytes written per change";
+    if (journal)
+        QVERIFY(perChange < 1024);
+}
+
+QTEST_GUILESS_MAIN(TestSettings)
+#include "tst_settings.moc"
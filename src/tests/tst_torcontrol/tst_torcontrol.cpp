@@ -0,0 +1,198 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <QtTest>
+#include <QtNetwork>
+
+// libtego
+#include <tego/tego.hpp>
+
+// libtego_ui
+#include "tor/TorControl.h"
+#include "tor/HiddenService.h"
+#include "utils/CryptoKey.h"
+
+constexpr char keyBlob[] = "ED25519-V3:CAeUhUcyrjvk95WmTaexNRY5+0wFvd7P2zDMhhBZM2TwnD2I9YgK3yMO/jOk0LVc39xnULCR02ZBghiyFdNR3w==";
+constexpr char serviceId[] = "ockeilzymnguehc4brf4dpcsc634wtei75wa5edslx6yuwfaw3pje6id";
+
+// just enough of a tor control port to connect to and publish services on; like tor,
+// it refuses to publish a service which is already up
+class FakeTor : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    QSet<QByteArray> onions;
+    QList<QByteArray> commands;
+
+    FakeTor()
+    {
+        connect(this, &QTcpServer::newConnection, this, [this]() {
+            while (QTcpSocket *socket = nextPendingConnection())
+                connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { readCommands(socket); });
+        });
+    }
+
+    // as when tor exits
+    void disconnectClients()
+    {
+        onions.clear();
+        for (QTcpSocket *socket : findChildren<QTcpSocket*>())
+            socket->disconnectFromHost();
+    }
+
+private:
+    void readCommands(QTcpSocket *socket)
+    {
+        while (socket->canReadLine()) {
+            const QByteArray line = socket->readLine().trimmed();
+            commands.append(line);
+
+            if (line.startsWith("PROTOCOLINFO")) {
+                socket->write("250-PROTOCOLINFO 1\r\n"
+                              "250-AUTH METHODS=NULL\r\n"
+                              "250-VERSION Tor=\"0.4.5.7\"\r\n"
+                              "250 OK\r\n");
+            } else if (line.startsWith("GETINFO")) {
+                socket->write("250-status/circuit-established=1\r\n"
+                              "250-status/bootstrap-phase=NOTICE BOOTSTRAP PROGRESS=100 TAG=done SUMMARY=\"Done\"\r\n"
+                              "250-net/listeners/socks=\"127.0.0.1:9050\"\r\n"
+                              "250 OK\r\n");
+            } else if (line.startsWith("ADD_ONION")) {
+                // only ever called with the test's key
+                if (onions.contains(serviceId)) {
+                    socket->write("550 Onion address collision\r\n");
+                } else {
+                    onions.insert(serviceId);
+                    socket->write("250-ServiceID=" + QByteArray(serviceId) + "\r\n250 OK\r\n");
+                }
+            } else if (line.startsWith("DEL_ONION ")) {
+                if (onions.remove(line.mid(10))) {
+                    socket->write("250 OK\r\n");
+                } else {
+                    socket->write("552 Unknown Onion Service id\r\n");
+                }
+            } else {
+                socket->write("250 OK\r\n");
+            }
+        }
+    }
+};
+
+class TestTorControl : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void removeDestroyedService();
+    void republishService();
+    void serviceOfflineOnDisconnect();
+
+private:
+    Tor::HiddenService *createService();
+
+    std::unique_ptr<FakeTor> tor;
+    std::unique_ptr<Tor::TorControl> control;
+};
+
+void TestTorControl::init()
+{
+    tor = std::make_unique<FakeTor>();
+    QVERIFY(tor->listen(QHostAddress::LocalHost));
+
+    control = std::make_unique<Tor::TorControl>();
+    control->connect(QHostAddress::LocalHost, tor->serverPort());
+    QTRY_VERIFY(control->isConnected());
+}
+
+void TestTorControl::cleanup()
+{
+    control.reset();
+    tor.reset();
+}
+
+Tor::HiddenService *TestTorControl::createService()
+{
+    CryptoKey key;
+    key.loadFromKeyBlob(keyBlob);
+    auto service = new Tor::HiddenService(key);
+    service->addTarget(9878, QHostAddress::LocalHost, 9878);
+    control->addHiddenService(service);
+    return service;
+}
+
+void TestTorControl::removeDestroyedService()
+{
+    auto service = createService();
+    QTRY_COMPARE(service->status(), Tor::HiddenService::Online);
+    QVERIFY(tor->onions.contains(serviceId));
+
+    // as when its context is uninitialized
+    delete service;
+    QVERIFY(control->hiddenServices().isEmpty());
+    QTRY_VERIFY(!tor->onions.contains(serviceId));
+    QVERIFY(tor->commands.contains(QByteArray("DEL_ONION ") + serviceId));
+}
+
+void TestTorControl::republishService()
+{
+    // uninitialize and initialize again with the same identity, on the same tor
+    auto service = createService();
+    QTRY_COMPARE(service->status(), Tor::HiddenService::Online);
+    delete service;
+
+    service = createService();
+    QTRY_COMPARE(service->status(), Tor::HiddenService::Online);
+    QCOMPARE(tor->onions.size(), 1);
+    delete service;
+}
+
+void TestTorControl::serviceOfflineOnDisconnect()
+{
+    // a service only lasts as long as the control connection which published it, and
+    // its context's host user state follows it
+    auto service = createService();
+    QTRY_COMPARE(service->status(), Tor::HiddenService::Online);
+    QVERIFY(control->hasConnectivity());
+
+    tor->disconnectClients();
+    QTRY_COMPARE(service->status(), Tor::HiddenService::Offline);
+    QVERIFY(!control->hasConnectivity());
+    delete service;
+}
+
+QTEST_MAIN(TestTorControl)
+#include "tst_torcontrol.moc"
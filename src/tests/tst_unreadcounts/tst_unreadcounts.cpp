@@ -0,0 +1,123 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2020, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// C++
+#include <random>
+#include <vector>
+#include <QtTest>
+
+// libtego
+#include "core/UnreadCounts.h"
+
+#include "fake_contacts.hpp"
+
+class TestUnreadCounts : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void runningTotal();
+    void removeContact();
+    void stress();
+};
+
+void TestUnreadCounts::runningTotal()
+{
+    UnreadCounts counts;
+    QCOMPARE(counts.total(), 0);
+
+    counts.set(fakeUser(0), 1);
+    counts.set(fakeUser(1), 3);
+    counts.set(fakeUser(0), 2);
+    QCOMPARE(counts.total(), 5);
+    QCOMPARE(counts.count(fakeUser(0)), 2);
+
+    // the contact read its conversation
+    counts.set(fakeUser(1), 0);
+    QCOMPARE(counts.total(), 2);
+    QCOMPARE(counts.count(fakeUser(1)), 0);
+
+    counts.set(fakeUser(0), 0);
+    QCOMPARE(counts.total(), 0);
+}
+
+void TestUnreadCounts::removeContact()
+{
+    UnreadCounts counts;
+    counts.set(fakeUser(0), 4);
+    counts.set(fakeUser(1), 6);
+
+    counts.remove(fakeUser(1));
+    QCOMPARE(counts.total(), 4);
+    // removing twice, or a contact without unread messages, changes nothing
+    counts.remove(fakeUser(1));
+    counts.remove(fakeUser(2));
+    QCOMPARE(counts.total(), 4);
+}
+
+// 10k contacts receive a million messages between them, with every contact
+// occasionally reading its conversation and the total checked after each message
+void TestUnreadCounts::stress()
+{
+    constexpr int contacts = 10000;
+    constexpr int messages = 1000000;
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick(0, contacts - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    std::vector<int> expected(contacts, 0);
+    int expectedTotal = 0;
+    UnreadCounts counts;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < messages; ++i) {
+        const int contact = pick(rng);
+        if (percent(rng) == 0) {
+            expectedTotal -= expected[contact];
+            expected[contact] = 0;
+        } else {
+            ++expected[contact];
+            ++expectedTotal;
+        }
+        counts.set(fakeUser(contact), expected[contact]);
+        QCOMPARE(counts.total(), expectedTotal);
+    }
+    qDebug() << messages << "updates over" << contacts << "contacts in" << timer.elapsed() << "ms";
+
+    for (int contact = 0; contact < contacts; ++contact)
+        QCOMPARE(counts.count(fakeUser(contact)), expected[contact]);
+}
+
+QTEST_APPLESS_MAIN(TestUnreadCounts)
+#include "tst_unreadcounts.moc"